@@ -6,6 +6,7 @@
 #include "internal_includes/reflect.h"
 #include "internal_includes/debug.h"
 #include "log.h"
+#include <atomic>
 
 #define FOURCC(a, b, c, d) ((uint32_t)(uint8_t)(a) | ((uint32_t)(uint8_t)(b) << 8) | ((uint32_t)(uint8_t)(c) << 16) | ((uint32_t)(uint8_t)(d) << 24 ))
 enum {FOURCC_DXBC = FOURCC('D', 'X', 'B', 'C')}; //DirectX byte code
@@ -37,8 +38,9 @@ typedef struct DXBCChunkHeaderTAG
 } DXBCChunkHeader;
 
 #ifdef _DEBUG
-static uint64_t operandID = 0;
-static uint64_t instructionID = 0;
+// cmd_Decompiler -j decodes shaders on several threads at once:
+static std::atomic<uint64_t> operandID(0);
+static std::atomic<uint64_t> instructionID(0);
 #endif
 
 #if defined(_WIN32)
@@ -286,7 +288,10 @@ uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
     else
     if(psOperand->eType == OPERAND_TYPE_IMMEDIATE64)
     {
-        for(i=0; i< psOperand->iNumComponents; ++i)
+        // Each double takes two components, so a 4 component operand
+        // holds two doubles, not four:
+        int iNumDoubles = psOperand->iNumComponents == 4 ? 2 : psOperand->iNumComponents;
+        for(i=0; i< iNumDoubles; ++i)
         {
             psOperand->adImmediates[i] = *((double*)(&pui32Tokens[ui32NumTokens]));
             ui32NumTokens +=2;
@@ -312,10 +317,10 @@ uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
             }
             case OPERAND_INDEX_RELATIVE:
             {
+                // The relative operand may itself be extended or relative,
+                // so use its real length (less the one we add below):
                 psOperand->psSubOperand[i] = new Operand();
-                    DecodeOperand(pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]);
-
-                    ui32NumTokens++;
+                ui32NumTokens += DecodeOperand(pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]) - 1;
                 break;
             }
 			case OPERAND_INDEX_IMMEDIATE32_PLUS_RELATIVE:
@@ -326,9 +331,7 @@ uint32_t DecodeOperand (const uint32_t *pui32Tokens, Operand* psOperand)
                 ui32NumTokens++;
 
                 psOperand->psSubOperand[i] = new Operand();
-                    DecodeOperand(pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]);
-
-				ui32NumTokens++;
+                ui32NumTokens += DecodeOperand(pui32Tokens+ui32NumTokens, psOperand->psSubOperand[i]) - 1;
 				break;
 			}
             default:
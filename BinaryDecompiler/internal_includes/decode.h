@@ -12,4 +12,7 @@ Shader* DecodeDX9BC(const uint32_t* pui32Tokens);
 
 void UpdateOperandReferences(Shader* psShader, Instruction* psInst);
 
+//Decodes a single operand, returning the number of tokens it used.
+uint32_t DecodeOperand(const uint32_t *pui32Tokens, Operand* psOperand);
+
 #endif
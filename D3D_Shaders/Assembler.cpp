@@ -1,6 +1,10 @@
 #include "stdafx.h"
 #include "float.h"
 
+#include <mutex>
+#include <algorithm>
+#include <emmintrin.h>
+
 #if MIGOTO_DX == 9
 #include <d3dx9shader.h>
 #endif
@@ -15,7 +19,13 @@ using namespace std;
 // for sscanf_s convinience. Explanation in DecompileHLSL.cpp
 #define UCOUNTOF(...) (unsigned)_countof(__VA_ARGS__)
 
+// Instructions that failed to round trip through the disassembler. The
+// disassembler may be called from several threads at once (shaders created on
+// different threads in game, or cmd_Decompiler's -j option), so this is
+// protected by a lock - it is only written to on failures, so it is not
+// contended in practice:
 static unordered_map<string, vector<DWORD>> codeBin;
+static mutex codeBin_lock;
 
 static DWORD strToDWORD(string s)
 {
@@ -82,7 +92,7 @@ static uint64_t str_to_raw_double(string &s)
 	return *(uint64_t*)&d;
 }
 
-static string convertF(DWORD original)
+string convertF(DWORD original)
 {
 	char buf[80];
 	char scientific[80];
@@ -149,7 +159,7 @@ static string convertF(DWORD original)
 	return buf;
 }
 
-static string convertD(DWORD v1, DWORD v2)
+string convertD(DWORD v1, DWORD v2)
 {
 	char buf[80];
 	uint64_t q = (uint64_t)v1 | ((uint64_t)v2 << 32);
@@ -777,15 +787,17 @@ static vector<DWORD> assembleOp(string s, bool special)
 	return v;
 }
 
-static vector<string> strToWords(string s)
+// Splits an instruction into the mnemonic and its operands, without copying
+// any of them. The tokens point into s, so are only valid until it changes.
+static void tokenizeWords(const string &s, vector<AsmToken> *words)
 {
-	vector<string> words;
 	string::size_type start = 0;
+	words->clear();
 	while (s[start] == ' ') start++;
 	string::size_type end = start;
 	while (end < s.size() && s[end] != ' ' && s[end] != '(')
 		end++;
-	words.push_back(s.substr(start, end - start));
+	words->push_back({s.data() + start, end - start});
 
 	while (s.size() > end) {
 		if (s[end] == ' ') {
@@ -834,21 +846,36 @@ static vector<string> strToWords(string s)
 				end++;
 		}
 
-		if (end == string::npos) {
-			words.push_back(s.substr(start));
-		} else {
-			string::size_type length = end - start;
-			words.push_back(s.substr(start, length));
-		}
+		if (end == string::npos)
+			words->push_back({s.data() + start, s.size() - start});
+		else
+			words->push_back({s.data() + start, end - start});
 	}
-	for (size_t i = 0; i < words.size(); i++) {
-		string s2 = words[i];
+	for (AsmToken &word : *words) {
 		// Fixed access before start of array -DarkStarSword
-		if (!s2.empty() && s2[s2.size() - 1] == ',')
-			s2.erase(--s2.end());
-		words[i] = s2;
+		if (word.len && word.ptr[word.len - 1] == ',')
+			word.len--;
 	}
-	return words;
+}
+
+// Tokenizes an instruction into the arena's word list. The strings in the
+// arena are assigned rather than replaced, so they keep their storage from
+// one instruction to the next.
+static vector<string>& strToWords(const string &s, AsmTokenArena *arena)
+{
+	size_t i;
+
+	tokenizeWords(s, &arena->tokens);
+	arena->words.resize(arena->tokens.size());
+	for (i = 0; i < arena->tokens.size(); i++)
+		arena->words[i].assign(arena->tokens[i].ptr, arena->tokens[i].len);
+	return arena->words;
+}
+
+static vector<string> strToWords(const string &s)
+{
+	AsmTokenArena arena;
+	return strToWords(s, &arena);
 }
 
 static DWORD parseAoffimmi(DWORD start, string o)
@@ -1175,6 +1202,126 @@ static unordered_map<string, vector<int>> insMap = {
 	{ "utod",                      { 2, 0xd9    } }, // Added and verified -DarkStarSword
 };
 
+// Instructions that need more than the generic encodings in insMap and ldMap.
+// Each of these has its own case in assembleIns.
+enum class InsHandler {
+	HS_DECLS,
+	HS_FORK_PHASE,
+	HS_JOIN_PHASE,
+	HS_CONTROL_POINT_PHASE,
+	DCL_INPUT,
+	DCL_OUTPUT,
+	DCL_RESOURCE_RAW,
+	DCL_RESOURCE_BUFFER,
+	DCL_RESOURCE_TEXTURE1D,
+	DCL_RESOURCE_TEXTURE1DARRAY,
+	DCL_UAV_TYPED_TEXTURE1D,
+	DCL_UAV_TYPED_TEXTURE1DARRAY,
+	DCL_RESOURCE_TEXTURE2D,
+	DCL_UAV_TYPED_BUFFER,
+	DCL_RESOURCE_TEXTURE3D,
+	DCL_UAV_TYPED_TEXTURE3D,
+	DCL_RESOURCE_TEXTURECUBE,
+	DCL_RESOURCE_TEXTURECUBEARRAY,
+	DCL_RESOURCE_TEXTURE2DARRAY,
+	DCL_UAV_TYPED_TEXTURE2D,
+	DCL_UAV_TYPED_TEXTURE2DARRAY,
+	DCL_RESOURCE_TEXTURE2DMS,
+	DCL_RESOURCE_TEXTURE2DMSARRAY,
+	DCL_INDEXRANGE,
+	DCL_TEMPS,
+	DCL_RESOURCE_STRUCTURED,
+	DCL_SAMPLER,
+	DCL_GLOBALFLAGS,
+	DCL_CONSTANTBUFFER,
+	DCL_OUTPUT_SGV,
+	DCL_OUTPUT_SIV,
+	DCL_INPUT_SIV,
+	DCL_INPUT_SGV,
+	DCL_INPUT_PS,
+	DCL_INPUT_PS_SGV,
+	DCL_INPUT_PS_SIV,
+	DCL_INDEXABLETEMP,
+	DCL_IMMEDIATECONSTANTBUFFER,
+	DCL_TESSELLATOR_PARTITIONING,
+	DCL_TESSELLATOR_OUTPUT_PRIMITIVE,
+	DCL_TESSELLATOR_DOMAIN,
+	DCL_STREAM,
+	EMIT_STREAM,
+	CUT_STREAM,
+	EMIT_THEN_CUT_STREAM,
+	DCL_OUTPUTTOPOLOGY,
+	DCL_OUTPUT_CONTROL_POINT_COUNT,
+	DCL_INPUT_CONTROL_POINT_COUNT,
+	DCL_MAXOUT,
+	DCL_INPUTPRIMITIVE,
+	DCL_HS_MAX_TESSFACTOR,
+	DCL_HS_FORK_PHASE_INSTANCE_COUNT,
+	SAMPLEPOS,
+	PRINTF,
+	ERRORF,
+	UNDECIPHERABLE,
+};
+
+static const unordered_map<string, InsHandler> insHandlerMap = {
+	{ "hs_decls",                          InsHandler::HS_DECLS },
+	{ "hs_fork_phase",                     InsHandler::HS_FORK_PHASE },
+	{ "hs_join_phase",                     InsHandler::HS_JOIN_PHASE },
+	{ "hs_control_point_phase",            InsHandler::HS_CONTROL_POINT_PHASE },
+	{ "dcl_input",                         InsHandler::DCL_INPUT },
+	{ "dcl_output",                        InsHandler::DCL_OUTPUT },
+	{ "dcl_resource_raw",                  InsHandler::DCL_RESOURCE_RAW },
+	{ "dcl_resource_buffer",               InsHandler::DCL_RESOURCE_BUFFER },
+	{ "dcl_resource_texture1d",            InsHandler::DCL_RESOURCE_TEXTURE1D },
+	{ "dcl_resource_texture1darray",       InsHandler::DCL_RESOURCE_TEXTURE1DARRAY },
+	{ "dcl_uav_typed_texture1d",           InsHandler::DCL_UAV_TYPED_TEXTURE1D },
+	{ "dcl_uav_typed_texture1darray",      InsHandler::DCL_UAV_TYPED_TEXTURE1DARRAY },
+	{ "dcl_resource_texture2d",            InsHandler::DCL_RESOURCE_TEXTURE2D },
+	{ "dcl_uav_typed_buffer",              InsHandler::DCL_UAV_TYPED_BUFFER },
+	{ "dcl_resource_texture3d",            InsHandler::DCL_RESOURCE_TEXTURE3D },
+	{ "dcl_uav_typed_texture3d",           InsHandler::DCL_UAV_TYPED_TEXTURE3D },
+	{ "dcl_resource_texturecube",          InsHandler::DCL_RESOURCE_TEXTURECUBE },
+	{ "dcl_resource_texturecubearray",     InsHandler::DCL_RESOURCE_TEXTURECUBEARRAY },
+	{ "dcl_resource_texture2darray",       InsHandler::DCL_RESOURCE_TEXTURE2DARRAY },
+	{ "dcl_uav_typed_texture2d",           InsHandler::DCL_UAV_TYPED_TEXTURE2D },
+	{ "dcl_uav_typed_texture2darray",      InsHandler::DCL_UAV_TYPED_TEXTURE2DARRAY },
+	{ "dcl_resource_texture2dms",          InsHandler::DCL_RESOURCE_TEXTURE2DMS },
+	{ "dcl_resource_texture2dmsarray",     InsHandler::DCL_RESOURCE_TEXTURE2DMSARRAY },
+	{ "dcl_indexrange",                    InsHandler::DCL_INDEXRANGE },
+	{ "dcl_temps",                         InsHandler::DCL_TEMPS },
+	{ "dcl_resource_structured",           InsHandler::DCL_RESOURCE_STRUCTURED },
+	{ "dcl_sampler",                       InsHandler::DCL_SAMPLER },
+	{ "dcl_globalFlags",                   InsHandler::DCL_GLOBALFLAGS },
+	{ "dcl_constantbuffer",                InsHandler::DCL_CONSTANTBUFFER },
+	{ "dcl_output_sgv",                    InsHandler::DCL_OUTPUT_SGV },
+	{ "dcl_output_siv",                    InsHandler::DCL_OUTPUT_SIV },
+	{ "dcl_input_siv",                     InsHandler::DCL_INPUT_SIV },
+	{ "dcl_input_sgv",                     InsHandler::DCL_INPUT_SGV },
+	{ "dcl_input_ps",                      InsHandler::DCL_INPUT_PS },
+	{ "dcl_input_ps_sgv",                  InsHandler::DCL_INPUT_PS_SGV },
+	{ "dcl_input_ps_siv",                  InsHandler::DCL_INPUT_PS_SIV },
+	{ "dcl_indexableTemp",                 InsHandler::DCL_INDEXABLETEMP },
+	{ "dcl_immediateConstantBuffer",       InsHandler::DCL_IMMEDIATECONSTANTBUFFER },
+	{ "dcl_tessellator_partitioning",      InsHandler::DCL_TESSELLATOR_PARTITIONING },
+	{ "dcl_tessellator_output_primitive",  InsHandler::DCL_TESSELLATOR_OUTPUT_PRIMITIVE },
+	{ "dcl_tessellator_domain",            InsHandler::DCL_TESSELLATOR_DOMAIN },
+	{ "dcl_stream",                        InsHandler::DCL_STREAM },
+	{ "emit_stream",                       InsHandler::EMIT_STREAM },
+	{ "cut_stream",                        InsHandler::CUT_STREAM },
+	{ "emit_then_cut_stream",              InsHandler::EMIT_THEN_CUT_STREAM },
+	{ "dcl_outputtopology",                InsHandler::DCL_OUTPUTTOPOLOGY },
+	{ "dcl_output_control_point_count",    InsHandler::DCL_OUTPUT_CONTROL_POINT_COUNT },
+	{ "dcl_input_control_point_count",     InsHandler::DCL_INPUT_CONTROL_POINT_COUNT },
+	{ "dcl_maxout",                        InsHandler::DCL_MAXOUT },
+	{ "dcl_inputprimitive",                InsHandler::DCL_INPUTPRIMITIVE },
+	{ "dcl_hs_max_tessfactor",             InsHandler::DCL_HS_MAX_TESSFACTOR },
+	{ "dcl_hs_fork_phase_instance_count",  InsHandler::DCL_HS_FORK_PHASE_INSTANCE_COUNT },
+	{ "samplepos",                         InsHandler::SAMPLEPOS },
+	{ "printf",                            InsHandler::PRINTF },
+	{ "errorf",                            InsHandler::ERRORF },
+	{ "undecipherable",                    InsHandler::UNDECIPHERABLE },
+};
+
 static void assembleResourceDeclarationType(string *type, vector<DWORD> *v)
 {
 	// The resource declarations all use the same format strings and
@@ -1476,14 +1623,16 @@ static vector<DWORD> assemble_undecipherable_custom_data(string &s, vector<DWORD
 	return v;
 }
 
-static vector<DWORD> assembleIns(string s)
+static vector<DWORD> assembleIns(string s, AsmTokenArena *arena)
 {
+	unordered_map<string, vector<int>>::const_iterator generic;
+	unordered_map<string, InsHandler>::const_iterator handler;
+	unordered_map<string, vector<DWORD>>::const_iterator hack;
 	unsigned msaa_samples = 0;
 
-	if (hackMap.find(s) != hackMap.end()) {
-		auto v = hackMap[s];
-		return v;
-	}
+	hack = hackMap.find(s);
+	if (hack != hackMap.end())
+		return hack->second;
 	DWORD op = 0;
 	shader_ins* ins = (shader_ins*)&op;
 	size_t pos = s.find("[precise");
@@ -1529,7 +1678,7 @@ static vector<DWORD> assembleIns(string s)
 		ins->_11_23 = 1;
 	}
 	vector<DWORD> v;
-	vector<string> w = strToWords(s);
+	vector<string> &w = strToWords(s, arena);
 	string o = w[0];
 	if (o == "sampleinfo" && ins->_11_23 == 2)
 		ins->_11_23 = 1;
@@ -1544,87 +1693,16 @@ static vector<DWORD> assembleIns(string s)
 	bool bGlc = o.find("_glc") < o.size(); // Globally coherent UAV declaration
 	if (bGlc) o = o.substr(0, o.find("_glc"));
 
-	if (o == "hs_decls") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x71;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "hs_fork_phase") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x73;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "hs_join_phase") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x74;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "hs_control_point_phase") {
-		check_num_ops(s, w, 0);
-		ins->opcode = 0x72;
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "ps_") {
-		check_num_ops(s, w, 0);
-		op = 0x00000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "vs_") {
-		check_num_ops(s, w, 0);
-		op = 0x10000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "gs_") {
-		check_num_ops(s, w, 0);
-		op = 0x20000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "hs_") {
-		check_num_ops(s, w, 0);
-		op = 0x30000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "ds_") {
-		check_num_ops(s, w, 0);
-		op = 0x40000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (o.substr(0, 3) == "cs_") {
-		check_num_ops(s, w, 0);
-		op = 0x50000;
-		op |= 16 * atoi(o.substr(3, 1).c_str());
-		op |= atoi(o.substr(5, 1).c_str());
-		v.push_back(op);
-	} else if (w[0].substr(0, 4) == "sync") {
-		ins->opcode = 0xbe;
-		check_num_ops(s, w, 0);
-		ins->_11_23 = parseSyncFlags(&w[0]);
-		ins->length = 1;
-		v.push_back(op);
-	} else if (w[0] == "store_uav_typed") {
-		ins->opcode = 0x86;
-		int numOps = 3;
-		check_num_ops(s, w, numOps);
-		if (w[1][0] == 'u') {
-			ins->opcode = 0xa4;
-		}
-		vector<vector<DWORD>> Os;
-		int numSpecial = 1;
-		for (int i = 0; i < numOps; i++)
-			Os.push_back(assembleOp(w[i + 1], i < numSpecial));
-		ins->length = 1;
-		for (int i = 0; i < numOps; i++)
-			ins->length += (int)Os[i].size();
-		v.push_back(op);
-		for (int i = 0; i < numOps; i++)
-			v.insert(v.end(), Os[i].begin(), Os[i].end());
-	} else if (insMap.find(o) != insMap.end()) {
-		vector<int> vIns = insMap[o];
+	// The bulk of the instructions in any shader are in one of the generic
+	// tables, so look those up first. Everything else has its own encoder
+	// below, found with a single lookup in insHandlerMap rather than
+	// comparing against each mnemonic in turn. The mnemonics in these
+	// three tables are distinct, so the order they are checked in only
+	// matters for speed. The shader model and sync instructions are
+	// matched by prefix so can't go in a table, but only come up once or
+	// twice per shader.
+	if ((generic = insMap.find(o)) != insMap.end()) {
+		const vector<int> &vIns = generic->second;
 		int numOps = vIns[0];
 		check_num_ops(s, w, numOps);
 		vector<vector<DWORD>> Os;
@@ -1648,8 +1726,8 @@ static vector<DWORD> assembleIns(string s)
 		v.push_back(op);
 		for (int i = 0; i < numOps; i++)
 			v.insert(v.end(), Os[i].begin(), Os[i].end());
-	} else if (ldMap.find(o) != ldMap.end()) {
-		vector<int> vIns = ldMap[o];
+	} else if ((generic = ldMap.find(o)) != ldMap.end()) {
+		const vector<int> &vIns = generic->second;
 		int numOps = vIns[0];
 		vector<vector<DWORD>> Os;
 		int startPos = 1 + (vIns[2] & 3);
@@ -1720,568 +1798,751 @@ static vector<DWORD> assembleIns(string s)
 		}
 		for (int i = 0; i < numOps; i++)
 			v.insert(v.end(), Os[i].begin(), Os[i].end());
-	} else if (o == "dcl_input") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1], 1);
-		ins->opcode = 0x5f;
-		ins->length = 1 + os.size();
-		// Should sort special value for text constants.
-		if ((os[0] & 0xFF0) == 0)
-			os[0] -= 1;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_output") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1], 1);
-		ins->opcode = 0x65;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_resource_raw") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0xa1;
-		ins->length = 3;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_resource_buffer") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 1;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture1d") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 2;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture1darray") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 7;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture1d") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x9c;
-		ins->_11_23 = 2;
-		if (bGlc)
-			ins->_11_23 |= 0x20;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture1darray") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x9c;
-		ins->_11_23 = 7;
-		if (bGlc)
-			ins->_11_23 |= 0x20;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture2d") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 3;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_buffer") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x9c;
-		ins->_11_23 = 1;
-		if (bGlc)
-			ins->_11_23 |= 0x20;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture3d") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 5;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture3d") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x9c;
-		ins->_11_23 = 5;
-		if (bGlc)
-			ins->_11_23 |= 0x20;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texturecube") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 6;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texturecubearray") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 10;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture2darray") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x58;
-		ins->_11_23 = 8;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture2d") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x9c;
-		ins->_11_23 = 3;
-		if (bGlc)
-			ins->_11_23 |= 0x20;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_uav_typed_texture2darray") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[2]);
-		ins->opcode = 0x9c;
-		ins->_11_23 = 8;
-		if (bGlc)
-			ins->_11_23 |= 0x20;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[1], &v);
-	} else if (o == "dcl_resource_texture2dms") {
-		check_num_ops(s, w, 3);
-		vector<DWORD> os = assembleOp(w[3]);
-		ins->opcode = 0x58;
-		// Changed this to calculate the value rather than hard coding
-		// a small handful of values that we've seen. -DarkStarSword
-		sscanf_s(w[1].c_str(), "(%d)", &msaa_samples);
-		ins->_11_23 = (msaa_samples << 5) | 4;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[2], &v);
-	} else if (o == "dcl_resource_texture2dmsarray") {
-		check_num_ops(s, w, 3);
-		vector<DWORD> os = assembleOp(w[3]);
-		ins->opcode = 0x58;
-		// Changed this to calculate the value rather than hard coding
-		// a small handful of values that we've seen. -DarkStarSword
-		sscanf_s(w[1].c_str(), "(%d)", &msaa_samples);
-		ins->_11_23 = (msaa_samples << 5) | 9;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		assembleResourceDeclarationType(&w[2], &v);
-	} else if (o == "dcl_indexrange") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[1], true);
-		ins->opcode = 0x5b;
-		ins->length = 2 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		v.push_back(atoi(w[2].c_str()));
-	} else if (o == "dcl_temps") {
-		ins->opcode = 0x68;
-		ins->length = 2;
-		v.push_back(op);
-		check_num_ops(s, w, 1);
-		v.push_back(atoi(w[1].c_str()));
-	} else if (o == "dcl_resource_structured") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0xa2;
-		ins->length = 4;
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-		v.push_back(atoi(w[2].c_str()));
-	} else if (o == "dcl_sampler") {
-		check_num_ops(s, w, 1, 2);
-		vector<DWORD> os = assembleOp(w[1]);
-		os[0] = 0x106000;
-		ins->opcode = 0x5a;
-		if (w.size() > 2) {
-			if (w[2] == "mode_default") {
-				ins->_11_23 = 0;
-			} else if (w[2] == "mode_comparison") {
-				ins->_11_23 = 1;
-			}
-		}
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_globalFlags") {
-		ins->opcode = 0x6a;
-		ins->length = 1;
-		ins->_11_23 = 0;
-		for (unsigned i = 1; i < w.size(); i += 2) {
-			// Changed this to use a loop rather than parsing a
-			// fixed number of arguments. Added double precision,
-			// minimum precision, skipOptimization and 11.1 shader
-			// extension flags.
-			// FIXME: Missing D3D_SHADER_REQUIRES_UAVS_AT_EVERY_STAGE
-			// FIXME: Missing D3D_SHADER_REQUIRES_64_UAVS
-			// FIXME: Missing D3D_SHADER_REQUIRES_LEVEL_9_COMPARISON_FILTERING
-			// FIXME: Missing D3D_SHADER_REQUIRES_TILED_RESOURCES
-			//   - https://docs.microsoft.com/en-gb/windows/desktop/api/d3d11shader/nf-d3d11shader-id3d11shaderreflection-getrequiresflags
-			//   -DarkStarSword
-			string s = w[i];
-			if (s == "refactoringAllowed")
-				ins->_11_23 |= 0x01;
-			if (s == "enableDoublePrecisionFloatOps")
-				ins->_11_23 |= 0x02;
-			if (s == "forceEarlyDepthStencil")
-				ins->_11_23 |= 0x04;
-			if (s == "enableRawAndStructuredBuffers")
-				ins->_11_23 |= 0x08;
-			if (s == "skipOptimization")
-				ins->_11_23 |= 0x10;
-			if (s == "enableMinimumPrecision")
-				ins->_11_23 |= 0x20;
-			if (s == "enable11_1DoubleExtensions")
-				ins->_11_23 |= 0x40;
-			if (s == "enable11_1ShaderExtensions")
-				ins->_11_23 |= 0x80;
+	} else if ((handler = insHandlerMap.find(o)) != insHandlerMap.end()) {
+		switch (handler->second) {
+		case InsHandler::HS_DECLS:
+			check_num_ops(s, w, 0);
+			ins->opcode = 0x71;
+			ins->length = 1;
+			v.push_back(op);
+			break;
+		case InsHandler::HS_FORK_PHASE:
+			check_num_ops(s, w, 0);
+			ins->opcode = 0x73;
+			ins->length = 1;
+			v.push_back(op);
+			break;
+		case InsHandler::HS_JOIN_PHASE:
+			check_num_ops(s, w, 0);
+			ins->opcode = 0x74;
+			ins->length = 1;
+			v.push_back(op);
+			break;
+		case InsHandler::HS_CONTROL_POINT_PHASE:
+			check_num_ops(s, w, 0);
+			ins->opcode = 0x72;
+			ins->length = 1;
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_INPUT: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1], 1);
+			ins->opcode = 0x5f;
+			ins->length = 1 + os.size();
+			// Should sort special value for text constants.
+			if ((os[0] & 0xFF0) == 0)
+				os[0] -= 1;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
 		}
-		v.push_back(op);
-	} else if (o == "dcl_constantbuffer") {
-		check_num_ops(s, w, 1, 2);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x59;
-		if (w.size() > 2) {
-			if (w[2] == "dynamicIndexed")
-				ins->_11_23 = 1;
-			else if (w[2] == "immediateIndexed")
-				ins->_11_23 = 0;
+		case InsHandler::DCL_OUTPUT: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1], 1);
+			ins->opcode = 0x65;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
 		}
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_output_sgv") {
-		// Added and verified. Used when writing to SV_IsFrontFace in a
-		// geometry shader. -DarkStarSword
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[1], true);
-		ins->opcode = 0x66;
-		assembleSystemValue(&w[2], &os);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_output_siv") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[1], true);
-		ins->opcode = 0x67;
-		assembleSystemValue(&w[2], &os);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_siv") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[1], true);
-		ins->opcode = 0x61;
-		assembleSystemValue(&w[2], &os);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_sgv") {
-		check_num_ops(s, w, 2);
-		vector<DWORD> os = assembleOp(w[1], true);
-		ins->opcode = 0x60;
-		assembleSystemValue(&w[2], &os);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_ps") {
-		vector<DWORD> os;
-		ins->opcode = 0x62;
-		// Switched to use common interpolation mode parsing to catch
-		// more variants -DarkStarSword
-		ins->_11_23 = interpolationMode(w, 0); // FIXME: Default?
-		os = assembleOp(w[w.size() - 1], true);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_ps_sgv") {
-		// Fixed for d3dcompiler_47 disassembly that includes an
-		// interpolationMode missing from d3dcompiler_46 disassembly
-		// e.g.
-		// d3dcompiler_46: dcl_input_ps_sgv v6.x, is_front_face
-		// d3dcompiler_47: dcl_input_ps_sgv constant v6.x, is_front_face
-		//   -DarkStarSword
-		check_num_ops(s, w, 2, 5);
-		vector<DWORD> os = assembleOp(w[w.size() - 2], true);
-		ins->opcode = 0x63;
-		ins->_11_23 = interpolationMode(w, 1);
-		if (w.size() > 2)
-			assembleSystemValue(&w[w.size() - 1], &os);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_input_ps_siv") {
-		vector<DWORD> os;
-		ins->opcode = 0x64;
-		// Switched to use common interpolation mode parsing (fixes
-		// missing linear noperspective sample case in WATCH_DOGS2) and
-		// system value parsing (fixes missing viewport_array_index)
-		//   -DarkStarSword
-		check_num_ops(s, w, 2, 5);
-		ins->_11_23 = interpolationMode(w, 0); // FIXME: Default?
-		os = assembleOp(w[w.size() - 2], true);
-		assembleSystemValue(&w[w.size() - 1], &os);
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_indexableTemp") {
-		check_num_ops(s, w, 2);
-		string s1 = w[1].erase(0, 1);
-		string s2 = s1.substr(0, s1.find('['));
-		string s3 = s1.substr(s1.find('[') + 1);
-		s3.erase(s3.end() - 1, s3.end());
-		ins->opcode = 0x69;
-		ins->length = 4;
-		v.push_back(op);
-		v.push_back(atoi(s2.c_str()));
-		v.push_back(atoi(s3.c_str()));
-		v.push_back(atoi(w[2].c_str()));
-	} else if (o == "dcl_immediateConstantBuffer") {
-		vector<DWORD> os;
-		ins->opcode = 0x35;
-		ins->_11_23 = 3;
-		ins->length = 0;
-		DWORD length = 2;
-		DWORD offset = 3;
-		// The modulus here is by 5, matching the below offset += 5
-		if ((w.size() - offset) % 5 != 0)
-			throw AssemblerParseError(s, "Immediate Constant Buffer must have a multiple of four values");
-		while (offset < w.size()) {
-			string s1 = w[offset + 0];
-			s1 = s1.substr(0, s1.find(','));
-			string s2 = w[offset + 1];
-			s2 = s2.substr(0, s2.find(','));
-			string s3 = w[offset + 2];
-			s3 = s3.substr(0, s3.find(','));
-			string s4 = w[offset + 3];
-			s4 = s4.substr(0, s4.find('}'));
-			os.push_back(strToDWORD(s1));
-			os.push_back(strToDWORD(s2));
-			os.push_back(strToDWORD(s3));
-			os.push_back(strToDWORD(s4));
-			length += 4;
-			offset += 5;
+		case InsHandler::DCL_RESOURCE_RAW: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0xa1;
+			ins->length = 3;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
 		}
-		v.push_back(op);
-		v.push_back(length);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_tessellator_partitioning") {
-		ins->opcode = 0x96;
-		ins->length = 1;
-		check_num_ops(s, w, 1);
-		if (w[1] == "partitioning_integer")
-			ins->_11_23 = 1;
-		else if (w[1] == "partitioning_pow2")
-			ins->_11_23 = 2;
-		else if (w[1] == "partitioning_fractional_odd")
-			ins->_11_23 = 3;
-		else if (w[1] == "partitioning_fractional_even")
-			ins->_11_23 = 4;
-		// Added pow2 -DarkStarSword
-		// https://msdn.microsoft.com/en-us/library/windows/desktop/ff471446(v=vs.85).aspx
-		v.push_back(op);
-	} else if (o == "dcl_tessellator_output_primitive") {
-		ins->opcode = 0x97;
-		ins->length = 1;
-		check_num_ops(s, w, 1);
-		if (w[1] == "output_point")
+		case InsHandler::DCL_RESOURCE_BUFFER: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
 			ins->_11_23 = 1;
-		else if (w[1] == "output_line")
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE1D: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
 			ins->_11_23 = 2;
-		else if (w[1] == "output_triangle_cw")
-			ins->_11_23 = 3;
-		else if (w[1] == "output_triangle_ccw")
-			ins->_11_23 = 4;
-		// Added output_point -DarkStarSword
-		// https://msdn.microsoft.com/en-us/library/windows/desktop/ff471445(v=vs.85).aspx
-		v.push_back(op);
-	} else if (o == "dcl_tessellator_domain") {
-		ins->opcode = 0x95;
-		ins->length = 1;
-		check_num_ops(s, w, 1);
-		if (w[1] == "domain_isoline")
-			ins->_11_23 = 1;
-		else if (w[1] == "domain_tri")
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE1DARRAY: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
+			ins->_11_23 = 7;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_UAV_TYPED_TEXTURE1D: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x9c;
 			ins->_11_23 = 2;
-		else if (w[1] == "domain_quad")
+			if (bGlc)
+				ins->_11_23 |= 0x20;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_UAV_TYPED_TEXTURE1DARRAY: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x9c;
+			ins->_11_23 = 7;
+			if (bGlc)
+				ins->_11_23 |= 0x20;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE2D: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
 			ins->_11_23 = 3;
-		v.push_back(op);
-	} else if (o == "dcl_stream") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x8f;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "emit_stream") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x75;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "cut_stream") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x76;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "emit_then_cut_stream") {
-		// Partially verified - assembled & disassembled OK, but did not
-		// check against compiled shader as fxc never generates this
-		//   -DarkStarSword
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x77;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_outputtopology") {
-		ins->opcode = 0x5c;
-		ins->length = 1;
-		check_num_ops(s, w, 1);
-		if (w[1] == "pointlist")
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_UAV_TYPED_BUFFER: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x9c;
 			ins->_11_23 = 1;
-		else if (w[1] == "trianglestrip")
+			if (bGlc)
+				ins->_11_23 |= 0x20;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE3D: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
 			ins->_11_23 = 5;
-		else if (w[1] == "linestrip")
-			ins->_11_23 = 3;
-		// Added point list -DarkStarSword
-		// https://msdn.microsoft.com/en-us/library/windows/desktop/bb509661(v=vs.85).aspx
-		v.push_back(op);
-	} else if (o == "dcl_output_control_point_count") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x94;
-		ins->_11_23 = os[0];
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "dcl_input_control_point_count") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x93;
-		ins->_11_23 = os[0];
-		ins->length = 1;
-		v.push_back(op);
-	} else if (o == "dcl_maxout") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x5e;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "dcl_inputprimitive") {
-		ins->opcode = 0x5d;
-		ins->length = 1;
-		check_num_ops(s, w, 1);
-		if (w[1] == "point")
-			ins->_11_23 = 1;
-		else if (w[1] == "line")
-			ins->_11_23 = 2;
-		else if (w[1] == "triangle")
-			ins->_11_23 = 3;
-		else if (w[1] == "lineadj")
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_UAV_TYPED_TEXTURE3D: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x9c;
+			ins->_11_23 = 5;
+			if (bGlc)
+				ins->_11_23 |= 0x20;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURECUBE: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
 			ins->_11_23 = 6;
-		else if (w[1] == "triangleadj")
-			ins->_11_23 = 7;
-		// Added "lineadj" -DarkStarSword
-		// https://msdn.microsoft.com/en-us/library/windows/desktop/bb509609(v=vs.85).aspx
-		v.push_back(op);
-	} else if (o == "dcl_hs_max_tessfactor") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x98;
-		ins->length = 1 + os.size() - 1;
-		v.push_back(op);
-		v.insert(v.end(), os.begin() + 1, os.end());
-	} else if (o == "dcl_hs_fork_phase_instance_count") {
-		check_num_ops(s, w, 1);
-		vector<DWORD> os = assembleOp(w[1]);
-		ins->opcode = 0x99;
-		ins->length = 1 + os.size();
-		v.push_back(op);
-		v.insert(v.end(), os.begin(), os.end());
-	} else if (o == "samplepos") {
-		// samplepos can either be used with a texture register, or the
-		// rasterizer. In the former case it has an extra 0 appended.
-		vector<vector<DWORD>> os;
-		ins->opcode = 0x6e;
-		int numOps = 3;
-		check_num_ops(s, w, numOps);
-		for (int i = 0; i < numOps; i++)
-			os.push_back(assembleOp(w[i + 1], i < 1));
-
-		// When the instruction operates on a texture register
-		// (GetSamplerPosition) there is an extra 0 inserted that is
-		// not present when used on the rasterizer register
-		// (GetRenderTargetSamplePosition). It's not clear if there are
-		// any cases where this should be non-zero:
-		if (w[2][0] == 't') {
-			numOps++;
-			os.push_back(vector<DWORD>{0});
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
 		}
-
-		ins->length = 1;
-		for (int i = 0; i < numOps; i++)
-			ins->length += (int)os[i].size();
-
-		v.push_back(op);
-		for (int i = 0; i < numOps; i++)
-			v.insert(v.end(), os[i].begin(), os[i].end());
-	} else if (o == "printf") {
-		return assemble_printf(s, v, w, false);
-	} else if (o == "errorf") {
-		return assemble_printf(s, v, w, true);
-	} else if (o == "undecipherable") {
-		return assemble_undecipherable_custom_data(s, v, w);
-	} else {
-		throw AssemblerParseError(s, "Unrecognised instruction");
-	}
-
+		case InsHandler::DCL_RESOURCE_TEXTURECUBEARRAY: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
+			ins->_11_23 = 10;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE2DARRAY: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x58;
+			ins->_11_23 = 8;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_UAV_TYPED_TEXTURE2D: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x9c;
+			ins->_11_23 = 3;
+			if (bGlc)
+				ins->_11_23 |= 0x20;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_UAV_TYPED_TEXTURE2DARRAY: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[2]);
+			ins->opcode = 0x9c;
+			ins->_11_23 = 8;
+			if (bGlc)
+				ins->_11_23 |= 0x20;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[1], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE2DMS: {
+			check_num_ops(s, w, 3);
+			vector<DWORD> os = assembleOp(w[3]);
+			ins->opcode = 0x58;
+			// Changed this to calculate the value rather than hard coding
+			// a small handful of values that we've seen. -DarkStarSword
+			sscanf_s(w[1].c_str(), "(%d)", &msaa_samples);
+			ins->_11_23 = (msaa_samples << 5) | 4;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[2], &v);
+			break;
+		}
+		case InsHandler::DCL_RESOURCE_TEXTURE2DMSARRAY: {
+			check_num_ops(s, w, 3);
+			vector<DWORD> os = assembleOp(w[3]);
+			ins->opcode = 0x58;
+			// Changed this to calculate the value rather than hard coding
+			// a small handful of values that we've seen. -DarkStarSword
+			sscanf_s(w[1].c_str(), "(%d)", &msaa_samples);
+			ins->_11_23 = (msaa_samples << 5) | 9;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			assembleResourceDeclarationType(&w[2], &v);
+			break;
+		}
+		case InsHandler::DCL_INDEXRANGE: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[1], true);
+			ins->opcode = 0x5b;
+			ins->length = 2 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			v.push_back(atoi(w[2].c_str()));
+			break;
+		}
+		case InsHandler::DCL_TEMPS:
+			ins->opcode = 0x68;
+			ins->length = 2;
+			v.push_back(op);
+			check_num_ops(s, w, 1);
+			v.push_back(atoi(w[1].c_str()));
+			break;
+		case InsHandler::DCL_RESOURCE_STRUCTURED: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0xa2;
+			ins->length = 4;
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			v.push_back(atoi(w[2].c_str()));
+			break;
+		}
+		case InsHandler::DCL_SAMPLER: {
+			check_num_ops(s, w, 1, 2);
+			vector<DWORD> os = assembleOp(w[1]);
+			os[0] = 0x106000;
+			ins->opcode = 0x5a;
+			if (w.size() > 2) {
+				if (w[2] == "mode_default") {
+					ins->_11_23 = 0;
+				} else if (w[2] == "mode_comparison") {
+					ins->_11_23 = 1;
+				}
+			}
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_GLOBALFLAGS:
+			ins->opcode = 0x6a;
+			ins->length = 1;
+			ins->_11_23 = 0;
+			for (unsigned i = 1; i < w.size(); i += 2) {
+				// Changed this to use a loop rather than parsing a
+				// fixed number of arguments. Added double precision,
+				// minimum precision, skipOptimization and 11.1 shader
+				// extension flags.
+				// FIXME: Missing D3D_SHADER_REQUIRES_UAVS_AT_EVERY_STAGE
+				// FIXME: Missing D3D_SHADER_REQUIRES_64_UAVS
+				// FIXME: Missing D3D_SHADER_REQUIRES_LEVEL_9_COMPARISON_FILTERING
+				// FIXME: Missing D3D_SHADER_REQUIRES_TILED_RESOURCES
+				//   - https://docs.microsoft.com/en-gb/windows/desktop/api/d3d11shader/nf-d3d11shader-id3d11shaderreflection-getrequiresflags
+				//   -DarkStarSword
+				string s = w[i];
+				if (s == "refactoringAllowed")
+					ins->_11_23 |= 0x01;
+				if (s == "enableDoublePrecisionFloatOps")
+					ins->_11_23 |= 0x02;
+				if (s == "forceEarlyDepthStencil")
+					ins->_11_23 |= 0x04;
+				if (s == "enableRawAndStructuredBuffers")
+					ins->_11_23 |= 0x08;
+				if (s == "skipOptimization")
+					ins->_11_23 |= 0x10;
+				if (s == "enableMinimumPrecision")
+					ins->_11_23 |= 0x20;
+				if (s == "enable11_1DoubleExtensions")
+					ins->_11_23 |= 0x40;
+				if (s == "enable11_1ShaderExtensions")
+					ins->_11_23 |= 0x80;
+			}
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_CONSTANTBUFFER: {
+			check_num_ops(s, w, 1, 2);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x59;
+			if (w.size() > 2) {
+				if (w[2] == "dynamicIndexed")
+					ins->_11_23 = 1;
+				else if (w[2] == "immediateIndexed")
+					ins->_11_23 = 0;
+			}
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_OUTPUT_SGV: {
+			// Added and verified. Used when writing to SV_IsFrontFace in a
+			// geometry shader. -DarkStarSword
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[1], true);
+			ins->opcode = 0x66;
+			assembleSystemValue(&w[2], &os);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_OUTPUT_SIV: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[1], true);
+			ins->opcode = 0x67;
+			assembleSystemValue(&w[2], &os);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INPUT_SIV: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[1], true);
+			ins->opcode = 0x61;
+			assembleSystemValue(&w[2], &os);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INPUT_SGV: {
+			check_num_ops(s, w, 2);
+			vector<DWORD> os = assembleOp(w[1], true);
+			ins->opcode = 0x60;
+			assembleSystemValue(&w[2], &os);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INPUT_PS: {
+			vector<DWORD> os;
+			ins->opcode = 0x62;
+			// Switched to use common interpolation mode parsing to catch
+			// more variants -DarkStarSword
+			ins->_11_23 = interpolationMode(w, 0); // FIXME: Default?
+			os = assembleOp(w[w.size() - 1], true);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INPUT_PS_SGV: {
+			// Fixed for d3dcompiler_47 disassembly that includes an
+			// interpolationMode missing from d3dcompiler_46 disassembly
+			// e.g.
+			// d3dcompiler_46: dcl_input_ps_sgv v6.x, is_front_face
+			// d3dcompiler_47: dcl_input_ps_sgv constant v6.x, is_front_face
+			//   -DarkStarSword
+			check_num_ops(s, w, 2, 5);
+			vector<DWORD> os = assembleOp(w[w.size() - 2], true);
+			ins->opcode = 0x63;
+			ins->_11_23 = interpolationMode(w, 1);
+			if (w.size() > 2)
+				assembleSystemValue(&w[w.size() - 1], &os);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INPUT_PS_SIV: {
+			vector<DWORD> os;
+			ins->opcode = 0x64;
+			// Switched to use common interpolation mode parsing (fixes
+			// missing linear noperspective sample case in WATCH_DOGS2) and
+			// system value parsing (fixes missing viewport_array_index)
+			//   -DarkStarSword
+			check_num_ops(s, w, 2, 5);
+			ins->_11_23 = interpolationMode(w, 0); // FIXME: Default?
+			os = assembleOp(w[w.size() - 2], true);
+			assembleSystemValue(&w[w.size() - 1], &os);
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INDEXABLETEMP: {
+			check_num_ops(s, w, 2);
+			string s1 = w[1].erase(0, 1);
+			string s2 = s1.substr(0, s1.find('['));
+			string s3 = s1.substr(s1.find('[') + 1);
+			s3.erase(s3.end() - 1, s3.end());
+			ins->opcode = 0x69;
+			ins->length = 4;
+			v.push_back(op);
+			v.push_back(atoi(s2.c_str()));
+			v.push_back(atoi(s3.c_str()));
+			v.push_back(atoi(w[2].c_str()));
+			break;
+		}
+		case InsHandler::DCL_IMMEDIATECONSTANTBUFFER: {
+			vector<DWORD> os;
+			ins->opcode = 0x35;
+			ins->_11_23 = 3;
+			ins->length = 0;
+			DWORD length = 2;
+			DWORD offset = 3;
+			// The modulus here is by 5, matching the below offset += 5
+			if ((w.size() - offset) % 5 != 0)
+				throw AssemblerParseError(s, "Immediate Constant Buffer must have a multiple of four values");
+			while (offset < w.size()) {
+				string s1 = w[offset + 0];
+				s1 = s1.substr(0, s1.find(','));
+				string s2 = w[offset + 1];
+				s2 = s2.substr(0, s2.find(','));
+				string s3 = w[offset + 2];
+				s3 = s3.substr(0, s3.find(','));
+				string s4 = w[offset + 3];
+				s4 = s4.substr(0, s4.find('}'));
+				os.push_back(strToDWORD(s1));
+				os.push_back(strToDWORD(s2));
+				os.push_back(strToDWORD(s3));
+				os.push_back(strToDWORD(s4));
+				length += 4;
+				offset += 5;
+			}
+			v.push_back(op);
+			v.push_back(length);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_TESSELLATOR_PARTITIONING:
+			ins->opcode = 0x96;
+			ins->length = 1;
+			check_num_ops(s, w, 1);
+			if (w[1] == "partitioning_integer")
+				ins->_11_23 = 1;
+			else if (w[1] == "partitioning_pow2")
+				ins->_11_23 = 2;
+			else if (w[1] == "partitioning_fractional_odd")
+				ins->_11_23 = 3;
+			else if (w[1] == "partitioning_fractional_even")
+				ins->_11_23 = 4;
+			// Added pow2 -DarkStarSword
+			// https://msdn.microsoft.com/en-us/library/windows/desktop/ff471446(v=vs.85).aspx
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_TESSELLATOR_OUTPUT_PRIMITIVE:
+			ins->opcode = 0x97;
+			ins->length = 1;
+			check_num_ops(s, w, 1);
+			if (w[1] == "output_point")
+				ins->_11_23 = 1;
+			else if (w[1] == "output_line")
+				ins->_11_23 = 2;
+			else if (w[1] == "output_triangle_cw")
+				ins->_11_23 = 3;
+			else if (w[1] == "output_triangle_ccw")
+				ins->_11_23 = 4;
+			// Added output_point -DarkStarSword
+			// https://msdn.microsoft.com/en-us/library/windows/desktop/ff471445(v=vs.85).aspx
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_TESSELLATOR_DOMAIN:
+			ins->opcode = 0x95;
+			ins->length = 1;
+			check_num_ops(s, w, 1);
+			if (w[1] == "domain_isoline")
+				ins->_11_23 = 1;
+			else if (w[1] == "domain_tri")
+				ins->_11_23 = 2;
+			else if (w[1] == "domain_quad")
+				ins->_11_23 = 3;
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_STREAM: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x8f;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::EMIT_STREAM: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x75;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::CUT_STREAM: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x76;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::EMIT_THEN_CUT_STREAM: {
+			// Partially verified - assembled & disassembled OK, but did not
+			// check against compiled shader as fxc never generates this
+			//   -DarkStarSword
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x77;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_OUTPUTTOPOLOGY:
+			ins->opcode = 0x5c;
+			ins->length = 1;
+			check_num_ops(s, w, 1);
+			if (w[1] == "pointlist")
+				ins->_11_23 = 1;
+			else if (w[1] == "trianglestrip")
+				ins->_11_23 = 5;
+			else if (w[1] == "linestrip")
+				ins->_11_23 = 3;
+			// Added point list -DarkStarSword
+			// https://msdn.microsoft.com/en-us/library/windows/desktop/bb509661(v=vs.85).aspx
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_OUTPUT_CONTROL_POINT_COUNT: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x94;
+			ins->_11_23 = os[0];
+			ins->length = 1;
+			v.push_back(op);
+			break;
+		}
+		case InsHandler::DCL_INPUT_CONTROL_POINT_COUNT: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x93;
+			ins->_11_23 = os[0];
+			ins->length = 1;
+			v.push_back(op);
+			break;
+		}
+		case InsHandler::DCL_MAXOUT: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x5e;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::DCL_INPUTPRIMITIVE:
+			ins->opcode = 0x5d;
+			ins->length = 1;
+			check_num_ops(s, w, 1);
+			if (w[1] == "point")
+				ins->_11_23 = 1;
+			else if (w[1] == "line")
+				ins->_11_23 = 2;
+			else if (w[1] == "triangle")
+				ins->_11_23 = 3;
+			else if (w[1] == "lineadj")
+				ins->_11_23 = 6;
+			else if (w[1] == "triangleadj")
+				ins->_11_23 = 7;
+			// Added "lineadj" -DarkStarSword
+			// https://msdn.microsoft.com/en-us/library/windows/desktop/bb509609(v=vs.85).aspx
+			v.push_back(op);
+			break;
+		case InsHandler::DCL_HS_MAX_TESSFACTOR: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x98;
+			ins->length = 1 + os.size() - 1;
+			v.push_back(op);
+			v.insert(v.end(), os.begin() + 1, os.end());
+			break;
+		}
+		case InsHandler::DCL_HS_FORK_PHASE_INSTANCE_COUNT: {
+			check_num_ops(s, w, 1);
+			vector<DWORD> os = assembleOp(w[1]);
+			ins->opcode = 0x99;
+			ins->length = 1 + os.size();
+			v.push_back(op);
+			v.insert(v.end(), os.begin(), os.end());
+			break;
+		}
+		case InsHandler::SAMPLEPOS: {
+			// samplepos can either be used with a texture register, or the
+			// rasterizer. In the former case it has an extra 0 appended.
+			vector<vector<DWORD>> os;
+			ins->opcode = 0x6e;
+			int numOps = 3;
+			check_num_ops(s, w, numOps);
+			for (int i = 0; i < numOps; i++)
+				os.push_back(assembleOp(w[i + 1], i < 1));
+
+			// When the instruction operates on a texture register
+			// (GetSamplerPosition) there is an extra 0 inserted that is
+			// not present when used on the rasterizer register
+			// (GetRenderTargetSamplePosition). It's not clear if there are
+			// any cases where this should be non-zero:
+			if (w[2][0] == 't') {
+				numOps++;
+				os.push_back(vector<DWORD>{0});
+			}
+
+			ins->length = 1;
+			for (int i = 0; i < numOps; i++)
+				ins->length += (int)os[i].size();
+
+			v.push_back(op);
+			for (int i = 0; i < numOps; i++)
+				v.insert(v.end(), os[i].begin(), os[i].end());
+			break;
+		}
+		case InsHandler::PRINTF:
+			return assemble_printf(s, v, w, false);
+		case InsHandler::ERRORF:
+			return assemble_printf(s, v, w, true);
+		case InsHandler::UNDECIPHERABLE:
+			return assemble_undecipherable_custom_data(s, v, w);
+		}
+	} else if (!o.compare(0, 3, "ps_")) {
+		check_num_ops(s, w, 0);
+		op = 0x00000;
+		op |= 16 * atoi(o.substr(3, 1).c_str());
+		op |= atoi(o.substr(5, 1).c_str());
+		v.push_back(op);
+	} else if (!o.compare(0, 3, "vs_")) {
+		check_num_ops(s, w, 0);
+		op = 0x10000;
+		op |= 16 * atoi(o.substr(3, 1).c_str());
+		op |= atoi(o.substr(5, 1).c_str());
+		v.push_back(op);
+	} else if (!o.compare(0, 3, "gs_")) {
+		check_num_ops(s, w, 0);
+		op = 0x20000;
+		op |= 16 * atoi(o.substr(3, 1).c_str());
+		op |= atoi(o.substr(5, 1).c_str());
+		v.push_back(op);
+	} else if (!o.compare(0, 3, "hs_")) {
+		check_num_ops(s, w, 0);
+		op = 0x30000;
+		op |= 16 * atoi(o.substr(3, 1).c_str());
+		op |= atoi(o.substr(5, 1).c_str());
+		v.push_back(op);
+	} else if (!o.compare(0, 3, "ds_")) {
+		check_num_ops(s, w, 0);
+		op = 0x40000;
+		op |= 16 * atoi(o.substr(3, 1).c_str());
+		op |= atoi(o.substr(5, 1).c_str());
+		v.push_back(op);
+	} else if (!o.compare(0, 3, "cs_")) {
+		check_num_ops(s, w, 0);
+		op = 0x50000;
+		op |= 16 * atoi(o.substr(3, 1).c_str());
+		op |= atoi(o.substr(5, 1).c_str());
+		v.push_back(op);
+	} else if (!w[0].compare(0, 4, "sync")) {
+		ins->opcode = 0xbe;
+		check_num_ops(s, w, 0);
+		ins->_11_23 = parseSyncFlags(&w[0]);
+		ins->length = 1;
+		v.push_back(op);
+	} else if (w[0] == "store_uav_typed") {
+		ins->opcode = 0x86;
+		int numOps = 3;
+		check_num_ops(s, w, numOps);
+		if (w[1][0] == 'u') {
+			ins->opcode = 0xa4;
+		}
+		vector<vector<DWORD>> Os;
+		int numSpecial = 1;
+		for (int i = 0; i < numOps; i++)
+			Os.push_back(assembleOp(w[i + 1], i < numSpecial));
+		ins->length = 1;
+		for (int i = 0; i < numOps; i++)
+			ins->length += (int)Os[i].size();
+		v.push_back(op);
+		for (int i = 0; i < numOps; i++)
+			v.insert(v.end(), Os[i].begin(), Os[i].end());
+	} else {
+		throw AssemblerParseError(s, "Unrecognised instruction");
+	}
+
 	return v;
 }
 
+static vector<DWORD> assembleIns(string s)
+{
+	AsmTokenArena arena;
+	return assembleIns(s, &arena);
+}
+
 static string assembleAndCompare(string s, vector<DWORD> v)
 {
 	string s2;
@@ -2497,6 +2758,7 @@ static string assembleAndCompare(string s, vector<DWORD> v)
 				s2.append(s);
 				// codeBin[s2] = v;
 			} else {
+				lock_guard<mutex> lock(codeBin_lock);
 				s2 = s;
 				s2.append(" orig");
 				codeBin[s2] = v;
@@ -2507,6 +2769,7 @@ static string assembleAndCompare(string s, vector<DWORD> v)
 		}
 	} else {
 		if (s != "undecipherable custom data") {
+			lock_guard<mutex> lock(codeBin_lock);
 			s2 = "!missing ";
 			s2.append(s);
 			codeBin[s2] = v;
@@ -2520,33 +2783,26 @@ static string assembleAndCompare(string s, vector<DWORD> v)
 	return ret;
 }
 
-vector<string> stringToLines(const char* start, size_t size)
+// Splits the assembly into lines without copying them. The tokens point into
+// the buffer, so are only valid for as long as it is.
+void tokenizeLines(const char* start, size_t size, vector<AsmToken> *lines)
 {
-	vector<string> lines;
 	const char* pStart = start;
 	const char* pEnd = pStart;
 	const char* pRealEnd = pStart + size;
-	while (true) {
-		while (*pEnd != '\n' && pEnd < pRealEnd) {
+	const char* pLineEnd;
+
+	lines->clear();
+	while (pStart < pRealEnd && *pStart != 0) {
+		while (pEnd < pRealEnd && *pEnd != '\n')
 			pEnd++;
-		}
-		if (*pStart == 0) {
-			break;
-		}
-		string s(pStart, pEnd++);
-		pStart = pEnd;
-		lines.push_back(s);
-		if (pStart >= pRealEnd) {
-			break;
-		}
-	}
-	for (unsigned int i = 0; i < lines.size(); i++) {
-		string s = lines[i];
+		pLineEnd = pEnd++;
+
 		// Bug fixed: This would not strip carriage returns from DOS
 		// style newlines if they were the only character on the line,
 		// corrupting the resulting shader binary. -DarkStarSword
-		if (s.size() >= 1 && s[s.size() - 1] == '\r')
-			s.erase(--s.end());
+		if (pLineEnd > pStart && pLineEnd[-1] == '\r')
+			pLineEnd--;
 
 		// Strip whitespace from the end of each line. This isn't
 		// strictly necessary, but the MS disassembler inserts an extra
@@ -2556,11 +2812,23 @@ vector<string> stringToLines(const char* start, size_t size)
 		// understand why the pattern isn't matching. By removing
 		// excess spaces from the end of each line now we can make this
 		// gotcha go away.
-		while (s.size() >= 1 && s[s.size() - 1] == ' ')
-			s.erase(--s.end());
+		while (pLineEnd > pStart && pLineEnd[-1] == ' ')
+			pLineEnd--;
 
-		lines[i] = s;
+		lines->push_back({pStart, (size_t)(pLineEnd - pStart)});
+		pStart = pEnd;
 	}
+}
+
+vector<string> stringToLines(const char* start, size_t size)
+{
+	vector<AsmToken> tokens;
+	vector<string> lines;
+
+	tokenizeLines(start, size, &tokens);
+	lines.reserve(tokens.size());
+	for (AsmToken &line : tokens)
+		lines.emplace_back(line.ptr, line.len);
 	return lines;
 }
 static vector<string> stringToLinesDX9(const char* start, size_t size) {
@@ -2672,7 +2940,7 @@ static void encode_custom_data(string &s, vector<DWORD> &v)
 // other differences ("cb" vs "CB" in dcl_constantbuffer lines, number of
 // digits used in certain number formatting routines), but this is the most
 // likely to interfere with ShaderRegex patterns.
-static inline void patch_d3dcompiler_47_rdef(string *line, int *rdef_state)
+void patch_d3dcompiler_47_rdef(string *line, int *rdef_state)
 {
 	char name[256], type[16], format[16], dim[16], bind_type[16];
 	int bind_idx, count, numRead;
@@ -2764,7 +3032,7 @@ static char txt_swiz[] = {
 //       int m_PatchX;                  // Index:    0
 //       int m_PatchZ;                  // Index:    0.y
 //
-static inline void replace_cb_offsets_with_indices(string *line)
+void replace_cb_offsets_with_indices(string *line)
 {
 	int numRead, end1 = 0, end2 = 0;
 	unsigned offset = 0, size = 0;
@@ -3085,262 +3353,644 @@ static void preprocessLine(string &line)
 	}
 }
 
-// For anyone confused about what this hash function is doing, there is a
-// clearer implementation here, with details of how this differs from MD5:
+// The DXBC checksum is MD5's compression function with its own padding scheme
+// (the length in bits goes at the start of the final block instead of the end,
+// and the last word is the length * 2 + 1). For anyone confused about what
+// this is doing, there is a clearer implementation here, with details of how
+// this differs from MD5:
 // https://github.com/DarkStarSword/3d-fixes/blob/master/dx11shaderanalyse.py
-static vector<DWORD> ComputeHash(byte const* input, DWORD size)
+//
+// The block function is a template so the same code can hash one buffer using
+// regular integers, or four buffers at once using one SSE2 lane for each.
+
+static inline DWORD hash_add(DWORD a, DWORD b) { return a + b; }
+static inline DWORD hash_f(DWORD x, DWORD y, DWORD z) { return z ^ (x & (y ^ z)); }
+static inline DWORD hash_and(DWORD x, DWORD y) { return x & y; }
+static inline DWORD hash_andnot(DWORD x, DWORD y) { return ~x & y; }
+static inline DWORD hash_h(DWORD x, DWORD y, DWORD z) { return x ^ (y ^ z); }
+static inline DWORD hash_i(DWORD x, DWORD y, DWORD z) { return y ^ (x | ~z); }
+template <int s> static inline DWORD hash_rotl(DWORD x) { return _rotl(x, s); }
+template <typename T> static inline T hash_const(DWORD k);
+template <> inline DWORD hash_const<DWORD>(DWORD k) { return k; }
+
+static inline __m128i hash_add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+static inline __m128i hash_f(__m128i x, __m128i y, __m128i z) { return _mm_xor_si128(z, _mm_and_si128(x, _mm_xor_si128(y, z))); }
+static inline __m128i hash_and(__m128i x, __m128i y) { return _mm_and_si128(x, y); }
+static inline __m128i hash_andnot(__m128i x, __m128i y) { return _mm_andnot_si128(x, y); }
+static inline __m128i hash_h(__m128i x, __m128i y, __m128i z) { return _mm_xor_si128(x, _mm_xor_si128(y, z)); }
+static inline __m128i hash_i(__m128i x, __m128i y, __m128i z) { return _mm_xor_si128(y, _mm_or_si128(x, _mm_xor_si128(z, _mm_set1_epi32(-1)))); }
+template <int s> static inline __m128i hash_rotl(__m128i x) { return _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - s)); }
+template <> inline __m128i hash_const<__m128i>(DWORD k) { return _mm_set1_epi32((int)k); }
+
+// Each step depends on the one before it through b, so everything that
+// doesn't involve b is added first to keep it off the critical path. The G
+// round function is split into two terms that can be added separately for
+// the same reason:
+#define HASH_STEP(f, a, b, c, d, k, t, s) \
+	a = hash_add(hash_rotl<s>(hash_add(hash_add(a, hash_add(x[k], hash_const<T>(t))), f(b, c, d))), b)
+#define HASH_STEP_G(a, b, c, d, k, t, s) \
+	a = hash_add(hash_rotl<s>(hash_add(hash_add(hash_add(a, hash_add(x[k], hash_const<T>(t))), \
+			hash_andnot(d, c)), hash_and(b, d))), b)
+
+template <typename T, typename W>
+static inline void hash_block(T h[4], const W *x)
 {
-	DWORD esi;
-	DWORD ebx;
-	DWORD i = 0;
-	DWORD edi;
-	DWORD edx;
-	DWORD processedSize = 0;
-
-	DWORD sizeHash = size & 0x3F;
-	bool sizeHash56 = sizeHash >= 56;
-	DWORD restSize = sizeHash56 ? 120 - 56 : 56 - sizeHash;
-	DWORD loopSize = (size + 8 + restSize) >> 6;
-	DWORD Dst[16];
-	DWORD Data[] = { 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	DWORD loopSize2 = loopSize - (sizeHash56 ? 2 : 1);
-	DWORD start_0 = 0;
-	DWORD* pSrc = (DWORD*)input;
-	DWORD h[] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
-	if (loopSize > 0) {
-		while (i < loopSize) {
-			if (i == loopSize2) {
-				if (!sizeHash56) {
-					Dst[0] = size << 3;
-					DWORD remSize = size - processedSize;
-					std::memcpy(&Dst[1], pSrc, remSize);
-					std::memcpy(&Dst[1 + remSize / 4], Data, restSize);
-					Dst[15] = (size * 2) | 1;
-					pSrc = Dst;
-				} else {
-					DWORD remSize = size - processedSize;
-					std::memcpy(&Dst[0], pSrc, remSize);
-					std::memcpy(&Dst[remSize / 4], Data, 64 - remSize);
-					pSrc = Dst;
-				}
-			} else if (i > loopSize2) {
-				Dst[0] = size << 3;
-				std::memcpy(&Dst[1], &Data[1], 56);
-				Dst[15] = (size * 2) | 1;
-				pSrc = Dst;
-			}
+	T a = h[0], b = h[1], c = h[2], d = h[3];
+
+	HASH_STEP(hash_f, a, b, c, d,  0, 0xD76AA478,  7);
+	HASH_STEP(hash_f, d, a, b, c,  1, 0xE8C7B756, 12);
+	HASH_STEP(hash_f, c, d, a, b,  2, 0x242070DB, 17);
+	HASH_STEP(hash_f, b, c, d, a,  3, 0xC1BDCEEE, 22);
+	HASH_STEP(hash_f, a, b, c, d,  4, 0xF57C0FAF,  7);
+	HASH_STEP(hash_f, d, a, b, c,  5, 0x4787C62A, 12);
+	HASH_STEP(hash_f, c, d, a, b,  6, 0xA8304613, 17);
+	HASH_STEP(hash_f, b, c, d, a,  7, 0xFD469501, 22);
+	HASH_STEP(hash_f, a, b, c, d,  8, 0x698098D8,  7);
+	HASH_STEP(hash_f, d, a, b, c,  9, 0x8B44F7AF, 12);
+	HASH_STEP(hash_f, c, d, a, b, 10, 0xFFFF5BB1, 17);
+	HASH_STEP(hash_f, b, c, d, a, 11, 0x895CD7BE, 22);
+	HASH_STEP(hash_f, a, b, c, d, 12, 0x6B901122,  7);
+	HASH_STEP(hash_f, d, a, b, c, 13, 0xFD987193, 12);
+	HASH_STEP(hash_f, c, d, a, b, 14, 0xA679438E, 17);
+	HASH_STEP(hash_f, b, c, d, a, 15, 0x49B40821, 22);
+
+	HASH_STEP_G(a, b, c, d,  1, 0xF61E2562,  5);
+	HASH_STEP_G(d, a, b, c,  6, 0xC040B340,  9);
+	HASH_STEP_G(c, d, a, b, 11, 0x265E5A51, 14);
+	HASH_STEP_G(b, c, d, a,  0, 0xE9B6C7AA, 20);
+	HASH_STEP_G(a, b, c, d,  5, 0xD62F105D,  5);
+	HASH_STEP_G(d, a, b, c, 10, 0x02441453,  9);
+	HASH_STEP_G(c, d, a, b, 15, 0xD8A1E681, 14);
+	HASH_STEP_G(b, c, d, a,  4, 0xE7D3FBC8, 20);
+	HASH_STEP_G(a, b, c, d,  9, 0x21E1CDE6,  5);
+	HASH_STEP_G(d, a, b, c, 14, 0xC33707D6,  9);
+	HASH_STEP_G(c, d, a, b,  3, 0xF4D50D87, 14);
+	HASH_STEP_G(b, c, d, a,  8, 0x455A14ED, 20);
+	HASH_STEP_G(a, b, c, d, 13, 0xA9E3E905,  5);
+	HASH_STEP_G(d, a, b, c,  2, 0xFCEFA3F8,  9);
+	HASH_STEP_G(c, d, a, b,  7, 0x676F02D9, 14);
+	HASH_STEP_G(b, c, d, a, 12, 0x8D2A4C8A, 20);
+
+	HASH_STEP(hash_h, a, b, c, d,  5, 0xFFFA3942,  4);
+	HASH_STEP(hash_h, d, a, b, c,  8, 0x8771F681, 11);
+	HASH_STEP(hash_h, c, d, a, b, 11, 0x6D9D6122, 16);
+	HASH_STEP(hash_h, b, c, d, a, 14, 0xFDE5380C, 23);
+	HASH_STEP(hash_h, a, b, c, d,  1, 0xA4BEEA44,  4);
+	HASH_STEP(hash_h, d, a, b, c,  4, 0x4BDECFA9, 11);
+	HASH_STEP(hash_h, c, d, a, b,  7, 0xF6BB4B60, 16);
+	HASH_STEP(hash_h, b, c, d, a, 10, 0xBEBFBC70, 23);
+	HASH_STEP(hash_h, a, b, c, d, 13, 0x289B7EC6,  4);
+	HASH_STEP(hash_h, d, a, b, c,  0, 0xEAA127FA, 11);
+	HASH_STEP(hash_h, c, d, a, b,  3, 0xD4EF3085, 16);
+	HASH_STEP(hash_h, b, c, d, a,  6, 0x04881D05, 23);
+	HASH_STEP(hash_h, a, b, c, d,  9, 0xD9D4D039,  4);
+	HASH_STEP(hash_h, d, a, b, c, 12, 0xE6DB99E5, 11);
+	HASH_STEP(hash_h, c, d, a, b, 15, 0x1FA27CF8, 16);
+	HASH_STEP(hash_h, b, c, d, a,  2, 0xC4AC5665, 23);
+
+	HASH_STEP(hash_i, a, b, c, d,  0, 0xF4292244,  6);
+	HASH_STEP(hash_i, d, a, b, c,  7, 0x432AFF97, 10);
+	HASH_STEP(hash_i, c, d, a, b, 14, 0xAB9423A7, 15);
+	HASH_STEP(hash_i, b, c, d, a,  5, 0xFC93A039, 21);
+	HASH_STEP(hash_i, a, b, c, d, 12, 0x655B59C3,  6);
+	HASH_STEP(hash_i, d, a, b, c,  3, 0x8F0CCC92, 10);
+	HASH_STEP(hash_i, c, d, a, b, 10, 0xFFEFF47D, 15);
+	HASH_STEP(hash_i, b, c, d, a,  1, 0x85845DD1, 21);
+	HASH_STEP(hash_i, a, b, c, d,  8, 0x6FA87E4F,  6);
+	HASH_STEP(hash_i, d, a, b, c, 15, 0xFE2CE6E0, 10);
+	HASH_STEP(hash_i, c, d, a, b,  6, 0xA3014314, 15);
+	HASH_STEP(hash_i, b, c, d, a, 13, 0x4E0811A1, 21);
+	HASH_STEP(hash_i, a, b, c, d,  4, 0xF7537E82,  6);
+	HASH_STEP(hash_i, d, a, b, c, 11, 0xBD3AF235, 10);
+	HASH_STEP(hash_i, c, d, a, b,  2, 0x2AD7D2BB, 15);
+	HASH_STEP(hash_i, b, c, d, a,  9, 0xEB86D391, 21);
+
+	h[0] = hash_add(h[0], a);
+	h[1] = hash_add(h[1], b);
+	h[2] = hash_add(h[2], c);
+	h[3] = hash_add(h[3], d);
+}
 
-			// initial values from memory
-			edx = h[0];
-			ebx = h[1];
-			edi = h[2];
-			esi = h[3];
-
-			edx = _rotl((~ebx & esi | ebx & edi) + pSrc[0] + 0xD76AA478 + edx, 7) + ebx;
-			esi = _rotl((~edx & edi | edx & ebx) + pSrc[1] + 0xE8C7B756 + esi, 12) + edx;
-			edi = _rotr((~esi & ebx | esi & edx) + pSrc[2] + 0x242070DB + edi, 15) + esi;
-			ebx = _rotr((~edi & edx | edi & esi) + pSrc[3] + 0xC1BDCEEE + ebx, 10) + edi;
-			edx = _rotl((~ebx & esi | ebx & edi) + pSrc[4] + 0xF57C0FAF + edx, 7) + ebx;
-			esi = _rotl((~edx & edi | ebx & edx) + pSrc[5] + 0x4787C62A + esi, 12) + edx;
-			edi = _rotr((~esi & ebx | esi & edx) + pSrc[6] + 0xA8304613 + edi, 15) + esi;
-			ebx = _rotr((~edi & edx | edi & esi) + pSrc[7] + 0xFD469501 + ebx, 10) + edi;
-			edx = _rotl((~ebx & esi | ebx & edi) + pSrc[8] + 0x698098D8 + edx, 7) + ebx;
-			esi = _rotl((~edx & edi | ebx & edx) + pSrc[9] + 0x8B44F7AF + esi, 12) + edx;
-			edi = _rotr((~esi & ebx | esi & edx) + pSrc[10] + 0xFFFF5BB1 + edi, 15) + esi;
-			ebx = _rotr((~edi & edx | edi & esi) + pSrc[11] + 0x895CD7BE + ebx, 10) + edi;
-			edx = _rotl((~ebx & esi | ebx & edi) + pSrc[12] + 0x6B901122 + edx, 7) + ebx;
-			esi = _rotl((~edx & edi | ebx & edx) + pSrc[13] + 0xFD987193 + esi, 12) + edx;
-			edi = _rotr((~esi & ebx | esi & edx) + pSrc[14] + 0xA679438E + edi, 15) + esi;
-			ebx = _rotr((~edi & edx | edi & esi) + pSrc[15] + 0x49B40821 + ebx, 10) + edi;
-
-			edx = _rotl((~esi & edi | esi & ebx) + pSrc[1] + 0xF61E2562 + edx, 5) + ebx;
-			esi = _rotl((~edi & ebx | edi & edx) + pSrc[6] + 0xC040B340 + esi, 9) + edx;
-			edi = _rotl((~ebx & edx | ebx & esi) + pSrc[11] + 0x265E5A51 + edi, 14) + esi;
-			ebx = _rotr((~edx & esi | edx & edi) + pSrc[0] + 0xE9B6C7AA + ebx, 12) + edi;
-			edx = _rotl((~esi & edi | esi & ebx) + pSrc[5] + 0xD62F105D + edx, 5) + ebx;
-			esi = _rotl((~edi & ebx | edi & edx) + pSrc[10] + 0x02441453 + esi, 9) + edx;
-			edi = _rotl((~ebx & edx | ebx & esi) + pSrc[15] + 0xD8A1E681 + edi, 14) + esi;
-			ebx = _rotr((~edx & esi | edx & edi) + pSrc[4] + 0xE7D3FBC8 + ebx, 12) + edi;
-			edx = _rotl((~esi & edi | esi & ebx) + pSrc[9] + 0x21E1CDE6 + edx, 5) + ebx;
-			esi = _rotl((~edi & ebx | edi & edx) + pSrc[14] + 0xC33707D6 + esi, 9) + edx;
-			edi = _rotl((~ebx & edx | ebx & esi) + pSrc[3] + 0xF4D50D87 + edi, 14) + esi;
-			ebx = _rotr((~edx & esi | edx & edi) + pSrc[8] + 0x455A14ED + ebx, 12) + edi;
-			edx = _rotl((~esi & edi | esi & ebx) + pSrc[13] + 0xA9E3E905 + edx, 5) + ebx;
-			esi = _rotl((~edi & ebx | edi & edx) + pSrc[2] + 0xFCEFA3F8 + esi, 9) + edx;
-			edi = _rotl((~ebx & edx | ebx & esi) + pSrc[7] + 0x676F02D9 + edi, 14) + esi;
-			ebx = _rotr((~edx & esi | edx & edi) + pSrc[12] + 0x8D2A4C8A + ebx, 12) + edi;
-
-			edx = _rotl((esi ^ edi ^ ebx) + pSrc[5] + 0xFFFA3942 + edx, 4) + ebx;
-			esi = _rotl((edi ^ ebx ^ edx) + pSrc[8] + 0x8771F681 + esi, 11) + edx;
-			edi = _rotl((ebx ^ edx ^ esi) + pSrc[11] + 0x6D9D6122 + edi, 16) + esi;
-			ebx = _rotr((edx ^ esi ^ edi) + pSrc[14] + 0xFDE5380C + ebx, 9) + edi;
-			edx = _rotl((esi ^ edi ^ ebx) + pSrc[1] + 0xA4BEEA44 + edx, 4) + ebx;
-			esi = _rotl((edi ^ ebx ^ edx) + pSrc[4] + 0x4BDECFA9 + esi, 11) + edx;
-			edi = _rotl((ebx ^ edx ^ esi) + pSrc[7] + 0xF6BB4B60 + edi, 16) + esi;
-			ebx = _rotr((edx ^ esi ^ edi) + pSrc[10] + 0xBEBFBC70 + ebx, 9) + edi;
-			edx = _rotl((esi ^ edi ^ ebx) + pSrc[13] + 0x289B7EC6 + edx, 4) + ebx;
-			esi = _rotl((edi ^ ebx ^ edx) + pSrc[0] + 0xEAA127FA + esi, 11) + edx;
-			edi = _rotl((ebx ^ edx ^ esi) + pSrc[3] + 0xD4EF3085 + edi, 16) + esi;
-			ebx = _rotr((edx ^ esi ^ edi) + pSrc[6] + 0x04881D05 + ebx, 9) + edi;
-			edx = _rotl((esi ^ edi ^ ebx) + pSrc[9] + 0xD9D4D039 + edx, 4) + ebx;
-			esi = _rotl((edi ^ ebx ^ edx) + pSrc[12] + 0xE6DB99E5 + esi, 11) + edx;
-			edi = _rotl((ebx ^ edx ^ esi) + pSrc[15] + 0x1FA27CF8 + edi, 16) + esi;
-			ebx = _rotr((edx ^ esi ^ edi) + pSrc[2] + 0xC4AC5665 + ebx, 9) + edi;
-
-			edx = _rotl(((~esi | ebx) ^ edi) + pSrc[0] + 0xF4292244 + edx, 6) + ebx;
-			esi = _rotl(((~edi | edx) ^ ebx) + pSrc[7] + 0x432AFF97 + esi, 10) + edx;
-			edi = _rotl(((~ebx | esi) ^ edx) + pSrc[14] + 0xAB9423A7 + edi, 15) + esi;
-			ebx = _rotr(((~edx | edi) ^ esi) + pSrc[5] + 0xFC93A039 + ebx, 11) + edi;
-			edx = _rotl(((~esi | ebx) ^ edi) + pSrc[12] + 0x655B59C3 + edx, 6) + ebx;
-			esi = _rotl(((~edi | edx) ^ ebx) + pSrc[3] + 0x8F0CCC92 + esi, 10) + edx;
-			edi = _rotl(((~ebx | esi) ^ edx) + pSrc[10] + 0xFFEFF47D + edi, 15) + esi;
-			ebx = _rotr(((~edx | edi) ^ esi) + pSrc[1] + 0x85845DD1 + ebx, 11) + edi;
-			edx = _rotl(((~esi | ebx) ^ edi) + pSrc[8] + 0x6FA87E4F + edx, 6) + ebx;
-			esi = _rotl(((~edi | edx) ^ ebx) + pSrc[15] + 0xFE2CE6E0 + esi, 10) + edx;
-			edi = _rotl(((~ebx | esi) ^ edx) + pSrc[6] + 0xA3014314 + edi, 15) + esi;
-			ebx = _rotr(((~edx | edi) ^ esi) + pSrc[13] + 0x4E0811A1 + ebx, 11) + edi;
-			edx = _rotl(((~esi | ebx) ^ edi) + pSrc[4] + 0xF7537E82 + edx, 6) + ebx;
-			h[0] += edx;
-			esi = _rotl(((~edi | edx) ^ ebx) + pSrc[11] + 0xBD3AF235 + esi, 10) + edx;
-			h[3] += esi;
-			edi = _rotl(((~ebx | esi) ^ edx) + pSrc[2] + 0x2AD7D2BB + edi, 15) + esi;
-			h[2] += edi;
-			ebx = _rotr(((~edx | edi) ^ esi) + pSrc[9] + 0xEB86D391 + ebx, 11) + edi;
-			h[1] += ebx;
-
-			processedSize += 0x40;
-			pSrc += 16;
-			i++;
-		}
+#undef HASH_STEP
+#undef HASH_STEP_G
+
+static const DWORD hash_init[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+
+// Builds the one or two blocks at the end of the hash from whatever is left
+// over after the last whole block, plus the padding and length. Returns the
+// number of blocks.
+static DWORD hash_tail(byte const* input, DWORD size, DWORD tail[32])
+{
+	DWORD rem = size & 0x3F;
+	byte const* pSrc = input + (size & ~0x3F);
+
+	memset(tail, 0, 128);
+	if (rem < 56) {
+		tail[0] = size << 3;
+		// Byte offsets, since the size is not always a multiple of 4:
+		memcpy(&tail[1], pSrc, rem);
+		((byte*)&tail[1])[rem] = 0x80;
+		tail[15] = (size * 2) | 1;
+		return 1;
 	}
+
+	memcpy(&tail[0], pSrc, rem);
+	((byte*)&tail[0])[rem] = 0x80;
+	tail[16] = size << 3;
+	tail[31] = (size * 2) | 1;
+	return 2;
+}
+
+void ComputeHash(byte const* input, DWORD size, DWORD hash[4])
+{
+	DWORD h[4] = { hash_init[0], hash_init[1], hash_init[2], hash_init[3] };
+	DWORD blocks = size >> 6;
+	DWORD tail[32];
+	DWORD i, n;
+
+	for (i = 0; i < blocks; i++)
+		hash_block(h, (DWORD const*)(input + i * 64));
+	n = hash_tail(input, size, tail);
+	for (i = 0; i < n; i++)
+		hash_block(h, tail + i * 16);
+
+	memcpy(hash, h, 16);
+}
+
+vector<DWORD> ComputeHash(byte const* input, DWORD size)
+{
 	vector<DWORD> hash(4);
-	std::memcpy(hash.data(), h, 16);
+	ComputeHash(input, size, hash.data());
 	return hash;
 }
 
-// origByteCode is modified in this function, so passing it by value!
-// asmFile is not modified, so passing it by pointer -DarkStarSword
-vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
+// Tracks one buffer being hashed in a lane of ComputeHashes
+struct HashLane {
+	byte const* input;
+	size_t index;
+	DWORD blocks;
+	DWORD total;
+	DWORD next;
+	DWORD tail[32];
+};
+
+static void start_hash_lane(HashLane *lane, byte const* input, DWORD size, size_t index)
+{
+	lane->input = input;
+	lane->index = index;
+	lane->blocks = size >> 6;
+	lane->total = lane->blocks + hash_tail(input, size, lane->tail);
+	lane->next = 0;
+}
+
+static DWORD const* hash_lane_block(HashLane *lane)
+{
+	if (lane->next < lane->blocks)
+		return (DWORD const*)(lane->input + lane->next * 64);
+	return lane->tail + (lane->next - lane->blocks) * 16;
+}
+
+// Computes the checksums of several buffers at once, for tools that work
+// through a whole folder of shaders. Four buffers are hashed side by side in
+// SSE2 lanes, and whenever one finishes the next buffer takes over its lane,
+// so buffers of different sizes don't leave lanes sitting idle. Once there
+// are no more buffers to start, the last one is finished on its own. The
+// largest buffers are started first so that the smaller ones can fill in the
+// other lanes alongside them, rather than leaving a large one to run alone.
+void ComputeHashes(byte const* const* inputs, const DWORD *sizes, size_t count, DWORD (*hashes)[4])
+{
+	static const DWORD idle_block[16] = {0};
+	HashLane lanes[4];
+	DWORD state[4][4]; // [word][lane]
+	DWORD const* blocks[4];
+	__m128i h[4], x[16], t[4];
+	vector<size_t> order(count);
+	size_t next = 0, i;
+	unsigned active = 0, l, j;
+
+	for (i = 0; i < count; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [sizes](size_t a, size_t b) {
+		return sizes[a] > sizes[b];
+	});
+
+	for (l = 0; l < 4; l++) {
+		for (j = 0; j < 4; j++)
+			state[j][l] = hash_init[j];
+		lanes[l].input = NULL;
+		if (next < count) {
+			i = order[next++];
+			start_hash_lane(&lanes[l], inputs[i], sizes[i], i);
+			active++;
+		}
+	}
+	for (j = 0; j < 4; j++)
+		h[j] = _mm_loadu_si128((__m128i*)state[j]);
+
+	while (active > 1) {
+		for (l = 0; l < 4; l++)
+			blocks[l] = lanes[l].input ? hash_lane_block(&lanes[l]) : idle_block;
+
+		// Transpose the blocks so that each vector holds the same
+		// word from each lane:
+		for (j = 0; j < 4; j++) {
+			x[j * 4 + 0] = _mm_loadu_si128((__m128i*)(blocks[0] + j * 4));
+			x[j * 4 + 1] = _mm_loadu_si128((__m128i*)(blocks[1] + j * 4));
+			x[j * 4 + 2] = _mm_loadu_si128((__m128i*)(blocks[2] + j * 4));
+			x[j * 4 + 3] = _mm_loadu_si128((__m128i*)(blocks[3] + j * 4));
+			t[0] = _mm_unpacklo_epi32(x[j * 4 + 0], x[j * 4 + 1]);
+			t[1] = _mm_unpacklo_epi32(x[j * 4 + 2], x[j * 4 + 3]);
+			t[2] = _mm_unpackhi_epi32(x[j * 4 + 0], x[j * 4 + 1]);
+			t[3] = _mm_unpackhi_epi32(x[j * 4 + 2], x[j * 4 + 3]);
+			x[j * 4 + 0] = _mm_unpacklo_epi64(t[0], t[1]);
+			x[j * 4 + 1] = _mm_unpackhi_epi64(t[0], t[1]);
+			x[j * 4 + 2] = _mm_unpacklo_epi64(t[2], t[3]);
+			x[j * 4 + 3] = _mm_unpackhi_epi64(t[2], t[3]);
+		}
+
+		hash_block(h, x);
+
+		for (l = 0; l < 4; l++) {
+			if (!lanes[l].input || ++lanes[l].next < lanes[l].total)
+				continue;
+
+			// This lane is done - pass its result back and start
+			// the next buffer in its place:
+			for (j = 0; j < 4; j++)
+				_mm_storeu_si128((__m128i*)state[j], h[j]);
+			for (j = 0; j < 4; j++) {
+				hashes[lanes[l].index][j] = state[j][l];
+				state[j][l] = hash_init[j];
+			}
+			if (next < count) {
+				i = order[next++];
+				start_hash_lane(&lanes[l], inputs[i], sizes[i], i);
+			} else {
+				lanes[l].input = NULL;
+				active--;
+			}
+			for (j = 0; j < 4; j++)
+				h[j] = _mm_loadu_si128((__m128i*)state[j]);
+		}
+	}
+
+	// Not worth keeping the other three lanes busy for one buffer:
+	for (j = 0; j < 4; j++)
+		_mm_storeu_si128((__m128i*)state[j], h[j]);
+	for (l = 0; l < 4; l++) {
+		if (!lanes[l].input)
+			continue;
+		DWORD s[4] = { state[0][l], state[1][l], state[2][l], state[3][l] };
+		for (; lanes[l].next < lanes[l].total; lanes[l].next++)
+			hash_block(s, hash_lane_block(&lanes[l]));
+		memcpy(hashes[lanes[l].index], s, 16);
+	}
+}
+
+// One instruction in the assembly text. This is usually a single line, but an
+// immediate constant buffer spans several:
+struct AsmStatement {
+	DWORD first_line;
+	DWORD last_line;
+};
+
+// Groups the lines into instructions the same way the assembler always has.
+// Everything before the shader model (the comments and signatures) and blank
+// lines are not part of any statement. s is just scratch space, passed in so
+// the caller's buffer can be reused.
+static void splitStatements(vector<AsmToken> *lines, vector<AsmStatement> *statements, string &s)
+{
+	bool codeStarted = false;
+	bool multiLine = false;
+	DWORD first = 0;
+
+	statements->clear();
+	for (DWORD i = 0; i < lines->size(); i++) {
+		s.assign((*lines)[i].ptr, (*lines)[i].len);
+		preprocessLine(s);
+		if (!codeStarted) {
+			if (s.size() > 0 && s[0] != ' ') {
+				codeStarted = true;
+				statements->push_back({i, i});
+			}
+		} else if (s.find("{ {") < s.size()) {
+			first = i;
+			multiLine = true;
+		} else if (s.find("} }") < s.size()) {
+			if (!multiLine)
+				first = i;
+			multiLine = false;
+			statements->push_back({first, i});
+		} else if (!multiLine && s.find_first_not_of(" ") != string::npos) {
+			statements->push_back({i, i});
+		}
+	}
+}
+
+static vector<DWORD> assembleStatement(vector<AsmToken> *lines, AsmStatement *statement,
+		AsmTokenArena *arena, string &s, string &s2)
+{
+	s.assign((*lines)[statement->first_line].ptr, (*lines)[statement->first_line].len);
+	preprocessLine(s);
+	if (statement->first_line == statement->last_line)
+		return assembleIns(s, arena);
+
+	s2 = s;
+	for (DWORD i = statement->first_line + 1; i <= statement->last_line; i++) {
+		s.assign((*lines)[i].ptr, (*lines)[i].len);
+		preprocessLine(s);
+		s2.append("\n");
+		s2.append(s);
+	}
+	return assembleIns(s2, arena);
+}
+
+// Must be called from within the catch block for the parse error
+static void handleParseError(AssemblerParseError &e, AsmStatement *statement,
 		vector<AssemblerParseError> *parse_errors)
 {
-	byte fourcc[4];
-	DWORD fHash[4];
-	DWORD one;
-	DWORD fSize;
+	e.line_no = statement->last_line + 1;
+	e.update_msg();
+
+	// Since we never used to warn about parse errors there may well be
+	// shaders with problems in the wild that happen to pass anyway (e.g.
+	// I've seen at least one example of someone including the ~~~~~~~~/
+	// line from the HLSL comment in an assembly shader).
+	//
+	// If the caller has passed somewhere to store the parse errors we will
+	// store them there so that they can display a warning, but we will
+	// continue parsing the rest of the shader as before. Otherwise we will
+	// throw an exception and stop parsing now.
+	if (!parse_errors)
+		throw;
+
+	parse_errors->push_back(e);
+}
+
+// Returns the SHEX or SHDR section of a shader binary, starting from the
+// section header, and optionally its index in the section table.
+static byte* findCodeChunk(vector<byte> *bytecode, DWORD *chunkIndex)
+{
 	DWORD numChunks;
-	vector<DWORD> chunkOffsets;
+	DWORD *chunkOffsets;
+	byte *chunk;
 
-	// TODO: Add robust error checking here (origBytecode is at least as large as
-	// the header, etc). I've added a check for numChunks < 1 as that
-	// would lead to codeByteStart being used uninitialised
-	byte* pPosition = origBytecode.data();
-	std::memcpy(fourcc, pPosition, 4);
-	pPosition += 4;
-	std::memcpy(fHash, pPosition, 16);
-	pPosition += 16;
-	one = *(DWORD*)pPosition;
-	pPosition += 4;
-	fSize = *(DWORD*)pPosition;
-	pPosition += 4;
-	numChunks = *(DWORD*)pPosition;
-	if (numChunks < 1)
+	if (bytecode->size() < 32)
 		throw std::invalid_argument("assembler: Bad shader binary");
-	pPosition += 4;
-	chunkOffsets.resize(numChunks);
-	std::memcpy(chunkOffsets.data(), pPosition, 4 * numChunks);
+	numChunks = *(DWORD*)(bytecode->data() + 28);
+	if (numChunks < 1 || bytecode->size() < 32 + 4 * (size_t)numChunks)
+		throw std::invalid_argument("assembler: Bad shader binary");
+	chunkOffsets = (DWORD*)(bytecode->data() + 32);
 
-	char* asmBuffer;
-	size_t asmSize;
-	asmBuffer = asmFile->data();
-	asmSize = asmFile->size();
-	byte* codeByteStart;
-	int codeChunk = 0;
 	for (DWORD i = 1; i <= numChunks; i++) {
-		codeChunk = numChunks - i;
-		codeByteStart = origBytecode.data() + chunkOffsets[numChunks - i];
-		if (memcmp(codeByteStart, "SHEX", 4) == 0 || memcmp(codeByteStart, "SHDR", 4) == 0)
-			break;
+		if (chunkOffsets[numChunks - i] > bytecode->size() - 8)
+			continue;
+		chunk = bytecode->data() + chunkOffsets[numChunks - i];
+		if (memcmp(chunk, "SHEX", 4) == 0 || memcmp(chunk, "SHDR", 4) == 0) {
+			if (chunkIndex)
+				*chunkIndex = numChunks - i;
+			return chunk;
+		}
 	}
-	// FIXME: If neither SHEX or SHDR was found in the shader, codeByteStart will be garbage
-	vector<string> lines = stringToLines(asmBuffer, asmSize);
-	DWORD* codeStart = (DWORD*)(codeByteStart + 8);
-	bool codeStarted = false;
-	bool multiLine = false;
-	string s2;
-	vector<DWORD> o;
-	for (DWORD i = 0; i < lines.size(); i++) {
-		try {
-			string s = lines[i];
-			preprocessLine(s);
-			vector<DWORD> v;
-			if (!codeStarted) {
-				if (s.size() > 0 && s[0] != ' ') {
-					codeStarted = true;
-					vector<DWORD> ins = assembleIns(s);
-					o.insert(o.end(), ins.begin(), ins.end());
-					o.push_back(0);
-				}
-			} else if (s.find("{ {") < s.size()) {
-				s2 = s;
-				multiLine = true;
-			} else if (s.find("} }") < s.size()) {
-				s2.append("\n");
-				s2.append(s);
-				s = s2;
-				multiLine = false;
-				vector<DWORD> ins = assembleIns(s);
-				o.insert(o.end(), ins.begin(), ins.end());
-			} else if (multiLine) {
-				s2.append("\n");
-				s2.append(s);
-			} else if (s.find_first_not_of(" ") != string::npos) {
-				vector<DWORD> ins = assembleIns(s);
-				o.insert(o.end(), ins.begin(), ins.end());
-			}
-		} catch (AssemblerParseError &e) {
-			e.line_no = i + 1;
-			e.update_msg();
-
-			// Since we never used to warn about parse errors there
-			// may well be shaders with problems in the wild that
-			// happen to pass anyway (e.g. I've seen at least one
-			// example of someone including the ~~~~~~~~/ line from
-			// the HLSL comment in an assembly shader).
-			//
-			// If the caller has passed somewhere to store the
-			// parse errors we will store them there so that they
-			// can display a warning, but we will continue parsing
-			// the rest of the shader as before. Otherwise we will
-			// throw an exception and stop parsing now.
-			if (!parse_errors)
-				throw;
-
-			parse_errors->push_back(e);
-		}
-	}
-	codeStart = (DWORD*)(codeByteStart); // Endian bug, not that we care
-	auto it = origBytecode.begin() + chunkOffsets[codeChunk] + 8;
+
+	throw std::invalid_argument("assembler: Shader binary has no SHEX or SHDR section");
+}
+
+// Replaces the contents of the code section with the assembled instructions,
+// fixing up the lengths, the offsets of any sections after it, and the
+// checksum.
+static void replaceCodeChunk(vector<byte> *bytecode, vector<DWORD> *o)
+{
+	DWORD codeChunk;
+	byte* codeByteStart = findCodeChunk(bytecode, &codeChunk);
+	DWORD* codeStart = (DWORD*)(codeByteStart); // Endian bug, not that we care
+	DWORD numChunks = *(DWORD*)(bytecode->data() + 28);
+	size_t codeOffset = codeByteStart - bytecode->data() + 8;
 	size_t codeSize = codeStart[1];
-	origBytecode.erase(it, it + codeSize);
-	size_t newCodeSize = 4 * o.size();
+	size_t newCodeSize = 4 * o->size();
+
+	(*o)[1] = (DWORD)o->size();
 	codeStart[1] = (DWORD)newCodeSize;
-	vector<byte> newCode(newCodeSize);
-	o[1] = (DWORD)o.size();
-	memcpy(newCode.data(), o.data(), newCodeSize);
-	it = origBytecode.begin() + chunkOffsets[codeChunk] + 8;
-	origBytecode.insert(it, newCode.begin(), newCode.end());
-	DWORD* dwordBuffer = (DWORD*)origBytecode.data();
+	bytecode->erase(bytecode->begin() + codeOffset, bytecode->begin() + codeOffset + codeSize);
+	bytecode->insert(bytecode->begin() + codeOffset, (byte*)o->data(), (byte*)o->data() + newCodeSize);
+
+	DWORD* dwordBuffer = (DWORD*)bytecode->data();
 	for (DWORD i = codeChunk + 1; i < numChunks; i++) {
 		dwordBuffer[8 + i] += (DWORD)(newCodeSize - codeSize);
 	}
-	dwordBuffer[6] = (DWORD)origBytecode.size();
-	vector<DWORD> hash = ComputeHash((byte const*)origBytecode.data() + 20, (DWORD)origBytecode.size() - 20);
-	dwordBuffer[1] = hash[0];
-	dwordBuffer[2] = hash[1];
-	dwordBuffer[3] = hash[2];
-	dwordBuffer[4] = hash[3];
+	dwordBuffer[6] = (DWORD)bytecode->size();
+	ComputeHash((byte const*)bytecode->data() + 20, (DWORD)bytecode->size() - 20, &dwordBuffer[1]);
+}
+
+// origByteCode is modified in this function, so passing it by value!
+// asmFile is not modified, so passing it by pointer -DarkStarSword
+vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode,
+		vector<AssemblerParseError> *parse_errors)
+{
+	AsmTokenArena arena;
+	vector<AsmStatement> statements;
+	string s, s2;
+	vector<DWORD> o;
+
+	// Check the binary is something we can work with before doing the
+	// work of assembling the shader:
+	findCodeChunk(&origBytecode, NULL);
+
+	tokenizeLines(asmFile->data(), asmFile->size(), &arena.lines);
+	splitStatements(&arena.lines, &statements, s);
+	for (DWORD i = 0; i < statements.size(); i++) {
+		try {
+			// Reuses the same strings for every line so they only
+			// allocate when a line is longer than any before it:
+			vector<DWORD> ins = assembleStatement(&arena.lines, &statements[i], &arena, s, s2);
+			o.insert(o.end(), ins.begin(), ins.end());
+			// The shader model is followed by the length of the
+			// shader, which replaceCodeChunk fills in:
+			if (i == 0)
+				o.push_back(0);
+		} catch (AssemblerParseError &e) {
+			handleParseError(e, &statements[i], parse_errors);
+		}
+	}
+	if (o.size() < 2)
+		throw std::invalid_argument("assembler: No shader model found");
+
+	replaceCodeChunk(&origBytecode, &o);
 	return origBytecode;
 }
+
+static bool statementsEqual(vector<AsmToken> *lines1, AsmStatement *s1,
+		vector<AsmToken> *lines2, AsmStatement *s2)
+{
+	DWORD n = s1->last_line - s1->first_line;
+
+	if (s2->last_line - s2->first_line != n)
+		return false;
+	for (DWORD i = 0; i <= n; i++) {
+		AsmToken *l1 = &(*lines1)[s1->first_line + i];
+		AsmToken *l2 = &(*lines2)[s2->first_line + i];
+		if (l1->len != l2->len || memcmp(l1->ptr, l2->ptr, l1->len))
+			return false;
+	}
+	return true;
+}
+
+static uint64_t hashStatement(vector<AsmToken> *lines, AsmStatement *statement)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+
+	for (DWORD i = statement->first_line; i <= statement->last_line; i++) {
+		AsmToken *line = &(*lines)[i];
+		for (size_t j = 0; j < line->len; j++) {
+			hash ^= (byte)line->ptr[j];
+			hash *= 0x100000001b3ULL;
+		}
+		hash ^= '\n';
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Finds where each instruction starts in the code section, so they can be
+// matched up with the statements in the disassembly. Returns false if the
+// token stream doesn't make sense, or has a different number of instructions
+// to the disassembly, which means we can't tell which tokens belong to which
+// line (e.g. the disassembler drops debug info custom data blocks).
+static bool splitInstructions(byte *codeChunk, size_t numStatements, vector<DWORD> *offsets)
+{
+	DWORD *code = (DWORD*)(codeChunk + 8);
+	DWORD codeSize = *(DWORD*)(codeChunk + 4) / 4;
+	DWORD pos, len;
+
+	if (codeSize < 2 || code[1] > codeSize)
+		return false;
+	codeSize = code[1];
+
+	offsets->clear();
+	offsets->push_back(0);
+	for (pos = 2; pos < codeSize; pos += len) {
+		offsets->push_back(pos);
+		// Custom data (immediate constant buffers and the like)
+		// stores its length in the next token:
+		if ((code[pos] & 0x7ff) == 0x35)
+			len = pos + 1 < codeSize ? code[pos + 1] : 0;
+		else
+			len = (code[pos] >> 24) & 0x7f;
+		if (!len || len > codeSize - pos)
+			return false;
+	}
+	offsets->push_back(codeSize);
+
+	return offsets->size() == numStatements + 1;
+}
+
+// Assembles a patched copy of a shader's disassembly, only encoding the
+// instructions that the patch changed and copying the rest from the original
+// binary. This is for ShaderRegex, where a typical patch touches a handful of
+// lines in a shader that may be thousands long. origAsmFile must be the
+// disassembly of origBytecode, and only the code section of origBytecode is
+// used - the result is otherwise built from origContainer, the same as the
+// origBytecode passed to assembler().
+//
+// Every declaration and instruction is encoded independently of the others,
+// so added declarations and a changed dcl_temps are handled the same as any
+// other line. If the shader model or anything above it (the signatures) has
+// changed, or the disassembly doesn't line up with the original binary, this
+// falls back to assembling the whole shader. reencoded is set to the number of
+// statements that were assembled, or -1 if it fell back.
+vector<byte> assemblerIncremental(vector<char> *asmFile, vector<char> *origAsmFile,
+		vector<byte> *origBytecode, vector<byte> origContainer,
+		vector<AssemblerParseError> *parse_errors, int *reencoded)
+{
+	AsmTokenArena arena;
+	vector<AsmToken> origLines;
+	vector<AsmStatement> statements, origStatements;
+	unordered_multimap<uint64_t, DWORD> origIndex;
+	vector<DWORD> offsets;
+	string s, s2;
+	vector<DWORD> o;
+	DWORD *origCode;
+	DWORD i, j, k;
+	int count = 0;
+
+	if (reencoded)
+		*reencoded = -1;
+
+	tokenizeLines(asmFile->data(), asmFile->size(), &arena.lines);
+	tokenizeLines(origAsmFile->data(), origAsmFile->size(), &origLines);
+	splitStatements(&arena.lines, &statements, s);
+	splitStatements(&origLines, &origStatements, s);
+
+	if (statements.empty() || origStatements.empty())
+		return assembler(asmFile, origContainer, parse_errors);
+
+	// Everything up to and including the shader model must be unchanged:
+	if (statements[0].first_line != origStatements[0].first_line)
+		return assembler(asmFile, origContainer, parse_errors);
+	for (i = 0; i <= statements[0].first_line; i++) {
+		if (arena.lines[i].len != origLines[i].len
+				|| memcmp(arena.lines[i].ptr, origLines[i].ptr, origLines[i].len))
+			return assembler(asmFile, origContainer, parse_errors);
+	}
+
+	origCode = (DWORD*)(findCodeChunk(origBytecode, NULL) + 8);
+	if (!splitInstructions((byte*)origCode - 8, origStatements.size(), &offsets))
+		return assembler(asmFile, origContainer, parse_errors);
+
+	// Shader model, followed by the length which replaceCodeChunk fills in:
+	o.reserve(offsets.back() + 64);
+	o.push_back(origCode[0]);
+	o.push_back(0);
+
+	// Walk the patched statements alongside the originals. Most will be
+	// the same as the next original one, but where they aren't we look
+	// them up by their text to step over any the patch inserted or
+	// deleted, and only assemble those that aren't in the original at all.
+	for (i = 1, j = 1; i < statements.size(); i++) {
+		if (j < origStatements.size() && statementsEqual(&arena.lines, &statements[i], &origLines, &origStatements[j])) {
+			k = j++;
+		} else {
+			// Only index the original once we need it, which is
+			// only once we reach the first change:
+			if (origIndex.empty()) {
+				origIndex.reserve(origStatements.size());
+				for (k = 1; k < origStatements.size(); k++)
+					origIndex.emplace(hashStatement(&origLines, &origStatements[k]), k);
+			}
+
+			// Prefer the first match at or after the current
+			// position, so an unchanged stretch keeps lining up:
+			k = 0;
+			auto range = origIndex.equal_range(hashStatement(&arena.lines, &statements[i]));
+			for (auto it = range.first; it != range.second; it++) {
+				if (!statementsEqual(&arena.lines, &statements[i], &origLines, &origStatements[it->second]))
+					continue;
+				if (!k || (it->second >= j && (k < j || it->second < k)))
+					k = it->second;
+			}
+			if (k >= j)
+				j = k + 1;
+		}
+
+		if (k) {
+			o.insert(o.end(), origCode + offsets[k], origCode + offsets[k + 1]);
+			continue;
+		}
+
+		try {
+			vector<DWORD> ins = assembleStatement(&arena.lines, &statements[i], &arena, s, s2);
+			o.insert(o.end(), ins.begin(), ins.end());
+			count++;
+		} catch (AssemblerParseError &e) {
+			handleParseError(e, &statements[i], parse_errors);
+		}
+	}
+
+	replaceCodeChunk(&origContainer, &o);
+	if (reencoded)
+		*reencoded = count;
+	return origContainer;
+}
 #if MIGOTO_DX == 9
 vector<byte> assemblerDX9(vector<char> *asmFile)
 {
@@ -0,0 +1,2396 @@
+#include "stdafx.h"
+
+#include <stdarg.h>
+#include <math.h>
+
+#include "log.h"
+#include "shader.h"
+
+#include "BinaryDecompiler\internal_includes\structs.h"
+#include "BinaryDecompiler\internal_includes\decode.h"
+
+// A disassembler for DXBC shader model 4 and 5 bytecode that doesn't need
+// d3dcompiler. The shader is decoded with the same BinaryDecompiler routines
+// the HLSL decompiler uses, and everything is written in the same format as
+// disassembler() - Microsoft's disassembler with our fixups applied - so the
+// output reassembles to the same shader with our assembler, and the RDEF
+// comment block is there for the HLSL decompiler, patch_cb_offsets and any
+// ShaderRegex patterns or ASM fixes that match against it.
+//
+// Microsoft's disassembler prints floats with %f, which our fixups replace
+// with enough digits to reproduce the exact value whenever that loses
+// precision. We do the same check up front, so literals come out the way
+// disassembler() would leave them.
+//
+// Anything we don't understand (shader model 5.1, shader messages, hexdumps)
+// makes the whole disassembly fail with E_FAIL, rather than producing
+// something that would reassemble to a different shader, and callers should
+// fall back to disassembler() in that case.
+
+// Lines are formatted in this fixed buffer before being passed on, so there
+// are no allocations per line. The longest lines are instructions with
+// several relative indexed operands and minimum precision tags, which are
+// still only a few hundred characters.
+#define NATIVE_ASM_MAX_LINE 1024
+
+// The maximum number of operands in any instruction. The most in any real
+// instruction is sample_d / gather4_po_c with 6 - this leaves some headroom.
+#define NATIVE_ASM_MAX_OPERANDS 8
+
+class NativeAsmWriter {
+	char line[NATIVE_ASM_MAX_LINE];
+	size_t len;
+
+	vector<byte> *out;
+	NativeAsmLineCallback callback;
+	void *context;
+
+	bool d3dcompiler_46_compat;
+	bool patch_cb_offsets;
+	int rdef_state;
+
+	// The same fixups disassembler() applies to the comment lines. These
+	// work on a string, but only comments are affected and only when the
+	// options are enabled, so most lines never take this path:
+	void patch_comment()
+	{
+		string s(line, len);
+
+		if (d3dcompiler_46_compat)
+			patch_d3dcompiler_47_rdef(&s, &rdef_state);
+		if (patch_cb_offsets)
+			replace_cb_offsets_with_indices(&s);
+
+		if (s.size() >= NATIVE_ASM_MAX_LINE) {
+			overflow = true;
+			return;
+		}
+		memcpy(line, s.data(), s.size());
+		len = s.size();
+	}
+
+public:
+	bool overflow;
+	bool disassemble_undecipherable_data;
+
+	// Scratch space for the decoded operands of the current instruction,
+	// reused for every instruction in the shader:
+	Operand operands[NATIVE_ASM_MAX_OPERANDS];
+
+	NativeAsmWriter(vector<byte> *out, NativeAsmLineCallback callback, void *context,
+			bool d3dcompiler_46_compat, bool disassemble_undecipherable_data,
+			bool patch_cb_offsets) :
+		len(0),
+		out(out),
+		callback(callback),
+		context(context),
+		d3dcompiler_46_compat(d3dcompiler_46_compat),
+		patch_cb_offsets(patch_cb_offsets),
+		rdef_state(0),
+		overflow(false),
+		disassemble_undecipherable_data(disassemble_undecipherable_data)
+	{}
+
+	void append(const char *str, size_t n)
+	{
+		if (len + n >= NATIVE_ASM_MAX_LINE) {
+			overflow = true;
+			return;
+		}
+		memcpy(line + len, str, n);
+		len += n;
+	}
+
+	void puts(const char *str)
+	{
+		append(str, strlen(str));
+	}
+
+	void printf(const char *fmt, ...)
+	{
+		va_list ap;
+		int ret;
+
+		va_start(ap, fmt);
+		ret = vsnprintf(line + len, NATIVE_ASM_MAX_LINE - len, fmt, ap);
+		va_end(ap);
+
+		if (ret < 0 || len + ret >= NATIVE_ASM_MAX_LINE) {
+			overflow = true;
+			line[len] = '\0';
+			return;
+		}
+		len += ret;
+	}
+
+	// Pads the line with spaces up to the given column, which the RDEF
+	// block uses to line up the offsets of each variable:
+	void pad_to(size_t column)
+	{
+		while (len < column && !overflow)
+			append(" ", 1);
+	}
+
+	void end_line()
+	{
+		if ((d3dcompiler_46_compat || patch_cb_offsets) && len >= 2 && !memcmp(line, "//", 2))
+			patch_comment();
+
+		if (callback) {
+			line[len] = '\0';
+			callback(line, len, context);
+		} else {
+			out->insert(out->end(), line, line + len);
+			out->push_back('\n');
+		}
+		len = 0;
+	}
+
+	void put_line(const char *str)
+	{
+		puts(str);
+		end_line();
+	}
+};
+
+static char *component_names = "xyzw";
+
+enum class LiteralType {
+	TYPELESS,
+	FLOAT,
+	INT,
+	UINT,
+};
+
+struct native_asm_opcode {
+	char *name;
+	LiteralType literal;
+};
+
+// Mnemonics and literal types for every opcode, indexed by opcode. Entries
+// with a NULL name are either declarations with their own formatting below,
+// or opcodes we don't support. The literal type decides how Microsoft's
+// disassembler would print any l() values in the instruction.
+static struct native_asm_opcode native_asm_opcodes[] = {
+	{ "add",                    LiteralType::FLOAT    }, // 0x00
+	{ "and",                    LiteralType::UINT     },
+	{ "break",                  LiteralType::UINT     },
+	{ "breakc",                 LiteralType::UINT     },
+	{ "call",                   LiteralType::UINT     },
+	{ "callc",                  LiteralType::UINT     },
+	{ "case",                   LiteralType::UINT     },
+	{ "continue",               LiteralType::UINT     },
+	{ "continuec",              LiteralType::UINT     }, // 0x08
+	{ "cut",                    LiteralType::UINT     },
+	{ "default",                LiteralType::UINT     },
+	{ "deriv_rtx",              LiteralType::FLOAT    },
+	{ "deriv_rty",              LiteralType::FLOAT    },
+	{ "discard",                LiteralType::UINT     },
+	{ "div",                    LiteralType::FLOAT    },
+	{ "dp2",                    LiteralType::FLOAT    },
+	{ "dp3",                    LiteralType::FLOAT    }, // 0x10
+	{ "dp4",                    LiteralType::FLOAT    },
+	{ "else",                   LiteralType::UINT     },
+	{ "emit",                   LiteralType::UINT     },
+	{ "emit_then_cut",          LiteralType::UINT     },
+	{ "endif",                  LiteralType::UINT     },
+	{ "endloop",                LiteralType::UINT     },
+	{ "endswitch",              LiteralType::UINT     },
+	{ "eq",                     LiteralType::FLOAT    }, // 0x18
+	{ "exp",                    LiteralType::FLOAT    },
+	{ "frc",                    LiteralType::FLOAT    },
+	{ "ftoi",                   LiteralType::FLOAT    },
+	{ "ftou",                   LiteralType::FLOAT    },
+	{ "ge",                     LiteralType::FLOAT    },
+	{ "iadd",                   LiteralType::INT      },
+	{ "if",                     LiteralType::UINT     },
+	{ "ieq",                    LiteralType::INT      }, // 0x20
+	{ "ige",                    LiteralType::INT      },
+	{ "ilt",                    LiteralType::INT      },
+	{ "imad",                   LiteralType::INT      },
+	{ "imax",                   LiteralType::INT      },
+	{ "imin",                   LiteralType::INT      },
+	{ "imul",                   LiteralType::INT      },
+	{ "ine",                    LiteralType::INT      },
+	{ "ineg",                   LiteralType::INT      }, // 0x28
+	{ "ishl",                   LiteralType::INT      },
+	{ "ishr",                   LiteralType::INT      },
+	{ "itof",                   LiteralType::INT      },
+	{ "label",                  LiteralType::UINT     },
+	{ "ld",                     LiteralType::INT      },
+	{ "ldms",                   LiteralType::INT      },
+	{ "log",                    LiteralType::FLOAT    },
+	{ "loop",                   LiteralType::UINT     }, // 0x30
+	{ "lt",                     LiteralType::FLOAT    },
+	{ "mad",                    LiteralType::FLOAT    },
+	{ "min",                    LiteralType::FLOAT    },
+	{ "max",                    LiteralType::FLOAT    },
+	{ NULL,                     LiteralType::UINT     }, // customdata
+	{ "mov",                    LiteralType::TYPELESS },
+	{ "movc",                   LiteralType::TYPELESS },
+	{ "mul",                    LiteralType::FLOAT    }, // 0x38
+	{ "ne",                     LiteralType::FLOAT    },
+	{ "nop",                    LiteralType::UINT     },
+	{ "not",                    LiteralType::UINT     },
+	{ "or",                     LiteralType::UINT     },
+	{ "resinfo",                LiteralType::INT      },
+	{ "ret",                    LiteralType::UINT     },
+	{ "retc",                   LiteralType::UINT     },
+	{ "round_ne",               LiteralType::FLOAT    }, // 0x40
+	{ "round_ni",               LiteralType::FLOAT    },
+	{ "round_pi",               LiteralType::FLOAT    },
+	{ "round_z",                LiteralType::FLOAT    },
+	{ "rsq",                    LiteralType::FLOAT    },
+	{ "sample",                 LiteralType::FLOAT    },
+	{ "sample_c",               LiteralType::FLOAT    },
+	{ "sample_c_lz",            LiteralType::FLOAT    },
+	{ "sample_l",               LiteralType::FLOAT    }, // 0x48
+	{ "sample_d",               LiteralType::FLOAT    },
+	{ "sample_b",               LiteralType::FLOAT    },
+	{ "sqrt",                   LiteralType::FLOAT    },
+	{ "switch",                 LiteralType::UINT     },
+	{ "sincos",                 LiteralType::FLOAT    },
+	{ "udiv",                   LiteralType::UINT     },
+	{ "ult",                    LiteralType::UINT     },
+	{ "uge",                    LiteralType::UINT     }, // 0x50
+	{ "umul",                   LiteralType::UINT     },
+	{ "umad",                   LiteralType::UINT     },
+	{ "umax",                   LiteralType::UINT     },
+	{ "umin",                   LiteralType::UINT     },
+	{ "ushr",                   LiteralType::UINT     },
+	{ "utof",                   LiteralType::UINT     },
+	{ "xor",                    LiteralType::UINT     },
+	{ NULL,                     LiteralType::UINT     }, // 0x58 dcl_resource
+	{ NULL,                     LiteralType::UINT     }, // dcl_constantbuffer
+	{ NULL,                     LiteralType::UINT     }, // dcl_sampler
+	{ NULL,                     LiteralType::UINT     }, // dcl_indexrange
+	{ NULL,                     LiteralType::UINT     }, // dcl_outputtopology
+	{ NULL,                     LiteralType::UINT     }, // dcl_inputprimitive
+	{ NULL,                     LiteralType::UINT     }, // dcl_maxout
+	{ NULL,                     LiteralType::UINT     }, // dcl_input
+	{ NULL,                     LiteralType::UINT     }, // 0x60 dcl_input_sgv
+	{ NULL,                     LiteralType::UINT     }, // dcl_input_siv
+	{ NULL,                     LiteralType::UINT     }, // dcl_input_ps
+	{ NULL,                     LiteralType::UINT     }, // dcl_input_ps_sgv
+	{ NULL,                     LiteralType::UINT     }, // dcl_input_ps_siv
+	{ NULL,                     LiteralType::UINT     }, // dcl_output
+	{ NULL,                     LiteralType::UINT     }, // dcl_output_sgv
+	{ NULL,                     LiteralType::UINT     }, // dcl_output_siv
+	{ NULL,                     LiteralType::UINT     }, // 0x68 dcl_temps
+	{ NULL,                     LiteralType::UINT     }, // dcl_indexableTemp
+	{ NULL,                     LiteralType::UINT     }, // dcl_globalFlags
+	{ NULL,                     LiteralType::UINT     }, // RESERVED_10
+	{ "lod",                    LiteralType::FLOAT    },
+	{ "gather4",                LiteralType::FLOAT    },
+	{ "samplepos",              LiteralType::INT      },
+	{ "sampleinfo",             LiteralType::INT      },
+	{ NULL,                     LiteralType::UINT     }, // 0x70 RESERVED_10_1
+	{ "hs_decls",               LiteralType::UINT     },
+	{ "hs_control_point_phase", LiteralType::UINT     },
+	{ "hs_fork_phase",          LiteralType::UINT     },
+	{ "hs_join_phase",          LiteralType::UINT     },
+	{ "emit_stream",            LiteralType::UINT     },
+	{ "cut_stream",             LiteralType::UINT     },
+	{ "emit_then_cut_stream",   LiteralType::UINT     },
+	{ "fcall",                  LiteralType::UINT     }, // 0x78
+	{ "bufinfo",                LiteralType::UINT     },
+	{ "deriv_rtx_coarse",       LiteralType::FLOAT    },
+	{ "deriv_rtx_fine",         LiteralType::FLOAT    },
+	{ "deriv_rty_coarse",       LiteralType::FLOAT    },
+	{ "deriv_rty_fine",         LiteralType::FLOAT    },
+	{ "gather4_c",              LiteralType::FLOAT    },
+	{ "gather4_po",             LiteralType::FLOAT    },
+	{ "gather4_po_c",           LiteralType::FLOAT    }, // 0x80
+	{ "rcp",                    LiteralType::FLOAT    },
+	{ "f32tof16",               LiteralType::FLOAT    },
+	{ "f16tof32",               LiteralType::UINT     },
+	{ "uaddc",                  LiteralType::UINT     },
+	{ "usubb",                  LiteralType::UINT     },
+	{ "countbits",              LiteralType::UINT     },
+	{ "firstbit_hi",            LiteralType::UINT     },
+	{ "firstbit_lo",            LiteralType::UINT     }, // 0x88
+	{ "firstbit_shi",           LiteralType::INT      },
+	{ "ubfe",                   LiteralType::UINT     },
+	{ "ibfe",                   LiteralType::INT      },
+	{ "bfi",                    LiteralType::UINT     },
+	{ "bfrev",                  LiteralType::UINT     },
+	{ "swapc",                  LiteralType::TYPELESS },
+	{ NULL,                     LiteralType::UINT     }, // dcl_stream
+	{ NULL,                     LiteralType::UINT     }, // 0x90 dcl_function_body
+	{ NULL,                     LiteralType::UINT     }, // dcl_function_table
+	{ NULL,                     LiteralType::UINT     }, // dcl_interface
+	{ NULL,                     LiteralType::UINT     }, // dcl_input_control_point_count
+	{ NULL,                     LiteralType::UINT     }, // dcl_output_control_point_count
+	{ NULL,                     LiteralType::UINT     }, // dcl_tessellator_domain
+	{ NULL,                     LiteralType::UINT     }, // dcl_tessellator_partitioning
+	{ NULL,                     LiteralType::UINT     }, // dcl_tessellator_output_primitive
+	{ NULL,                     LiteralType::UINT     }, // 0x98 dcl_hs_max_tessfactor
+	{ NULL,                     LiteralType::UINT     }, // dcl_hs_fork_phase_instance_count
+	{ NULL,                     LiteralType::UINT     }, // dcl_hs_join_phase_instance_count
+	{ NULL,                     LiteralType::UINT     }, // dcl_thread_group
+	{ NULL,                     LiteralType::UINT     }, // dcl_uav_typed
+	{ NULL,                     LiteralType::UINT     }, // dcl_uav_raw
+	{ NULL,                     LiteralType::UINT     }, // dcl_uav_structured
+	{ NULL,                     LiteralType::UINT     }, // dcl_tgsm_raw
+	{ NULL,                     LiteralType::UINT     }, // 0xa0 dcl_tgsm_structured
+	{ NULL,                     LiteralType::UINT     }, // dcl_resource_raw
+	{ NULL,                     LiteralType::UINT     }, // dcl_resource_structured
+	{ "ld_uav_typed",           LiteralType::UINT     },
+	{ "store_uav_typed",        LiteralType::UINT     },
+	{ "ld_raw",                 LiteralType::UINT     },
+	{ "store_raw",              LiteralType::UINT     },
+	{ "ld_structured",          LiteralType::UINT     },
+	{ "store_structured",       LiteralType::UINT     }, // 0xa8
+	{ "atomic_and",             LiteralType::UINT     },
+	{ "atomic_or",              LiteralType::UINT     },
+	{ "atomic_xor",             LiteralType::UINT     },
+	{ "atomic_cmp_store",       LiteralType::UINT     },
+	{ "atomic_iadd",            LiteralType::INT      },
+	{ "atomic_imax",            LiteralType::INT      },
+	{ "atomic_imin",            LiteralType::INT      },
+	{ "atomic_umax",            LiteralType::UINT     }, // 0xb0
+	{ "atomic_umin",            LiteralType::UINT     },
+	{ "imm_atomic_alloc",       LiteralType::UINT     },
+	{ "imm_atomic_consume",     LiteralType::UINT     },
+	{ "imm_atomic_iadd",        LiteralType::INT      },
+	{ "imm_atomic_and",         LiteralType::UINT     },
+	{ "imm_atomic_or",          LiteralType::UINT     },
+	{ "imm_atomic_xor",         LiteralType::UINT     },
+	{ "imm_atomic_exch",        LiteralType::UINT     }, // 0xb8
+	{ "imm_atomic_cmp_exch",    LiteralType::UINT     },
+	{ "imm_atomic_imax",        LiteralType::INT      },
+	{ "imm_atomic_imin",        LiteralType::INT      },
+	{ "imm_atomic_umax",        LiteralType::UINT     },
+	{ "imm_atomic_umin",        LiteralType::UINT     },
+	{ "sync",                   LiteralType::UINT     },
+	{ "dadd",                   LiteralType::UINT     },
+	{ "dmax",                   LiteralType::UINT     }, // 0xc0
+	{ "dmin",                   LiteralType::UINT     },
+	{ "dmul",                   LiteralType::UINT     },
+	{ "deq",                    LiteralType::UINT     },
+	{ "dge",                    LiteralType::UINT     },
+	{ "dlt",                    LiteralType::UINT     },
+	{ "dne",                    LiteralType::UINT     },
+	{ "dmov",                   LiteralType::UINT     },
+	{ "dmovc",                  LiteralType::UINT     }, // 0xc8
+	{ "dtof",                   LiteralType::UINT     },
+	{ "ftod",                   LiteralType::FLOAT    },
+	{ "eval_snapped",           LiteralType::FLOAT    },
+	{ "eval_sample_index",      LiteralType::FLOAT    },
+	{ "eval_centroid",          LiteralType::FLOAT    },
+	{ NULL,                     LiteralType::UINT     }, // dcl_gsinstances
+	{ "abort",                  LiteralType::UINT     },
+	{ "debug_break",            LiteralType::UINT     }, // 0xd0
+	{ NULL,                     LiteralType::UINT     }, // RESERVED_11
+	{ "ddiv",                   LiteralType::UINT     },
+	{ "dfma",                   LiteralType::UINT     },
+	{ "drcp",                   LiteralType::UINT     },
+	{ "msad",                   LiteralType::UINT     },
+	{ "dtoi",                   LiteralType::UINT     },
+	{ "dtou",                   LiteralType::UINT     },
+	{ "itod",                   LiteralType::INT      }, // 0xd8
+	{ "utod",                   LiteralType::UINT     },
+};
+
+struct native_asm_register {
+	char *name;
+
+	// Whether the first index goes in brackets (icb[0]) or is attached
+	// to the name (cb0[0]). Registers that are usually attached still
+	// use brackets if the first index is relative (o[r0.x + 1]):
+	bool bracket_first_index;
+};
+
+// Register names, indexed by operand type. Literals are handled separately,
+// and NULL entries are registers that never appear in an instruction.
+static struct native_asm_register native_asm_registers[] = {
+	{ "r",                         false }, // 0
+	{ "v",                         false },
+	{ "o",                         false },
+	{ "x",                         false },
+	{ NULL,                        false }, // l() - handled separately
+	{ NULL,                        false }, // d() - handled separately
+	{ "s",                         false },
+	{ "t",                         false },
+	{ "cb",                        false }, // 8
+	{ "icb",                       true  },
+	{ "l",                         false }, // label
+	{ "vPrim",                     false },
+	{ "oDepth",                    false },
+	{ "null",                      false },
+	{ "rasterizer",                false },
+	{ "oMask",                     false },
+	{ "m",                         false }, // 16
+	{ "fb",                        false }, // function body
+	{ "ft",                        false }, // function table
+	{ "fp",                        false }, // interface
+	{ NULL,                        false }, // function input
+	{ NULL,                        false }, // function output
+	{ "vOutputControlPointID",     false },
+	{ "vForkInstanceID",           false },
+	{ "vJoinInstanceID",           false }, // 24
+	{ "vicp",                      true  },
+	{ "vocp",                      true  },
+	{ "vpc",                       false },
+	{ "vDomain",                   false },
+	{ "this",                      true  },
+	{ "u",                         false },
+	{ "g",                         false },
+	{ "vThreadID",                 false }, // 32
+	{ "vThreadGroupID",            false },
+	{ "vThreadIDInGroup",          false },
+	{ "vCoverage",                 false },
+	{ "vThreadIDInGroupFlattened", false },
+	{ "vGSInstanceID",             false },
+	{ "oDepthGE",                  false },
+	{ "oDepthLE",                  false },
+	{ "vCycleCounter",             false }, // 40
+};
+
+static char *min_precision_names[] = {
+	"def32",
+	"min16f",
+	"min2_8f",
+	NULL,
+	"min16i",
+	"min16u",
+	NULL,
+	NULL,
+};
+
+static char *resource_dimension_names[] = {
+	NULL,
+	"buffer",
+	"texture1d",
+	"texture2d",
+	"texture2dms",
+	"texture3d",
+	"texturecube",
+	"texture1darray",
+	"texture2darray",
+	"texture2dmsarray",
+	"texturecubearray",
+	"raw_buffer",
+	"structured_buffer",
+};
+
+static char *return_type_names[] = {
+	NULL,
+	"unorm",
+	"snorm",
+	"sint",
+	"uint",
+	"float",
+	"mixed",
+	"double",
+	"<continued>",
+	"<unused>",
+};
+
+// System values used in the dcl_*_s?v declarations. Note that these are the
+// values from the bytecode, which differ from those in the signatures.
+static char *system_value_names[] = {
+	NULL,
+	"position",
+	"clip_distance",
+	"cull_distance",
+	"rendertarget_array_index",
+	"viewport_array_index",
+	"vertex_id",
+	"primitive_id",
+	"instance_id",
+	"is_front_face",
+	"sampleIndex",
+	"finalQuadUeq0EdgeTessFactor",
+	"finalQuadVeq0EdgeTessFactor",
+	"finalQuadUeq1EdgeTessFactor",
+	"finalQuadVeq1EdgeTessFactor",
+	"finalQuadUInsideTessFactor",
+	"finalQuadVInsideTessFactor",
+	"finalTriUeq0EdgeTessFactor",
+	"finalTriVeq0EdgeTessFactor",
+	"finalTriWeq0EdgeTessFactor",
+	"finalTriInsideTessFactor",
+	"finalLineDetailTessFactor",
+	"finalLineDensityTessFactor",
+};
+
+static char *interpolation_mode_names[] = {
+	NULL,
+	"constant",
+	"linear",
+	"linear centroid",
+	"linear noperspective",
+	"linear noperspective centroid",
+	"linear sample",
+	"linear noperspective sample",
+};
+
+static char *global_flag_names[] = {
+	"refactoringAllowed",
+	"enableDoublePrecisionFloatOps",
+	"forceEarlyDepthStencil",
+	"enableRawAndStructuredBuffers",
+	"skipOptimization",
+	"enableMinimumPrecision",
+	"enable11_1DoubleExtensions",
+	"enable11_1ShaderExtensions",
+	"allResourcesBound",
+};
+
+static char *output_topology_names[] = {
+	NULL,
+	"pointlist",
+	"linelist",
+	"linestrip",
+	"trianglelist",
+	"trianglestrip",
+};
+
+static char *input_primitive_names[] = {
+	NULL,
+	"point",
+	"line",
+	"triangle",
+	NULL,
+	NULL,
+	"lineadj",
+	"triangleadj",
+};
+
+static char *tessellator_domain_names[] = {
+	NULL,
+	"domain_isoline",
+	"domain_tri",
+	"domain_quad",
+};
+
+static char *tessellator_partitioning_names[] = {
+	NULL,
+	"partitioning_integer",
+	"partitioning_pow2",
+	"partitioning_fractional_odd",
+	"partitioning_fractional_even",
+};
+
+static char *tessellator_output_primitive_names[] = {
+	NULL,
+	"output_point",
+	"output_line",
+	"output_triangle_cw",
+	"output_triangle_ccw",
+};
+
+// Looks up a name in one of the above tables, returning NULL if the value is
+// out of range so the caller can bail on anything unexpected:
+#define LOOKUP_NAME(table, val) ((val) < ARRAYSIZE(table) ? (table)[val] : NULL)
+
+// Integers up to this magnitude are printed in decimal, and anything larger
+// in hex. Microsoft's disassembler switches somewhere between l(1023) and
+// l(0x0000ffff) going by the games in TestShaders, and 10000 is where other
+// disassemblers that mimic it switch:
+#define NATIVE_ASM_MAX_DECIMAL 10000
+
+// Formats a float the way disassembler() would for a float typed instruction.
+// Microsoft's disassembler always uses %f, and where that doesn't parse back
+// to the exact same bits our fixups replace it with convertF(), so we do the
+// same. Positive infinity comes out as 1.#INF00, which the assembler
+// understands, while NAN and negative infinity end up as hex:
+static void format_float_literal(NativeAsmWriter *w, uint32_t val)
+{
+	float f = reinterpret_cast<float &>(val);
+	char buf[64];
+
+	if (val == 0x7f800000) {
+		w->puts("1.#INF00");
+		return;
+	}
+	if (isnan(f) || isinf(f)) {
+		w->printf("0x%08x", val);
+		return;
+	}
+
+	sprintf_s(buf, 64, "%f", f);
+	float check = (float)atof(buf);
+	if (reinterpret_cast<uint32_t &>(check) == val)
+		w->puts(buf);
+	else
+		w->puts(convertF(val).c_str());
+}
+
+// Typeless instructions (mov, movc, swapc) and the immediate constant buffer
+// don't know whether a value is a float or an integer, so like Microsoft's
+// disassembler we guess - anything that looks like a normal float is printed
+// as one, small integers as decimal and everything else in hex.
+static void format_typeless_literal(NativeAsmWriter *w, uint32_t val)
+{
+	uint32_t exponent = (val >> 23) & 0xff;
+	int32_t i = (int32_t)val;
+
+	if (exponent != 0 && exponent != 0xff)
+		format_float_literal(w, val);
+	else if (i >= -NATIVE_ASM_MAX_DECIMAL && i <= NATIVE_ASM_MAX_DECIMAL)
+		w->printf("%d", i);
+	else if (val == 0x80000000)
+		w->puts("-0.000000");
+	else
+		w->printf("0x%08x", val);
+}
+
+static void format_literal(NativeAsmWriter *w, uint32_t val, LiteralType type)
+{
+	int32_t i = (int32_t)val;
+
+	switch (type) {
+	case LiteralType::FLOAT:
+		format_float_literal(w, val);
+		break;
+	case LiteralType::INT:
+		if (i >= -NATIVE_ASM_MAX_DECIMAL && i <= NATIVE_ASM_MAX_DECIMAL)
+			w->printf("%d", i);
+		else
+			w->printf("0x%08x", val);
+		break;
+	case LiteralType::UINT:
+		if (val <= NATIVE_ASM_MAX_DECIMAL)
+			w->printf("%u", val);
+		else
+			w->printf("0x%08x", val);
+		break;
+	default:
+		format_typeless_literal(w, val);
+		break;
+	}
+}
+
+static void format_double_literal(NativeAsmWriter *w, uint32_t lo, uint32_t hi)
+{
+	uint64_t q = (uint64_t)lo | ((uint64_t)hi << 32);
+	double d = reinterpret_cast<double &>(q);
+	char buf[400];
+
+	if (!isnan(d) && !isinf(d)) {
+		sprintf_s(buf, 400, "%fl", d);
+		double check = atof(buf);
+		if (reinterpret_cast<uint64_t &>(check) == q) {
+			w->puts(buf);
+			return;
+		}
+	}
+	w->puts(convertD(lo, hi).c_str());
+}
+
+static void free_sub_operands(Operand *op)
+{
+	int i;
+
+	for (i = 0; i < MAX_SUB_OPERANDS; i++) {
+		if (op->psSubOperand[i]) {
+			free_sub_operands(op->psSubOperand[i]);
+			delete op->psSubOperand[i];
+			op->psSubOperand[i] = NULL;
+		}
+	}
+}
+
+// Decodes an operand at tok, returning the number of tokens it used, or 0 if
+// it would run past the end of the instruction:
+static uint32_t decode_operand(const uint32_t *tok, const uint32_t *end, Operand *op)
+{
+	uint32_t len;
+
+	if (tok >= end)
+		return 0;
+
+	// DecodeOperand only sets the minimum precision if the operand has
+	// an extended token, so clear it from the previous instruction:
+	op->eMinPrecision = OPERAND_MIN_PRECISION_DEFAULT;
+	len = DecodeOperand(tok, op);
+	if (tok + len > end) {
+		free_sub_operands(op);
+		return 0;
+	}
+	return len;
+}
+
+static bool format_min_precision(NativeAsmWriter *w, uint32_t precision, uint32_t dest_precision, bool source)
+{
+	char *name = LOOKUP_NAME(min_precision_names, precision);
+	char *dest_name = LOOKUP_NAME(min_precision_names, dest_precision);
+
+	if (!name || !dest_name)
+		return false;
+
+	// Sources that differ from the destination are listed as a cast,
+	// e.g. "l(1.000000) {def32 as min16f}", which the assembler only
+	// uses the first half of:
+	if (source && precision != dest_precision)
+		w->printf(" {%s as %s}", name, dest_name);
+	else if (precision)
+		w->printf(" {%s}", name);
+	return true;
+}
+
+// Formats a register or literal operand. tok points at the operand's tokens,
+// and is only used to read literal values, so is NULL for relative indices.
+static bool format_operand(NativeAsmWriter *w, const Operand *op, const uint32_t *tok,
+		LiteralType literal, bool declaration, uint32_t dest_precision, bool source)
+{
+	const native_asm_register *reg;
+	const uint32_t *imm;
+	int i;
+
+	if (op->eModifier == OPERAND_MODIFIER_NEG || op->eModifier == OPERAND_MODIFIER_ABSNEG)
+		w->puts("-");
+	if (op->eModifier == OPERAND_MODIFIER_ABS || op->eModifier == OPERAND_MODIFIER_ABSNEG)
+		w->puts("|");
+
+	if (op->eType == OPERAND_TYPE_IMMEDIATE32) {
+		if (!tok)
+			return false;
+		imm = tok + 1 + op->iExtended;
+		w->puts("l(");
+		for (i = 0; i < op->iNumComponents; i++) {
+			if (i)
+				w->puts(literal == LiteralType::TYPELESS ? "," : ", ");
+			format_literal(w, imm[i], literal);
+		}
+		w->puts(")");
+	} else if (op->eType == OPERAND_TYPE_IMMEDIATE64) {
+		// Doubles take two components each, and the assembler only
+		// understands the four component form with two doubles:
+		if (!tok || op->iNumComponents != 4)
+			return false;
+		imm = tok + 1 + op->iExtended;
+		w->puts("d(");
+		format_double_literal(w, imm[0], imm[1]);
+		w->puts(", ");
+		format_double_literal(w, imm[2], imm[3]);
+		w->puts(")");
+	} else {
+		if (op->eType < 0 || op->eType >= ARRAYSIZE(native_asm_registers))
+			return false;
+		reg = &native_asm_registers[op->eType];
+		if (!reg->name)
+			return false;
+
+		w->puts(reg->name);
+		for (i = 0; i < op->iIndexDims; i++) {
+			// Two dimensional inputs (geometry shader v[vertex][reg])
+			// put both indices in brackets, as does anything
+			// where the first index is relative:
+			bool bracket = (i > 0 || reg->bracket_first_index
+					|| op->eIndexRep[0] != OPERAND_INDEX_IMMEDIATE32
+					|| (op->eType == OPERAND_TYPE_INPUT && op->iIndexDims > 1));
+			if (bracket)
+				w->puts("[");
+			switch (op->eIndexRep[i]) {
+			case OPERAND_INDEX_IMMEDIATE32:
+				w->printf("%u", op->aui32ArraySizes[i]);
+				break;
+			case OPERAND_INDEX_RELATIVE:
+			case OPERAND_INDEX_IMMEDIATE32_PLUS_RELATIVE:
+				if (!op->psSubOperand[i])
+					return false;
+				if (!format_operand(w, op->psSubOperand[i], NULL, literal, false, 0, false))
+					return false;
+				w->printf(" + %u", op->aui32ArraySizes[i]);
+				break;
+			default:
+				return false;
+			}
+			if (bracket)
+				w->puts("]");
+		}
+
+		if (op->iNumComponents == 4) {
+			switch (op->eSelMode) {
+			case OPERAND_4_COMPONENT_MASK_MODE:
+				if (op->ui32CompMask) {
+					w->puts(".");
+					for (i = 0; i < 4; i++) {
+						if (op->ui32CompMask & (OPERAND_4_COMPONENT_MASK_X << i))
+							w->append(component_names + i, 1);
+					}
+				}
+				break;
+			case OPERAND_4_COMPONENT_SWIZZLE_MODE:
+				// Declarations never list a swizzle:
+				if (!declaration) {
+					w->puts(".");
+					for (i = 0; i < 4; i++)
+						w->append(component_names + (op->aui32Swizzle[i] & 3), 1);
+				}
+				break;
+			case OPERAND_4_COMPONENT_SELECT_1_MODE:
+				w->puts(".");
+				w->append(component_names + (op->aui32Swizzle[0] & 3), 1);
+				break;
+			default:
+				return false;
+			}
+		}
+	}
+
+	if (!format_min_precision(w, op->eMinPrecision, dest_precision, source))
+		return false;
+
+	if (op->eModifier == OPERAND_MODIFIER_ABS || op->eModifier == OPERAND_MODIFIER_ABSNEG)
+		w->puts("|");
+
+	return true;
+}
+
+// Decodes and formats a declaration's single register operand, returning a
+// pointer to the token following it, or NULL on failure:
+static const uint32_t* format_declaration_operand(NativeAsmWriter *w, const uint32_t *tok, const uint32_t *end)
+{
+	Operand *op = &w->operands[0];
+	uint32_t len;
+	bool ok;
+
+	len = decode_operand(tok, end, op);
+	if (!len)
+		return NULL;
+
+	ok = format_operand(w, op, tok, LiteralType::UINT, true, 0, false);
+	free_sub_operands(op);
+	if (!ok)
+		return NULL;
+
+	return tok + len;
+}
+
+static bool format_return_type(NativeAsmWriter *w, uint32_t tok, bool extended)
+{
+	char *name;
+	uint32_t i;
+
+	w->puts("(");
+	for (i = 0; i < 4; i++) {
+		if (extended)
+			name = LOOKUP_NAME(return_type_names, DecodeExtendedResourceReturnType(i, tok));
+		else
+			name = LOOKUP_NAME(return_type_names, DecodeResourceReturnType(i, tok));
+		if (!name)
+			return false;
+		if (i)
+			w->puts(",");
+		w->puts(name);
+	}
+	w->puts(")");
+	return true;
+}
+
+// Immediate constant buffers are printed one row per line, the way
+// Microsoft's disassembler does, and the assembler puts them back together:
+static bool format_immediate_constant_buffer(NativeAsmWriter *w, const uint32_t *tok, uint32_t len)
+{
+	uint32_t rows, row, i;
+
+	if (len < 6 || (len - 2) % 4)
+		return false;
+	rows = (len - 2) / 4;
+
+	for (row = 0; row < rows; row++) {
+		if (row == 0)
+			w->puts("dcl_immediateConstantBuffer { { ");
+		else
+			w->puts("                              { ");
+		for (i = 0; i < 4; i++) {
+			if (i)
+				w->puts(", ");
+			format_typeless_literal(w, tok[2 + row * 4 + i]);
+		}
+		w->puts(row == rows - 1 ? "} }" : "},");
+		w->end_line();
+	}
+	return true;
+}
+
+// Formats any declaration that needs more than the generic formatting.
+// Returns 1 if handled, 0 if this is not a declaration, or -1 on failure.
+static int format_declaration(NativeAsmWriter *w, const uint32_t *tok, const uint32_t *end)
+{
+	OPCODE_TYPE opcode = DecodeOpcodeType(*tok);
+	const uint32_t *op_tok = tok + 1;
+	char *name;
+	uint32_t val, i;
+
+	// Declarations are never extended, so leave anything that is for
+	// format_instruction, which will reject it if it is a declaration:
+	if (DecodeIsOpcodeExtended(*tok))
+		return 0;
+
+	// A few of these have a trailing space to match Microsoft's
+	// disassembler (dcl_inputprimitive, dcl_outputtopology and
+	// dcl_resource_structured), in case anything is matching them:
+	switch (opcode) {
+	case OPCODE_DCL_RESOURCE:
+		name = LOOKUP_NAME(resource_dimension_names, DecodeResourceDimension(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_resource_%s", name);
+		val = DecodeResourceDimension(*tok);
+		if (val == RESOURCE_DIMENSION_TEXTURE2DMS || val == RESOURCE_DIMENSION_TEXTURE2DMSARRAY)
+			w->printf("(%u)", (*tok >> 16) & 0x7f);
+		w->puts(" ");
+		// The return type follows the operand, but is printed first:
+		{
+			Operand *op = &w->operands[0];
+			uint32_t len = decode_operand(op_tok, end, op);
+			bool ok;
+			if (!len || op_tok + len >= end)
+				return -1;
+			if (!format_return_type(w, op_tok[len], false))
+				return -1;
+			w->puts(" ");
+			ok = format_operand(w, op, op_tok, LiteralType::UINT, true, 0, false);
+			free_sub_operands(op);
+			if (!ok)
+				return -1;
+		}
+		break;
+	case OPCODE_DCL_UNORDERED_ACCESS_VIEW_TYPED:
+		name = LOOKUP_NAME(resource_dimension_names, DecodeResourceDimension(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_uav_typed_%s", name);
+		if (DecodeAccessCoherencyFlags(*tok))
+			w->puts("_glc");
+		w->puts(" ");
+		{
+			Operand *op = &w->operands[0];
+			uint32_t len = decode_operand(op_tok, end, op);
+			bool ok;
+			if (!len || op_tok + len >= end)
+				return -1;
+			if (!format_return_type(w, op_tok[len], false))
+				return -1;
+			w->puts(" ");
+			ok = format_operand(w, op, op_tok, LiteralType::UINT, true, 0, false);
+			free_sub_operands(op);
+			if (!ok)
+				return -1;
+		}
+		break;
+	case OPCODE_DCL_CONSTANT_BUFFER:
+		w->puts("dcl_constantbuffer ");
+		if (!format_declaration_operand(w, op_tok, end))
+			return -1;
+		w->puts((*tok & 0x800) ? ", dynamicIndexed" : ", immediateIndexed");
+		break;
+	case OPCODE_DCL_SAMPLER:
+		w->puts("dcl_sampler ");
+		if (!format_declaration_operand(w, op_tok, end))
+			return -1;
+		switch ((*tok >> 11) & 0xf) {
+		case 0:
+			w->puts(", mode_default");
+			break;
+		case 1:
+			w->puts(", mode_comparison");
+			break;
+		case 2:
+			w->puts(", mode_mono");
+			break;
+		default:
+			return -1;
+		}
+		break;
+	case OPCODE_DCL_INDEX_RANGE:
+		w->puts("dcl_indexrange ");
+		op_tok = format_declaration_operand(w, op_tok, end);
+		if (!op_tok || op_tok >= end)
+			return -1;
+		w->printf(" %u", *op_tok);
+		break;
+	case OPCODE_DCL_GS_OUTPUT_PRIMITIVE_TOPOLOGY:
+		name = LOOKUP_NAME(output_topology_names, DecodeGSOutputPrimitiveTopology(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_outputtopology %s ", name);
+		break;
+	case OPCODE_DCL_GS_INPUT_PRIMITIVE:
+		name = LOOKUP_NAME(input_primitive_names, DecodeGSInputPrimitive(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_inputprimitive %s ", name);
+		break;
+	case OPCODE_DCL_MAX_OUTPUT_VERTEX_COUNT:
+		if (op_tok >= end)
+			return -1;
+		w->printf("dcl_maxout %u", *op_tok);
+		break;
+	case OPCODE_DCL_INPUT:
+	case OPCODE_DCL_OUTPUT:
+		w->puts(opcode == OPCODE_DCL_INPUT ? "dcl_input " : "dcl_output ");
+		if (!format_declaration_operand(w, op_tok, end))
+			return -1;
+		break;
+	case OPCODE_DCL_INPUT_SGV:
+	case OPCODE_DCL_INPUT_SIV:
+	case OPCODE_DCL_INPUT_PS_SGV:
+	case OPCODE_DCL_INPUT_PS_SIV:
+	case OPCODE_DCL_OUTPUT_SGV:
+	case OPCODE_DCL_OUTPUT_SIV:
+	case OPCODE_DCL_INPUT_PS:
+		switch (opcode) {
+		case OPCODE_DCL_INPUT_SGV:    w->puts("dcl_input_sgv");    break;
+		case OPCODE_DCL_INPUT_SIV:    w->puts("dcl_input_siv");    break;
+		case OPCODE_DCL_INPUT_PS_SGV: w->puts("dcl_input_ps_sgv"); break;
+		case OPCODE_DCL_INPUT_PS_SIV: w->puts("dcl_input_ps_siv"); break;
+		case OPCODE_DCL_OUTPUT_SGV:   w->puts("dcl_output_sgv");   break;
+		case OPCODE_DCL_OUTPUT_SIV:   w->puts("dcl_output_siv");   break;
+		case OPCODE_DCL_INPUT_PS:     w->puts("dcl_input_ps");     break;
+		}
+		if (opcode == OPCODE_DCL_INPUT_PS || opcode == OPCODE_DCL_INPUT_PS_SGV || opcode == OPCODE_DCL_INPUT_PS_SIV) {
+			val = DecodeInterpolationMode(*tok);
+			if (val) {
+				name = LOOKUP_NAME(interpolation_mode_names, val);
+				if (!name)
+					return -1;
+				w->printf(" %s", name);
+			}
+		}
+		w->puts(" ");
+		op_tok = format_declaration_operand(w, op_tok, end);
+		if (!op_tok)
+			return -1;
+		if (opcode != OPCODE_DCL_INPUT_PS) {
+			if (op_tok >= end)
+				return -1;
+			name = LOOKUP_NAME(system_value_names, DecodeOperandSpecialName(*op_tok));
+			if (!name)
+				return -1;
+			w->printf(", %s", name);
+		}
+		break;
+	case OPCODE_DCL_TEMPS:
+		if (op_tok >= end)
+			return -1;
+		w->printf("dcl_temps %u", *op_tok);
+		break;
+	case OPCODE_DCL_INDEXABLE_TEMP:
+		if (op_tok + 3 > end)
+			return -1;
+		w->printf("dcl_indexableTemp x%u[%u], %u", op_tok[0], op_tok[1], op_tok[2]);
+		break;
+	case OPCODE_DCL_GLOBAL_FLAGS:
+		w->puts("dcl_globalFlags ");
+		val = DecodeGlobalFlags(*tok) >> 11;
+		for (i = 0; val; i++, val >>= 1) {
+			if (!(val & 1))
+				continue;
+			name = LOOKUP_NAME(global_flag_names, i);
+			if (!name)
+				return -1;
+			w->puts(name);
+			if (val > 1)
+				w->puts(" | ");
+		}
+		break;
+	case OPCODE_DCL_STREAM:
+		w->puts("dcl_stream ");
+		if (!format_declaration_operand(w, op_tok, end))
+			return -1;
+		break;
+	case OPCODE_DCL_INPUT_CONTROL_POINT_COUNT:
+		w->printf("dcl_input_control_point_count %u", DecodeOutputControlPointCount(*tok));
+		break;
+	case OPCODE_DCL_OUTPUT_CONTROL_POINT_COUNT:
+		w->printf("dcl_output_control_point_count %u", DecodeOutputControlPointCount(*tok));
+		break;
+	case OPCODE_DCL_TESS_DOMAIN:
+		name = LOOKUP_NAME(tessellator_domain_names, DecodeTessDomain(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_tessellator_domain %s", name);
+		break;
+	case OPCODE_DCL_TESS_PARTITIONING:
+		name = LOOKUP_NAME(tessellator_partitioning_names, DecodeTessPartitioning(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_tessellator_partitioning %s", name);
+		break;
+	case OPCODE_DCL_TESS_OUTPUT_PRIMITIVE:
+		name = LOOKUP_NAME(tessellator_output_primitive_names, DecodeTessOutPrim(*tok));
+		if (!name)
+			return -1;
+		w->printf("dcl_tessellator_output_primitive %s", name);
+		break;
+	case OPCODE_DCL_HS_MAX_TESSFACTOR:
+		if (op_tok >= end)
+			return -1;
+		w->puts("dcl_hs_max_tessfactor l(");
+		format_float_literal(w, *op_tok);
+		w->puts(")");
+		break;
+	case OPCODE_DCL_HS_FORK_PHASE_INSTANCE_COUNT:
+		if (op_tok >= end)
+			return -1;
+		w->printf("dcl_hs_fork_phase_instance_count %u", *op_tok);
+		break;
+	case OPCODE_DCL_HS_JOIN_PHASE_INSTANCE_COUNT:
+		if (op_tok >= end)
+			return -1;
+		w->printf("dcl_hs_join_phase_instance_count %u", *op_tok);
+		break;
+	case OPCODE_DCL_THREAD_GROUP:
+		if (op_tok + 3 > end)
+			return -1;
+		w->printf("dcl_thread_group %u, %u, %u", op_tok[0], op_tok[1], op_tok[2]);
+		break;
+	case OPCODE_DCL_UNORDERED_ACCESS_VIEW_RAW:
+	case OPCODE_DCL_UNORDERED_ACCESS_VIEW_STRUCTURED:
+		if (opcode == OPCODE_DCL_UNORDERED_ACCESS_VIEW_RAW)
+			w->puts("dcl_uav_raw");
+		else
+			w->puts("dcl_uav_structured");
+		if (DecodeAccessCoherencyFlags(*tok))
+			w->puts("_glc");
+		if (*tok & 0x00800000) // UAV has an order preserving counter
+			w->puts("_opc");
+		w->puts(" ");
+		op_tok = format_declaration_operand(w, op_tok, end);
+		if (!op_tok)
+			return -1;
+		if (opcode == OPCODE_DCL_UNORDERED_ACCESS_VIEW_STRUCTURED) {
+			if (op_tok >= end)
+				return -1;
+			w->printf(", %u", *op_tok);
+		}
+		break;
+	case OPCODE_DCL_THREAD_GROUP_SHARED_MEMORY_RAW:
+		w->puts("dcl_tgsm_raw ");
+		op_tok = format_declaration_operand(w, op_tok, end);
+		if (!op_tok || op_tok >= end)
+			return -1;
+		w->printf(", %u", *op_tok);
+		break;
+	case OPCODE_DCL_THREAD_GROUP_SHARED_MEMORY_STRUCTURED:
+		w->puts("dcl_tgsm_structured ");
+		op_tok = format_declaration_operand(w, op_tok, end);
+		if (!op_tok || op_tok + 2 > end)
+			return -1;
+		w->printf(", %u, %u", op_tok[0], op_tok[1]);
+		break;
+	case OPCODE_DCL_RESOURCE_RAW:
+		w->puts("dcl_resource_raw ");
+		if (!format_declaration_operand(w, op_tok, end))
+			return -1;
+		break;
+	case OPCODE_DCL_RESOURCE_STRUCTURED:
+		w->puts("dcl_resource_structured ");
+		op_tok = format_declaration_operand(w, op_tok, end);
+		if (!op_tok || op_tok >= end)
+			return -1;
+		w->printf(", %u ", *op_tok);
+		break;
+	case OPCODE_DCL_GS_INSTANCE_COUNT:
+		if (op_tok >= end)
+			return -1;
+		w->printf("dcl_gsinstances %u", *op_tok);
+		break;
+	case OPCODE_DCL_FUNCTION_BODY:
+		if (op_tok >= end)
+			return -1;
+		w->printf("dcl_function_body fb%u", *op_tok);
+		break;
+	case OPCODE_DCL_FUNCTION_TABLE:
+		// Table number, number of bodies, then the bodies:
+		if (op_tok + 2 > end || op_tok[1] > (uint32_t)(end - op_tok - 2))
+			return -1;
+		w->printf("dcl_function_table ft%u = {", op_tok[0]);
+		for (i = 0; i < op_tok[1]; i++)
+			w->printf(i ? ", fb%u" : "fb%u", op_tok[2 + i]);
+		w->puts("}");
+		break;
+	case OPCODE_DCL_INTERFACE:
+		// Interface number, number of call sites, then the number of
+		// tables in the low half and the array size in the high half,
+		// followed by the tables:
+		if (op_tok + 3 > end || (op_tok[2] & 0xffff) > (uint32_t)(end - op_tok - 3))
+			return -1;
+		w->puts((*tok & 0x800) ? "dcl_interface_dynamicindexed" : "dcl_interface");
+		w->printf(" fp%u[%u][%u] = {", op_tok[0], op_tok[2] >> 16, op_tok[1]);
+		for (i = 0; i < (op_tok[2] & 0xffff); i++)
+			w->printf(i ? ", ft%u" : "ft%u", op_tok[3 + i]);
+		w->puts("};");
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+static bool format_sync(NativeAsmWriter *w, uint32_t tok)
+{
+	uint32_t flags = DecodeSyncFlags(tok);
+
+	// The unordered access view group flag shares the bit the other
+	// instructions use for saturate, and the disassembler prints it as
+	// such (see parseSyncFlags in the assembler):
+	w->puts("sync");
+	if ((flags & SYNC_UNORDERED_ACCESS_VIEW_MEMORY_GROUP) && (flags & SYNC_UNORDERED_ACCESS_VIEW_MEMORY_GLOBAL))
+		w->puts("_sat_uglobal");
+	else if (flags & SYNC_UNORDERED_ACCESS_VIEW_MEMORY_GROUP)
+		w->puts("_sat_ugroup");
+	else if (flags & SYNC_UNORDERED_ACCESS_VIEW_MEMORY_GLOBAL)
+		w->puts("_uglobal");
+	if (flags & SYNC_THREAD_GROUP_SHARED_MEMORY)
+		w->puts("_g");
+	if (flags & SYNC_THREADS_IN_GROUP)
+		w->puts("_t");
+	return true;
+}
+
+static bool has_test_boolean(OPCODE_TYPE opcode)
+{
+	switch (opcode) {
+	case OPCODE_BREAKC:
+	case OPCODE_CALLC:
+	case OPCODE_CONTINUEC:
+	case OPCODE_IF:
+	case OPCODE_RETC:
+	case OPCODE_DISCARD:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Some instructions have a literal in one operand with a different type to
+// the rest of the instruction:
+static LiteralType operand_literal_type(OPCODE_TYPE opcode, LiteralType def, uint32_t operand, uint32_t num_operands)
+{
+	switch (opcode) {
+	case OPCODE_GATHER4_PO:
+	case OPCODE_GATHER4_PO_C:
+		if (operand == 2) // Offset
+			return LiteralType::INT;
+		break;
+	case OPCODE_EVAL_SNAPPED:
+	case OPCODE_EVAL_SAMPLE_INDEX:
+		if (operand == 2) // Offset / sample index
+			return LiteralType::INT;
+		break;
+	case OPCODE_STORE_RAW:
+	case OPCODE_STORE_STRUCTURED:
+	case OPCODE_STORE_UAV_TYPED:
+		if (operand == num_operands - 1) // Value being stored
+			return LiteralType::TYPELESS;
+		break;
+	}
+	return def;
+}
+
+static bool format_instruction(NativeAsmWriter *w, const uint32_t *tok, const uint32_t *end)
+{
+	OPCODE_TYPE opcode = DecodeOpcodeType(*tok);
+	const native_asm_opcode *info;
+	const uint32_t *op_tok[NATIVE_ASM_MAX_OPERANDS];
+	const uint32_t *pos = tok + 1;
+	uint32_t ext, num_operands = 0, max_operands = NATIVE_ASM_MAX_OPERANDS;
+	uint32_t dest_precision, precise, len, i;
+	bool have_aoffimmi = false, have_resource_dim = false, have_return_type = false;
+	uint32_t aoffimmi = 0, resource_dim_tok = 0, return_type_tok = 0, call_site = 0;
+	bool ok = true;
+
+	if ((uint32_t)opcode >= ARRAYSIZE(native_asm_opcodes))
+		return false;
+	info = &native_asm_opcodes[opcode];
+	if (!info->name)
+		return false;
+
+	if (DecodeIsOpcodeExtended(*tok)) {
+		do {
+			if (pos >= end)
+				return false;
+			ext = *pos++;
+			switch (DecodeExtendedOpcodeType(ext)) {
+			case EXTENDED_OPCODE_SAMPLE_CONTROLS:
+				have_aoffimmi = true;
+				aoffimmi = ext;
+				break;
+			case EXTENDED_OPCODE_RESOURCE_DIM:
+				have_resource_dim = true;
+				resource_dim_tok = ext;
+				break;
+			case EXTENDED_OPCODE_RESOURCE_RETURN_TYPE:
+				have_return_type = true;
+				return_type_tok = ext;
+				break;
+			default:
+				return false;
+			}
+		} while (DecodeIsOpcodeExtended(ext));
+	}
+
+	if (opcode == OPCODE_SYNC) {
+		format_sync(w, *tok);
+	} else {
+		w->puts(info->name);
+		if (has_test_boolean(opcode))
+			w->puts(DecodeInstrTestBool(*tok) == INSTRUCTION_TEST_NONZERO ? "_nz" : "_z");
+		if (DecodeInstructionSaturate(*tok))
+			w->puts("_sat");
+		if (have_aoffimmi)
+			w->puts("_aoffimmi");
+		if (have_resource_dim)
+			w->puts("_indexable");
+		if (have_aoffimmi) {
+			// Offsets are signed 4 bit integers:
+			w->printf("(%d,%d,%d)",
+				((int32_t)DecodeImmediateAddressOffset(IMMEDIATE_ADDRESS_OFFSET_U, aoffimmi) << 28) >> 28,
+				((int32_t)DecodeImmediateAddressOffset(IMMEDIATE_ADDRESS_OFFSET_V, aoffimmi) << 28) >> 28,
+				((int32_t)DecodeImmediateAddressOffset(IMMEDIATE_ADDRESS_OFFSET_W, aoffimmi) << 28) >> 28);
+		}
+		if (have_resource_dim) {
+			char *name = LOOKUP_NAME(resource_dimension_names, DecodeExtendedResourceDimension(resource_dim_tok));
+			if (!name)
+				return false;
+			if (DecodeExtendedResourceDimension(resource_dim_tok) == RESOURCE_DIMENSION_STRUCTURED_BUFFER)
+				w->printf("(%s, stride=%u)", name, (resource_dim_tok >> 11) & 0xfff);
+			else
+				w->printf("(%s)", name);
+		}
+		if (have_return_type && !format_return_type(w, return_type_tok, true))
+			return false;
+		if (opcode == OPCODE_RESINFO) {
+			switch (DecodeResInfoReturnType(*tok)) {
+			case RESINFO_INSTRUCTION_RETURN_RCPFLOAT:
+				w->puts("_rcpfloat");
+				break;
+			case RESINFO_INSTRUCTION_RETURN_UINT:
+				w->puts("_uint");
+				break;
+			}
+		}
+		if (opcode == OPCODE_SAMPLE_INFO && (*tok & 0x800))
+			w->puts("_uint");
+	}
+
+	precise = (*tok >> 19) & 0xf;
+	if (precise == 0xf) {
+		w->puts(" [precise]");
+	} else if (precise) {
+		w->puts(" [precise(");
+		for (i = 0; i < 4; i++) {
+			if (precise & (1 << i))
+				w->append(component_names + i, 1);
+		}
+		w->puts(")]");
+	}
+
+	// samplepos has an extra zero after its operands when used with a
+	// texture that the assembler adds back in:
+	if (opcode == OPCODE_SAMPLE_POS)
+		max_operands = 3;
+
+	// fcall has the call site before its interface operand, and prints
+	// it as a final index - fp0[array index][call site]:
+	if (opcode == OPCODE_INTERFACE_CALL) {
+		if (pos >= end)
+			return false;
+		call_site = *pos++;
+	}
+
+	while (pos < end && num_operands < max_operands) {
+		len = decode_operand(pos, end, &w->operands[num_operands]);
+		if (!len) {
+			ok = false;
+			break;
+		}
+		op_tok[num_operands++] = pos;
+		pos += len;
+	}
+	if (ok && pos < end && opcode != OPCODE_SAMPLE_POS)
+		ok = false;
+
+	dest_precision = num_operands ? w->operands[0].eMinPrecision : 0;
+	for (i = 0; ok && i < num_operands; i++) {
+		w->puts(i ? ", " : " ");
+		ok = format_operand(w, &w->operands[i], op_tok[i],
+				operand_literal_type(opcode, info->literal, i, num_operands),
+				false, dest_precision, i > 0);
+	}
+	if (ok && opcode == OPCODE_INTERFACE_CALL)
+		w->printf("[%u]", call_site);
+
+	// Microsoft's disassembler leaves a trailing space on instructions
+	// without any operands ("ret ", "endif "), which some existing ASM
+	// fixes and ShaderRegex patterns may depend on:
+	if (!num_operands && opcode != OPCODE_SYNC)
+		w->puts(" ");
+
+	for (i = 0; i < num_operands; i++)
+		free_sub_operands(&w->operands[i]);
+
+	return ok;
+}
+
+static bool format_shader_code(NativeAsmWriter *w, const uint32_t *code, uint32_t size)
+{
+	static char *shader_types[] = { "ps", "vs", "gs", "hs", "ds", "cs" };
+	const uint32_t *tok, *end, *ins_end;
+	OPCODE_TYPE opcode;
+	uint32_t len, indent = 0, i;
+	char *type;
+	int ret;
+
+	if (size < 8)
+		return false;
+	len = code[1];
+	if (len < 2 || len > size / 4)
+		return false;
+	end = code + len;
+
+	type = LOOKUP_NAME(shader_types, DecodeShaderType(code[0]));
+	if (!type)
+		return false;
+	w->printf("%s_%u_%u", type, DecodeProgramMajorVersion(code[0]), DecodeProgramMinorVersion(code[0]));
+	w->end_line();
+
+	for (tok = code + 2; tok < end; tok = ins_end) {
+		if (DecodeOpcodeType(*tok) == OPCODE_CUSTOMDATA) {
+			if (tok + 1 >= end)
+				return false;
+			len = tok[1];
+		} else {
+			len = DecodeInstructionLength(*tok);
+		}
+		if (!len || len > (uint32_t)(end - tok))
+			return false;
+		ins_end = tok + len;
+
+		if (DecodeOpcodeType(*tok) == OPCODE_CUSTOMDATA) {
+			switch (DecodeCustomDataClass(*tok)) {
+			case CUSTOMDATA_DCL_IMMEDIATE_CONSTANT_BUFFER:
+				if (!format_immediate_constant_buffer(w, tok, len))
+					return false;
+				break;
+			case CUSTOMDATA_COMMENT:
+			case CUSTOMDATA_DEBUGINFO:
+			case CUSTOMDATA_OPAQUE:
+				// Microsoft's disassembler prints these as
+				// "undecipherable custom data", which
+				// disassembler() either drops or follows with
+				// a hexdump the assembler can put back:
+				if (w->disassemble_undecipherable_data) {
+					w->puts("undecipherable custom data");
+					for (i = 0; i < len; i++)
+						w->printf(" %08x", tok[i]);
+					w->end_line();
+				}
+				break;
+			default:
+				// Shader messages (printf/errorf) need the
+				// format strings decoding - leave them to
+				// Microsoft's disassembler:
+				return false;
+			}
+			continue;
+		}
+
+		// Flow control is indented two spaces per level, the same
+		// as Microsoft's disassembler. Note that case and default
+		// are not indented any further than the switch body:
+		opcode = DecodeOpcodeType(*tok);
+		if (opcode == OPCODE_ELSE || opcode == OPCODE_ENDIF
+		 || opcode == OPCODE_ENDLOOP || opcode == OPCODE_ENDSWITCH) {
+			if (indent)
+				indent--;
+		}
+		for (i = 0; i < indent; i++)
+			w->puts("  ");
+		if (opcode == OPCODE_IF || opcode == OPCODE_ELSE
+		 || opcode == OPCODE_LOOP || opcode == OPCODE_SWITCH)
+			indent++;
+
+		ret = format_declaration(w, tok, ins_end);
+		if (ret < 0)
+			return false;
+		if (!ret && !format_instruction(w, tok, ins_end))
+			return false;
+		if (w->overflow)
+			return false;
+		w->end_line();
+	}
+
+	return true;
+}
+
+struct native_asm_spr {
+	uint32_t system_value;
+	char *semantic;
+	char *short_name;
+	char *reg;
+};
+
+// Semantics that use special purpose registers in the signatures, looked up
+// either by their system value, or by name for shaders that were assembled
+// from text, since the signature parser stores these with a system value of 0:
+static struct native_asm_spr native_asm_sprs[] = {
+	{ 65, "SV_Depth",             "DEPTH",      "oDepth"      },
+	{ 66, "SV_Coverage",          "COVERAGE",   "oMask"       },
+	{ 67, "SV_DepthGreaterEqual", "DEPTHGE",    "oDepthGE"    },
+	{ 68, "SV_DepthLessEqual",    "DEPTHLE",    "oDepthLE"    },
+	{ 69, "SV_StencilRef",        "STENCILREF", "oStencilRef" },
+	{ 70, "SV_InnerCoverage",     "INNERCOV",   "special"     },
+};
+
+static char *signature_system_values[] = {
+	"NONE",
+	"POS",
+	"CLIPDST",
+	"CULLDST",
+	"RTINDEX",
+	"VPINDEX",
+	"VERTID",
+	"PRIMID",
+	"INSTID",
+	"FFACE",
+	"SAMPLE",
+	"QUADEDGE",
+	"QUADINT",
+	"TRIEDGE",
+	"TRIINT",
+	"LINEDET",
+	"LINEDEN",
+};
+
+static char* signature_format_name(uint32_t format, uint32_t min_precision)
+{
+	static char *format_names[] = { "unknown", "uint", "int", "float" };
+
+	switch (min_precision) {
+	case 0:
+		return LOOKUP_NAME(format_names, format);
+	case 1:
+		return format == 3 ? "min16f" : NULL;
+	case 2:
+		return format == 3 ? "min2_8f" : NULL;
+	case 4:
+		return format == 2 ? "min16i" : NULL;
+	case 5:
+		return format == 1 ? "min16u" : NULL;
+	}
+	return NULL;
+}
+
+static void signature_mask(char buf[5], uint8_t mask)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		buf[i] = (mask & (1 << i)) ? component_names[i] : ' ';
+	buf[4] = '\0';
+}
+
+// Formats a signature section in the same layout that the signature parser
+// reads back in. invert_used should match what the parser uses for this
+// section, since the output signatures store the components that are never
+// written rather than those that are.
+static bool format_signature(NativeAsmWriter *w, const char *section, uint32_t section_size,
+		const char *title, const char *empty, bool invert_used)
+{
+	const struct sgn_header *header = (const struct sgn_header*)(section + sizeof(section_header));
+	uint32_t data_size = section_size - sizeof(section_header);
+	uint32_t entry_size, i;
+	bool streams = false;
+
+	if (!memcmp(section, "ISGN", 4) || !memcmp(section, "OSGN", 4) || !memcmp(section, "PCSG", 4))
+		entry_size = 24;
+	else if (!memcmp(section, "OSG5", 4))
+		entry_size = 28;
+	else
+		entry_size = 32;
+
+	if (data_size < sizeof(sgn_header) || header->unknown > data_size
+	 || header->num_entries > (data_size - header->unknown) / entry_size)
+		return false;
+
+	const char *entries = (const char*)header + header->unknown;
+	for (i = 0; i < header->num_entries; i++) {
+		if (entry_size > 24 && *(uint32_t*)(entries + i * entry_size))
+			streams = true;
+	}
+
+	w->put_line("//");
+	w->printf("// %s signature:", title);
+	w->end_line();
+	w->put_line("//");
+	w->put_line("// Name                 Index   Mask Register SysValue  Format   Used");
+	w->put_line("// -------------------- ----- ------ -------- -------- ------- ------");
+
+	if (!header->num_entries) {
+		w->printf("// no %s", empty);
+		w->end_line();
+		return true;
+	}
+
+	for (i = 0; i < header->num_entries; i++) {
+		const char *entry = entries + i * entry_size;
+		const struct sgn_entry_serialiased *sgn;
+		uint32_t stream = 0, min_precision = 0;
+		char name[80], reg[16], mask[5], used[5];
+		const char *semantic, *sv = NULL, *format;
+		uint8_t used_mask;
+		size_t name_len;
+
+		if (entry_size > 24) {
+			stream = *(uint32_t*)entry;
+			sgn = (const struct sgn_entry_serialiased*)(entry + 4);
+		} else {
+			sgn = (const struct sgn_entry_serialiased*)entry;
+		}
+		if (entry_size == 32)
+			min_precision = *(uint32_t*)(entry + 28);
+
+		if (sgn->name_offset >= data_size)
+			return false;
+		semantic = (const char*)header + sgn->name_offset;
+		name_len = strnlen(semantic, data_size - sgn->name_offset);
+		if (name_len == data_size - sgn->name_offset || name_len > 63)
+			return false;
+
+		if (streams)
+			sprintf_s(name, 80, "m%u:%s", stream, semantic);
+		else
+			sprintf_s(name, 80, "%s", semantic);
+
+		format = signature_format_name(sgn->common.format, min_precision);
+		if (!format)
+			return false;
+
+		used_mask = sgn->common.used;
+		if (invert_used)
+			used_mask ^= 0xf;
+
+		if (sgn->common.reg == 0xffffffff) {
+			// Special purpose registers list N/A for the mask and
+			// YES/NO for whether they are used
+			for (const native_asm_spr &spr : native_asm_sprs) {
+				if (sgn->common.system_value == spr.system_value
+				 || (!sgn->common.system_value && !_stricmp(semantic, spr.semantic))) {
+					sv = spr.short_name;
+					strcpy_s(reg, 16, spr.reg);
+					break;
+				}
+			}
+			if (!sv && sgn->common.system_value == 7) {
+				sv = "PRIMID";
+				strcpy_s(reg, 16, "primID");
+			}
+			if (!sv)
+				return false;
+			strcpy_s(mask, 5, "N/A");
+			strcpy_s(used, 5, (used_mask & 0xf) ? "YES" : "NO");
+		} else {
+			if (!sgn->common.system_value && !_stricmp(semantic, "SV_Target"))
+				sv = "TARGET";
+			else
+				sv = LOOKUP_NAME(signature_system_values, sgn->common.system_value);
+			if (!sv)
+				return false;
+			sprintf_s(reg, 16, "%u", sgn->common.reg);
+			signature_mask(mask, sgn->common.mask);
+			signature_mask(used, used_mask);
+		}
+
+		w->printf("// %-20s %5u %6s %8s %8s %7s %6s", name, sgn->common.semantic_index,
+				mask, reg, sv, format, used);
+		w->end_line();
+	}
+
+	w->put_line("//");
+	return true;
+}
+
+// The RDEF section describes the constant buffers and resource bindings,
+// which Microsoft's disassembler prints in a comment block ahead of the
+// signatures. All offsets in the section are relative to the start of its
+// data, and the sizes of each structure come from the RD11 header in shader
+// model 5, or are fixed in shader model 4:
+struct native_asm_rdef {
+	const char *data;
+	uint32_t size;
+	uint32_t cbuffer_size;
+	uint32_t binding_size;
+	uint32_t var_size;
+	uint32_t type_size;
+	uint32_t member_size;
+};
+
+// Structures can be nested, but not this deep in any real shader, and this
+// stops a crafted shader from recursing forever:
+#define NATIVE_ASM_MAX_STRUCT_DEPTH 16
+
+static const uint32_t* rdef_dwords(const native_asm_rdef *r, uint32_t offset, uint32_t count)
+{
+	if (offset > r->size || count > (r->size - offset) / 4)
+		return NULL;
+	return (const uint32_t*)(r->data + offset);
+}
+
+static const char* rdef_string(const native_asm_rdef *r, uint32_t offset)
+{
+	size_t len;
+
+	if (offset >= r->size)
+		return NULL;
+	len = strnlen(r->data + offset, r->size - offset);
+	if (len == r->size - offset || len > 255)
+		return NULL;
+	return r->data + offset;
+}
+
+struct native_asm_var_type {
+	uint32_t type;
+	char *name;
+};
+
+static struct native_asm_var_type native_asm_var_types[] = {
+	{  1, "bool"       },
+	{  2, "int"        },
+	{  3, "float"      },
+	{ 19, "uint"       },
+	{ 39, "double"     },
+	{ 57, "min8float"  },
+	{ 58, "min10float" },
+	{ 59, "min16float" },
+	{ 60, "min12int"   },
+	{ 61, "min16int"   },
+	{ 62, "min16uint"  },
+};
+
+// Writes the type of a variable the way it was declared in HLSL, e.g.
+// "row_major float4x4", "struct Name" or "interface iName". Shader model 5
+// stores the type name, but for scalars, vectors and matrices that may be a
+// typedef ("dword", "Matrix44", ...) and Microsoft's disassembler always
+// prints the underlying type, so we build those from the numeric type. Shader
+// model 4 structures have no name and are left anonymous:
+static bool rdef_type_decl(const native_asm_rdef *r, const uint32_t *type, char *buf, size_t size)
+{
+	uint32_t var_class = type[0] & 0xffff, var_type = type[0] >> 16;
+	uint32_t rows = type[1] & 0xffff, cols = type[1] >> 16;
+	const char *name = NULL, *base = NULL;
+
+	if (r->type_size >= 36 && type[8]) {
+		name = rdef_string(r, type[8]);
+		if (!name)
+			return false;
+	}
+
+	switch (var_class) {
+	case 0: // Scalar
+	case 1: // Vector
+	case 2: // Row major matrix
+	case 3: // Column major matrix
+		for (const native_asm_var_type &t : native_asm_var_types) {
+			if (t.type == var_type)
+				base = t.name;
+		}
+		if (!base)
+			return false;
+		if (var_class == 0)
+			sprintf_s(buf, size, "%s", base);
+		else if (var_class == 1)
+			sprintf_s(buf, size, "%s%u", base, cols);
+		else
+			sprintf_s(buf, size, "%s%s%ux%u", var_class == 2 ? "row_major " : "", base, rows, cols);
+		return true;
+	case 5: // Struct
+		sprintf_s(buf, size, "struct%s%s", name ? " " : "", name ? name : "");
+		return true;
+	case 6: // Interface class
+		if (!name)
+			return false;
+		sprintf_s(buf, size, "class %s", name);
+		return true;
+	case 7: // Interface pointer
+		if (!name)
+			return false;
+		sprintf_s(buf, size, "interface %s", name);
+		return true;
+	default:
+		// Objects only turn up in shader model 5 classes, which
+		// always have the type name:
+		if (!name)
+			return false;
+		sprintf_s(buf, size, "%s", name);
+		return true;
+	}
+}
+
+// Formats one variable, recursing into any structure members. Members of a
+// structure only show their offset from the start of the constant buffer,
+// while top level variables also show their size and whether they are used:
+static bool format_rdef_variable(NativeAsmWriter *w, const native_asm_rdef *r, const char *name,
+		uint32_t type_offset, uint32_t offset, uint32_t depth, bool first, const uint32_t *var)
+{
+	const uint32_t *type = rdef_dwords(r, type_offset, r->type_size / 4);
+	const uint32_t *members;
+	const char *member_name;
+	size_t indent = 2 + 3 + 4 * depth;
+	uint32_t elements, num_members, i;
+	char decl[300];
+
+	if (!type || depth > NATIVE_ASM_MAX_STRUCT_DEPTH)
+		return false;
+	if (!rdef_type_decl(r, type, decl, sizeof(decl)))
+		return false;
+	elements = type[2] & 0xffff;
+	num_members = type[2] >> 16;
+
+	if (num_members) {
+		if (num_members > r->size / r->member_size)
+			return false;
+		members = rdef_dwords(r, type[3], num_members * r->member_size / 4);
+		if (!members)
+			return false;
+
+		if (!first) {
+			w->puts("//");
+			w->pad_to(indent);
+			w->end_line();
+		}
+		w->puts("//");
+		w->pad_to(indent);
+		w->puts(decl);
+		w->end_line();
+		w->puts("//");
+		w->pad_to(indent);
+		w->puts("{");
+		w->end_line();
+		w->puts("//");
+		w->pad_to(indent + 4);
+		w->end_line();
+
+		for (i = 0; i < num_members; i++) {
+			const uint32_t *member = members + i * r->member_size / 4;
+			member_name = rdef_string(r, member[0]);
+			if (!member_name)
+				return false;
+			if (!format_rdef_variable(w, r, member_name, member[1], offset + member[2],
+						depth + 1, i == 0, NULL))
+				return false;
+		}
+
+		w->put_line("//");
+		w->puts("//");
+		w->pad_to(indent);
+		w->printf("} %s", name);
+	} else {
+		w->puts("//");
+		w->pad_to(indent);
+		w->printf("%s %s", decl, name);
+	}
+
+	if (elements)
+		w->printf("[%u]", elements);
+	w->puts(";");
+	w->pad_to(40);
+	w->printf("// Offset: %4u", offset);
+	if (var) {
+		w->printf(" Size: %5u", var[2]);
+		if (!(var[3] & 2))
+			w->puts(" [unused]");
+	}
+	w->end_line();
+	return true;
+}
+
+// Default values are printed as hex dwords, four to a line:
+static bool format_rdef_default_value(NativeAsmWriter *w, const native_asm_rdef *r, const uint32_t *var)
+{
+	const uint32_t *val = rdef_dwords(r, var[5], var[2] / 4);
+	uint32_t i;
+
+	if (!val)
+		return false;
+
+	for (i = 0; i < var[2] / 4; i++) {
+		if (i % 4 == 0)
+			w->puts(i ? "//        " : "//      = ");
+		w->printf("0x%08x ", val[i]);
+		if (i % 4 == 3 || i == var[2] / 4 - 1)
+			w->end_line();
+	}
+	return true;
+}
+
+static bool format_rdef_cbuffer(NativeAsmWriter *w, const native_asm_rdef *r, const uint32_t *cb)
+{
+	const char *name = rdef_string(r, cb[0]);
+	const uint32_t *vars, *var;
+	const char *var_name;
+	uint32_t i;
+
+	if (!name || cb[1] > r->size / r->var_size)
+		return false;
+	vars = rdef_dwords(r, cb[2], cb[1] * r->var_size / 4);
+	if (!vars)
+		return false;
+
+	switch (cb[5]) {
+	case 0: // cbuffer
+	case 2: // Interface pointers ($ThisPointer)
+		w->printf("// cbuffer %s", name);
+		break;
+	case 1:
+		w->printf("// tbuffer %s", name);
+		break;
+	case 3:
+		w->printf("// Resource bind info for %s", name);
+		break;
+	default:
+		return false;
+	}
+	w->end_line();
+	w->put_line("// {");
+	w->put_line("//");
+
+	for (i = 0; i < cb[1]; i++) {
+		var = vars + i * r->var_size / 4;
+		var_name = rdef_string(r, var[0]);
+		if (!var_name)
+			return false;
+		if (!format_rdef_variable(w, r, var_name, var[4], var[1], 0, i == 0, var))
+			return false;
+		if (var[5] && !format_rdef_default_value(w, r, var))
+			return false;
+	}
+
+	w->put_line("//");
+	w->put_line("// }");
+	w->put_line("//");
+	return true;
+}
+
+static char *rdef_dimension_names[] = {
+	NULL,
+	"buf",
+	"1d",
+	"1darray",
+	"2d",
+	"2darray",
+	"2dMS",
+	"2darrayMS",
+	"3d",
+	"cube",
+	"cubearray",
+};
+
+struct native_asm_binding_type {
+	char *type;
+	char *format;
+	char *dim;
+	char *bind;
+};
+
+// Indexed by the shader input type. Typed textures and UAVs take the format
+// and dimension from the binding instead:
+static struct native_asm_binding_type native_asm_binding_types[] = {
+	{ "cbuffer", "NA",     "NA",      "cb" },
+	{ "tbuffer", "NA",     "NA",      "t"  },
+	{ "texture", NULL,     NULL,      "t"  },
+	{ "sampler", "NA",     "NA",      "s"  },
+	{ "UAV",     NULL,     NULL,      "u"  },
+	{ "texture", "struct", "r/o",     "t"  },
+	{ "UAV",     "struct", "r/w",     "u"  },
+	{ "texture", "byte",   "r/o",     "t"  },
+	{ "UAV",     "byte",   "r/w",     "u"  },
+	{ "UAV",     "struct", "append",  "u"  },
+	{ "UAV",     "struct", "consume", "u"  },
+	{ "UAV",     "struct", "r/w+cnt", "u"  },
+};
+
+static bool format_rdef_bindings(NativeAsmWriter *w, const native_asm_rdef *r, const uint32_t *bindings, uint32_t count)
+{
+	char format[16], dim[16], bind[16];
+	const char *name, *type, *return_type, *dim_name;
+	uint32_t i;
+
+	w->put_line("//");
+	w->put_line("// Resource Bindings:");
+	w->put_line("//");
+	w->put_line("// Name                                 Type  Format         Dim      HLSL Bind  Count");
+	w->put_line("// ------------------------------ ---------- ------- ----------- -------------- ------");
+
+	for (i = 0; i < count; i++) {
+		const uint32_t *binding = bindings + i * r->binding_size / 4;
+		const native_asm_binding_type *t;
+
+		// Name, type, return type, dimension, samples/stride, bind
+		// point, bind count, flags:
+		name = rdef_string(r, binding[0]);
+		if (!name || binding[1] >= ARRAYSIZE(native_asm_binding_types))
+			return false;
+		t = &native_asm_binding_types[binding[1]];
+		type = t->type;
+		if (binding[1] == 3 && (binding[7] & 2))
+			type = "sampler_c";
+
+		if (t->format) {
+			strcpy_s(format, 16, t->format);
+			strcpy_s(dim, 16, t->dim);
+		} else {
+			return_type = LOOKUP_NAME(return_type_names, binding[2]);
+			dim_name = LOOKUP_NAME(rdef_dimension_names, binding[3]);
+			if (!return_type || !dim_name || binding[2] > 7)
+				return false;
+			if ((binding[7] >> 2) & 3)
+				sprintf_s(format, 16, "%s%u", return_type, ((binding[7] >> 2) & 3) + 1);
+			else
+				strcpy_s(format, 16, return_type);
+			if ((binding[3] == 6 || binding[3] == 7) && binding[4] && binding[4] != 0xffffffff)
+				sprintf_s(dim, 16, "%s%u", dim_name, binding[4]);
+			else
+				strcpy_s(dim, 16, dim_name);
+		}
+		sprintf_s(bind, 16, "%s%u", t->bind, binding[5]);
+
+		w->printf("// %-30s %10s %7s %11s %14s %6u ", name, type, format, dim, bind, binding[6]);
+		w->end_line();
+	}
+
+	w->put_line("//");
+	return true;
+}
+
+// Shaders using class linkage have an IFCE section listing the classes and
+// the interface slots, which is printed after the resource bindings:
+static bool format_interfaces(NativeAsmWriter *w, const char *section, uint32_t section_size)
+{
+	const char *data = section + sizeof(section_header);
+	uint32_t size = section_size - sizeof(section_header);
+	const uint32_t *header = (const uint32_t*)data;
+	uint32_t num_instances, num_types, num_slot_records, num_slots, types_offset, slots_offset;
+	uint32_t i, j, start_slot = 0;
+	char span[16];
+
+	if (size < 28)
+		return false;
+	num_instances = header[0];
+	num_types = header[1];
+	num_slot_records = header[2];
+	num_slots = header[3];
+	types_offset = header[5];
+	slots_offset = header[6];
+
+	if (types_offset > size || num_types > (size - types_offset) / 12
+	 || num_instances > (size - types_offset - num_types * 12) / 16
+	 || slots_offset > size || num_slot_records > (size - slots_offset) / 16)
+		return false;
+
+	w->put_line("//");
+	w->put_line("// Available Class Types:");
+	w->put_line("//");
+	w->put_line("// Name                             ID CB Stride Texture Sampler");
+	w->put_line("// ------------------------------ ---- --------- ------- -------");
+	for (i = 0; i < num_types; i++) {
+		const char *type = data + types_offset + i * 12;
+		const uint16_t *fields = (const uint16_t*)(type + 4);
+		uint32_t name_offset = *(const uint32_t*)type;
+
+		if (name_offset >= size || strnlen(data + name_offset, size - name_offset) > 255)
+			return false;
+		w->printf("// %-30s %4u %9u %7u %7u", data + name_offset, i, fields[1], fields[2], fields[3]);
+		w->end_line();
+	}
+	w->put_line("//");
+
+	if (num_instances) {
+		w->put_line("// Available Class Instances:");
+		w->put_line("//");
+		w->put_line("// Name                        Type CB CB Offset Texture Sampler");
+		w->put_line("// --------------------------- ---- -- --------- ------- -------");
+		for (i = 0; i < num_instances; i++) {
+			const char *instance = data + types_offset + num_types * 12 + i * 16;
+			const uint16_t *fields = (const uint16_t*)(instance + 4);
+			uint32_t name_offset = *(const uint32_t*)instance;
+
+			if (name_offset >= size || strnlen(data + name_offset, size - name_offset) > 255)
+				return false;
+			w->printf("// %-27s %4u %2u %9u %7u %7u", data + name_offset,
+					fields[0], fields[2], fields[3], fields[4], fields[5]);
+			w->end_line();
+		}
+		w->put_line("//");
+	}
+
+	w->printf("// Interface slots, %u total:", num_slots);
+	w->end_line();
+	w->put_line("//");
+	w->put_line("//             Slots");
+	w->put_line("// +----------+---------+---------------------------------------");
+	for (i = 0; i < num_slot_records; i++) {
+		const uint32_t *slot = (const uint32_t*)(data + slots_offset + i * 16);
+		const uint16_t *type_ids;
+		const uint32_t *table_ids;
+
+		// Slot span, number of types, offset of the 16bit type
+		// IDs and offset of the 32bit table IDs:
+		if (slot[2] > size || slot[1] > (size - slot[2]) / 2
+		 || slot[3] > size || slot[1] > (size - slot[3]) / 4 || !slot[0])
+			return false;
+		type_ids = (const uint16_t*)(data + slot[2]);
+		table_ids = (const uint32_t*)(data + slot[3]);
+
+		if (slot[0] > 1)
+			sprintf_s(span, 16, "-%u", start_slot + slot[0] - 1);
+		else
+			span[0] = '\0';
+		w->printf("// | Type ID  |%4u%-5s|", start_slot, span);
+		for (j = 0; j < slot[1]; j++)
+			w->printf("%-5u", type_ids[j]);
+		w->end_line();
+		w->put_line("// |          |         |");
+		w->puts("// | Table ID |         |");
+		for (j = 0; j < slot[1]; j++)
+			w->printf("%-5u", table_ids[j]);
+		w->end_line();
+		w->put_line("// +----------+---------+---------------------------------------");
+
+		start_slot += slot[0];
+	}
+
+	return true;
+}
+
+// Formats the RDEF comment block, and the class linkage information if the
+// shader has any. Shader model 5.1 has a different layout with register
+// spaces that we don't handle:
+static bool format_rdef(NativeAsmWriter *w, const char *section, uint32_t section_size,
+		const char *ifce, uint32_t ifce_size)
+{
+	native_asm_rdef r;
+	const uint32_t *header, *cbuffers, *bindings;
+	uint32_t i;
+
+	r.data = section + sizeof(section_header);
+	r.size = section_size - sizeof(section_header);
+	r.cbuffer_size = 24;
+	r.binding_size = 32;
+	r.var_size = 24;
+	r.type_size = 16;
+	r.member_size = 12;
+
+	header = rdef_dwords(&r, 0, 7);
+	if (!header)
+		return false;
+	if ((header[4] & 0xffff) > 0x500)
+		return false;
+	if (rdef_dwords(&r, 0, 15) && !memcmp(&header[7], "RD11", 4)) {
+		if (header[9] < 24 || header[10] != 32 || header[11] < 24
+		 || header[12] < 16 || header[13] < 12)
+			return false;
+		r.cbuffer_size = header[9];
+		r.var_size = header[11];
+		r.type_size = header[12];
+		r.member_size = header[13];
+	}
+
+	if (header[0] > r.size / r.cbuffer_size || header[2] > r.size / r.binding_size)
+		return false;
+	cbuffers = rdef_dwords(&r, header[1], header[0] * r.cbuffer_size / 4);
+	bindings = rdef_dwords(&r, header[3], header[2] * r.binding_size / 4);
+	if (!cbuffers || !bindings)
+		return false;
+
+	if (header[0]) {
+		w->put_line("//");
+		w->put_line("// Buffer Definitions: ");
+		w->put_line("//");
+		for (i = 0; i < header[0]; i++) {
+			if (!format_rdef_cbuffer(w, &r, cbuffers + i * r.cbuffer_size / 4))
+				return false;
+		}
+	}
+
+	if (header[2] && !format_rdef_bindings(w, &r, bindings, header[2]))
+		return false;
+
+	if (ifce && !format_interfaces(w, ifce, ifce_size))
+		return false;
+
+	w->put_line("//");
+	return !w->overflow;
+}
+
+static HRESULT disassemble_native(vector<byte> *buffer, NativeAsmWriter *w, const char *comment)
+{
+	const struct dxbc_header *header = (const struct dxbc_header*)buffer->data();
+	const uint32_t *offsets;
+	const char *shex = NULL, *stat = NULL, *sfi0 = NULL, *rdef = NULL, *ifce = NULL;
+	uint32_t shex_size = 0, stat_size = 0, sfi0_size = 0, rdef_size = 0, ifce_size = 0;
+	const char *creator = "3Dmigoto's native disassembler";
+	uint64_t sfi = 0;
+	bool hull_shader = false;
+	uint32_t i;
+
+	if (buffer->size() < sizeof(struct dxbc_header)
+	 || memcmp(header->signature, "DXBC", 4)
+	 || header->num_sections > (buffer->size() - sizeof(struct dxbc_header)) / 4)
+		return E_FAIL;
+
+	// Validate all the sections and find the ones we need up front, since
+	// the signatures need to know what type of shader this is:
+	offsets = (const uint32_t*)(buffer->data() + sizeof(struct dxbc_header));
+	for (i = 0; i < header->num_sections; i++) {
+		const struct section_header *section;
+
+		if (offsets[i] > buffer->size() - sizeof(struct section_header))
+			return E_FAIL;
+		section = (const struct section_header*)(buffer->data() + offsets[i]);
+		if (section->size > buffer->size() - offsets[i] - sizeof(struct section_header))
+			return E_FAIL;
+
+		if (!memcmp(section->signature, "SHEX", 4) || !memcmp(section->signature, "SHDR", 4)) {
+			shex = (const char*)section;
+			shex_size = section->size;
+		} else if (!memcmp(section->signature, "STAT", 4)) {
+			stat = (const char*)section;
+			stat_size = section->size;
+		} else if (!memcmp(section->signature, "SFI0", 4)) {
+			sfi0 = (const char*)section;
+			sfi0_size = section->size;
+		} else if (!memcmp(section->signature, "RDEF", 4)) {
+			rdef = (const char*)section;
+			rdef_size = section->size + sizeof(struct section_header);
+		} else if (!memcmp(section->signature, "IFCE", 4)) {
+			ifce = (const char*)section;
+			ifce_size = section->size + sizeof(struct section_header);
+		}
+	}
+	if (!shex || shex_size < 8)
+		return E_FAIL;
+	hull_shader = (DecodeShaderType(*(uint32_t*)(shex + 8)) == HULL_SHADER);
+	if (sfi0 && sfi0_size >= 8)
+		memcpy(&sfi, sfi0 + 8, sizeof(sfi));
+
+	// Like Microsoft's disassembler we credit the compiler named in the
+	// RDEF section, or ourselves if the shader has been stripped:
+	if (rdef && rdef_size >= sizeof(struct section_header) + 28) {
+		uint32_t creator_offset = *(uint32_t*)(rdef + sizeof(struct section_header) + 24);
+		uint32_t data_size = rdef_size - sizeof(struct section_header);
+		const char *str = rdef + sizeof(struct section_header) + creator_offset;
+		if (creator_offset && creator_offset < data_size) {
+			size_t len = strnlen(str, data_size - creator_offset);
+			if (len < data_size - creator_offset && len < 256)
+				creator = str;
+		}
+	}
+
+	w->put_line("//");
+	w->printf("// Generated by %s", creator);
+	w->end_line();
+	w->put_line("//");
+	if (comment) {
+		// The comment may span multiple lines, and should already
+		// include the comment markers and a trailing "//" line:
+		const char *line = comment, *nl;
+		while (*line) {
+			nl = strchr(line, '\n');
+			if (!nl) {
+				w->put_line(line);
+				break;
+			}
+			w->append(line, nl - line);
+			w->end_line();
+			line = nl + 1;
+		}
+	}
+
+	if (sfi) {
+		w->put_line("//");
+		w->put_line("// Note: shader requires additional functionality:");
+		for (i = 0; i < 64; i++) {
+			const char *feature = (sfi & (1ULL << i)) ? subshader_feature_comment(i) : NULL;
+			if (feature) {
+				w->printf("//       %s", feature);
+				w->end_line();
+			}
+		}
+		w->put_line("//");
+	}
+
+	if (rdef && !format_rdef(w, rdef, rdef_size, ifce, ifce_size))
+		return E_FAIL;
+
+	// Shader model 4 shaders in an SHEX section need a hint for the
+	// signature parser, or it will put them back in an SHDR section:
+	if (!memcmp(shex, "SHEX", 4) && DecodeProgramMajorVersion(*(uint32_t*)(shex + 8)) < 5)
+		w->put_line("// Note: SHADER WILL ONLY WORK WITH THE DEBUG SDK LAYER ENABLED.");
+
+	// Signatures are printed in the order they appear in the shader:
+	for (i = 0; i < header->num_sections; i++) {
+		const char *section = (const char*)buffer->data() + offsets[i];
+		uint32_t size = ((const struct section_header*)section)->size + sizeof(struct section_header);
+		bool ok = true;
+
+		if (!memcmp(section, "ISGN", 4) || !memcmp(section, "ISG1", 4))
+			ok = format_signature(w, section, size, "Input", "Input", false);
+		else if (!memcmp(section, "OSGN", 4) || !memcmp(section, "OSG5", 4) || !memcmp(section, "OSG1", 4))
+			ok = format_signature(w, section, size, "Output", "Output", true);
+		else if (!memcmp(section, "PCSG", 4) || !memcmp(section, "PSG1", 4))
+			ok = format_signature(w, section, size, "Patch Constant", "Patch Constant", hull_shader);
+		if (!ok)
+			return E_FAIL;
+	}
+
+	if (!format_shader_code(w, (const uint32_t*)(shex + 8), shex_size))
+		return E_FAIL;
+
+	if (stat && stat_size >= 4) {
+		w->printf("// Approximately %u instruction slots used", *(uint32_t*)(stat + 8));
+		w->end_line();
+	}
+
+	if (w->overflow)
+		return E_FAIL;
+	return S_OK;
+}
+
+// Disassembles the shader into ret, in the same format as disassembler().
+// The output buffer is sized up front from the size of the bytecode, so it
+// should rarely need to grow.
+HRESULT disassemblerNative(vector<byte> *buffer, vector<byte> *ret, const char *comment,
+		bool d3dcompiler_46_compat, bool disassemble_undecipherable_data,
+		bool patch_cb_offsets)
+{
+	NativeAsmWriter *w = new NativeAsmWriter(ret, NULL, NULL, d3dcompiler_46_compat,
+			disassemble_undecipherable_data, patch_cb_offsets);
+	HRESULT hr;
+
+	ret->clear();
+	ret->reserve(buffer->size() * 3 + 4096);
+
+	hr = disassemble_native(buffer, w, comment);
+	delete w;
+
+	if (FAILED(hr))
+		ret->clear();
+	return hr;
+}
+
+// Streaming variant that passes each line to the callback as soon as it has
+// been formatted, without building the whole disassembly in memory. Note that
+// if this fails part way through the callback will already have been passed
+// the lines before the failure.
+HRESULT disassemblerNative(vector<byte> *buffer, NativeAsmLineCallback callback, void *context,
+		const char *comment, bool d3dcompiler_46_compat,
+		bool disassemble_undecipherable_data, bool patch_cb_offsets)
+{
+	NativeAsmWriter *w = new NativeAsmWriter(NULL, callback, context, d3dcompiler_46_compat,
+			disassemble_undecipherable_data, patch_cb_offsets);
+	HRESULT hr;
+
+	hr = disassemble_native(buffer, w, comment);
+	delete w;
+
+	return hr;
+}
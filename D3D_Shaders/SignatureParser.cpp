@@ -489,6 +489,15 @@ static char *subshader_feature_comments[] = {
 	"Shading Rate"
 };
 
+// Returns the comment the disassembler lists for a Subshader Feature Info
+// bit, or NULL if we don't know what it is:
+const char* subshader_feature_comment(unsigned bit)
+{
+	if (bit >= ARRAYSIZE(subshader_feature_comments))
+		return NULL;
+	return subshader_feature_comments[bit];
+}
+
 // Parses the globalFlags in the bytecode to derive Subshader Feature Info.
 // This is incomplete, as some of the SFI flags are not in globalFlags, but
 // must be found from the "shader requires" comment block instead.
@@ -759,6 +768,29 @@ HRESULT AssembleFluganWithSignatureParsing(vector<char> *assembly, vector<byte>
 
 	return S_OK;
 }
+
+// As above, but for a patched version of orig_assembly, which must be the
+// disassembly of orig_bytecode. Instructions the patch did not touch are
+// copied from orig_bytecode instead of being assembled again, which is a lot
+// faster for ShaderRegex, where patches are usually only a few lines.
+HRESULT AssembleFluganIncrementalWithSignatureParsing(vector<char> *assembly,
+		vector<char> *orig_assembly, vector<byte> *orig_bytecode,
+		vector<byte> *result_bytecode, vector<AssemblerParseError> *parse_errors,
+		int *reencoded)
+{
+	vector<byte> manufactured_bytecode;
+	HRESULT hr;
+
+	hr = manufacture_shader_binary(assembly->data(), assembly->size(), &manufactured_bytecode);
+	if (FAILED(hr))
+		return E_FAIL;
+
+	*result_bytecode = assemblerIncremental(assembly, orig_assembly, orig_bytecode,
+			manufactured_bytecode, parse_errors, reencoded);
+
+	return S_OK;
+}
+
 vector<byte> AssembleFluganWithOptionalSignatureParsing(vector<char> *assembly,
 		bool assemble_signatures, vector<byte> *orig_bytecode,
 		vector<AssemblerParseError> *parse_errors)
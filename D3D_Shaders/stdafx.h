@@ -83,14 +83,54 @@ struct token_operand
 	};
 };
 
+// A line or operand in the assembly text being assembled, pointing into the
+// original buffer rather than holding a copy. Would be std::string_view if we
+// were building as C++17.
+struct AsmToken {
+	const char *ptr;
+	size_t len;
+};
+
+// Scratch space for the assembler's tokenizer. The assembler reuses one of
+// these for every line in the shader, so that once it has grown to fit the
+// longest instruction splitting the rest doesn't need to allocate.
+struct AsmTokenArena {
+	vector<AsmToken> lines;
+	vector<AsmToken> tokens;
+	vector<string> words;
+};
+
+void tokenizeLines(const char* start, size_t size, vector<AsmToken> *lines);
 vector<string> stringToLines(const char* start, size_t size);
 HRESULT disassembler(vector<byte> *buffer, vector<byte> *ret, const char *comment,
 		int hexdump = 0, bool d3dcompiler_46_compat = false,
 		bool disassemble_undecipherable_data = false,
 		bool patch_cb_offsets = false);
 HRESULT disassemblerDX9(vector<byte> *buffer, vector<byte> *ret, const char *comment);
+// Same output as disassembler() without going through d3dcompiler. Returns
+// E_FAIL for anything it can't handle (see NativeDisassembler.cpp), in which
+// case the caller should fall back to disassembler():
+typedef void (*NativeAsmLineCallback)(const char *line, size_t len, void *context);
+HRESULT disassemblerNative(vector<byte> *buffer, vector<byte> *ret, const char *comment,
+		bool d3dcompiler_46_compat = false,
+		bool disassemble_undecipherable_data = false,
+		bool patch_cb_offsets = false);
+HRESULT disassemblerNative(vector<byte> *buffer, NativeAsmLineCallback callback, void *context,
+		const char *comment, bool d3dcompiler_46_compat = false,
+		bool disassemble_undecipherable_data = false,
+		bool patch_cb_offsets = false);
+void patch_d3dcompiler_47_rdef(string *line, int *rdef_state);
+void replace_cb_offsets_with_indices(string *line);
+string convertF(DWORD original);
+string convertD(DWORD v1, DWORD v2);
+const char* subshader_feature_comment(unsigned bit);
 vector<byte> assembler(vector<char> *asmFile, vector<byte> origBytecode, vector<AssemblerParseError> *parse_errors = NULL);
+vector<byte> assemblerIncremental(vector<char> *asmFile, vector<char> *origAsmFile, vector<byte> *origBytecode, vector<byte> origContainer, vector<AssemblerParseError> *parse_errors = NULL, int *reencoded = NULL);
 vector<byte> assemblerDX9(vector<char> *asmFile);
 void writeLUT();
+void ComputeHash(byte const* input, DWORD size, DWORD hash[4]);
+vector<DWORD> ComputeHash(byte const* input, DWORD size);
+void ComputeHashes(byte const* const* inputs, const DWORD *sizes, size_t count, DWORD (*hashes)[4]);
 HRESULT AssembleFluganWithSignatureParsing(vector<char> *assembly, vector<byte> *result_bytecode, vector<AssemblerParseError> *parse_errors = NULL);
+HRESULT AssembleFluganIncrementalWithSignatureParsing(vector<char> *assembly, vector<char> *orig_assembly, vector<byte> *orig_bytecode, vector<byte> *result_bytecode, vector<AssemblerParseError> *parse_errors = NULL, int *reencoded = NULL);
 vector<byte> AssembleFluganWithOptionalSignatureParsing(vector<char> *assembly, bool assemble_signatures, vector<byte> *orig_bytecode, vector<AssemblerParseError> *parse_errors = NULL);
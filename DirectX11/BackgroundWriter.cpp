@@ -0,0 +1,215 @@
+// Include before util.h (or any header that includes util.h) to get pretty
+// version of EnterCriticalSection:
+#include "lock.h"
+
+#include "BackgroundWriter.h"
+#include "globals.h"
+#include "log.h"
+#include "util.h"
+
+#include <list>
+#include <unordered_map>
+
+// Once this much is waiting to be written whoever is adding to the queue will
+// wait for the background thread to catch up. This is counted in bytes since
+// the cost is dominated by the size of the files, but a limit on the number of
+// jobs covers any that are cheap to queue but expensive to run (disassembly):
+#define MAX_BACKGROUND_BYTES (64 * 1024 * 1024)
+#define MAX_BACKGROUND_JOBS 1024
+
+struct BackgroundJob
+{
+	std::wstring key;
+	size_t size;
+	std::function<void()> job;
+};
+
+typedef std::list<BackgroundJob> BackgroundQueue;
+
+static CRITICAL_SECTION background_lock;
+static CONDITION_VARIABLE background_work_available;
+static CONDITION_VARIABLE background_space_available;
+static BackgroundQueue background_queue;
+static std::unordered_map<std::wstring, BackgroundQueue::iterator> background_keys;
+static HANDLE background_thread;
+static bool background_thread_failed;
+
+// Key of the job the background thread is running, if any, so that we can
+// say which file was cut short if we are unloaded in the middle of it.
+static std::wstring background_in_flight;
+
+void init_background_writer()
+{
+	InitializeCriticalSectionPretty(&background_lock);
+	InitializeConditionVariable(&background_work_available);
+	InitializeConditionVariable(&background_space_available);
+}
+
+static void pop_background_job(BackgroundJob *job)
+{
+	*job = std::move(background_queue.front());
+	if (!job->key.empty())
+		background_keys.erase(job->key);
+	background_queue.pop_front();
+}
+
+static DWORD WINAPI background_writer_thread(LPVOID param)
+{
+	BackgroundJob job;
+
+	EnterCriticalSectionPretty(&background_lock);
+	while (true) {
+		while (background_queue.empty())
+			SleepConditionVariableCS(&background_work_available, &background_lock, INFINITE);
+
+		pop_background_job(&job);
+		background_in_flight = job.key;
+		LeaveCriticalSection(&background_lock);
+
+		job.job();
+
+		// The backlog includes the job in progress so that we don't
+		// let the queue run any further ahead of the disk than the
+		// limits say we should:
+		EnterCriticalSectionPretty(&background_lock);
+		background_in_flight.clear();
+		Profiling::background_jobs_queued--;
+		Profiling::background_bytes_queued -= job.size;
+		WakeAllConditionVariable(&background_space_available);
+	}
+}
+
+void queue_background_job(const wchar_t *key, size_t size, std::function<void()> &&job)
+{
+	BackgroundQueue::iterator i;
+
+	EnterCriticalSectionPretty(&background_lock);
+
+	if (!background_thread && !background_thread_failed) {
+		background_thread = CreateThread(NULL, 0, background_writer_thread, NULL, 0, NULL);
+		if (!background_thread) {
+			LogInfo("Failed to create background writer thread: %u - writing synchronously\n", GetLastError());
+			background_thread_failed = true;
+		}
+	}
+
+	if (background_thread_failed) {
+		LeaveCriticalSection(&background_lock);
+		job();
+		return;
+	}
+
+	if (key) {
+		auto existing = background_keys.find(key);
+		if (existing != background_keys.end()) {
+			i = existing->second;
+			Profiling::background_bytes_queued += size - i->size;
+			Profiling::background_jobs_coalesced++;
+			i->size = size;
+			i->job = std::move(job);
+			LeaveCriticalSection(&background_lock);
+			return;
+		}
+	}
+
+	// Allow anything through if the queue is empty so that a single job
+	// larger than the limit can't get stuck:
+	while (!background_queue.empty() &&
+			(Profiling::background_jobs_queued >= MAX_BACKGROUND_JOBS ||
+			 Profiling::background_bytes_queued + size > MAX_BACKGROUND_BYTES)) {
+		Profiling::background_writer_stalls++;
+		SleepConditionVariableCS(&background_space_available, &background_lock, INFINITE);
+	}
+
+	i = background_queue.insert(background_queue.end(), BackgroundJob());
+	i->size = size;
+	i->job = std::move(job);
+	if (key) {
+		i->key = key;
+		background_keys[i->key] = i;
+	}
+
+	Profiling::background_jobs_queued++;
+	Profiling::background_bytes_queued += size;
+	if (Profiling::background_jobs_queued > Profiling::background_jobs_peak)
+		Profiling::background_jobs_peak = Profiling::background_jobs_queued;
+
+	WakeConditionVariable(&background_work_available);
+	LeaveCriticalSection(&background_lock);
+}
+
+void queue_background_write(const wchar_t *path, const void *data, size_t size, const FILETIME *timestamp)
+{
+	std::wstring wpath(path);
+	std::string buf((const char*)data, size);
+	bool set_timestamp = !!timestamp;
+	FILETIME ftWrite = {0};
+
+	if (timestamp)
+		ftWrite = *timestamp;
+
+	queue_background_job(path, size, [wpath, buf, set_timestamp, ftWrite]() mutable {
+		FILE *fw;
+
+		wfopen_ensuring_access(&fw, wpath.c_str(), L"wb");
+		if (!fw) {
+			LogInfo("    error writing %S\n", wpath.c_str());
+			return;
+		}
+		fwrite(buf.data(), 1, buf.size(), fw);
+		fclose(fw);
+
+		if (set_timestamp)
+			set_file_last_write_time(&wpath[0], &ftWrite);
+	});
+}
+
+void flush_background_writer()
+{
+	if (!background_thread)
+		return;
+
+	EnterCriticalSectionPretty(&background_lock);
+	if (Profiling::background_jobs_queued) {
+		LogInfo("Waiting for %u background writes to finish...\n", Profiling::background_jobs_queued);
+
+		// The count includes the job in progress, and the background
+		// thread wakes us after every job it completes:
+		while (Profiling::background_jobs_queued)
+			SleepConditionVariableCS(&background_space_available, &background_lock, INFINITE);
+	}
+	LeaveCriticalSection(&background_lock);
+}
+
+void abandon_background_writer()
+{
+	BackgroundQueue::iterator i;
+
+	if (!background_thread)
+		return;
+
+	// Never wait here - we are inside DllMain, holding the loader lock. At
+	// process exit the background thread has already been terminated,
+	// possibly while it held the lock, and on FreeLibrary anything it does
+	// that needs the loader lock would deadlock us:
+	if (!TryEnterCriticalSection(&background_lock)) {
+		LogInfo("Background writer lock is held on exit, %u queued background writes lost\n",
+				Profiling::background_jobs_queued);
+		return;
+	}
+
+	if (!background_in_flight.empty())
+		LogInfo("Background write of %S was still in progress on exit\n", background_in_flight.c_str());
+
+	if (!background_queue.empty()) {
+		LogInfo("%Iu queued background writes lost on exit:\n", background_queue.size());
+		for (i = background_queue.begin(); i != background_queue.end(); i++) {
+			if (i->key.empty())
+				LogInfo("  (unnamed job, %Iu bytes)\n", i->size);
+			else
+				LogInfo("  %S\n", i->key.c_str());
+		}
+	}
+
+	LeaveCriticalSection(&background_lock);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <windows.h>
+#include <functional>
+
+// A bounded queue of file I/O jobs serviced by a single background thread, so
+// that export_binary, export, export_hlsl and cache_shaders don't stall the
+// game's CreateXXXShader calls while we hit the disk. On a fresh game install
+// with these enabled that used to make shader creation many times slower,
+// which was enough to trip loading timeouts in some games.
+//
+// Jobs are run in the order they were queued on the one thread, so a job can
+// rely on any earlier job having completed (e.g. ExportOrigBinary checking for
+// a previously exported shader with the same hash). Jobs must not take
+// G->mCriticalSection - the queue is bounded and whoever is adding to it may
+// be holding that lock while waiting for space.
+
+void init_background_writer();
+
+// If key is not NULL and a job with the same key is still waiting in the
+// queue, the new job replaces it rather than being added to the end - used
+// for file writes so that only the latest version of a file is written.
+// size is only used to account for the backlog.
+void queue_background_job(const wchar_t *key, size_t size, std::function<void()> &&job);
+
+// Copies the data and writes it to path from the background thread. If
+// timestamp is not NULL the file's last modified time will be set to it once
+// written, which is what live reload compares against.
+void queue_background_write(const wchar_t *path, const void *data, size_t size, const FILETIME *timestamp);
+
+// Waits for everything queued so far to be written. Called when the last
+// device is released, which is our last chance to do this outside of
+// DllMain. Must not be called with G->mCriticalSection held.
+void flush_background_writer();
+
+// Called from DllMain on unload or exit, where we can't wait for the
+// background thread. Doesn't write anything, just logs whatever hadn't been
+// written yet so that it doesn't vanish silently.
+void abandon_background_writer();
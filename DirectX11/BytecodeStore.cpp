@@ -0,0 +1,290 @@
+// Include before util.h (or any header that includes util.h) to get pretty
+// version of EnterCriticalSection:
+#include "lock.h"
+
+#include "BytecodeStore.h"
+#include "globals.h"
+#include "log.h"
+
+#include <D3Dcompiler.h>
+
+// Exported by ntdll since Windows XP, so we can use it without pulling in a
+// compression library. LZNT1 is not the best ratio around, but shader
+// bytecode is very repetitive so it still does well, and decompression is
+// fast enough that recalling a shader while hunting won't be noticed:
+typedef LONG (WINAPI *RtlGetCompressionWorkSpaceSizeFn)(USHORT format, PULONG buffer_workspace_size, PULONG fragment_workspace_size);
+typedef LONG (WINAPI *RtlCompressBufferFn)(USHORT format, PUCHAR uncompressed, ULONG uncompressed_size,
+		PUCHAR compressed, ULONG compressed_size, ULONG chunk_size, PULONG final_size, PVOID workspace);
+typedef LONG (WINAPI *RtlDecompressBufferFn)(USHORT format, PUCHAR uncompressed, ULONG uncompressed_size,
+		PUCHAR compressed, ULONG compressed_size, PULONG final_size);
+
+static RtlCompressBufferFn _RtlCompressBuffer;
+static RtlDecompressBufferFn _RtlDecompressBuffer;
+static std::vector<char> compression_workspace;
+
+static CRITICAL_SECTION store_lock;
+static bool store_initialised;
+static bool compression_failed;
+static HANDLE scratch_file = INVALID_HANDLE_VALUE;
+static bool scratch_file_failed;
+static UINT64 scratch_file_size;
+
+static const wchar_t *shader_type_names[] = { L"vs", L"hs", L"ds", L"gs", L"ps", L"cs", L"??" };
+#define NUM_SHADER_TYPES ((int)ARRAYSIZE(shader_type_names))
+
+static struct {
+	unsigned count;
+	SIZE_T original_bytes;
+	SIZE_T resident_bytes;
+	SIZE_T disk_bytes;
+} type_stats[NUM_SHADER_TYPES];
+
+void init_bytecode_store()
+{
+	InitializeCriticalSectionPretty(&store_lock);
+	store_initialised = true;
+}
+
+static bool init_compression()
+{
+	RtlGetCompressionWorkSpaceSizeFn _RtlGetCompressionWorkSpaceSize;
+	ULONG workspace_size, fragment_workspace_size;
+	HMODULE ntdll;
+
+	if (_RtlCompressBuffer)
+		return true;
+	if (compression_failed)
+		return false;
+
+	ntdll = GetModuleHandle(L"ntdll.dll");
+	_RtlGetCompressionWorkSpaceSize = (RtlGetCompressionWorkSpaceSizeFn)GetProcAddress(ntdll, "RtlGetCompressionWorkSpaceSize");
+	_RtlDecompressBuffer = (RtlDecompressBufferFn)GetProcAddress(ntdll, "RtlDecompressBuffer");
+	if (!_RtlGetCompressionWorkSpaceSize || !_RtlDecompressBuffer
+	 || _RtlGetCompressionWorkSpaceSize(COMPRESSION_FORMAT_LZNT1, &workspace_size, &fragment_workspace_size) < 0) {
+		LogInfo("Shader bytecode compression unavailable, keeping it uncompressed\n");
+		compression_failed = true;
+		return false;
+	}
+
+	compression_workspace.resize(workspace_size);
+	_RtlCompressBuffer = (RtlCompressBufferFn)GetProcAddress(ntdll, "RtlCompressBuffer");
+	if (!_RtlCompressBuffer)
+		compression_failed = true;
+	return !compression_failed;
+}
+
+static bool init_scratch_file()
+{
+	wchar_t dir[MAX_PATH], path[MAX_PATH];
+
+	if (scratch_file != INVALID_HANDLE_VALUE)
+		return true;
+	if (scratch_file_failed)
+		return false;
+
+	// Deleted automatically when we close it or the game exits, and marked
+	// temporary so Windows will keep it in the file cache where it can,
+	// which is fine - unlike our own heap that memory can be reclaimed
+	// under pressure:
+	if (GetTempPath(MAX_PATH, dir) && GetTempFileName(dir, L"3DM", 0, path)) {
+		scratch_file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	}
+
+	if (scratch_file == INVALID_HANDLE_VALUE) {
+		LogInfo("Unable to create shader bytecode scratch file, keeping it in memory\n");
+		scratch_file_failed = true;
+		return false;
+	}
+
+	LogInfo("Spilling shader bytecode to %S\n", path);
+	return true;
+}
+
+static int shader_type_index(const std::wstring &shader_type)
+{
+	int i;
+
+	for (i = 0; i < NUM_SHADER_TYPES - 1; i++) {
+		if (shader_type == shader_type_names[i])
+			break;
+	}
+
+	return i;
+}
+
+StoredBytecode::StoredBytecode() :
+	storage(ShaderBytecodeStorage::MEMORY),
+	blob(NULL),
+	offset(0),
+	size(0),
+	stored_size(0),
+	type(NUM_SHADER_TYPES - 1)
+{}
+
+void StoredBytecode::store(ID3DBlob *bytecode, const std::wstring &shader_type)
+{
+	ID3DBlob *compressed = NULL;
+	ULONG compressed_size = 0;
+	OVERLAPPED overlapped = {0};
+	DWORD written = 0;
+
+	blob = bytecode;
+	size = bytecode->GetBufferSize();
+	stored_size = size;
+	storage = ShaderBytecodeStorage::MEMORY;
+	type = shader_type_index(shader_type);
+
+	EnterCriticalSectionPretty(&store_lock);
+
+	switch (G->shader_bytecode_storage) {
+	case ShaderBytecodeStorage::COMPRESSED:
+		if (!init_compression())
+			break;
+		// LZNT1 can expand incompressible data slightly, but if it
+		// doesn't save anything it isn't worth keeping compressed:
+		if (FAILED(D3DCreateBlob(size, &compressed)))
+			break;
+		if (_RtlCompressBuffer(COMPRESSION_FORMAT_LZNT1, (PUCHAR)bytecode->GetBufferPointer(), (ULONG)size,
+				(PUCHAR)compressed->GetBufferPointer(), (ULONG)size, 4096,
+				&compressed_size, compression_workspace.data()) < 0
+				|| compressed_size >= size) {
+			compressed->Release();
+			break;
+		}
+		// Blobs can't be shrunk, so copy it into one of the right size:
+		if (FAILED(D3DCreateBlob(compressed_size, &blob))) {
+			blob = bytecode;
+			compressed->Release();
+			break;
+		}
+		memcpy(blob->GetBufferPointer(), compressed->GetBufferPointer(), compressed_size);
+		compressed->Release();
+		bytecode->Release();
+		stored_size = compressed_size;
+		storage = ShaderBytecodeStorage::COMPRESSED;
+		break;
+
+	case ShaderBytecodeStorage::DISK:
+		if (!init_scratch_file())
+			break;
+		overlapped.Offset = (DWORD)scratch_file_size;
+		overlapped.OffsetHigh = (DWORD)(scratch_file_size >> 32);
+		if (!WriteFile(scratch_file, bytecode->GetBufferPointer(), (DWORD)size, &written, &overlapped)
+				|| written != size) {
+			LogInfo("Error writing shader bytecode to scratch file: %u\n", GetLastError());
+			break;
+		}
+		offset = scratch_file_size;
+		scratch_file_size += size;
+		bytecode->Release();
+		blob = NULL;
+		storage = ShaderBytecodeStorage::DISK;
+		break;
+	}
+
+	type_stats[type].count++;
+	type_stats[type].original_bytes += size;
+	if (storage == ShaderBytecodeStorage::DISK)
+		type_stats[type].disk_bytes += size;
+	else
+		type_stats[type].resident_bytes += stored_size;
+
+	LeaveCriticalSection(&store_lock);
+}
+
+ID3DBlob* StoredBytecode::recall() const
+{
+	ID3DBlob *ret = NULL;
+	ULONG final_size = 0;
+	OVERLAPPED overlapped = {0};
+	DWORD read = 0;
+
+	switch (storage) {
+	case ShaderBytecodeStorage::MEMORY:
+		if (blob)
+			blob->AddRef();
+		return blob;
+
+	case ShaderBytecodeStorage::COMPRESSED:
+		if (FAILED(D3DCreateBlob(size, &ret)))
+			return NULL;
+		if (_RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1, (PUCHAR)ret->GetBufferPointer(), (ULONG)size,
+				(PUCHAR)blob->GetBufferPointer(), (ULONG)stored_size, &final_size) < 0
+				|| final_size != size) {
+			LogInfo("Error decompressing shader bytecode\n");
+			ret->Release();
+			return NULL;
+		}
+		return ret;
+
+	case ShaderBytecodeStorage::DISK:
+		if (FAILED(D3DCreateBlob(size, &ret)))
+			return NULL;
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		EnterCriticalSectionPretty(&store_lock);
+		if (!ReadFile(scratch_file, ret->GetBufferPointer(), (DWORD)size, &read, &overlapped) || read != size) {
+			LeaveCriticalSection(&store_lock);
+			LogInfo("Error reading shader bytecode from scratch file: %u\n", GetLastError());
+			ret->Release();
+			return NULL;
+		}
+		LeaveCriticalSection(&store_lock);
+		return ret;
+	}
+
+	return NULL;
+}
+
+void StoredBytecode::release()
+{
+	if (empty())
+		return;
+
+	EnterCriticalSectionPretty(&store_lock);
+	type_stats[type].count--;
+	type_stats[type].original_bytes -= size;
+	if (storage == ShaderBytecodeStorage::DISK)
+		type_stats[type].disk_bytes -= size;
+	else
+		type_stats[type].resident_bytes -= stored_size;
+	LeaveCriticalSection(&store_lock);
+
+	// Space in the scratch file is not reused. Shader handles are only
+	// forgotten when the game releases a shader and its handle is reused,
+	// which is rare enough not to be worth managing free space for.
+	if (blob)
+		blob->Release();
+
+	*this = StoredBytecode();
+}
+
+std::wstring shader_bytecode_memory_report()
+{
+	std::wstring ret;
+	wchar_t buf[256];
+	int i;
+
+	if (!store_initialised)
+		return ret;
+
+	ret += L"\nRetained original shader bytecode:\n";
+
+	EnterCriticalSectionPretty(&store_lock);
+	for (i = 0; i < NUM_SHADER_TYPES; i++) {
+		if (!type_stats[i].count)
+			continue;
+		_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
+				L"   %ls: %5u shaders, %7IuKB original, %7IuKB resident, %7IuKB on disk\n",
+				shader_type_names[i],
+				type_stats[i].count,
+				type_stats[i].original_bytes / 1024,
+				type_stats[i].resident_bytes / 1024,
+				type_stats[i].disk_bytes / 1024);
+		ret += buf;
+	}
+	LeaveCriticalSection(&store_lock);
+
+	return ret;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <d3d11_1.h>
+#include <string>
+
+#include "util.h"
+
+// We keep a copy of the original bytecode of every shader while hunting (and
+// whenever ShaderRegex is in use) for live reload, CopyToFixes and ShaderRegex.
+// On large titles that adds up to hundreds of MB of resident memory in the
+// game process, so these options allow it to be kept out of the way until it
+// is actually needed:
+//	memory     = Keep the bytecode in memory as is (default)
+//	compressed = Keep the bytecode in memory compressed with LZNT1
+//	disk       = Spill the bytecode to a temporary scratch file
+enum class ShaderBytecodeStorage {
+	INVALID = -1,
+	MEMORY,
+	COMPRESSED,
+	DISK,
+};
+static EnumName_t<const wchar_t *, ShaderBytecodeStorage> ShaderBytecodeStorageNames[] = {
+	{L"memory", ShaderBytecodeStorage::MEMORY},
+	{L"compressed", ShaderBytecodeStorage::COMPRESSED},
+	{L"disk", ShaderBytecodeStorage::DISK},
+	{NULL, ShaderBytecodeStorage::INVALID} // End of list marker
+};
+
+// Handle to a copy of a shader's bytecode stored per the shader_bytecode
+// option at the time it was stored. Like the ID3DBlob* this replaces it is
+// freely copyable and does not own a reference - release() must be called
+// exactly once when the shader is forgotten.
+class StoredBytecode
+{
+	ShaderBytecodeStorage storage;
+	ID3DBlob *blob;		// Original bytecode or compressed bytecode
+	UINT64 offset;		// Location in the scratch file
+	SIZE_T size;		// Size of the original bytecode
+	SIZE_T stored_size;	// Resident (or on disk) size
+	int type;
+
+public:
+	StoredBytecode();
+
+	bool empty() const { return !size; }
+
+	// Takes over the caller's reference to the blob
+	void store(ID3DBlob *bytecode, const std::wstring &shader_type);
+
+	// Returns a new reference to a blob containing the original bytecode,
+	// which the caller must Release(), or NULL on failure
+	ID3DBlob* recall() const;
+
+	void release();
+};
+
+void init_bytecode_store();
+
+// Per shader type totals for the profiling overlay
+std::wstring shader_bytecode_memory_report();
@@ -2579,18 +2579,18 @@ float CommandListOperand::process_shader_filter(CommandListState *state)
 	if (!shader)
 		return -0.0;
 
-	ShaderMap::iterator shader_it = lookup_shader_hash(shader);
+	ShaderInfoMap::iterator shader_it = lookup_shader_info(shader);
 
-	if (shader_it == G->mShaders.end())
+	if (shader_it == G->mShaderInfo.end())
 		return 0.0;
 
 	// Positive zero means shader bound with no ShaderOverride
-	ShaderOverrideMap::iterator override = lookup_shaderoverride(shader_it->second);
-	if (override == G->mShaderOverrideMap.end())
+	ShaderOverride *override = lookup_shader_info_override(&shader_it->second);
+	if (!override)
 		return 0.0;
 
-	if (override->second.filter_index != FLT_MAX)
-		return override->second.filter_index;
+	if (override->filter_index != FLT_MAX)
+		return override->filter_index;
 
 	// Matched ShaderOverride / ShaderRegex, but no filter_index:
 	return 1.0;
@@ -6,6 +6,8 @@
 #include "HookedDXGI.h"
 
 #include "nvprofile.h"
+#include "BackgroundWriter.h"
+#include "BytecodeStore.h"
 
 //#include <Shlobj.h>
 //#include <Winuser.h>
@@ -179,9 +181,18 @@ static bool InitializeDLL()
 
 void DestroyDLL()
 {
+	// Too late to write anything still waiting to be exported or cached,
+	// that has to happen on device release, but at least log it:
+	abandon_background_writer();
+
 	if (LogFile)
 	{
 		LogInfo("Destroying DLL...\n");
+		if (G->shader_fixes_cache_lookups) {
+			LogInfo("Identical shader creations deduplicated: %u/%u (%.1f%%)\n",
+					G->shader_fixes_cache_hits, G->shader_fixes_cache_lookups,
+					100.0 * G->shader_fixes_cache_hits / G->shader_fixes_cache_lookups);
+		}
 		SavePersistentSettings();
 		fclose(LogFile);
 	}
@@ -439,6 +450,8 @@ void InitD311()
 	InitializeCriticalSectionPretty(&G->mCriticalSection);
 	InitializeCriticalSectionPretty(&G->mResourcesLock);
 	InitializeCriticalSectionPretty(&resource_creation_mode_lock);
+	init_background_writer();
+	init_bytecode_store();
 
 	InitializeDLL();
 	
@@ -0,0 +1,76 @@
+#include "DirectorySnapshot.h"
+
+#include <algorithm>
+#include <cwctype>
+
+void DirectorySnapshot::add(const std::wstring &name, uint64_t last_write_time, uint64_t size)
+{
+	DirectorySnapshotEntry entry = {name, last_write_time, size};
+
+	entries.push_back(std::move(entry));
+}
+
+static int compare_names(const std::wstring &a, const std::wstring &b)
+{
+	size_t i, len = std::min(a.size(), b.size());
+	wint_t ca, cb;
+
+	for (i = 0; i < len; i++) {
+		ca = std::towlower(a[i]);
+		cb = std::towlower(b[i]);
+		if (ca != cb)
+			return ca < cb ? -1 : 1;
+	}
+
+	if (a.size() == b.size())
+		return 0;
+	return a.size() < b.size() ? -1 : 1;
+}
+
+static std::vector<const DirectorySnapshotEntry*> sorted_entries(const std::vector<DirectorySnapshotEntry> &entries)
+{
+	std::vector<const DirectorySnapshotEntry*> sorted;
+
+	sorted.reserve(entries.size());
+	for (const DirectorySnapshotEntry &entry : entries)
+		sorted.push_back(&entry);
+
+	std::sort(sorted.begin(), sorted.end(),
+		[](const DirectorySnapshotEntry *a, const DirectorySnapshotEntry *b) {
+			return compare_names(a->name, b->name) < 0;
+		});
+
+	return sorted;
+}
+
+DirectorySnapshotDiff DirectorySnapshot::diff(const DirectorySnapshot &old) const
+{
+	std::vector<const DirectorySnapshotEntry*> a = sorted_entries(old.entries);
+	std::vector<const DirectorySnapshotEntry*> b = sorted_entries(entries);
+	DirectorySnapshotDiff result;
+	size_t i = 0, j = 0;
+	int cmp;
+
+	// Both lists are in the same order, so walk them side by side:
+	while (i < a.size() || j < b.size()) {
+		if (i == a.size())
+			cmp = 1;
+		else if (j == b.size())
+			cmp = -1;
+		else
+			cmp = compare_names(a[i]->name, b[j]->name);
+
+		if (cmp < 0) {
+			result.removed.push_back(a[i++]->name);
+		} else if (cmp > 0) {
+			result.added.push_back(b[j++]->name);
+		} else {
+			if (a[i]->last_write_time != b[j]->last_write_time || a[i]->size != b[j]->size)
+				result.modified.push_back(b[j]->name);
+			i++;
+			j++;
+		}
+	}
+
+	return result;
+}
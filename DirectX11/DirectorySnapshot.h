@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// A listing of the files in a directory along with their sizes and
+// modification times, and the comparison between two of them that the polling
+// FileChangeNotifier is built on. Listing the directory is left to the caller,
+// so this has no Windows dependencies and can be tested anywhere - see
+// Tests/test_directory_snapshot.cpp.
+
+struct DirectorySnapshotEntry
+{
+	std::wstring name;
+	uint64_t last_write_time;
+	uint64_t size;
+};
+
+struct DirectorySnapshotDiff
+{
+	std::vector<std::wstring> added;
+	std::vector<std::wstring> removed;
+	std::vector<std::wstring> modified;
+
+	bool empty() const
+	{
+		return added.empty() && removed.empty() && modified.empty();
+	}
+};
+
+class DirectorySnapshot
+{
+	std::vector<DirectorySnapshotEntry> entries;
+
+public:
+	// Files may be added in any order, as directory listings aren't
+	// sorted on every filesystem:
+	void add(const std::wstring &name, uint64_t last_write_time, uint64_t size);
+
+	size_t size() const
+	{
+		return entries.size();
+	}
+
+	// Lists what changed between an older snapshot and this one. Names are
+	// compared case insensitively, as Windows does, so a file renamed to
+	// change its case alone is neither added nor removed. A file counts as
+	// modified if either its size or its modification time is different.
+	DirectorySnapshotDiff diff(const DirectorySnapshot &old) const;
+};
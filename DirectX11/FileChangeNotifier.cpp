@@ -0,0 +1,117 @@
+#include "FileChangeNotifier.h"
+#include "DirectorySnapshot.h"
+
+#include "log.h"
+
+// How often the polling implementation lists the directory. Saving a file in
+// an editor and switching back to the game takes longer than this, so there is
+// no point doing it every frame:
+#define POLL_INTERVAL_MS 500
+
+class Win32FileChangeNotifier : public FileChangeNotifier
+{
+	HANDLE handle;
+
+public:
+	Win32FileChangeNotifier(HANDLE handle) :
+		handle(handle)
+	{}
+
+	~Win32FileChangeNotifier()
+	{
+		FindCloseChangeNotification(handle);
+	}
+
+	bool poll() override
+	{
+		bool changed = false;
+
+		// The handle stays signalled until we ask for the next change,
+		// and a burst of changes (such as an editor writing a file via
+		// a temporary and renaming it) may signal it more than once:
+		while (WaitForSingleObject(handle, 0) == WAIT_OBJECT_0) {
+			changed = true;
+			if (!FindNextChangeNotification(handle))
+				break;
+		}
+
+		return changed;
+	}
+};
+
+class PollingFileChangeNotifier : public FileChangeNotifier
+{
+	std::wstring search_path;
+	DirectorySnapshot snapshot;
+	ULONGLONG last_poll;
+
+	DirectorySnapshot list_directory()
+	{
+		WIN32_FIND_DATA find_data;
+		DirectorySnapshot listing;
+		HANDLE find;
+
+		find = FindFirstFile(search_path.c_str(), &find_data);
+		if (find == INVALID_HANDLE_VALUE)
+			return listing;
+
+		do {
+			listing.add(find_data.cFileName,
+				((uint64_t)find_data.ftLastWriteTime.dwHighDateTime << 32) | find_data.ftLastWriteTime.dwLowDateTime,
+				((uint64_t)find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow);
+		} while (FindNextFile(find, &find_data));
+		FindClose(find);
+
+		return listing;
+	}
+
+public:
+	PollingFileChangeNotifier(const wchar_t *dir, const wchar_t *pattern) :
+		search_path(std::wstring(dir) + L"\\" + pattern),
+		last_poll(GetTickCount64())
+	{
+		snapshot = list_directory();
+	}
+
+	bool poll() override
+	{
+		ULONGLONG now = GetTickCount64();
+		DirectorySnapshot new_snapshot;
+		DirectorySnapshotDiff diff;
+
+		if (now - last_poll < POLL_INTERVAL_MS)
+			return false;
+		last_poll = now;
+
+		new_snapshot = list_directory();
+		diff = new_snapshot.diff(snapshot);
+		if (diff.empty())
+			return false;
+
+		LogDebug("%Iu files added, %Iu removed, %Iu modified\n",
+				diff.added.size(), diff.removed.size(), diff.modified.size());
+
+		snapshot = std::move(new_snapshot);
+		return true;
+	}
+};
+
+FileChangeNotifier* create_file_change_notifier(const wchar_t *dir, const wchar_t *pattern, bool polling)
+{
+	HANDLE handle;
+
+	if (!polling) {
+		handle = FindFirstChangeNotification(dir, FALSE,
+				FILE_NOTIFY_CHANGE_FILE_NAME |
+				FILE_NOTIFY_CHANGE_LAST_WRITE |
+				FILE_NOTIFY_CHANGE_SIZE);
+		if (handle != INVALID_HANDLE_VALUE) {
+			LogInfo("Watching %S for changes\n", dir);
+			return new Win32FileChangeNotifier(handle);
+		}
+		LogInfo("Unable to watch %S for changes: %u - falling back to polling\n", dir, GetLastError());
+	}
+
+	LogInfo("Polling %S for changes\n", dir);
+	return new PollingFileChangeNotifier(dir, pattern);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+// Watches a directory for files matching a pattern being added, removed or
+// modified. Used for reload_fixes_watch, so that a shaderhacker can just save
+// a file in ShaderFixes and see the result in game without pressing F10.
+//
+// There are two implementations - the default uses the change notifications
+// provided by Windows, which cost nothing until something actually changes.
+// The polling implementation periodically lists the directory and compares
+// the names, sizes and modification times of the files, which is slower, but
+// works anywhere we can list a directory. That's useful on network shares
+// and under Wine, where change notifications may be missing or unreliable
+// depending on the underlying filesystem. The comparison itself lives in
+// DirectorySnapshot, which is portable and has its own tests.
+class FileChangeNotifier
+{
+public:
+	virtual ~FileChangeNotifier() {}
+
+	// Does not block. Returns true if anything matching the pattern may
+	// have changed since the last call. May return true spuriously (e.g.
+	// for changes to other files in the directory), but should never miss
+	// a change.
+	virtual bool poll() = 0;
+};
+
+// Returns NULL on failure. If polling is false but change notifications are
+// not available for the directory this will fall back to polling.
+FileChangeNotifier* create_file_change_notifier(const wchar_t *dir, const wchar_t *pattern, bool polling);
@@ -126,7 +126,7 @@ static void FrameAnalysisLogSlot(FILE *frame_analysis_log, int slot, char *slot_
 template <class ID3D11Shader>
 void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 {
-	ShaderMap::iterator hash;
+	ShaderInfoMap::iterator info;
 
 	// Always complete the line in the debug log:
 	LogDebug("\n");
@@ -141,9 +141,9 @@ void FrameAnalysisContext::FrameAnalysisLogShaderHash(ID3D11Shader *shader)
 
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 
-	hash = lookup_shader_hash(shader);
-	if (hash != end(G->mShaders))
-		fprintf(frame_analysis_log, " hash=%016llx", hash->second);
+	info = lookup_shader_info(shader);
+	if (info != end(G->mShaderInfo))
+		fprintf(frame_analysis_log, " hash=%016llx", info->second.hash);
 
 	LeaveCriticalSection(&G->mCriticalSection);
 
@@ -84,6 +84,12 @@ HackerContext::HackerContext(ID3D11Device1 *pDevice1, ID3D11DeviceContext1 *pCon
 	mCurrentDomainShaderHandle = NULL;
 	mCurrentHullShader = 0;
 	mCurrentHullShaderHandle = NULL;
+	memset(&mCurrentVertexShaderOverride, 0, sizeof(mCurrentVertexShaderOverride));
+	memset(&mCurrentPixelShaderOverride, 0, sizeof(mCurrentPixelShaderOverride));
+	memset(&mCurrentComputeShaderOverride, 0, sizeof(mCurrentComputeShaderOverride));
+	memset(&mCurrentGeometryShaderOverride, 0, sizeof(mCurrentGeometryShaderOverride));
+	memset(&mCurrentDomainShaderOverride, 0, sizeof(mCurrentDomainShaderOverride));
+	memset(&mCurrentHullShaderOverride, 0, sizeof(mCurrentHullShaderOverride));
 	mCurrentDepthTarget = NULL;
 	mCurrentPSUAVStartSlot = 0;
 	mCurrentPSNumUAVs = 0;
@@ -440,6 +446,24 @@ ID3D11PixelShader* HackerContext::SwitchPSShader(ID3D11PixelShader *shader)
 	return pPixelShader;
 }
 
+// Returns the ShaderOverride that SetShader found for a bound shader, unless
+// the ShaderOverride map has changed since then (config reload, or
+// ShaderRegex adding a new one) in which case it is looked up again. The
+// cache belongs to this context, so nothing else writes to it:
+ShaderOverride* HackerContext::LookupCurrentShaderOverride(UINT64 hash, CurrentShaderOverride *current)
+{
+	ShaderOverrideMap::iterator i;
+	unsigned generation = G->shader_override_generation;
+
+	if (current->generation != generation) {
+		i = lookup_shaderoverride(hash);
+		current->override = (i == G->mShaderOverrideMap.end()) ? NULL : &i->second;
+		current->generation = generation;
+	}
+
+	return current->override;
+}
+
 #define ENABLE_LEGACY_FILTERS 1
 void HackerContext::ProcessShaderOverride(ShaderOverride *shaderOverride, bool isPixelShader, DrawContext *data)
 {
@@ -495,14 +519,14 @@ void HackerContext::ProcessShaderOverride(ShaderOverride *shaderOverride, bool i
 		// Deprecated since the logic can be moved into the shaders with far more flexibility
 		if (use_orig) {
 			if (isPixelShader) {
-				ShaderReplacementMap::iterator i = lookup_original_shader(mCurrentPixelShaderHandle);
-				if (i != G->mOriginalShaders.end())
-					data->oldPixelShader = SwitchPSShader((ID3D11PixelShader*)i->second);
+				ShaderInfoMap::iterator i = lookup_shader_info(mCurrentPixelShaderHandle);
+				if (i != G->mShaderInfo.end() && i->second.original)
+					data->oldPixelShader = SwitchPSShader((ID3D11PixelShader*)i->second.original);
 			}
 			else {
-				ShaderReplacementMap::iterator i = lookup_original_shader(mCurrentVertexShaderHandle);
-				if (i != G->mOriginalShaders.end())
-					data->oldVertexShader = SwitchVSShader((ID3D11VertexShader*)i->second);
+				ShaderInfoMap::iterator i = lookup_shader_info(mCurrentVertexShaderHandle);
+				if (i != G->mShaderInfo.end() && i->second.original)
+					data->oldVertexShader = SwitchVSShader((ID3D11VertexShader*)i->second.original);
 			}
 		}
 	}
@@ -518,8 +542,8 @@ void HackerContext::ProcessShaderOverride(ShaderOverride *shaderOverride, bool i
 // we will do all the auto patching from one place.
 //
 // We do want to avoid replacing a shader that has already been replaced from
-// ShaderFixes, either at shader creation time, or dynamically by the
-// mReloadedShaders map - user replaced shaders should always take priority
+// ShaderFixes, either at shader creation time, or dynamically by live
+// reloading - user replaced shaders should always take priority
 // over automatically replaced shaders.
 template <class ID3D11Shader,
 	void (__stdcall ID3D11DeviceContext::*GetShaderVS2013BUGWORKAROUND)(ID3D11Shader**, ID3D11ClassInstance**, UINT*),
@@ -530,24 +554,26 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 {
 	ID3D11Shader *orig_shader = NULL, *patched_shader = NULL;
 	ID3D11ClassInstance *class_instances[256];
-	ShaderReloadMap::iterator orig_info_i;
+	ShaderInfoMap::iterator orig_info_i;
 	OriginalShaderInfo *orig_info = NULL;
+	ID3DBlob *orig_bytecode = NULL;
 	UINT num_instances = 0;
 	string asm_text;
 	bool patch_regex = false;
 	HRESULT hr;
 	unsigned i;
 	wstring tagline(L"//");
-	vector<byte> patched_bytecode;
-	vector<char> asm_vector;
+	vector<byte> patched_bytecode, orig_bytecode_vector;
+	vector<char> asm_vector, orig_asm_vector;
+	int reencoded;
 
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 
 	// Faster than catching an out_of_range exception from .at():
-	orig_info_i = lookup_reloaded_shader(shader);
-	if (orig_info_i == G->mReloadedShaders.end())
+	orig_info_i = lookup_shader_info(shader);
+	if (orig_info_i == G->mShaderInfo.end() || !orig_info_i->second.reload)
 		goto out_drop;
-	orig_info = &orig_info_i->second;
+	orig_info = orig_info_i->second.reload.get();
 
 	if (!orig_info->deferred_replacement_candidate || orig_info->deferred_replacement_processed)
 		goto out_drop;
@@ -556,6 +582,19 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 	// (until config reload) regardless of whether we patch it or not:
 	orig_info->deferred_replacement_processed = true;
 
+	// If no ShaderRegex group targets this shader model there is nothing
+	// to do, so don't bother checking the cache, let alone recalling and
+	// disassembling the bytecode. If we couldn't read the model from the
+	// bytecode when the shader was created we fall through and find it
+	// out the slow way:
+	if (!orig_info->bytecodeShaderModel.empty()
+	 && !shader_regex_targeted_models.count(orig_info->bytecodeShaderModel)) {
+		LogInfo("Skipping deferred shader analysis on %S %016I64x: no ShaderRegex targets %s (%li skipped)\n",
+				shader_type, hash, orig_info->bytecodeShaderModel.c_str(),
+				InterlockedIncrement(&shader_regex_model_skips));
+		goto out_drop;
+	}
+
 	switch (load_shader_regex_cache(hash, shader_type, &patched_bytecode, &tagline)) {
 	case ShaderRegexCache::NO_MATCH:
 		LogInfo("%S %016I64x has cached ShaderRegex miss\n", shader_type, hash);
@@ -569,12 +608,21 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 	case ShaderRegexCache::NO_CACHE:
 		LogInfo("Performing deferred shader analysis on %S %016I64x...\n", shader_type, hash);
 
-		asm_text = BinaryToAsmText(orig_info->byteCode->GetBufferPointer(),
-				orig_info->byteCode->GetBufferSize(),
+		orig_bytecode = orig_info->byteCode.recall();
+		if (!orig_bytecode)
+			goto out_drop;
+		asm_text = BinaryToAsmText(orig_bytecode->GetBufferPointer(),
+				orig_bytecode->GetBufferSize(),
 				G->patch_cb_offsets,
 				G->disassemble_undecipherable_custom_data);
+		// Keep the unpatched shader so the assembler only has to
+		// encode the instructions that ShaderRegex changed:
+		orig_bytecode_vector.assign((byte*)orig_bytecode->GetBufferPointer(),
+				(byte*)orig_bytecode->GetBufferPointer() + orig_bytecode->GetBufferSize());
+		orig_bytecode->Release();
 		if (asm_text.empty())
 			goto out_drop;
+		orig_asm_vector.assign(asm_text.begin(), asm_text.end());
 
 		try {
 			patch_regex = apply_shader_regex_groups(&asm_text, shader_type, &orig_info->shaderModel, hash, &tagline);
@@ -597,11 +645,16 @@ void HackerContext::DeferredShaderReplacement(ID3D11DeviceChild *shader, UINT64
 
 		try {
 			vector<AssemblerParseError> parse_errors;
-			hr = AssembleFluganWithSignatureParsing(&asm_vector, &patched_bytecode, &parse_errors);
+			hr = AssembleFluganIncrementalWithSignatureParsing(&asm_vector, &orig_asm_vector,
+					&orig_bytecode_vector, &patched_bytecode, &parse_errors, &reencoded);
 			if (FAILED(hr)) {
 				LogInfo("    *** Assembling patched shader failed\n");
 				goto out_drop;
 			}
+			if (reencoded < 0)
+				LogInfo("    Reassembled entire patched shader\n");
+			else
+				LogInfo("    Assembled %i patched instructions\n", reencoded);
 			// Parse errors are currently being treated as non-fatal on
 			// creation time replacement and ShaderRegex for backwards
 			// compatibility (live shader reload is fatal).
@@ -842,42 +895,42 @@ void HackerContext::BeforeDraw(DrawContext &data)
 
 	// Override settings?
 	if (!G->mShaderOverrideMap.empty()) {
-		ShaderOverrideMap::iterator i;
+		ShaderOverride *override;
 
-		i = lookup_shaderoverride(mCurrentVertexShader);
-		if (i != G->mShaderOverrideMap.end()) {
-			data.post_commands[0] = &i->second.post_command_list;
-			ProcessShaderOverride(&i->second, false, &data);
+		override = LookupCurrentShaderOverride(mCurrentVertexShader, &mCurrentVertexShaderOverride);
+		if (override) {
+			data.post_commands[0] = &override->post_command_list;
+			ProcessShaderOverride(override, false, &data);
 		}
 
 		if (mCurrentHullShader) {
-			i = lookup_shaderoverride(mCurrentHullShader);
-			if (i != G->mShaderOverrideMap.end()) {
-				data.post_commands[1] = &i->second.post_command_list;
-				ProcessShaderOverride(&i->second, false, &data);
+			override = LookupCurrentShaderOverride(mCurrentHullShader, &mCurrentHullShaderOverride);
+			if (override) {
+				data.post_commands[1] = &override->post_command_list;
+				ProcessShaderOverride(override, false, &data);
 			}
 		}
 
 		if (mCurrentDomainShader) {
-			i = lookup_shaderoverride(mCurrentDomainShader);
-			if (i != G->mShaderOverrideMap.end()) {
-				data.post_commands[2] = &i->second.post_command_list;
-				ProcessShaderOverride(&i->second, false, &data);
+			override = LookupCurrentShaderOverride(mCurrentDomainShader, &mCurrentDomainShaderOverride);
+			if (override) {
+				data.post_commands[2] = &override->post_command_list;
+				ProcessShaderOverride(override, false, &data);
 			}
 		}
 
 		if (mCurrentGeometryShader) {
-			i = lookup_shaderoverride(mCurrentGeometryShader);
-			if (i != G->mShaderOverrideMap.end()) {
-				data.post_commands[3] = &i->second.post_command_list;
-				ProcessShaderOverride(&i->second, false, &data);
+			override = LookupCurrentShaderOverride(mCurrentGeometryShader, &mCurrentGeometryShaderOverride);
+			if (override) {
+				data.post_commands[3] = &override->post_command_list;
+				ProcessShaderOverride(override, false, &data);
 			}
 		}
 
-		i = lookup_shaderoverride(mCurrentPixelShader);
-		if (i != G->mShaderOverrideMap.end()) {
-			data.post_commands[4] = &i->second.post_command_list;
-			ProcessShaderOverride(&i->second, true, &data);
+		override = LookupCurrentShaderOverride(mCurrentPixelShader, &mCurrentPixelShaderOverride);
+		if (override) {
+			data.post_commands[4] = &override->post_command_list;
+			ProcessShaderOverride(override, true, &data);
 		}
 	}
 
@@ -1388,7 +1441,8 @@ STDMETHODIMP_(void) HackerContext::GSSetShader(THIS_
 		 &G->mVisitedGeometryShaders,
 		 G->mSelectedGeometryShader,
 		 &mCurrentGeometryShader,
-		 &mCurrentGeometryShaderHandle);
+		 &mCurrentGeometryShaderHandle,
+		 &mCurrentGeometryShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::IASetPrimitiveTopology(THIS_
@@ -1528,16 +1582,16 @@ bool HackerContext::BeforeDispatch(DispatchContext *context)
 
 	// Override settings?
 	if (!G->mShaderOverrideMap.empty()) {
-		ShaderOverrideMap::iterator i;
+		ShaderOverride *override;
 
-		i = lookup_shaderoverride(mCurrentComputeShader);
-		if (i != G->mShaderOverrideMap.end()) {
-			context->post_commands = &i->second.post_command_list;
+		override = LookupCurrentShaderOverride(mCurrentComputeShader, &mCurrentComputeShaderOverride);
+		if (override) {
+			context->post_commands = &override->post_command_list;
 			// XXX: Not using ProcessShaderOverride() as a
 			// lot of it's logic doesn't really apply to
 			// compute shaders. The main thing we care
 			// about is the command list, so just run that:
-			RunCommandList(mHackerDevice, this, &i->second.command_list, &context->call_info, false);
+			RunCommandList(mHackerDevice, this, &override->command_list, &context->call_info, false);
 			return !context->call_info.skip;
 		}
 	}
@@ -1875,7 +1929,8 @@ STDMETHODIMP_(void) HackerContext::HSSetShader(THIS_
 		 &G->mVisitedHullShaders,
 		 G->mSelectedHullShader,
 		 &mCurrentHullShader,
-		 &mCurrentHullShaderHandle);
+		 &mCurrentHullShaderHandle,
+		 &mCurrentHullShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::HSSetSamplers(THIS_
@@ -1923,7 +1978,8 @@ STDMETHODIMP_(void) HackerContext::DSSetShader(THIS_
 		 &G->mVisitedDomainShaders,
 		 G->mSelectedDomainShader,
 		 &mCurrentDomainShader,
-		 &mCurrentDomainShaderHandle);
+		 &mCurrentDomainShaderHandle,
+		 &mCurrentDomainShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::DSSetSamplers(THIS_
@@ -1998,7 +2054,8 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 	std::set<UINT64> *visitedShaders,
 	UINT64 selectedShader,
 	UINT64 *currentShaderHash,
-	ID3D11Shader **currentShaderHandle)
+	ID3D11Shader **currentShaderHandle,
+	CurrentShaderOverride *currentShaderOverride)
 {
 	ID3D11Shader *repl_shader = pShader;
 
@@ -2007,23 +2064,42 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 	// types of old style filtering:
 	*currentShaderHandle = pShader;
 
+	// Look up the ShaderOverride now, once per bind, rather than for
+	// every draw call. The generation is read first, so if the map
+	// changes while we are looking it up BeforeDraw will look again:
+	currentShaderOverride->generation = G->shader_override_generation;
+	currentShaderOverride->override = NULL;
+
 	if (pShader) {
+		// Everything we know about this shader is in a single record,
+		// so this is the only lookup we do here now - the hash,
+		// replacement and original shader all come from it:
+		ShaderInfoMap::iterator i = lookup_shader_info(pShader);
+		ShaderInfo *info = NULL;
+		if (i != G->mShaderInfo.end())
+			info = &i->second;
+
 		// Store as current shader. Need to do this even while
 		// not hunting for ShaderOverride section in BeforeDraw
 		// We also set the current shader hash, but as an optimization,
-		// we skip the lookup if there are no ShaderOverride The
-		// lookup/find takes measurable amounts of CPU time.
+		// we skip it if there are no ShaderOverride since nothing
+		// will use it.
 		//
 		// grumble grumble this optimisation caught me out *TWICE* grumble grumble -DSS
 		if (!G->mShaderOverrideMap.empty() || !shader_regex_groups.empty() || (G->hunting == HUNTING_MODE_ENABLED)) {
-			ShaderMap::iterator i = lookup_shader_hash(pShader);
-			if (i != G->mShaders.end()) {
-				*currentShaderHash = i->second;
+			if (info) {
+				*currentShaderHash = info->hash;
+				currentShaderOverride->override = lookup_shader_info_override(info);
 				LogDebug("  shader found: handle = %p, hash = %016I64x\n", *currentShaderHandle, *currentShaderHash);
 
-				if ((G->hunting == HUNTING_MODE_ENABLED) && visitedShaders) {
+				// Only take the lock to add this to the visited
+				// set the first time we see it each time the
+				// visited sets are cleared:
+				if ((G->hunting == HUNTING_MODE_ENABLED) && visitedShaders
+						&& info->visited_generation != G->visited_shaders_generation) {
 					EnterCriticalSectionPretty(&G->mCriticalSection);
-					visitedShaders->insert(i->second);
+					visitedShaders->insert(info->hash);
+					info->visited_generation = G->visited_shaders_generation;
 					LeaveCriticalSection(&G->mCriticalSection);
 				}
 			}
@@ -2038,9 +2114,8 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 
 		// If the shader has been live reloaded from ShaderFixes, use the new one
 		// No longer conditional on G->hunting now that hunting may be soft enabled via key binding
-		ShaderReloadMap::iterator it = lookup_reloaded_shader(pShader);
-		if (it != G->mReloadedShaders.end() && it->second.replacement != NULL) {
-			LogDebug("  shader replaced by: %p\n", it->second.replacement);
+		if (info && info->reload && info->reload->replacement != NULL) {
+			LogDebug("  shader replaced by: %p\n", info->reload->replacement);
 
 			// It might make sense to Release() the original shader, to recover memory on GPU
 			//   -Bo3b
@@ -2051,15 +2126,14 @@ STDMETHODIMP_(void) HackerContext::SetShader(THIS_
 			// If we did want to do better here we could return a wrapper object when the game
 			// creates the original shader, and manage original/replaced/reverted/etc from there.
 			//   -DSS
-			repl_shader = (ID3D11Shader*)it->second.replacement;
+			repl_shader = (ID3D11Shader*)info->reload->replacement;
 		}
 
 		if (G->hunting == HUNTING_MODE_ENABLED) {
 			// Replacement map.
 			if (G->marking_mode == MarkingMode::ORIGINAL || !G->fix_enabled) {
-				ShaderReplacementMap::iterator j = lookup_original_shader(pShader);
-				if ((selectedShader == *currentShaderHash || !G->fix_enabled) && j != G->mOriginalShaders.end()) {
-					repl_shader = (ID3D11Shader*)j->second;
+				if ((selectedShader == *currentShaderHash || !G->fix_enabled) && info && info->original) {
+					repl_shader = (ID3D11Shader*)info->original;
 				}
 			}
 		}
@@ -2084,7 +2158,8 @@ STDMETHODIMP_(void) HackerContext::CSSetShader(THIS_
 		 &G->mVisitedComputeShaders,
 		 G->mSelectedComputeShader,
 		 &mCurrentComputeShader,
-		 &mCurrentComputeShaderHandle);
+		 &mCurrentComputeShaderHandle,
+		 &mCurrentComputeShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::CSSetSamplers(THIS_
@@ -2742,7 +2817,8 @@ STDMETHODIMP_(void) HackerContext::VSSetShader(THIS_
 		 &G->mVisitedVertexShaders,
 		 G->mSelectedVertexShader,
 		 &mCurrentVertexShader,
-		 &mCurrentVertexShaderHandle);
+		 &mCurrentVertexShaderHandle,
+		 &mCurrentVertexShaderOverride);
 }
 
 STDMETHODIMP_(void) HackerContext::PSSetShaderResources(THIS_
@@ -2768,7 +2844,8 @@ STDMETHODIMP_(void) HackerContext::PSSetShader(THIS_
 		 &G->mVisitedPixelShaders,
 		 G->mSelectedPixelShader,
 		 &mCurrentPixelShader,
-		 &mCurrentPixelShaderHandle);
+		 &mCurrentPixelShaderHandle,
+		 &mCurrentPixelShaderOverride);
 
 	if (pPixelShader) {
 		// Set custom depth texture.
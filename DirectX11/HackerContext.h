@@ -29,6 +29,13 @@ class HackerDevice;
 enum class FrameAnalysisOptions;
 struct ShaderOverride;
 
+// The ShaderOverride (or NULL) for a bound shader, looked up when it was
+// bound. Only valid while generation matches G->shader_override_generation.
+struct CurrentShaderOverride {
+	ShaderOverride *override;
+	unsigned generation;
+};
+
 
 struct DrawContext
 {
@@ -151,6 +158,7 @@ private:
 		UINT Subresource, D3D11_MAP MapType, UINT MapFlags,
 		D3D11_MAPPED_SUBRESOURCE *pMappedResource);
 	void TrackAndDivertUnmap(ID3D11Resource *pResource, UINT Subresource);
+	ShaderOverride* LookupCurrentShaderOverride(UINT64 hash, CurrentShaderOverride *current);
 	void ProcessShaderOverride(ShaderOverride *shaderOverride, bool isPixelShader, DrawContext *data);
 	ID3D11PixelShader* SwitchPSShader(ID3D11PixelShader *shader);
 	ID3D11VertexShader* SwitchVSShader(ID3D11VertexShader *shader);
@@ -184,7 +192,8 @@ private:
 		std::set<UINT64> *visitedShaders,
 		UINT64 selectedShader,
 		UINT64 *currentShaderHash,
-		ID3D11Shader **currentShaderHandle);
+		ID3D11Shader **currentShaderHandle,
+		CurrentShaderOverride *currentShaderOverride);
 	template <void (__stdcall ID3D11DeviceContext::*OrigSetShaderResources)(THIS_
 			UINT StartSlot,
 			UINT NumViews,
@@ -234,6 +243,15 @@ public:
 	ID3D11DomainShader *mCurrentDomainShaderHandle;
 	ID3D11HullShader *mCurrentHullShaderHandle;
 
+	// The ShaderOverride of each current shader, so BeforeDraw doesn't
+	// have to search the ShaderOverride map for every stage every draw:
+	CurrentShaderOverride mCurrentVertexShaderOverride;
+	CurrentShaderOverride mCurrentPixelShaderOverride;
+	CurrentShaderOverride mCurrentComputeShaderOverride;
+	CurrentShaderOverride mCurrentGeometryShaderOverride;
+	CurrentShaderOverride mCurrentDomainShaderOverride;
+	CurrentShaderOverride mCurrentHullShaderOverride;
+
 	/*** IUnknown methods ***/
 
 	HRESULT STDMETHODCALLTYPE QueryInterface(
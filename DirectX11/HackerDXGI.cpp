@@ -275,6 +275,14 @@ void HackerSwapChain::RunFrameActions()
 	if (G->gReloadConfigPending)
 		ReloadConfig(mHackerDevice);
 
+	// Likewise for reload_fixes_watch, which reloads ShaderFixes as soon
+	// as a file in it is saved:
+	PollShaderFixesWatch(mHackerDevice);
+
+	// Make any marked shaders that have finished copying to ShaderFixes
+	// in the background live:
+	CompleteCopyToFixes(mHackerDevice);
+
 	// Draw the on-screen overlay text with hunting and informational
 	// messages, before final Present. We now do this after the shader and
 	// config reloads, so if they have any notices we will see them this
@@ -32,6 +32,8 @@
 #include "D3D_Shaders\stdafx.h"
 #include "ResourceHash.h"
 #include "ShaderRegex.h"
+#include "ShaderHash.h"
+#include "BackgroundWriter.h"
 #include "CommandList.h"
 #include "Hunting.h"
 
@@ -567,16 +569,20 @@ static void RegisterForReload(ID3D11DeviceChild* ppShader, UINT64 hash, wstring
 	if (pClassLinkage)
 		pClassLinkage->AddRef();
 
-	G->mReloadedShaders[ppShader].hash = hash;
-	G->mReloadedShaders[ppShader].shaderType = shaderType;
-	G->mReloadedShaders[ppShader].shaderModel = shaderModel;
-	G->mReloadedShaders[ppShader].linkage = pClassLinkage;
-	G->mReloadedShaders[ppShader].byteCode = byteCode;
-	G->mReloadedShaders[ppShader].timeStamp = timeStamp;
-	G->mReloadedShaders[ppShader].replacement = NULL;
-	G->mReloadedShaders[ppShader].infoText = text;
-	G->mReloadedShaders[ppShader].deferred_replacement_candidate = deferred_replacement_candidate;
-	G->mReloadedShaders[ppShader].deferred_replacement_processed = false;
+	ShaderInfo *info = &G->mShaderInfo[ppShader];
+	info->hash = hash;
+	info->reload = std::make_unique<OriginalShaderInfo>();
+	info->reload->hash = hash;
+	info->reload->shaderType = shaderType;
+	info->reload->shaderModel = shaderModel;
+	info->reload->bytecodeShaderModel = GetShaderModelFromVersionToken(byteCode->GetBufferPointer(), byteCode->GetBufferSize());
+	info->reload->linkage = pClassLinkage;
+	info->reload->byteCode.store(byteCode, shaderType);
+	info->reload->timeStamp = timeStamp;
+	info->reload->replacement = NULL;
+	info->reload->infoText = text;
+	info->reload->deferred_replacement_candidate = deferred_replacement_candidate;
+	info->reload->deferred_replacement_processed = false;
 }
 
 
@@ -798,7 +804,8 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 			pShaderModel = shaderModel;
 			pTimeStamp = ftWrite;
 			std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_to_utf16;
-			pHeaderLine = utf8_to_utf16.from_bytes(srcData, strchr(srcData, '\n'));
+			const char *eol = (const char*)memchr(srcData, '\n', srcDataSize);
+			pHeaderLine = utf8_to_utf16.from_bytes(srcData, eol ? eol : srcData + srcDataSize);
 
 			// Way too many obscure interractions in this function, using another
 			// temporary variable to not modify anything already here and reduce
@@ -852,19 +859,11 @@ static bool ReplaceHLSLShader(__in UINT64 hash, const wchar_t *pShaderType,
 			if (G->CACHE_SHADERS && pCode)
 			{
 				swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_replace.bin", G->SHADER_PATH, hash, pShaderType);
-				FILE *fw;
-				wfopen_ensuring_access(&fw, path, L"wb");
-				if (fw)
-				{
-					LogInfo("    storing compiled shader to %S\n", path);
-					fwrite(pCode, 1, pCodeSize, fw);
-					fclose(fw);
-
-					// Set the last modified timestamp on the cached shader to match the
-					// .txt file it is created from, so we can later check its validity:
-					set_file_last_write_time(path, &ftWrite);
-				} else
-					LogInfo("    error writing compiled shader to %S\n", path);
+				LogInfo("    storing compiled shader to %S\n", path);
+
+				// Set the last modified timestamp on the cached shader to match the
+				// .txt file it is created from, so we can later check its validity:
+				queue_background_write(path, pCode, pCodeSize, &ftWrite);
 			}
 		}
 	}
@@ -927,7 +926,8 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 			pShaderModel = shaderModel;
 			pTimeStamp = ftWrite;
 			std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_to_utf16;
-			pHeaderLine = utf8_to_utf16.from_bytes(asmTextBytes.data(), strchr(asmTextBytes.data(), '\n'));
+			const char *eol = (const char*)memchr(asmTextBytes.data(), '\n', asmTextBytes.size());
+			pHeaderLine = utf8_to_utf16.from_bytes(asmTextBytes.data(), eol ? eol : asmTextBytes.data() + asmTextBytes.size());
 
 			vector<byte> byteCode(pBytecodeLength);
 			memcpy(byteCode.data(), pShaderBytecode, pBytecodeLength);
@@ -948,23 +948,12 @@ static bool ReplaceASMShader(__in UINT64 hash, const wchar_t *pShaderType, const
 					if (G->CACHE_SHADERS && pCode && parse_errors.empty())
 					{
 						// Write reassembled binary output as a cached shader.
-						FILE *fw;
 						swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls.bin", G->SHADER_PATH, hash, pShaderType);
-						wfopen_ensuring_access(&fw, path, L"wb");
-						if (fw)
-						{
-							LogInfoW(L"    storing reassembled binary to %s\n", path);
-							fwrite(byteCode.data(), 1, byteCode.size(), fw);
-							fclose(fw);
-
-							// Set the last modified timestamp on the cached shader to match the
-							// .txt file it is created from, so we can later check its validity:
-							set_file_last_write_time(path, &ftWrite);
-						}
-						else
-						{
-							LogInfoW(L"    error storing reassembled binary to %s\n", path);
-						}
+						LogInfoW(L"    storing reassembled binary to %s\n", path);
+
+						// Set the last modified timestamp on the cached shader to match the
+						// .txt file it is created from, so we can later check its validity:
+						queue_background_write(path, byteCode.data(), byteCode.size(), &ftWrite);
 					}
 				} else {
 					// Parse errors are currently being treated as non-fatal on
@@ -1002,7 +991,8 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 {
 	wchar_t val[MAX_PATH];
 	string asmText;
-	FILE *fw = NULL;
+	string exportText;
+	bool exporting = false;
 	string shaderModel = "";
 	bool patched = false;
 	bool errorOccurred = false;
@@ -1053,25 +1043,23 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 
 	if ((G->EXPORT_HLSL >= 1) || (G->EXPORT_FIXED && patched))
 	{
-		errno_t err = wfopen_ensuring_access(&fw, val, L"wb");
-		if (err != 0 || !fw)
-		{
-			LogInfo("    !!! Fail to open replace.txt file: 0x%x\n", err);
-			return NULL;
-		}
+		// The file is assembled in memory and handed off to the
+		// background writer once complete, so the game isn't waiting
+		// on the disk while creating shaders:
+		exporting = true;
 
 		LogInfo("    storing patched shader to %S\n", val);
 		// Save decompiled HLSL code to that new file.
-		fwrite(decompiledCode.c_str(), 1, decompiledCode.size(), fw);
+		exportText = decompiledCode;
 
 		// Now also write the ASM text to the shader file as a set of comments at the bottom.
 		// That will make the ASM code the master reference for fixing shaders, and should be more
 		// convenient, especially in light of the numerous decompiler bugs we see.
 		if (G->EXPORT_HLSL >= 2)
 		{
-			fprintf_s(fw, "\n\n/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Original ASM ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
-			fwrite(asmText.c_str(), 1, asmText.size(), fw);
-			fprintf_s(fw, "\n//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n");
+			exportText += "\n\n/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Original ASM ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+			exportText += asmText;
+			exportText += "\n//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n";
 
 		}
 	}
@@ -1116,16 +1104,18 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		LogInfo("\n---------------------------------------------- END ----------------------------------------------\n");
 
 		// And write the errors to the HLSL file as comments too, as a more convenient spot to see them.
-		fprintf_s(fw, "\n\n/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~ HLSL errors ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
-		fwrite(errMsg, 1, errSize - 1, fw);
-		fprintf_s(fw, "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n");
+		if (exporting) {
+			exportText += "\n\n/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~ HLSL errors ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+			exportText.append((const char*)errMsg, errSize - 1);
+			exportText += "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n";
+		}
 	}
 	if (pErrorMsgs)
 		pErrorMsgs->Release();
 
 	// If requested by .ini, also write the newly re-compiled assembly code to the file.  This gives a direct
 	// comparison between original ASM, and recompiled ASM.
-	if ((G->EXPORT_HLSL >= 3) && pCompiledOutput)
+	if (exporting && (G->EXPORT_HLSL >= 3) && pCompiledOutput)
 	{
 		asmText = BinaryToAsmText(pCompiledOutput->GetBufferPointer(), pCompiledOutput->GetBufferSize(), G->patch_cb_offsets);
 		if (asmText.empty())
@@ -1134,9 +1124,9 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		}
 		else
 		{
-			fprintf_s(fw, "\n\n/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Recompiled ASM ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
-			fwrite(asmText.c_str(), 1, asmText.size(), fw);
-			fprintf_s(fw, "\n//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n");
+			exportText += "\n\n/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~ Recompiled ASM ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n";
+			exportText += asmText;
+			exportText += "\n//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n";
 		}
 	}
 
@@ -1154,15 +1144,17 @@ static bool DecompileAndPossiblyPatchShader(__in UINT64 hash,
 		pCompiledOutput = NULL;
 	}
 
-	if (fw)
+	if (exporting)
 	{
-		// Any HLSL compiled shaders are reloading candidates, if moved to ShaderFixes
+		// Any HLSL compiled shaders are reloading candidates, if moved to ShaderFixes.
+		// We no longer have the file open to ask for its timestamp, so we pick one
+		// now and have the background writer stamp the file with it:
 		FILETIME ftWrite;
-		GetFileTime(fw, NULL, NULL, &ftWrite);
+		GetSystemTimeAsFileTime(&ftWrite);
 		foundShaderModel = shaderModel;
 		timeStamp = ftWrite;
 
-		fclose(fw);
+		queue_background_write(val, exportText.data(), exportText.size(), &ftWrite);
 	}
 
 	return !!pCode;
@@ -1218,13 +1210,27 @@ char* HackerDevice::_ReplaceShaderFromShaderFixes(UINT64 hash, const wchar_t *sh
 	if (!G->SHADER_PATH[0] || !G->SHADER_CACHE_PATH[0])
 		return NULL;
 
-	// Export every original game shader as a .bin file.
-	if (G->EXPORT_BINARY)
-		ExportOrigBinary(hash, shaderType, pShaderBytecode, BytecodeLength);
+	// Export every original game shader as a .bin file and/or every shader
+	// seen as an ASM text file. These are both done on the background
+	// writer thread with a copy of the bytecode, since the disassembly and
+	// disk I/O would otherwise be done while the game waits on us:
+	if (G->EXPORT_BINARY || G->EXPORT_SHADERS) {
+		shared_ptr<string> bytecode = make_shared<string>((const char*)pShaderBytecode, BytecodeLength);
+		wstring type(shaderType);
+		bool patch_cb_offsets = G->patch_cb_offsets;
+
+		if (G->EXPORT_BINARY) {
+			queue_background_job(NULL, BytecodeLength, [hash, type, bytecode]() {
+				ExportOrigBinary(hash, type.c_str(), bytecode->data(), bytecode->size());
+			});
+		}
 
-	// Export every shader seen as an ASM text file.
-	if (G->EXPORT_SHADERS)
-		CreateAsmTextFile(G->SHADER_CACHE_PATH, hash, shaderType, pShaderBytecode, BytecodeLength, G->patch_cb_offsets);
+		if (G->EXPORT_SHADERS) {
+			queue_background_job(NULL, BytecodeLength, [hash, type, bytecode, patch_cb_offsets]() {
+				CreateAsmTextFile(G->SHADER_CACHE_PATH, hash, type.c_str(), bytecode->data(), bytecode->size(), patch_cb_offsets);
+			});
+		}
+	}
 
 
 	// Read the binary compiled shaders, as previously cached shaders.  This is how
@@ -1275,23 +1281,73 @@ HRESULT HackerDevice::ReplaceShaderFromShaderFixes(UINT64 hash,
 		wchar_t *shaderType)
 {
 	ShaderOverrideMap::iterator override;
+	ShaderFixesCache::iterator cached;
 	const char *overrideShaderModel = NULL;
-	SIZE_T replaceShaderSize;
+	SIZE_T replaceShaderSize = 0;
 	string shaderModel;
 	wstring headerLine;
-	FILETIME ftWrite;
+	FILETIME ftWrite = {0};
+	char *replaceShader = NULL;
+	bool cacheable, found = false;
 	HRESULT hr = E_FAIL;
 
-	// Check if the user has overridden the shader model:
-	override = lookup_shaderoverride(hash);
-	if (override != G->mShaderOverrideMap.end()) {
-		if (override->second.model[0])
-			overrideShaderModel = override->second.model;
+	// If we have already been through this for an identical shader we
+	// already know the answer, and can skip all the file system checks,
+	// exporting, decompiling and compiling that might go into it. Only
+	// DXBC shaders have a checksum we can use to be sure it is identical:
+	cacheable = BytecodeLength >= 20 && !memcmp(pShaderBytecode, "DXBC", 4);
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+		G->shader_fixes_cache_lookups++;
+		cached = G->mShaderFixesCache.find(hash);
+		if (cacheable && cached != G->mShaderFixesCache.end()
+				&& cached->second.shaderType == shaderType
+				&& cached->second.originalLength == BytecodeLength
+				&& !memcmp(cached->second.originalChecksum, (const char*)pShaderBytecode + 4, 16)) {
+			G->shader_fixes_cache_hits++;
+			found = true;
+			if (!cached->second.bytecode.empty()) {
+				replaceShaderSize = cached->second.bytecode.size();
+				replaceShader = new char[replaceShaderSize];
+				memcpy(replaceShader, cached->second.bytecode.data(), replaceShaderSize);
+				shaderModel = cached->second.shaderModel;
+				ftWrite = cached->second.timeStamp;
+				headerLine = cached->second.headerLine;
+			}
+		}
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	if (found) {
+		LogInfo("    %016llx-%S already processed for an identical shader\n", hash, shaderType);
+	} else {
+		// Check if the user has overridden the shader model:
+		override = lookup_shaderoverride(hash);
+		if (override != G->mShaderOverrideMap.end()) {
+			if (override->second.model[0])
+				overrideShaderModel = override->second.model;
+		}
+
+		replaceShader = _ReplaceShaderFromShaderFixes(hash, shaderType,
+				pShaderBytecode, BytecodeLength, replaceShaderSize,
+				shaderModel, ftWrite, headerLine, overrideShaderModel);
+
+		EnterCriticalSectionPretty(&G->mCriticalSection);
+			if (cacheable && (replaceShader || G->mShaderFixesCache.size() < MAX_SHADER_FIXES_CACHE_ENTRIES
+						|| G->mShaderFixesCache.count(hash))) {
+				ShaderFixesResult *result = &G->mShaderFixesCache[hash];
+				result->shaderType = shaderType;
+				result->originalLength = BytecodeLength;
+				memcpy(result->originalChecksum, (const char*)pShaderBytecode + 4, 16);
+				result->bytecode.clear();
+				if (replaceShader) {
+					result->bytecode.assign(replaceShader, replaceShader + replaceShaderSize);
+					result->shaderModel = shaderModel;
+					result->timeStamp = ftWrite;
+					result->headerLine = headerLine;
+				}
+			}
+		LeaveCriticalSection(&G->mCriticalSection);
 	}
 
-	char *replaceShader = _ReplaceShaderFromShaderFixes(hash, shaderType,
-			pShaderBytecode, BytecodeLength, replaceShaderSize,
-			shaderModel, ftWrite, headerLine, overrideShaderModel);
 	if (!replaceShader)
 		return E_FAIL;
 
@@ -1324,8 +1380,6 @@ HRESULT HackerDevice::ReplaceShaderFromShaderFixes(UINT64 hash,
 		}
 	}
 
-	// FIXME: We have some very similar data structures that we should merge together:
-	// mReloadedShaders and mOriginalShader.
 	KeepOriginalShader<ID3D11Shader, OrigCreateShader>
 		(hash, shaderType, *ppShader, pShaderBytecode, BytecodeLength, pClassLinkage);
 
@@ -1378,17 +1432,18 @@ HRESULT HackerDevice::ProcessShaderNotFoundInShaderFixes(UINT64 hash,
 				memcpy(blob->GetBufferPointer(), pShaderBytecode, blob->GetBufferSize());
 				RegisterForReload(*ppShader, hash, shaderType, "bin", pClassLinkage, blob, {0}, L"", true);
 
-				// Also add the original shader to the original shaders
-				// map so that if it is later replaced marking_mode =
-				// original and depth buffer filtering will work:
-				if (lookup_original_shader(*ppShader) == end(G->mOriginalShaders)) {
+				// Also record the original shader so that if it is
+				// later replaced marking_mode = original and depth
+				// buffer filtering will work:
+				ShaderInfo *info = &G->mShaderInfo[*ppShader];
+				if (!info->original) {
 					// Since we are both returning *and* storing this we need to
 					// bump the refcount to 2, otherwise it could get freed and we
 					// may get a crash later in RevertMissingShaders, especially
 					// easy to expose with the auto shader patching engine
 					// and reverting shaders:
 					(*ppShader)->AddRef();
-					G->mOriginalShaders[*ppShader] = *ppShader;
+					info->original = *ppShader;
 				}
 			}
 		LeaveCriticalSection(&G->mCriticalSection);
@@ -1444,35 +1499,25 @@ void CleanupShaderMaps(ID3D11DeviceChild *handle)
 
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 
-	{
-		ShaderMap::iterator i = lookup_shader_hash(handle);
-		if (i != G->mShaders.end()) {
-			LogInfo("Shader handle %p reused, previous hash was: %016llx\n", handle, i->second);
-			G->mShaders.erase(i);
+	ShaderInfoMap::iterator i = lookup_shader_info(handle);
+	if (i != G->mShaderInfo.end()) {
+		LogInfo("Shader handle %p reused, previous hash was: %016llx\n", handle, i->second.hash);
+
+		if (i->second.reload) {
+			LogInfo("Shader handle %p reused, releasing previous live reload info\n", handle);
+			if (i->second.reload->replacement)
+				i->second.reload->replacement->Release();
+			i->second.reload->byteCode.release();
+			if (i->second.reload->linkage)
+				i->second.reload->linkage->Release();
 		}
-	}
 
-	{
-		ShaderReloadMap::iterator i = lookup_reloaded_shader(handle);
-		if (i != G->mReloadedShaders.end()) {
-			LogInfo("Shader handle %p reused, found in mReloadedShaders\n", handle);
-			if (i->second.replacement)
-				i->second.replacement->Release();
-			if (i->second.byteCode)
-				i->second.byteCode->Release();
-			if (i->second.linkage)
-				i->second.linkage->Release();
-			G->mReloadedShaders.erase(i);
-		}
-	}
-
-	{
-		ShaderReplacementMap::iterator i = lookup_original_shader(handle);
-		if (i != G->mOriginalShaders.end()) {
+		if (i->second.original) {
 			LogInfo("Shader handle %p reused, releasing previous original shader\n", handle);
-			i->second->Release();
-			G->mOriginalShaders.erase(i);
+			i->second.original->Release();
 		}
+
+		G->mShaderInfo.erase(i);
 	}
 
 	LeaveCriticalSection(&G->mCriticalSection);
@@ -1507,7 +1552,7 @@ void HackerDevice::KeepOriginalShader(UINT64 hash, wchar_t *shaderType,
 		hr = (mOrigDevice1->*OrigCreateShader)(pShaderBytecode, BytecodeLength, pClassLinkage, &originalShader);
 		CleanupShaderMaps(originalShader);
 		if (SUCCEEDED(hr))
-			G->mOriginalShaders[pShader] = originalShader;
+			G->mShaderInfo[pShader].original = originalShader;
 
 		// Unlike the *other* code path in CreateShader that can also
 		// fill out this structure, we do *not* bump the refcount on
@@ -1540,6 +1585,11 @@ STDMETHODIMP_(ULONG) HackerDevice::Release(THIS)
 
 		unregister_hacker_device(this);
 
+		// Last chance to get any shaders still waiting to be exported
+		// or cached to disk - by the time DllMain is called on exit we
+		// can no longer wait for the background writer:
+		flush_background_writer();
+
 		if (mStereoHandle)
 		{
 			int result = NvAPI_Stereo_DestroyHandle(mStereoHandle);
@@ -2533,6 +2583,12 @@ fnv:
 				goto fnv;
 			LogInfo("  Bytecode hash = %016I64x\n", hash);
 			break;
+
+		case ShaderHashType::FAST:
+			hash = fast_shader_hash(pShaderBytecode, BytecodeLength);
+			LogInfo("      Fast hash = %016I64x\n", hash);
+			hash = resolve_fast_shader_hash(hash, pShaderBytecode, BytecodeLength);
+			break;
 	}
 
 	return hash;
@@ -2581,7 +2637,7 @@ STDMETHODIMP HackerDevice::CreateShader(THIS_
 
 	if (hr == S_OK) {
 		EnterCriticalSectionPretty(&G->mCriticalSection);
-			G->mShaders[*ppShader] = hash;
+			G->mShaderInfo[*ppShader].hash = hash;
 			LogDebugW(L"    %ls: handle = %p, hash = %016I64x\n", shaderType, *ppShader, hash);
 		LeaveCriticalSection(&G->mCriticalSection);
 	}
@@ -4,6 +4,8 @@
 #include <sstream>
 #include <D3Dcompiler.h>
 #include <codecvt>
+#include <algorithm>
+#include <list>
 
 #include "ScreenGrab.h"
 #include "wincodec.h"
@@ -20,6 +22,8 @@
 #include "profiling.h"
 #include "FrameAnalysis.h"
 #include "ShaderRegex.h"
+#include "FileChangeNotifier.h"
+#include "BackgroundWriter.h"
 
 // bo3b: For this routine, we have a lot of warnings in x64, from converting a size_t result into the needed
 //  DWORD type for the Write calls.  These are writing 256 byte strings, so there is never a chance that it 
@@ -485,14 +489,93 @@ void MigotoIncludeHandler::push_dir(const char *path)
 		dir_stack.push_back("");
 }
 
+// Cache of included files, shared between every compilation on any thread.
+// Most fixes include the same few helper headers from every shader, so when
+// hundreds of shaders are compiled from ShaderFixes at launch (or on a
+// reload) we would otherwise be reading each header hundreds of times. Files
+// are keyed by their full lower case path, and we still check the timestamp
+// and size on every #include so that editing a header and reloading will
+// pick up the change:
+struct IncludeCacheEntry
+{
+	FILETIME timeStamp;
+	UINT64 size;
+	std::shared_ptr<const string> data;
+};
+static std::unordered_map<wstring, IncludeCacheEntry> include_cache;
+static SRWLOCK include_cache_lock = SRWLOCK_INIT;
+
+static wstring include_cache_key(const wstring &path)
+{
+	wchar_t full_path[MAX_PATH];
+	wstring ret;
+
+	if (GetFullPathName(path.c_str(), MAX_PATH, full_path, NULL))
+		ret = full_path;
+	else
+		ret = path;
+
+	std::transform(ret.begin(), ret.end(), ret.begin(), ::towlower);
+	return ret;
+}
+
+static std::shared_ptr<const string> read_include_file(const wstring &path, WIN32_FILE_ATTRIBUTE_DATA *attributes)
+{
+	std::shared_ptr<const string> ret;
+	IncludeCacheEntry entry;
+	wstring key = include_cache_key(path);
+	DWORD read;
+	HANDLE f;
+
+	entry.timeStamp = attributes->ftLastWriteTime;
+	entry.size = ((UINT64)attributes->nFileSizeHigh << 32) | attributes->nFileSizeLow;
+
+	AcquireSRWLockShared(&include_cache_lock);
+	auto i = include_cache.find(key);
+	if (i != include_cache.end()
+			&& !CompareFileTime(&i->second.timeStamp, &entry.timeStamp)
+			&& i->second.size == entry.size)
+		ret = i->second.data;
+	ReleaseSRWLockShared(&include_cache_lock);
+
+	if (ret) {
+		LogDebug("      (cached)\n");
+		return ret;
+	}
+
+	f = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (f == INVALID_HANDLE_VALUE) {
+		LogInfo("      Error opening included file: %S\n", path.c_str());
+		return NULL;
+	}
+
+	string *buf = new string((size_t)entry.size, '\0');
+	entry.data.reset(buf);
+	if (!ReadFile(f, &(*buf)[0], (DWORD)entry.size, &read, 0) || entry.size != read) {
+		LogInfo("      Error reading included file.\n");
+		CloseHandle(f);
+		return NULL;
+	}
+	CloseHandle(f);
+
+	// If the file changes after we looked at the timestamp we will read
+	// it again next time since the timestamp won't match, so there's no
+	// danger of caching stale contents under the new timestamp:
+	AcquireSRWLockExclusive(&include_cache_lock);
+	include_cache[key] = entry;
+	ReleaseSRWLockExclusive(&include_cache_lock);
+
+	return entry.data;
+}
+
 STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFileName, LPCVOID pParentData, LPCVOID *ppData, UINT *pBytes)
 {
 	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> codec;
-	char *buf = NULL;
-	DWORD size, read;
+	std::shared_ptr<const string> data;
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
 	string apath;
 	wstring wpath;
-	HANDLE f;
+	bool found;
 
 	LogDebug("      MigotoIncludeHandler::Open(%p, %u, %s, %p)\n", this, IncludeType, pFileName, pParentData);
 
@@ -517,8 +600,10 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 		apath = dir_stack.front() + pFileName;
 	wpath = codec.from_bytes(apath);
 
-	f = CreateFile(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (f == INVALID_HANDLE_VALUE && !G->recursive_include) {
+	// We only need the timestamp to check the include cache, so we don't
+	// open the file unless we actually need to read it:
+	found = !!GetFileAttributesEx(wpath.c_str(), GetFileExInfoStandard, &attributes);
+	if (!found && !G->recursive_include) {
 		// If the included file is not found relative to the includer
 		// D3D_COMPILE_STANDARD_FILE_INCLUDE falls back to trying to
 		// open the file from the current working directory, so we do
@@ -531,9 +616,9 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 		// enabled as that already disables backwards compatibility.
 		apath = pFileName;
 		wpath = codec.from_bytes(apath);
-		f = CreateFile(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		found = !!GetFileAttributesEx(wpath.c_str(), GetFileExInfoStandard, &attributes);
 	}
-	if (f == INVALID_HANDLE_VALUE) {
+	if (!found || (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
 		LogInfo("      Error opening included file: %s\n", apath.c_str());
 		return E_FAIL;
 	}
@@ -552,50 +637,175 @@ STDMETHODIMP MigotoIncludeHandler::Open(D3D_INCLUDE_TYPE IncludeType, LPCSTR pFi
 			break;
 	}
 
-	size = GetFileSize(f, 0);
-	buf = new char[size];
-
-	if (!ReadFile(f, buf, size, &read, 0) || size != read) {
-		LogInfo("      Error reading included file.\n");
-		goto err_free;
-	}
-	CloseHandle(f);
+	data = read_include_file(wpath, &attributes);
+	if (!data)
+		return E_FAIL;
 
-	*pBytes = size;
-	*ppData = buf;
+	*pBytes = (UINT)data->size();
+	*ppData = data->data();
+	open_files.emplace(*ppData, data);
 	push_dir(apath.c_str());
-	LogDebug("       -> %p\n", buf);
+	LogDebug("       -> %p\n", *ppData);
 
 	return S_OK;
-
-err_free:
-	delete [] buf;
-	CloseHandle(f);
-	return E_FAIL;
 }
 
 STDMETHODIMP MigotoIncludeHandler::Close(LPCVOID pData)
 {
 	LogDebug("      MigotoIncludeHandler::Close(%p, %p)\n", this, pData);
-	delete [] pData;
+	auto i = open_files.find(pData);
+	if (i != open_files.end())
+		open_files.erase(i);
 	dir_stack.pop_back();
 	return S_OK;
 }
 
+// Persistent record of what was in each file in ShaderFixes the last time we
+// reloaded it, saved in ShaderCache so that it survives a restart. The
+// shaders themselves already track the timestamp of the file they were loaded
+// from, which is enough to skip files that haven't been touched without even
+// opening them, but a timestamp alone can't tell us if a file was saved again
+// without changes, checked out of version control, or touched by a build
+// script - in which case we read it and compare a digest of the contents
+// instead of recompiling it:
+struct ShaderFixState
+{
+	FILETIME timeStamp;
+	UINT64 size;
+	UINT64 digest;
+};
+typedef std::unordered_map<wstring, ShaderFixState> ShaderFixStates;
+static ShaderFixStates shader_fix_states;
+static bool shader_fix_states_loaded;
+static bool shader_fix_states_dirty;
+
+#define SHADER_FIX_STATES_FILE L"ShaderFixesState.txt"
+
+// One line per file: digest, size, timestamp and the UTF-8 file name. An entry
+// is only ever used if the shaders were loaded from a file with exactly the
+// same timestamp and size, so a stale or foreign table can cost a recompile,
+// but can't cause us to skip one. Must be called with G->mCriticalSection held.
+static void LoadShaderFixStates()
+{
+	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_to_utf16;
+	wchar_t path[MAX_PATH];
+	char line[MAX_PATH * 4];
+	char name[MAX_PATH * 4];
+	ShaderFixState state;
+	FILE *f;
+
+	if (shader_fix_states_loaded)
+		return;
+	shader_fix_states_loaded = true;
+
+	if (!G->SHADER_CACHE_PATH[0])
+		return;
+
+	swprintf_s(path, MAX_PATH, L"%ls\\" SHADER_FIX_STATES_FILE, G->SHADER_CACHE_PATH);
+	if (_wfopen_s(&f, path, L"r") || !f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf_s(line, "%llx %llu %lx %lx %[^\n]", &state.digest, &state.size,
+				&state.timeStamp.dwHighDateTime, &state.timeStamp.dwLowDateTime,
+				name, (unsigned)sizeof(name)) != 5)
+			continue;
+		try {
+			shader_fix_states[utf8_to_utf16.from_bytes(name)] = state;
+		} catch (...) {
+			// Not valid UTF-8, so not anything we wrote
+		}
+	}
+	fclose(f);
+
+	LogInfo("Loaded %Iu ShaderFixes digests from %S\n", shader_fix_states.size(), path);
+}
+
+// Written from the background writer, so it never holds up a reload. Must be
+// called with G->mCriticalSection held.
+static void SaveShaderFixStates()
+{
+	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf16_to_utf8;
+	wchar_t path[MAX_PATH];
+	std::string contents;
+	char buf[64];
+
+	if (!shader_fix_states_dirty || !G->SHADER_CACHE_PATH[0])
+		return;
+	shader_fix_states_dirty = false;
+
+	for (auto &i : shader_fix_states) {
+		sprintf_s(buf, sizeof(buf), "%016llx %llu %08lx %08lx ", i.second.digest, i.second.size,
+				i.second.timeStamp.dwHighDateTime, i.second.timeStamp.dwLowDateTime);
+		contents += buf;
+		contents += utf16_to_utf8.to_bytes(i.first);
+		contents += "\n";
+	}
+
+	CreateDirectory(G->SHADER_CACHE_PATH, 0);
+	swprintf_s(path, MAX_PATH, L"%ls\\" SHADER_FIX_STATES_FILE, G->SHADER_CACHE_PATH);
+	queue_background_write(path, contents.data(), contents.size(), NULL);
+}
+
+// One file from ShaderFixes to reload, along with every shader handle that it
+// needs to be applied to (there can be several with the same hash).
+struct ShaderFixReload
+{
+	wstring fileName;
+	UINT64 hash;
+	vector<ID3D11DeviceChild*> handles;
+	wstring shaderType;		// "vs", "ps", "cs" maybe "gs"
+	string shaderModel;
+	ID3DBlob *origByteCode;		// Only recalled for ASM or "bin" shaders
+	bool check_digest;
+	UINT64 last_digest;
+
+	// Filled out by RegenerateShader:
+	FILETIME timeStamp;
+	UINT64 size;
+	UINT64 digest;
+	bool unchanged;
+	bool failed;
+	ID3DBlob *compiled;
+	wstring headerLine;		// First line of the HLSL file.
+	string errText;
+
+	ShaderFixReload() :
+		hash(0),
+		origByteCode(NULL),
+		check_digest(false),
+		last_digest(0),
+		timeStamp(),
+		size(0),
+		digest(0),
+		unchanged(false),
+		failed(false),
+		compiled(NULL)
+	{}
+};
+
+typedef std::unordered_multimap<UINT64, ID3D11DeviceChild*> ShaderFixesIndex;
+
+// The assembler keeps some global state, so while we can compile HLSL on any
+// number of threads at once, assembling has to be done one at a time:
+static SRWLOCK assembler_lock = SRWLOCK_INIT;
+
 // Compile a new shader from  HLSL text input, and report on errors if any.
-// Return the binary blob of pCode to be activated with CreateVertexShader or CreatePixelShader.
-// If the timeStamp has not changed from when it was loaded, skip the recompile, and return false as not an 
-// error, but skipped.  On actual errors, return true so that we bail out.
+// On success job->compiled is the binary blob to be activated with CreateVertexShader or CreatePixelShader.
+// If the file contents have not changed since they were last reloaded, skip the recompile and set
+// job->unchanged instead. On actual errors job->failed is set so that we bail out.
+//
+// This does not touch any of our data structures and must be called *without*
+// holding G->mCriticalSection, since a reload may run several of these in
+// parallel and we don't want to stall the game while they compile.
 
 // Compile example taken from: http://msdn.microsoft.com/en-us/library/windows/desktop/hh968107(v=vs.85).aspx
 
-static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const char *shaderModel, 
-	UINT64 hash, wstring shaderType, ID3DBlob *origByteCode,
-	__out FILETIME* timeStamp, __out wstring &headerLine, _Outptr_ ID3DBlob** pCode, string *errText)
+static void RegenerateShader(wchar_t *shaderFixPath, ShaderFixReload *job)
 {
-	*pCode = nullptr;
 	wchar_t fullName[MAX_PATH];
 	char apath[MAX_PATH];
+	const wchar_t *fileName = job->fileName.c_str();
 	swprintf_s(fullName, MAX_PATH, L"%s\\%s", shaderFixPath, fileName);
 
 	WarnIfConflictingShaderExists(fullName);
@@ -604,8 +814,8 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 	if (f == INVALID_HANDLE_VALUE)
 	{
 		LogInfo("    ReloadShader shader not found: %ls\n", fullName);
-
-		return true;
+		job->failed = true;
+		return;
 	}
 
 
@@ -620,18 +830,35 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 	{
 		LogInfo("    Error reading txt file.\n");
 		CloseHandle(f);
-
-		return true;
+		job->failed = true;
+		return;
 	}
 	CloseHandle(f);
 
-	// Check file time stamp, and only recompile shaders that have been edited since they were loaded.
-	// This dramatically improves the F10 reload speed.
-	if (!CompareFileTime(timeStamp, &curFileTime))
+	job->timeStamp = curFileTime;
+	job->size = srcDataSize;
+	job->digest = fnv_64_buf(srcData.data(), srcDataSize);
+
+	// The timestamp has changed, but if the contents haven't there's no
+	// need to go through the compiler again:
+	if (job->check_digest && job->digest == job->last_digest)
 	{
-		return false;
+		job->unchanged = true;
+		return;
 	}
-	*timeStamp = curFileTime;
+
+	// If shaderModel is "bin", that means the original was loaded as a binary object, and thus shaderModel is unknown.
+	// Disassemble the binary to get that string.
+	if (job->shaderModel.compare("bin") == 0)
+	{
+		job->shaderModel = GetShaderModel(job->origByteCode->GetBufferPointer(), job->origByteCode->GetBufferSize());
+		if (job->shaderModel.empty())
+		{
+			job->failed = true;
+			return;
+		}
+	}
+	const char *shaderModel = job->shaderModel.c_str();
 
 	// Now that we are sure to be reloading, let's see if it's an ASM file and assemble instead.
 	ID3DBlob* pByteCode = nullptr;
@@ -675,8 +902,7 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 				fwrite(errMsg, 1, errSize - 1, LogFile);
 			}
 			LogInfo("---------------------------------------------- END ----------------------------------------------\n");
-			if (errText)
-				*errText = string((char*)pErrorMsgs->GetBufferPointer(), pErrorMsgs->GetBufferSize() - 1);
+			job->errText = string((char*)pErrorMsgs->GetBufferPointer(), pErrorMsgs->GetBufferSize() - 1);
 			pErrorMsgs->Release();
 		}
 
@@ -687,7 +913,8 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 				pByteCode->Release();
 				pByteCode = 0;
 			}
-			return true;
+			job->failed = true;
+			return;
 		}
 	}
 	else
@@ -697,9 +924,10 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 		LogInfo("    assembling replacement ASM code with shader model %s\n", shaderModel);
 
 		// We need original byte code unchanged, so make a copy.
-		vector<byte> byteCode(origByteCode->GetBufferSize());
-		memcpy(byteCode.data(), origByteCode->GetBufferPointer(), origByteCode->GetBufferSize());
+		vector<byte> byteCode(job->origByteCode->GetBufferSize());
+		memcpy(byteCode.data(), job->origByteCode->GetBufferPointer(), job->origByteCode->GetBufferSize());
 
+		AcquireSRWLockExclusive(&assembler_lock);
 		try
 		{
 			// Treat parse errors on shader reload as fatal since there should
@@ -708,10 +936,13 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 		}
 		catch (const exception &e)
 		{
+			ReleaseSRWLockExclusive(&assembler_lock);
 			LogOverlay(LOG_NOTICE, "Error assembling %S: %s\n",
 					fileName, e.what());
-			return true;
+			job->failed = true;
+			return;
 		}
+		ReleaseSRWLockExclusive(&assembler_lock);
 
 		// Since the re-assembly worked, let's make it the active shader code.
 		HRESULT ret = D3DCreateBlob(byteCode.size(), &pByteCode);
@@ -720,7 +951,8 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 		}
 		else {
 			LogInfo("    *** failed to allocate new Blob for assemble.\n");
-			return true;
+			job->failed = true;
+			return;
 		}
 	}
 
@@ -731,11 +963,289 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 
 	// For success, let's add the first line of text from the file to the OriginalShaderInfo,
 	// so the ShaderHacker can edit the line and reload and have it live.
+	// srcData is not NUL terminated, so don't go looking past the end of
+	// it if the file has no newline:
 	std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> utf8_to_utf16;
-	headerLine = utf8_to_utf16.from_bytes(srcData.data(), strchr(srcData.data(), '\n'));
+	const char *eol = (const char*)memchr(srcData.data(), '\n', srcData.size());
+	job->headerLine = utf8_to_utf16.from_bytes(srcData.data(), eol ? eol : srcData.data() + srcData.size());
+
+	job->compiled = pByteCode;
+}
+
+struct ShaderFixReloadBatch
+{
+	wchar_t *shaderFixPath;
+	vector<ShaderFixReload> *jobs;
+	volatile LONG next;
+};
+
+static DWORD WINAPI RegenerateShadersThread(LPVOID param)
+{
+	ShaderFixReloadBatch *batch = (ShaderFixReloadBatch*)param;
+	LONG i;
+
+	while ((i = InterlockedIncrement(&batch->next) - 1) < (LONG)batch->jobs->size())
+		RegenerateShader(batch->shaderFixPath, &(*batch->jobs)[i]);
+
+	return 0;
+}
+
+// Compiles every queued file. When there is more than one they are spread
+// over as many threads as we have cores - the compiler is the slow part of a
+// reload by far, and this is the difference between waiting several seconds
+// after checking out a new version of a fix and barely noticing. Must be
+// called *without* holding G->mCriticalSection.
+static void RegenerateShaders(wchar_t *shaderFixPath, vector<ShaderFixReload> *jobs)
+{
+	ShaderFixReloadBatch batch = {shaderFixPath, jobs, 0};
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	SYSTEM_INFO sysinfo;
+	DWORD num_threads = 0, max_threads;
 
-	// pCode on return == NULL for error cases, valid if made it this far.
-	*pCode = pByteCode;
+	GetSystemInfo(&sysinfo);
+	max_threads = min(sysinfo.dwNumberOfProcessors, (DWORD)MAXIMUM_WAIT_OBJECTS);
+	max_threads = min(max_threads, (DWORD)jobs->size());
+
+	// We do our share on this thread, so only need to start the others.
+	// If we can't start a thread that's not fatal - the ones we have will
+	// just have more to do:
+	while (num_threads + 1 < max_threads) {
+		threads[num_threads] = CreateThread(NULL, 0, RegenerateShadersThread, &batch, 0, NULL);
+		if (!threads[num_threads])
+			break;
+		num_threads++;
+	}
+
+	RegenerateShadersThread(&batch);
+
+	if (num_threads) {
+		WaitForMultipleObjects(num_threads, threads, TRUE, INFINITE);
+		while (num_threads)
+			CloseHandle(threads[--num_threads]);
+	}
+}
+
+static void ReleaseShaderFixReloads(vector<ShaderFixReload> *jobs)
+{
+	for (ShaderFixReload &job : *jobs) {
+		if (job.origByteCode)
+			job.origByteCode->Release();
+		if (job.compiled)
+			job.compiled->Release();
+	}
+	jobs->clear();
+}
+
+// Must be called with G->mCriticalSection held
+static void BuildShaderFixesIndex(ShaderFixesIndex *index)
+{
+	// It's notable that the map can contain multiple copies of the same hash, used for different visual
+	// items, but with same original code.  We need to update all copies. This used to be a linear search
+	// of the whole map for each file in ShaderFixes, which is why it's worth building an index first.
+	index->clear();
+	for (auto &iter : G->mShaderInfo) {
+		if (iter.second.reload)
+			index->emplace(iter.second.reload->hash, iter.first);
+	}
+}
+
+// Works out which shaders a file in ShaderFixes applies to, and which of those
+// are out of date, queueing a job to reload the file if any are. Must be
+// called with G->mCriticalSection held. Returns false on error.
+static bool QueueShaderFixReload(wchar_t *fileName, FILETIME *fileTime, UINT64 fileSize,
+		ShaderFixesIndex *index, vector<ShaderFixReload> *jobs)
+{
+	ShaderFixReload job;
+	ShaderInfoMap::iterator i;
+	ShaderOverrideMap::iterator override;
+	ShaderFixStates::iterator state;
+	OriginalShaderInfo *info;
+	bool check_digest;
+
+	// Extract hash from first 16 characters of file name so we can look up details by hash
+	wstring ws = fileName;
+	job.hash = stoull(ws.substr(0, 16), NULL, 16);
+	job.fileName = fileName;
+
+	// If the size has changed the contents obviously have too:
+	state = shader_fix_states.find(job.fileName);
+	check_digest = (state != shader_fix_states.end() && state->second.size == fileSize);
+
+	// Find the original shaders in the mShaderInfo Map. This map contains entries for all
+	// shaders from the ShaderFixes and ShaderCache folder, and can also include .bin files that were loaded directly.
+	// We include ShaderCache because that allows moving files into ShaderFixes as they are identified.
+	// If we didn't find an original shader, that is OK, because it might not have been loaded yet.
+	// Just skip it in that case, because the new version will be loaded when it is used.
+	auto range = index->equal_range(job.hash);
+	for (auto j = range.first; j != range.second; j++)
+	{
+		i = lookup_shader_info(j->second);
+		if (i == G->mShaderInfo.end() || !i->second.reload)
+			continue;
+		info = i->second.reload.get();
+
+		// Still in ShaderFixes, so RevertMissingShaders will leave it be:
+		info->found = true;
+
+		// Check file time stamp, and only recompile shaders that have been edited since they were loaded.
+		// This dramatically improves the F10 reload speed.
+		if (!CompareFileTime(&info->timeStamp, fileTime))
+			continue;
+
+		if (job.handles.empty())
+		{
+			job.shaderType = info->shaderType;
+			job.shaderModel = info->shaderModel;
+
+			// Recall the original bytecode, which may have been
+			// compressed or spilled to disk, if we will need it
+			// for the assembler or to find the shader model:
+			if (job.shaderModel.compare("bin") == 0 || !wcsstr(fileName, L"_replace"))
+			{
+				job.origByteCode = info->byteCode.recall();
+				if (!job.origByteCode)
+				{
+					LogInfo("> failed to recall original bytecode: %ls\n", fileName);
+					return false;
+				}
+			}
+		}
+
+		// We can only skip the compile based on the contents if every
+		// shader we are about to update was loaded from those contents:
+		if (check_digest && CompareFileTime(&info->timeStamp, &state->second.timeStamp))
+			check_digest = false;
+
+		job.handles.push_back(j->second);
+	}
+
+	if (job.handles.empty())
+		return true;
+
+	// Check if the user has overridden the shader model:
+	override = lookup_shaderoverride(job.hash);
+	if (override != G->mShaderOverrideMap.end()) {
+		if (override->second.model[0])
+			job.shaderModel = override->second.model;
+	}
+
+	job.check_digest = check_digest;
+	if (check_digest)
+		job.last_digest = state->second.digest;
+
+	jobs->push_back(std::move(job));
+	return true;
+}
+
+// This needs to call the real CreateVertexShader, not our wrapped version
+static HRESULT CreateReplacementShader(HackerDevice *device, wstring &shaderType, ID3DBlob *pShaderBytecode,
+		ID3D11ClassLinkage *classLinkage, ID3D11DeviceChild **replacement)
+{
+	HRESULT hr = E_FAIL;
+
+	*replacement = NULL;
+	if (shaderType.compare(L"vs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateVertexShader(pShaderBytecode->GetBufferPointer(), pShaderBytecode->GetBufferSize(), classLinkage,
+			(ID3D11VertexShader**)replacement);
+	}
+	else if (shaderType.compare(L"ps") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreatePixelShader(pShaderBytecode->GetBufferPointer(), pShaderBytecode->GetBufferSize(), classLinkage,
+			(ID3D11PixelShader**)replacement);
+	}
+	else if (shaderType.compare(L"cs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateComputeShader(pShaderBytecode->GetBufferPointer(),
+			pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11ComputeShader**)replacement);
+	}
+	else if (shaderType.compare(L"gs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateGeometryShader(pShaderBytecode->GetBufferPointer(),
+			pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11GeometryShader**)replacement);
+	}
+	else if (shaderType.compare(L"hs") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateHullShader(pShaderBytecode->GetBufferPointer(),
+			pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11HullShader**)replacement);
+	}
+	else if (shaderType.compare(L"ds") == 0)
+	{
+		hr = device->GetPassThroughOrigDevice1()->CreateDomainShader(pShaderBytecode->GetBufferPointer(),
+			pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11DomainShader**)replacement);
+	}
+
+	if (SUCCEEDED(hr))
+		CleanupShaderMaps(*replacement);
+
+	return hr;
+}
+
+// Activates a compiled file for every shader it was queued for. Must be
+// called with G->mCriticalSection held. Returns false on error.
+static bool ApplyShaderFixReload(HackerDevice *device, ShaderFixReload *job)
+{
+	ID3D11DeviceChild* replacement = NULL;
+	ShaderInfoMap::iterator i;
+	OriginalShaderInfo *info;
+	ShaderFixState state;
+	HRESULT hr;
+
+	// If we compiled but got nothing, that's a fatal error we need to report.
+	if (job->failed || (!job->unchanged && !job->compiled))
+		return false;
+
+	for (ID3D11DeviceChild *handle : job->handles)
+	{
+		// We didn't hold the lock while compiling, so the game may
+		// have released the shader in the meantime, and the handle
+		// may even have been reused for another shader:
+		i = lookup_shader_info(handle);
+		if (i == G->mShaderInfo.end() || !i->second.reload || i->second.reload->hash != job->hash)
+			continue;
+		info = i->second.reload.get();
+
+		// Update timestamp, since we have an edited file.
+		info->timeStamp = job->timeStamp;
+
+		// Still the same code as the replacement it already has:
+		if (job->unchanged)
+			continue;
+
+		hr = CreateReplacementShader(device, job->shaderType, job->compiled, info->linkage, &replacement);
+		if (FAILED(hr))
+			return false;
+
+		if (info->shaderModel.compare("bin") == 0)
+			info->shaderModel = job->shaderModel;
+		info->infoText = job->headerLine;
+
+		// If we have an older reloaded shader, let's release it to avoid a memory leak.  This only happens after 1st reload.
+		// New shader is loaded on GPU and ready to be used as override in VSSetShader or PSSetShader
+		if (info->replacement != NULL)
+			info->replacement->Release();
+		info->replacement = replacement;
+
+		// We do *not* replace the byteCode in the reload info,
+		// since that is used in future CopyToFixes and ShaderRegex which
+		// needs the original bytecode - this was the cause of our duplicate
+		// StereoParams bug.
+
+		// Any shaders that we load from disk are no longer
+		// candidates for auto patching:
+		info->deferred_replacement_candidate = false;
+
+		LogInfo("> successfully reloaded shader: %ls\n", job->fileName.c_str());
+	}
+
+	if (job->unchanged)
+		LogInfo("> %ls touched, but contents unchanged\n", job->fileName.c_str());
+
+	state.timeStamp = job->timeStamp;
+	state.size = job->size;
+	state.digest = job->digest;
+	shader_fix_states[job->fileName] = state;
+	shader_fix_states_dirty = true;
 
 	return true;
 }
@@ -770,174 +1280,125 @@ static bool RegenerateShader(wchar_t *shaderFixPath, wchar_t *fileName, const ch
 // new version will be used at VSSetShader and PSSetShader.
 // File names are uniform in the form: 3c69e169edc8cd5f-ps_replace.txt
 
-static bool ReloadShader(wchar_t *shaderPath, wchar_t *fileName, HackerDevice *device, string *errText)
-{
-	UINT64 hash;
-	ShaderOverrideMap::iterator override;
-	ID3D11DeviceChild* oldShader = NULL;
-	ID3D11DeviceChild* replacement = NULL;
-	ID3D11ClassLinkage* classLinkage;
-	ID3DBlob* shaderCode;
-	string shaderModel;
-	wstring shaderType;		// "vs", "ps", "cs" maybe "gs"
-	wstring headerLine;		// First line of the HLSL file.
-	FILETIME timeStamp;
-	HRESULT hr = E_FAIL;
-	bool rc = true;
-
-	// Extract hash from first 16 characters of file name so we can look up details by hash
-	wstring ws = fileName;
-	hash = stoull(ws.substr(0, 16), NULL, 16);
+// This is split in two - PrepareShaderReload() compiles the file and can be
+// called from any thread, while ApplyShaderFixReload() then needs to be called
+// for each of the returned jobs to make them live, and the caller is
+// responsible for calling ReleaseShaderFixReloads() afterwards either way.
 
-	// This is probably unnecessary, because we modify already existing map entries, but
-	// for consistency, we'll wrap this.
-	EnterCriticalSectionPretty(&G->mCriticalSection);
+static bool PrepareShaderReload(wchar_t *shaderPath, wchar_t *fileName, vector<ShaderFixReload> *jobs, string *errText)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	wchar_t fullName[MAX_PATH];
+	ShaderFixesIndex index;
+	bool rc;
 
-	// Find the original shader bytecode in the mReloadedShaders Map. This map contains entries for all
-	// shaders from the ShaderFixes and ShaderCache folder, and can also include .bin files that were loaded directly.
-	// We include ShaderCache because that allows moving files into ShaderFixes as they are identified.
-	// This needs to use the value to find the key, so a linear search.
-	// It's notable that the map can contain multiple copies of the same hash, used for different visual
-	// items, but with same original code.  We need to update all copies.
-	for each (pair<ID3D11DeviceChild *, OriginalShaderInfo> iter in G->mReloadedShaders)
+	swprintf_s(fullName, MAX_PATH, L"%s\\%s", shaderPath, fileName);
+	if (!GetFileAttributesEx(fullName, GetFileExInfoStandard, &attributes))
 	{
-		if (iter.second.hash == hash)
-		{
-			oldShader = iter.first;
-			classLinkage = iter.second.linkage;
-			shaderModel = iter.second.shaderModel;
-			shaderType = iter.second.shaderType;
-			timeStamp = iter.second.timeStamp;
-			shaderCode = iter.second.byteCode;
-
-			// If we didn't find an original shader, that is OK, because it might not have been loaded yet.
-			// Just skip it in that case, because the new version will be loaded when it is used.
-			if (oldShader == NULL)
-			{
-				LogInfo("> failed to find original shader in mReloadedShaders: %ls\n", fileName);
-				continue;
-			}
-
-			// Is there a good reason we are operating on a copy of the map and not the original?
-			// Took me a while to work out why this wasn't working: iter.second.found = true;
-			//   -DarkStarSword
-			// Not a _good_ reason, but I was worried about breaking something I didn't understand, 
-			// if I were to modify the original. Too many moving parts for me, no good way to test regressions.
-			//   -bo3b
-			G->mReloadedShaders[oldShader].found = true;
-
-			// Check if the user has overridden the shader model:
-			ShaderOverrideMap::iterator override = lookup_shaderoverride(hash);
-			if (override != G->mShaderOverrideMap.end()) {
-				if (override->second.model[0])
-					shaderModel = override->second.model;
-			}
-
-			// If shaderModel is "bin", that means the original was loaded as a binary object, and thus shaderModel is unknown.
-			// Disassemble the binary to get that string.
-			if (shaderModel.compare("bin") == 0)
-			{
-				shaderModel = GetShaderModel(shaderCode->GetBufferPointer(), shaderCode->GetBufferSize());
-				if (shaderModel.empty())
-					goto err;
-				G->mReloadedShaders[oldShader].shaderModel = shaderModel;
-			}
+		LogInfo("    ReloadShader shader not found: %ls\n", fullName);
+		return false;
+	}
 
-			// Compile anew. If timestamp is unchanged, the code is unchanged, continue to next shader.
-			ID3DBlob *pShaderBytecode = NULL;
-			if (!RegenerateShader(shaderPath, fileName, shaderModel.c_str(), hash, shaderType, shaderCode, &timeStamp, headerLine, &pShaderBytecode, errText))
-				continue;
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+	BuildShaderFixesIndex(&index);
+	rc = QueueShaderFixReload(fileName, &attributes.ftLastWriteTime,
+			((UINT64)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow,
+			&index, jobs);
+	LeaveCriticalSection(&G->mCriticalSection);
 
-			// If we compiled but got nothing, that's a fatal error we need to report.
-			if (pShaderBytecode == NULL)
-				goto err;
+	if (!rc)
+		return false;
 
-			// Update timestamp, since we have an edited file.
-			G->mReloadedShaders[oldShader].timeStamp = timeStamp;
-			G->mReloadedShaders[oldShader].infoText = headerLine;
-
-			replacement = NULL;
-			// This needs to call the real CreateVertexShader, not our wrapped version
-			if (shaderType.compare(L"vs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateVertexShader(pShaderBytecode->GetBufferPointer(), pShaderBytecode->GetBufferSize(), classLinkage,
-					(ID3D11VertexShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"ps") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreatePixelShader(pShaderBytecode->GetBufferPointer(), pShaderBytecode->GetBufferSize(), classLinkage,
-					(ID3D11PixelShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"cs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateComputeShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11ComputeShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"gs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateGeometryShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11GeometryShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"hs") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateHullShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11HullShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			else if (shaderType.compare(L"ds") == 0)
-			{
-				hr = device->GetPassThroughOrigDevice1()->CreateDomainShader(pShaderBytecode->GetBufferPointer(),
-					pShaderBytecode->GetBufferSize(), classLinkage, (ID3D11DomainShader**)&replacement);
-				CleanupShaderMaps(replacement);
-			}
-			if (FAILED(hr))
-				goto err;
+	RegenerateShaders(shaderPath, jobs);
 
+	for (ShaderFixReload &job : *jobs) {
+		if (job.failed || (!job.unchanged && !job.compiled))
+			rc = false;
+		if (errText)
+			*errText = job.errText;
+	}
 
-			// If we have an older reloaded shader, let's release it to avoid a memory leak.  This only happens after 1st reload.
-			// New shader is loaded on GPU and ready to be used as override in VSSetShader or PSSetShader
-			if (G->mReloadedShaders[oldShader].replacement != NULL)
-				G->mReloadedShaders[oldShader].replacement->Release();
-			G->mReloadedShaders[oldShader].replacement = replacement;
+	return rc;
+}
 
-			// We do *not* replace the byteCode in the ReloadedShaders map,
-			// since that is used in future CopyToFixes and ShaderRegex which
-			// needs the original bytecode - this was the cause of our duplicate
-			// StereoParams bug.
+// Marked shaders are copied to ShaderFixes on a background thread, since
+// decompiling and test compiling a large shader (particularly compute shaders)
+// can take several seconds, during which the game would otherwise be frozen.
+// The finished jobs are picked up from Present, where the new shader is made
+// live the same as it used to be.
+struct CopyToFixesJob
+{
+	UINT64 hash;
+	wstring shaderType;
+	string shaderModel;
+	ID3DBlob *byteCode;
+	MarkingAction marking_actions;
+	bool patch_cb_offsets;
+
+	// Filled out on the background thread:
+	bool success;
+	bool regex_patched;
+	vector<ShaderFixReload> reloads;
+
+	CopyToFixesJob() :
+		hash(0),
+		byteCode(NULL),
+		marking_actions(MarkingAction::INVALID),
+		patch_cb_offsets(false),
+		success(false),
+		regex_patched(false)
+	{}
+};
+
+static SRWLOCK copy_to_fixes_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE copy_to_fixes_work = CONDITION_VARIABLE_INIT;
+static std::list<CopyToFixesJob*> copy_to_fixes_queue;
+static std::list<CopyToFixesJob*> copy_to_fixes_done;
+static std::set<UINT64> copy_to_fixes_pending;
+static HANDLE copy_to_fixes_thread;
+static bool copy_to_fixes_thread_failed;
+
+unsigned copy_to_fixes_in_progress()
+{
+	unsigned ret;
+
+	AcquireSRWLockShared(&copy_to_fixes_lock);
+	ret = (unsigned)copy_to_fixes_pending.size();
+	ReleaseSRWLockShared(&copy_to_fixes_lock);
 
-			// Any shaders that we load from disk are no longer
-			// candidates for auto patching:
-			G->mReloadedShaders[oldShader].deferred_replacement_candidate = false;
+	return ret;
+}
 
-			LogInfo("> successfully reloaded shader: %ls\n", fileName);
-		}
-	}	// for every registered shader in mReloadedShaders 
+// Shader files are written under a temporary name and renamed into place once
+// complete, so that a reload in the meantime (reload_fixes_watch will notice
+// the file as soon as it is created) can never see a partially written file:
+static bool commit_shader_fixes_file(FILE *f, wchar_t *tmpName, wchar_t *fullName)
+{
+	fclose(f);
 
-out:
-	LeaveCriticalSection(&G->mCriticalSection);
+	if (!MoveFileEx(tmpName, fullName, MOVEFILE_REPLACE_EXISTING)) {
+		LogInfo("    error renaming %S to %S: %u\n", tmpName, fullName, GetLastError());
+		DeleteFile(tmpName);
+		return false;
+	}
 
-	return rc;
-err:
-	rc = false;
-	goto out;
+	return true;
 }
 
 static bool WriteASM(string *asmText, string *hlslText, string *errText,
-		UINT64 hash, OriginalShaderInfo shader_info, HackerDevice *device, wstring *tagline = NULL)
+		CopyToFixesJob *job, wstring *tagline = NULL)
 {
 	wchar_t fileName[MAX_PATH];
 	wchar_t fullName[MAX_PATH];
+	wchar_t tmpName[MAX_PATH];
 	std::string token;
 	FILE *f;
 
-	swprintf_s(fileName, MAX_PATH, L"%016llx-%ls.txt", hash, shader_info.shaderType.c_str());
+	swprintf_s(fileName, MAX_PATH, L"%016llx-%ls.txt", job->hash, job->shaderType.c_str());
 	swprintf_s(fullName, MAX_PATH, L"%ls\\%ls", G->SHADER_PATH, fileName);
+	swprintf_s(tmpName, MAX_PATH, L"%ls.tmp", fullName);
 
-	wfopen_ensuring_access(&f, fullName, L"wb");
+	wfopen_ensuring_access(&f, tmpName, L"wb");
 	if (!f) {
 		LogInfo("    error storing marked shader to %S\n", fullName);
 		return false;
@@ -970,11 +1431,12 @@ static bool WriteASM(string *asmText, string *hlslText, string *errText,
 		fprintf_s(f, "/////////////////////////////////////////////////////////////////////////////\n");
 	}
 
-	fclose(f);
+	if (!commit_shader_fixes_file(f, tmpName, fullName))
+		return false;
 
 	// Lastly, reload the shader generated, to check for decompile errors, set it as the active
 	// shader code, in case there are visual errors, and make it the match the code in the file.
-	return ReloadShader(G->SHADER_PATH, fileName, device, NULL);
+	return PrepareShaderReload(G->SHADER_PATH, fileName, &job->reloads, NULL);
 }
 
 // Write the decompiled text as HLSL source code to the txt file.
@@ -987,15 +1449,16 @@ static bool WriteASM(string *asmText, string *hlslText, string *errText,
 // If a file was already extant in the ShaderFixes, it will be picked up at game launch as the master shaderByteCode.
 
 static bool WriteHLSL(string *asmText, string *hlslText, string *errText,
-		UINT64 hash, OriginalShaderInfo shader_info, HackerDevice *device, bool remove_failed)
+		CopyToFixesJob *job, bool remove_failed)
 {
 	wchar_t fileName[MAX_PATH];
 	wchar_t fullName[MAX_PATH];
+	wchar_t tmpName[MAX_PATH];
 	FILE *fw;
 	bool ret;
 
 	// Try to decompile the current byte code into HLSL:
-	*hlslText = Decompile(shader_info.byteCode, asmText);
+	*hlslText = Decompile(job->byteCode, asmText);
 	if (hlslText->empty())
 		return false;
 
@@ -1003,9 +1466,10 @@ static bool WriteHLSL(string *asmText, string *hlslText, string *errText,
 	// this has been moved to the earlier shader_already_dumped() routine,
 	// and that no longer modifies the file when touching it.
 
-	swprintf_s(fileName, MAX_PATH, L"%016llx-%ls_replace.txt", hash, shader_info.shaderType.c_str());
+	swprintf_s(fileName, MAX_PATH, L"%016llx-%ls_replace.txt", job->hash, job->shaderType.c_str());
 	swprintf_s(fullName, MAX_PATH, L"%ls\\%ls", G->SHADER_PATH, fileName);
-	wfopen_ensuring_access(&fw, fullName, L"wb");
+	swprintf_s(tmpName, MAX_PATH, L"%ls.tmp", fullName);
+	wfopen_ensuring_access(&fw, tmpName, L"wb");
 	if (!fw)
 	{
 		LogInfoW(L"    error storing marked shader to %s\n", fullName);
@@ -1020,15 +1484,17 @@ static bool WriteHLSL(string *asmText, string *hlslText, string *errText,
 	fwrite(asmText->c_str(), 1, asmText->size(), fw);
 	fprintf_s(fw, "\n//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/\n");
 
-	fclose(fw);
+	if (!commit_shader_fixes_file(fw, tmpName, fullName))
+		return false;
 
 	// Lastly, reload the shader generated, to check for decompile errors, set it as the active
 	// shader code, in case there are visual errors, and make it the match the code in the file.
-	ret = ReloadShader(G->SHADER_PATH, fileName, device, errText);
+	ret = PrepareShaderReload(G->SHADER_PATH, fileName, &job->reloads, errText);
 
 	if (!ret && remove_failed) {
 		LogInfo("    removing shader that failed to reload: %S\n", fullName);
 		DeleteFile(fullName);
+		ReleaseShaderFixReloads(&job->reloads);
 	}
 
 	return ret;
@@ -1097,89 +1563,212 @@ static bool shader_already_dumped(UINT64 hash, char *type)
 // The universal way to do this is to keep the shaderByteCode around, and when mark happens, use that as
 // the replacement and build code to match.  This handles all the variants of preload, cache, hlsl 
 // or not, and allows creating new files on a first run.  Should be handy.
+//
+// This part runs on the background thread and must not hold G->mCriticalSection
+// for any longer than necessary.
 
-static void CopyToFixes(UINT64 hash, HackerDevice *device)
+static void RunCopyToFixes(CopyToFixesJob *job)
 {
-	bool success = false;
-	bool asm_enabled = !!(G->marking_actions & MarkingAction::ASM);
+	bool asm_enabled = !!(job->marking_actions & MarkingAction::ASM);
 	string asmText, hlslText, errText;
+	ID3DBlob *byteCode = job->byteCode;
+
+	if (job->marking_actions & MarkingAction::REGEX) {
+		// We don't have the patched assembly saved anywhere, and even if we did save it
+		// off while applying ShaderRegex that would only work when not loading from cache.
+		// We can't really use the ShaderRegex bytecode either because that will be missing
+		// RDEF making it not all that useful to look at. Instead we will disassemble the
+		// original shader now (with RDEF assuming the game didn't strip that), run
+		// ShaderRegex and output that.
+		asmText = BinaryToAsmText(byteCode->GetBufferPointer(), byteCode->GetBufferSize(), job->patch_cb_offsets);
+		if (asmText.empty())
+			return;
+		wstring tagline(L"// MANUALLY DUMPED ");
+		bool patched = false;
+		// ShaderRegex links its command lists into the ShaderOverride:
+		EnterCriticalSectionPretty(&G->mCriticalSection);
+		try {
+			patched = apply_shader_regex_groups(&asmText, job->shaderType.c_str(), &job->shaderModel, job->hash, &tagline);
+		} catch (...) {
+			LogOverlay(LOG_WARNING, "Exception while patching shader\n");
+		}
+		LeaveCriticalSection(&G->mCriticalSection);
 
-	// The key of the map is the actual shader, we thus need to do a linear search to find our marked hash.
-	for each (pair<ID3D11DeviceChild *, OriginalShaderInfo> iter in G->mReloadedShaders)
-	{
-		if (iter.second.hash == hash)
-		{
-			if (G->marking_actions & MarkingAction::REGEX) {
-				// We don't have the patched assembly saved anywhere, and even if we did save it
-				// off while applying ShaderRegex that would only work when not loading from cache.
-				// We can't really use the ShaderRegex bytecode either because that will be missing
-				// RDEF making it not all that useful to look at. Instead we will disassemble the
-				// original shader now (with RDEF assuming the game didn't strip that), run
-				// ShaderRegex and output that.
-				asmText = BinaryToAsmText(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), G->patch_cb_offsets);
-				if (asmText.empty())
-					break;
-				wstring tagline(L"// MANUALLY DUMPED ");
-				bool patched = false;
-				try {
-					patched = apply_shader_regex_groups(&asmText, iter.second.shaderType.c_str(), &iter.second.shaderModel, hash, &tagline);
-				} catch (...) {
-					LogOverlay(LOG_WARNING, "Exception while patching shader\n");
-				}
+		if (patched) {
+			job->regex_patched = true;
+			job->success = WriteASM(&asmText, NULL, NULL, job, &tagline);
+			return;
+		}
+	}
 
-				if (patched) {
-					success = WriteASM(&asmText, NULL, NULL, hash, iter.second, device, &tagline);
-					break;
-				}
-			}
+	if (job->marking_actions & MarkingAction::HLSL) {
+		// TODO: Allow the decompiler to parse the patched CB offsets
+		// and move this line back to the common code path:
+		asmText = BinaryToAsmText(byteCode->GetBufferPointer(), byteCode->GetBufferSize(), false);
+		if (asmText.empty())
+			return;
 
-			if (G->marking_actions & MarkingAction::HLSL) {
-				// TODO: Allow the decompiler to parse the patched CB offsets
-				// and move this line back to the common code path:
-				asmText = BinaryToAsmText(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), false);
-				if (asmText.empty())
-					break;
-
-				// Save the decompiled text, and ASM text into the HLSL .txt source file:
-				success = WriteHLSL(&asmText, &hlslText, &errText, hash, iter.second, device, asm_enabled);
-				if (success)
-					break;
-				else if (asm_enabled)
-					LogOverlay(LOG_NOTICE, "> HLSL decompilation failed. Falling back to assembly\n");
-			}
+		// Save the decompiled text, and ASM text into the HLSL .txt source file:
+		job->success = WriteHLSL(&asmText, &hlslText, &errText, job, asm_enabled);
+		if (job->success)
+			return;
+		else if (asm_enabled)
+			LogOverlay(LOG_NOTICE, "> HLSL decompilation failed. Falling back to assembly\n");
+	}
 
-			if (asm_enabled) {
-				asmText = BinaryToAsmText(iter.second.byteCode->GetBufferPointer(), iter.second.byteCode->GetBufferSize(), G->patch_cb_offsets);
-				if (asmText.empty())
-					break;
+	if (asm_enabled) {
+		asmText = BinaryToAsmText(byteCode->GetBufferPointer(), byteCode->GetBufferSize(), job->patch_cb_offsets);
+		if (asmText.empty())
+			return;
 
-				success = WriteASM(&asmText, &hlslText, &errText, hash, iter.second, device);
-				break;
-			}
+		job->success = WriteASM(&asmText, &hlslText, &errText, job);
+	}
+}
 
-			if (success) {
-				// ShaderRegex may have also altered the ShaderOverride, but now we've dumped it
-				// out this would not be processed on the next config reload, so revert the
-				// changes to the ShaderOverride to ensure things are consistent:
-				if (unlink_shader_regex_command_lists_and_filter_index(hash))
-					LogOverlay(LOG_WARNING, "NOTICE: ShaderRegex command lists were dropped from the ShaderOverride\n");
-			}
+static DWORD WINAPI CopyToFixesThread(LPVOID param)
+{
+	CopyToFixesJob *job;
 
-			// There can be more than one in the map with the same hash, but we only need a single copy to
-			// make the hlsl file output, so exit with success.
-			break;
+	AcquireSRWLockExclusive(&copy_to_fixes_lock);
+	while (true) {
+		while (copy_to_fixes_queue.empty())
+			SleepConditionVariableSRW(&copy_to_fixes_work, &copy_to_fixes_lock, INFINITE, 0);
+
+		job = copy_to_fixes_queue.front();
+		copy_to_fixes_queue.pop_front();
+		ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+
+		RunCopyToFixes(job);
+
+		AcquireSRWLockExclusive(&copy_to_fixes_lock);
+		copy_to_fixes_done.push_back(job);
+	}
+
+	return 0;
+}
+
+// Called from Present to make any shaders that have finished copying live
+void CompleteCopyToFixes(HackerDevice *device)
+{
+	std::list<CopyToFixesJob*> done;
+	bool success;
+
+	AcquireSRWLockExclusive(&copy_to_fixes_lock);
+	done.swap(copy_to_fixes_done);
+	ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+
+	for (CopyToFixesJob *job : done) {
+		success = job->success;
+
+		EnterCriticalSectionPretty(&G->mCriticalSection);
+
+		for (ShaderFixReload &reload : job->reloads)
+			success = ApplyShaderFixReload(device, &reload) && success;
+
+		if (success) {
+			// ShaderRegex may have also altered the ShaderOverride, but now we've dumped it
+			// out this would not be processed on the next config reload, so revert the
+			// changes to the ShaderOverride to ensure things are consistent:
+			if (job->regex_patched && unlink_shader_regex_command_lists_and_filter_index(job->hash))
+				LogOverlay(LOG_WARNING, "NOTICE: ShaderRegex command lists were dropped from the ShaderOverride\n");
+
+			// Any identical shaders created after this should be loaded
+			// from the file we just wrote:
+			G->mShaderFixesCache.erase(job->hash);
 		}
+
+		LeaveCriticalSection(&G->mCriticalSection);
+
+		if (success)
+		{
+			LogOverlay(LOG_INFO, "> successfully copied Marked shader %016llx to ShaderFixes\n", job->hash);
+		}
+		else
+		{
+			LogOverlay(LOG_WARNING, "> FAILED to copy Marked shader %016llx to ShaderFixes\n", job->hash);
+			BeepFailure();
+		}
+
+		AcquireSRWLockExclusive(&copy_to_fixes_lock);
+		copy_to_fixes_pending.erase(job->hash);
+		ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+
+		ReleaseShaderFixReloads(&job->reloads);
+		job->byteCode->Release();
+		delete job;
 	}
+}
+
+// Must be called with G->mCriticalSection held
+static void CopyToFixes(UINT64 hash, HackerDevice *device)
+{
+	CopyToFixesJob *job = NULL;
 
-	if (success)
+	AcquireSRWLockExclusive(&copy_to_fixes_lock);
+	if (copy_to_fixes_pending.count(hash)) {
+		ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+		LogOverlay(LOG_INFO, "> shader %016llx is already being copied to ShaderFixes\n", hash);
+		return;
+	}
+	ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+
+	// The key of the map is the actual shader, we thus need to do a linear search to find our marked hash.
+	// There can be more than one in the map with the same hash, but we only need a single copy to
+	// make the hlsl file output.
+	for (auto &iter : G->mShaderInfo)
 	{
-		LogOverlay(LOG_INFO, "> successfully copied Marked shader to ShaderFixes\n");
+		if (iter.second.reload && iter.second.reload->hash == hash)
+		{
+			// Take our own reference to the bytecode and a copy of
+			// everything else the background thread will need,
+			// since the game may release the shader in the meantime:
+			job = new CopyToFixesJob();
+			job->hash = hash;
+			job->shaderType = iter.second.reload->shaderType;
+			job->shaderModel = iter.second.reload->shaderModel;
+			job->byteCode = iter.second.reload->byteCode.recall();
+			job->marking_actions = G->marking_actions;
+			job->patch_cb_offsets = G->patch_cb_offsets;
+			break;
+		}
 	}
-	else
+
+	if (!job || !job->byteCode)
 	{
+		delete job;
 		LogOverlay(LOG_WARNING, "> FAILED to copy Marked shader to ShaderFixes\n");
 		BeepFailure();
+		return;
+	}
+
+	AcquireSRWLockExclusive(&copy_to_fixes_lock);
+
+	copy_to_fixes_pending.insert(hash);
+
+	if (!copy_to_fixes_thread && !copy_to_fixes_thread_failed) {
+		copy_to_fixes_thread = CreateThread(NULL, 0, CopyToFixesThread, NULL, 0, NULL);
+		if (!copy_to_fixes_thread) {
+			LogInfo("Failed to create CopyToFixes thread: %u - copying synchronously\n", GetLastError());
+			copy_to_fixes_thread_failed = true;
+		}
+	}
+
+	if (copy_to_fixes_thread_failed) {
+		ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+		RunCopyToFixes(job);
+		AcquireSRWLockExclusive(&copy_to_fixes_lock);
+		copy_to_fixes_done.push_back(job);
+		ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+		CompleteCopyToFixes(device);
+		return;
 	}
+
+	copy_to_fixes_queue.push_back(job);
+	WakeConditionVariable(&copy_to_fixes_work);
+
+	ReleaseSRWLockExclusive(&copy_to_fixes_lock);
+
+	LogOverlay(LOG_INFO, "> copying Marked shader %016llx to ShaderFixes...\n", hash);
 }
 
 static void TakeScreenShot(HackerDevice *wrapped, void *private_data)
@@ -1204,37 +1793,38 @@ static void TakeScreenShot(HackerDevice *wrapped, void *private_data)
 static void RevertMissingShaders()
 {
 	ID3D11DeviceChild* replacement = NULL;
-	ShaderReloadMap::iterator i;
+	ShaderInfoMap::iterator i;
+	OriginalShaderInfo *info;
 
-	for (i = G->mReloadedShaders.begin(); i != G->mReloadedShaders.end(); i++) {
-		if (i->second.found)
+	for (i = G->mShaderInfo.begin(); i != G->mShaderInfo.end(); i++) {
+		info = i->second.reload.get();
+		if (!i->second.reload || info->found)
 			continue;
 
-		ShaderReplacementMap::iterator j = G->mOriginalShaders.find(i->first);
-		if (j == G->mOriginalShaders.end())
+		replacement = i->second.original;
+		if (!replacement)
 			continue;
-		replacement = j->second;
 
-		if ((i->second.replacement == NULL && i->first == replacement)
-			|| replacement == i->second.replacement) {
+		if ((info->replacement == NULL && i->first == replacement)
+			|| replacement == info->replacement) {
 			continue;
 		}
 
-		LogInfo("Reverting %016llx not found in ShaderFixes\n", i->second.hash);
+		LogInfo("Reverting %016llx not found in ShaderFixes\n", info->hash);
 
-		if (i->second.replacement)
-			i->second.replacement->Release();
+		if (info->replacement)
+			info->replacement->Release();
 
 		replacement->AddRef();
-		i->second.replacement = replacement;
-		i->second.timeStamp = { 0 };
-		i->second.infoText.clear();
+		info->replacement = replacement;
+		info->timeStamp = { 0 };
+		info->infoText.clear();
 
 		// Any shaders that we revert become candidates for auto
 		// patching. Elsewhere, when reloading the config we also clear
 		// the processed flag so that any updated patterns in the ini
 		// will be [re]applied:
-		i->second.deferred_replacement_candidate = true;
+		info->deferred_replacement_candidate = true;
 	}
 }
 
@@ -1255,6 +1845,9 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 		bool success = true;
 		WIN32_FIND_DATA findFileData;
 		wchar_t fileName[MAX_PATH];
+		ShaderFixesIndex index;
+		vector<ShaderFixReload> jobs;
+		unsigned files = 0, recompiled = 0, unchanged = 0;
 
 		// Clears any notices currently displayed on the overlay. This ensures
 		// that any notices that haven't timed out yet (e.g. from a previous
@@ -1266,27 +1859,70 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 		// of these actually takes effect in the current frame.
 		ClearNotices();
 
-		for (ShaderReloadMap::iterator iter = G->mReloadedShaders.begin(); iter != G->mReloadedShaders.end(); iter++)
-			iter->second.found = false;
+		EnterCriticalSectionPretty(&G->mCriticalSection);
+
+		for (ShaderInfoMap::iterator iter = G->mShaderInfo.begin(); iter != G->mShaderInfo.end(); iter++) {
+			if (iter->second.reload)
+				iter->second.reload->found = false;
+		}
+
+		// Any shaders created from here on need to look at the current
+		// contents of ShaderFixes, not what was there when an
+		// identical shader was created earlier:
+		G->mShaderFixesCache.clear();
+
+		BuildShaderFixesIndex(&index);
+		LoadShaderFixStates();
 
 		// Strict file name format, to allow renaming out of the way. 
 		// "00aa7fa12bbf66b3-ps_replace.txt" or "00aa7fa12bbf66b3-vs.txt"
 		// Will still blow up if the first characters are not hex.
+		// Only files modified since the shaders using them were loaded
+		// are queued - the rest never need to be opened:
 		swprintf_s(fileName, MAX_PATH, L"%ls\\????????????????-??*.txt", G->SHADER_PATH);
 		HANDLE hFind = FindFirstFile(fileName, &findFileData);
 		if (hFind != INVALID_HANDLE_VALUE)
 		{
 			do {
-				success = ReloadShader(G->SHADER_PATH, findFileData.cFileName, device, NULL) && success;
+				success = QueueShaderFixReload(findFileData.cFileName, &findFileData.ftLastWriteTime,
+						((UINT64)findFileData.nFileSizeHigh << 32) | findFileData.nFileSizeLow,
+						&index, &jobs) && success;
+				files++;
 			} while (FindNextFile(hFind, &findFileData));
 			FindClose(hFind);
 		}
 
+		LeaveCriticalSection(&G->mCriticalSection);
+
+		RegenerateShaders(G->SHADER_PATH, &jobs);
+
+		EnterCriticalSectionPretty(&G->mCriticalSection);
+
+		// Applied in the same order the files were found, so that if
+		// there is both an HLSL and ASM version of a shader the same
+		// one wins as always has:
+		for (ShaderFixReload &job : jobs) {
+			success = ApplyShaderFixReload(device, &job) && success;
+			if (job.unchanged)
+				unchanged++;
+			else if (job.compiled)
+				recompiled++;
+		}
+
 		// Any shaders in the map not visited, we want to revert back
 		// to original. We do this even if a shader failed, because we
 		// should still revert other shaders.
 		RevertMissingShaders();
 
+		SaveShaderFixStates();
+
+		LeaveCriticalSection(&G->mCriticalSection);
+
+		ReleaseShaderFixReloads(&jobs);
+
+		LogInfo("> %u files in ShaderFixes: %u recompiled, %u touched but unchanged\n",
+				files, recompiled, unchanged);
+
 		if (success)
 		{
 			LogOverlay(LOG_INFO, "> successfully reloaded shaders from ShaderFixes\n");
@@ -1299,6 +1935,34 @@ static void ReloadFixes(HackerDevice *device, void *private_data)
 	}
 }
 
+// reload_fixes_watch support. Editors tend to save a file in several steps
+// (truncate, write, rename over, etc), so rather than reloading on the first
+// change we wait for the directory to settle down for a moment first:
+#define RELOAD_FIXES_WATCH_SETTLE_MS 250
+static FileChangeNotifier *shader_fixes_watcher;
+static ULONGLONG shader_fixes_changed_time;
+
+void PollShaderFixesWatch(HackerDevice *device)
+{
+	ULONGLONG now;
+
+	if (!shader_fixes_watcher || G->hunting != HUNTING_MODE_ENABLED)
+		return;
+
+	now = GetTickCount64();
+
+	if (shader_fixes_watcher->poll()) {
+		shader_fixes_changed_time = now;
+		return;
+	}
+
+	if (shader_fixes_changed_time && now - shader_fixes_changed_time >= RELOAD_FIXES_WATCH_SETTLE_MS) {
+		shader_fixes_changed_time = 0;
+		LogInfo("> change detected in ShaderFixes\n");
+		ReloadFixes(device, NULL);
+	}
+}
+
 static void DisableFix(HackerDevice *device, void *private_data)
 {
 	if (G->hunting != HUNTING_MODE_ENABLED)
@@ -1923,6 +2587,10 @@ void TimeoutHuntingBuffers()
 	G->mVisitedDomainShaders.clear();
 	G->mVisitedHullShaders.clear();
 	G->mVisitedRenderTargets.clear();
+
+	// Any shader whose visited_generation no longer matches will be added
+	// back into the above sets the next time it is bound:
+	G->visited_shaders_generation++;
 }
 
 // User has requested all shaders be re-enabled
@@ -2009,6 +2677,12 @@ void ParseHuntingSection()
 	// the [Hunting] section for historical reasons:
 	RegisterIniKeyBinding(L"Hunting", L"take_screenshot", TakeScreenShot, NULL, noRepeat, NULL);
 
+	// Stop watching ShaderFixes in case reload_fixes_watch or the
+	// override_directory was changed:
+	delete shader_fixes_watcher;
+	shader_fixes_watcher = NULL;
+	shader_fixes_changed_time = 0;
+
 	// Don't register hunting keys when hard disabled. In this case the
 	// only way to turn hunting on is to edit the ini file and reload it.
 	if (G->hunting == HUNTING_MODE_DISABLED)
@@ -2081,6 +2755,11 @@ void ParseHuntingSection()
 	RegisterIniKeyBinding(L"Hunting", L"done_hunting", DoneHunting, NULL, noRepeat, NULL);
 
 	RegisterIniKeyBinding(L"Hunting", L"reload_fixes", ReloadFixes, NULL, noRepeat, NULL);
+	G->reload_fixes_watch = GetIniEnumClass(L"Hunting", L"reload_fixes_watch", ReloadFixesWatch::OFF, NULL, ReloadFixesWatchNames);
+	if (G->reload_fixes_watch != ReloadFixesWatch::OFF && G->SHADER_PATH[0]) {
+		shader_fixes_watcher = create_file_change_notifier(G->SHADER_PATH, L"????????????????-??*.txt",
+				G->reload_fixes_watch == ReloadFixesWatch::POLL);
+	}
 
 	G->show_original_enabled = RegisterIniKeyBinding(L"Hunting", L"show_original", DisableFix, EnableFix, noRepeat, NULL);
 
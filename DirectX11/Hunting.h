@@ -4,10 +4,17 @@
 
 #include "HackerDevice.h"
 
+#include <memory>
+#include <unordered_map>
+
 // Custom #include handler used to track which shaders need to be reloaded after an included file is modified
 class MigotoIncludeHandler : public ID3DInclude
 {
 	std::vector<std::string> dir_stack;
+	// Files we have handed to the compiler, which may be shared with the
+	// include cache, and must be kept alive until it calls Close(). The
+	// same file may be open more than once if it is included recursively:
+	std::unordered_multimap<LPCVOID, std::shared_ptr<const std::string>> open_files;
 
 	void push_dir(const char *path);
 public:
@@ -18,5 +25,8 @@ public:
 };
 
 void TimeoutHuntingBuffers();
+void PollShaderFixesWatch(HackerDevice *device);
+void CompleteCopyToFixes(HackerDevice *device);
+unsigned copy_to_fixes_in_progress();
 void ParseHuntingSection();
 void DumpUsage(wchar_t *dir);
@@ -16,6 +16,7 @@
 #include "Hunting.h"
 #include "nvprofile.h"
 #include "ShaderRegex.h"
+#include "ShaderHash.h"
 #include "cursor.h"
 
 #define INI_FILENAME L"d3dx.ini"
@@ -1195,6 +1196,8 @@ template TransitionType GetIniEnumClass<const char *, TransitionType>(const wcha
 		struct EnumName_t<const char *, TransitionType> *enum_names);
 template MarkingMode GetIniEnumClass<const wchar_t *, MarkingMode>(const wchar_t *section, const wchar_t *key, MarkingMode def, bool *found,
 		struct EnumName_t<const wchar_t *, MarkingMode> *enum_names);
+template ReloadFixesWatch GetIniEnumClass<const wchar_t *, ReloadFixesWatch>(const wchar_t *section, const wchar_t *key, ReloadFixesWatch def, bool *found,
+		struct EnumName_t<const wchar_t *, ReloadFixesWatch> *enum_names);
 
 // For options that used to be booleans and are now integers. Boolean values
 // (0/1/true/false/yes/no/on/off) will continue retuning 0/1 for backwards
@@ -2252,6 +2255,12 @@ static void ParseShaderOverrideSections()
 	EnterCriticalSectionPretty(&G->mCriticalSection);
 
 	G->mShaderOverrideMap.clear();
+	G->shader_override_generation++;
+
+	// ShaderOverrides can change the shader model used to compile a
+	// replacement, and any other settings that influence how we process
+	// ShaderFixes may have changed, so forget everything we processed:
+	G->mShaderFixesCache.clear();
 
 	lower = ini_sections.lower_bound(wstring(L"ShaderOverride"));
 	upper = prefix_upper_bound(ini_sections, wstring(L"ShaderOverride"));
@@ -2527,12 +2536,14 @@ static void ParseShaderRegexSections()
 
 	shader_regex_group_index.clear();
 	shader_regex_groups.clear();
+	shader_regex_targeted_models.clear();
 
 	// Hash any settings that may alter assembly or otherwise have an
 	// effect on ShaderRegex to invalidate the cache if these change:
 	hash = crc32c_hw(hash, &G->assemble_signature_comments, sizeof(G->assemble_signature_comments));
 	hash = crc32c_hw(hash, &G->disassemble_undecipherable_custom_data, sizeof(G->disassemble_undecipherable_custom_data));
 	hash = crc32c_hw(hash, &G->patch_cb_offsets, sizeof(G->patch_cb_offsets));
+	shader_regex_settings_hash = hash;
 
 	lower = ini_sections.lower_bound(wstring(L"ShaderRegex"));
 	upper = prefix_upper_bound(ini_sections, wstring(L"ShaderRegex"));
@@ -2556,6 +2567,7 @@ static void ParseShaderRegexSections()
 		regex_group = get_regex_group(&subsection_names[0], subsection_names.size() == 1);
 		if (!regex_group)
 			continue;
+		regex_group->digest = hash_ini_section(regex_group->digest, section_id);
 
 		switch (subsection_names.size()) {
 			case 1:
@@ -2597,15 +2609,22 @@ static void ParseShaderRegexSections()
 
 	// When we load ShaderRegex metadata from the cache we need to look up
 	// the command lists and filter_index from the data structures. The
-	// shader_regex_hash means we know the data structures should be
-	// identical to when the shader was first cached, and since
-	// shader_regex_groups is sorted the order should be the same too.
+	// cache records the digests of the groups that applied to the shader,
+	// and since shader_regex_groups is sorted their order is consistent.
 	// Copy pointers to each of the groups to a vector so we can look them
 	// up directly without iterating over the map:
 	shader_regex_hash = hash;
 	LogInfo("ShaderRegex hash: %08x\n", shader_regex_hash);
-	for (j = shader_regex_groups.begin(); j != shader_regex_groups.end(); j++)
+	for (j = shader_regex_groups.begin(); j != shader_regex_groups.end(); j++) {
 		shader_regex_group_index.push_back(&j->second);
+		shader_regex_targeted_models.insert(j->second.shader_models.begin(), j->second.shader_models.end());
+	}
+
+	if (shader_regex_model_skips)
+		LogInfo("ShaderRegex: %li shaders skipped without disassembly under the previous config\n", shader_regex_model_skips);
+	shader_regex_model_skips = 0;
+
+	build_shader_regex_prefilter();
 }
 
 // For fuzzy matching instead of using hash. Using terms consistent
@@ -4173,6 +4192,7 @@ void LoadConfigFile()
 	LogInfo("[Rendering]\n");
 
 	G->shader_hash_type = GetIniEnumClass(L"Rendering", L"shader_hash", ShaderHashType::FNV, NULL, ShaderHashNames);
+	G->shader_bytecode_storage = GetIniEnumClass(L"Rendering", L"shader_bytecode", ShaderBytecodeStorage::MEMORY, NULL, ShaderBytecodeStorageNames);
 	G->texture_hash_version = GetIniInt(L"Rendering", L"texture_hash", 0, NULL);
 
 	if (GetIniStringAndLog(L"Rendering", L"override_directory", 0, G->SHADER_PATH, MAX_PATH))
@@ -4368,6 +4388,10 @@ void LoadConfigFile()
 	ParseShaderRegexSections();
 	ParseTextureOverrideSections();
 
+	// Must be done after the ShaderOverride sections have been parsed so
+	// that we know which legacy hashes a fix may be referring to:
+	load_shader_hash_map();
+
 	LogInfo("[Present]\n");
 	G->present_command_list.clear();
 	G->post_present_command_list.clear();
@@ -4495,9 +4519,9 @@ static void WipeUserConfig()
 
 static void MarkAllShadersDeferredUnprocessed()
 {
-	ShaderReloadMap::iterator i;
+	ShaderInfoMap::iterator i;
 
-	for (i = G->mReloadedShaders.begin(); i != G->mReloadedShaders.end(); i++) {
+	for (i = G->mShaderInfo.begin(); i != G->mShaderInfo.end(); i++) {
 		// Whenever we reload the config we clear the processed flag on
 		// all auto patched shaders to ensure that they will be
 		// re-patched using the current patterns in the d3dx.ini. This
@@ -4505,7 +4529,8 @@ static void MarkAllShadersDeferredUnprocessed()
 		// which will be set in the shader reload routine for any
 		// shaders that have been removed from disk, and removed from
 		// any that are loaded from disk:
-		i->second.deferred_replacement_processed = false;
+		if (i->second.reload)
+			i->second.reload->deferred_replacement_processed = false;
 	}
 
 	// TODO: If ShaderRegex hash is unchanged leave these shaders in place
@@ -18,6 +18,7 @@
 
 #include "HackerDevice.h"
 #include "HackerContext.h"
+#include "Hunting.h"
 
 #define MAX_SIMULTANEOUS_NOTICES 10
 
@@ -565,6 +566,8 @@ static void AppendShaderText(wchar_t *fullLine, wchar_t *type, int pos, size_t s
 static void CreateShaderCountString(wchar_t *counts)
 {
 	const wchar_t *marking_mode;
+	wchar_t append[maxstring];
+	unsigned copying;
 
 	wcscpy_s(counts, maxstring, L"");
 	// The order here more or less follows how important these are for
@@ -584,6 +587,14 @@ static void CreateShaderCountString(wchar_t *counts)
 	if (G->mSelectedRenderTarget != (ID3D11Resource *)-1)
 		AppendShaderText(counts, L"RT", G->mSelectedRenderTargetPos, G->mVisitedRenderTargets.size());
 
+	// Shaders being copied to ShaderFixes in the background - this can
+	// take several seconds for a large shader:
+	copying = copy_to_fixes_in_progress();
+	if (copying) {
+		swprintf_s(append, maxstring, L"Copying:%u ", copying);
+		wcscat_s(counts, maxstring, append);
+	}
+
 	marking_mode = lookup_enum_name(MarkingModeNames, G->marking_mode);
 	if (marking_mode)
 		wcscat_s(counts, maxstring, marking_mode);
@@ -596,9 +607,9 @@ static void CreateShaderCountString(wchar_t *counts)
 
 static bool FindInfoText(wchar_t *info, UINT64 selectedShader)
 {
-	for each (pair<ID3D11DeviceChild *, OriginalShaderInfo> loaded in G->mReloadedShaders)
+	for (auto &loaded : G->mShaderInfo)
 	{
-		if ((loaded.second.hash == selectedShader) && !loaded.second.infoText.empty())
+		if (loaded.second.reload && (loaded.second.reload->hash == selectedShader) && !loaded.second.reload->infoText.empty())
 		{
 			// We now use wcsncat_s instead of wcscat_s here,
 			// because the later will terminate us if the resulting
@@ -614,7 +625,7 @@ static bool FindInfoText(wchar_t *info, UINT64 selectedShader)
 			// silly (maxstring-strlen(info)-1) and VS complains.
 			//
 			// Skip past first two characters, which will always be //
-			wcsncat_s(info, maxstring, loaded.second.infoText.c_str() + 2, _TRUNCATE);
+			wcsncat_s(info, maxstring, loaded.second.reload->infoText.c_str() + 2, _TRUNCATE);
 			return true;
 		}
 	}
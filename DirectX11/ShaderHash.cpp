@@ -0,0 +1,149 @@
+// Include before util.h (or any header that includes util.h) to get pretty
+// version of EnterCriticalSection:
+#include "lock.h"
+
+#include "ShaderHash.h"
+#include "globals.h"
+#include "log.h"
+#include "util.h"
+
+#include <unordered_map>
+#include <unordered_set>
+
+// Persistent fast hash -> FNV hash table. Loaded once from ShaderFixes and
+// appended to whenever we have to calculate the FNV hash of a shader we
+// haven't seen before. Living in ShaderFixes rather than ShaderCache means a
+// shaderhacker can ship it with a fix so that end users never pay the cost of
+// the FNV hash at all, and it is not picked up by the ShaderFixes reload since
+// it doesn't match the ????????????????-??*.txt pattern.
+static std::unordered_map<UINT64, UINT64> fast_to_fnv_map;
+static bool shader_hash_map_loaded;
+
+// Every hash referenced by a file in ShaderFixes or by a [ShaderOverride]
+// section. If a shader's fast hash is not in here we check if its FNV hash is,
+// and if neither are we don't care which we use, so we use the fast hash.
+// Refreshed on every config reload since new files may have been added.
+static std::unordered_set<UINT64> referenced_shader_hashes;
+
+static void load_shader_hash_map_file()
+{
+	wchar_t path[MAX_PATH];
+	UINT64 fast_hash, fnv_hash;
+	FILE *f;
+
+	if (shader_hash_map_loaded)
+		return;
+	shader_hash_map_loaded = true;
+
+	swprintf_s(path, MAX_PATH, L"%ls\\" SHADER_HASH_MAP_FILENAME, G->SHADER_PATH);
+	if (_wfopen_s(&f, path, L"r") || !f)
+		return;
+
+	while (fscanf_s(f, "%16llx %16llx\n", &fast_hash, &fnv_hash) == 2)
+		fast_to_fnv_map[fast_hash] = fnv_hash;
+
+	fclose(f);
+
+	LogInfo("Loaded %Iu entries from shader hash map %S\n", fast_to_fnv_map.size(), path);
+}
+
+static void save_shader_hash_map_entry(UINT64 fast_hash, UINT64 fnv_hash)
+{
+	wchar_t path[MAX_PATH];
+	FILE *f;
+
+	swprintf_s(path, MAX_PATH, L"%ls\\" SHADER_HASH_MAP_FILENAME, G->SHADER_PATH);
+	wfopen_ensuring_access(&f, path, L"a");
+	if (!f) {
+		LogInfo("    error appending to shader hash map %S\n", path);
+		return;
+	}
+
+	fprintf_s(f, "%016llx %016llx\n", fast_hash, fnv_hash);
+	fclose(f);
+}
+
+static void scan_referenced_shader_hashes()
+{
+	WIN32_FIND_DATA findFileData;
+	wchar_t path[MAX_PATH];
+	HANDLE hFind;
+
+	referenced_shader_hashes.clear();
+
+	// Same loose pattern as ReloadFixes, but we want .bin, _bad.txt, etc.
+	// as well, since any of those being present means a shaderhacker has
+	// done something with that hash:
+	swprintf_s(path, MAX_PATH, L"%ls\\????????????????-??*", G->SHADER_PATH);
+	hFind = FindFirstFile(path, &findFileData);
+	if (hFind != INVALID_HANDLE_VALUE) {
+		do {
+			if (!iswxdigit(findFileData.cFileName[0]))
+				continue;
+			referenced_shader_hashes.insert(wcstoull(findFileData.cFileName, NULL, 16));
+		} while (FindNextFile(hFind, &findFileData));
+		FindClose(hFind);
+	}
+
+	for (auto &i : G->mShaderOverrideMap)
+		referenced_shader_hashes.insert(i.first);
+
+	LogInfo("  %Iu shader hashes referenced by ShaderFixes and ShaderOverrides\n",
+			referenced_shader_hashes.size());
+}
+
+// Called from LoadConfigFile after the ShaderOverride sections have been parsed
+void load_shader_hash_map()
+{
+	if (G->shader_hash_type != ShaderHashType::FAST || !G->SHADER_PATH[0])
+		return;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+		load_shader_hash_map_file();
+		scan_referenced_shader_hashes();
+	LeaveCriticalSection(&G->mCriticalSection);
+}
+
+// Decide whether a shader should be known by its fast hash or its legacy FNV
+// hash. In the common case where nothing in the fix refers to this shader we
+// return immediately without ever calculating the FNV hash, which is the whole
+// point of the fast hash mode.
+UINT64 resolve_fast_shader_hash(UINT64 hash, const void *pShaderBytecode, SIZE_T BytecodeLength)
+{
+	std::unordered_map<UINT64, UINT64>::iterator i;
+	UINT64 fnv_hash;
+	bool known;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+		if (referenced_shader_hashes.empty() || referenced_shader_hashes.count(hash)) {
+			LeaveCriticalSection(&G->mCriticalSection);
+			return hash;
+		}
+		i = fast_to_fnv_map.find(hash);
+		known = (i != fast_to_fnv_map.end());
+		if (known)
+			fnv_hash = i->second;
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	if (!known) {
+		// Calculated outside the lock - this is the slow part, and
+		// only happens once for any given shader since we save it:
+		fnv_hash = fnv_64_buf(pShaderBytecode, BytecodeLength);
+
+		EnterCriticalSectionPretty(&G->mCriticalSection);
+			if (fast_to_fnv_map.emplace(hash, fnv_hash).second)
+				save_shader_hash_map_entry(hash, fnv_hash);
+		LeaveCriticalSection(&G->mCriticalSection);
+	}
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+		known = !!referenced_shader_hashes.count(fnv_hash);
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	if (known) {
+		LogInfo("  Legacy FNV hash %016I64x referenced by fix, using in place of fast hash %016I64x\n", fnv_hash, hash);
+		return fnv_hash;
+	}
+
+	return hash;
+}
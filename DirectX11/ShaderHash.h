@@ -0,0 +1,14 @@
+#pragma once
+
+#include <d3d11_1.h>
+
+// Support for shader_hash = fast. Shaders are identified by fast_shader_hash(),
+// but fixes already in the field name their ShaderFixes and [ShaderOverride]
+// sections after the traditional FNV hash, so we keep a persistent table of
+// fast -> FNV hashes to let those continue to resolve without having to FNV
+// hash every shader the game creates on every launch.
+
+#define SHADER_HASH_MAP_FILENAME L"shader_hash_map.txt"
+
+void load_shader_hash_map();
+UINT64 resolve_fast_shader_hash(UINT64 hash, const void *pShaderBytecode, SIZE_T BytecodeLength);
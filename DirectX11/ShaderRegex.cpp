@@ -1,366 +1,26 @@
 #include "ShaderRegex.h"
+#include "ShaderRegexPrefilter.h"
 #include "CommandList.h"
 #include "globals.h" // For ShaderOverride FIXME: This should be in a separate header
 #include "log.h"
 
 #include <algorithm>
-#include <iterator>
 
 ShaderRegexGroups shader_regex_groups;
 std::vector<ShaderRegexGroup*> shader_regex_group_index;
+ShaderRegexModels shader_regex_targeted_models;
+volatile LONG shader_regex_model_skips;
 uint32_t shader_regex_hash;
+uint32_t shader_regex_settings_hash;
 
-static void log_pcre2_error_nonl(int err, char *fmt, ...)
-{
-	PCRE2_UCHAR buf[120]; // doco says "120 code units is ample"
-	va_list ap;
-
-	pcre2_get_error_message(err, buf, sizeof(buf));
-
-	va_start(ap, fmt);
-	vLogInfo(fmt, ap);
-	va_end(ap);
-
-	LogInfo(": %s\n", buf);
-}
-
-static bool get_shader_model(std::string *asm_text, std::string *shader_model)
-{
-	size_t shader_model_pos;
-
-	for (
-		shader_model_pos = asm_text->find("\n");
-		shader_model_pos != std::string::npos && (*asm_text)[shader_model_pos + 1] == '/';
-		shader_model_pos = asm_text->find("\n", shader_model_pos + 1)
-	) {}
-
-	if (shader_model_pos == std::string::npos)
-		return false;
-
-	*shader_model = asm_text->substr(shader_model_pos + 1, asm_text->find("\n", shader_model_pos + 1) - shader_model_pos - 1);
-	return true;
-}
-
-static bool find_dcl_end(std::string *asm_text, size_t *dcl_end_pos)
-{
-	// FIXME: Might be better to scan forwards
-
-	*dcl_end_pos = asm_text->rfind("\ndcl_");
-	*dcl_end_pos = asm_text->find("\n", *dcl_end_pos + 1);
-
-	if (*dcl_end_pos == std::string::npos) {
-		LogInfo("WARNING: Unable to locate end of shader declarations!\n");
-		return false;
-	}
-
-	return true;
-}
-
-static bool insert_declarations(std::string *asm_text, ShaderRegexDeclarations *declarations)
-{
-	ShaderRegexDeclarations::iterator i;
-	std::string insert_str;
-	size_t dcl_end;
-	bool patch = false;
-
-	if (!find_dcl_end(asm_text, &dcl_end))
-		return false;
-
-	for (i = declarations->begin(); i != declarations->end(); i++) {
-		insert_str = std::string("\n") + *i;
-
-		if (asm_text->find(insert_str + std::string("\n")) != std::string::npos)
-			continue;
-
-		asm_text->insert(dcl_end, insert_str);
-		dcl_end += insert_str.size();
-
-		patch = true;
-	}
-
-	return patch;
-}
-
-static bool find_dcl_temps(std::string *asm_text, size_t *dcl_temps_pos)
-{
-	// Could use regex for this as well, but given we only need to find a
-	// constant string it will be more efficient to just do this:
-	*dcl_temps_pos = asm_text->find("\ndcl_temps ", 0);
-
-	if (*dcl_temps_pos == std::string::npos)
-		return false;
-
-	return true;
-}
+// Built from the required literals of every ShaderRegex group once they have
+// all been parsed, and only read after that, so it is safe to scan with from
+// multiple threads:
+static LiteralAutomaton shader_regex_prefilter;
 
-static unsigned get_dcl_temps(std::string *asm_text)
+ShaderRegexThreadState** shader_regex_thread_state_slot()
 {
-	size_t dcl_temps;
-	unsigned tmp_regs = 0;
-
-	if (!find_dcl_temps(asm_text, &dcl_temps))
-		return 0;
-
-	tmp_regs = stoul(asm_text->substr(dcl_temps + 10, 4));
-	LogInfo("Found dcl_temps %d\n", tmp_regs);
-
-	return tmp_regs;
-}
-
-static bool update_dcl_temps(std::string *asm_text, size_t new_val)
-{
-	size_t dcl_temps, dcl_temps_end, dcl_end;
-	std::string insert_str;
-
-	if (find_dcl_temps(asm_text, &dcl_temps)) {
-		dcl_temps += 11;
-		dcl_temps_end = asm_text->find("\n", dcl_temps);
-		LogInfo("Updating dcl_temps %Iu\n", new_val);
-		asm_text->replace(dcl_temps, dcl_temps_end - dcl_temps, std::to_string(new_val));
-		return true;
-	}
-
-	if (!find_dcl_end(asm_text, &dcl_end))
-		return false;
-
-	insert_str = std::string("\ndcl_temps ") + std::to_string(new_val);
-	LogInfo("Inserting dcl_temps %Iu\n", new_val);
-	asm_text->insert(dcl_end, insert_str);
-	dcl_end += insert_str.size();
-
-	return true;
-}
-
-ShaderRegexPattern::ShaderRegexPattern() :
-	regex(NULL),
-	do_replace(false)
-{
-}
-
-ShaderRegexPattern::~ShaderRegexPattern()
-{
-	pcre2_code_free(regex);
-}
-
-bool ShaderRegexPattern::compile(std::string *pattern)
-{
-	uint32_t name_table_entry_size;
-	uint32_t name_table_count;
-	uint32_t i;
-	PCRE2_SPTR name_table;
-	PCRE2_SIZE err_off;
-	int err;
-
-	// CASELESS is for compatibility with d3dcompiler_46 & 47 without
-	// having to always remember to account for the dcl_constantbuffer
-	// differences:
-	regex = pcre2_compile((PCRE2_SPTR)pattern->c_str(),
-			pattern->length(), // or PCRE2_ZERO_TERMINATED
-			PCRE2_CASELESS | PCRE2_MULTILINE,
-			&err, &err_off, NULL);
-	if (!regex) {
-		log_pcre2_error_nonl(err, "  WARNING: PCRE2 regex compilation failed at offset %u", (unsigned)err_off);
-		return false;
-	}
-
-	// TODO: Use callback to confirm that JIT does actually get used, as in
-	// some cases pcre2 can fall back to using the slower interpreter
-	pcre2_jit_compile(regex, 0);
-
-	pcre2_pattern_info(regex, PCRE2_INFO_NAMECOUNT, &name_table_count);
-	pcre2_pattern_info(regex, PCRE2_INFO_NAMEENTRYSIZE, &name_table_entry_size);
-	pcre2_pattern_info(regex, PCRE2_INFO_NAMETABLE, &name_table);
-
-	static_assert(PCRE2_CODE_UNIT_WIDTH == 8, "Need to fix name table parsing for non-8bit pcre2");
-	for (i = 0; i < name_table_count; i++)
-		named_capture_groups.insert(std::string((char*)(name_table + name_table_entry_size*i + 2)));
-
-	return true;
-}
-
-bool ShaderRegexPattern::named_group_overlaps(ShaderRegexTemps &other_set)
-{
-	ShaderRegexTemps intersection;
-
-	// C++ why you be so verbose?
-	std::set_intersection(
-				named_capture_groups.begin(),
-				named_capture_groups.end(),
-				other_set.begin(),
-				other_set.end(),
-				std::inserter(intersection, intersection.begin()));
-
-	return intersection.size() != 0;
-}
-
-bool ShaderRegexPattern::matches(std::string *asm_text)
-{
-	pcre2_match_data *match_data = NULL;
-	bool match = false;
-	int rc;
-
-	// TODO: Assign per-thread JIT stack if the default 32K turns out to be
-	// insufficient. Can probably store this in the context, as that is
-	// supposed to be per-thread, or use thread local storage.
-
-	match_data = pcre2_match_data_create_from_pattern(regex, NULL);
-
-	// TODO: Consider using pcre2_jit_match - doco claims 10% faster, but
-	// has less sanity checks. TODO: Use callback to confirm JIT was used
-	rc = pcre2_match(regex, (PCRE2_SPTR)asm_text->c_str(), asm_text->length(), 0, 0, match_data, NULL);
-	if (rc == PCRE2_ERROR_NOMATCH)
-		goto out_free;
-	if (rc < 0) {
-		log_pcre2_error_nonl(rc, "  WARNING: regex match error");
-		goto out_free;
-	}
-
-	match = true;
-
-out_free:
-	pcre2_match_data_free(match_data);
-	return match;
-}
-
-static void replacement_search_and_replace(std::string &str, std::string *search, std::string *replace)
-{
-	size_t pos;
-
-	for (pos = str.find(*search); pos != std::string::npos; pos = str.find(*search, pos + 1)) {
-		if (pos > 0 && (str[pos-1] == '$' || str[pos-1] == '\\'))
-			continue;
-
-		str.replace(pos, search->length(), *replace);
-	}
-}
-
-static void substitute_temp_regs(std::string &replacement, ShaderRegexTemps *temp_regs, unsigned dcl_temps)
-{
-	ShaderRegexTemps::iterator i;
-	unsigned tmp_reg = dcl_temps;
-	std::string search_str, repl_str;
-
-	for (i = temp_regs->begin(); i != temp_regs->end(); i++, tmp_reg++) {
-		repl_str = std::string("r") + std::to_string(tmp_reg);
-
-		search_str = std::string("$") + *i;
-		replacement_search_and_replace(replacement, &search_str, &repl_str);
-
-		search_str = std::string("${") + *i + std::string("}");
-		replacement_search_and_replace(replacement, &search_str, &repl_str);
-	}
-}
-
-bool ShaderRegexPattern::patch(std::string *asm_text, ShaderRegexTemps *temp_regs, unsigned dcl_temps)
-{
-	pcre2_match_data *match_data = NULL;
-	PCRE2_SIZE est_size, output_size;
-	std::string replace_copy;
-	PCRE2_UCHAR *buf = NULL;
-	bool patch = false;
-	uint32_t options;
-	int rc;
-
-	static_assert(PCRE2_CODE_UNIT_WIDTH == 8, "Need to fix output buffer allocation for non-8bit pcre2");
-
-	// We operate on a copy of the replace string so that future shaders
-	// don't get our temporary register numbers:
-	replace_copy = replace;
-	substitute_temp_regs(replace_copy, temp_regs, dcl_temps);
-
-	// TODO: Allow named capture groups from other patterns in the same
-	// regex group to be substituted in, and provide some simple arithmetic
-	// operators to e.g. allow a constant buffer byte offset to be divided
-	// by 16 to get the constant buffer index and vice versa
-
-	// At a minimum we want \n to be translated in the replace string,
-	// which needs extended substitution processing to be enabled:
-	options = PCRE2_SUBSTITUTE_EXTENDED;
-
-	match_data = pcre2_match_data_create_from_pattern(regex, NULL);
-
-	output_size = est_size = asm_text->length() + replace_copy.length() + 1024;
-	buf = new PCRE2_UCHAR[output_size];
-	rc = pcre2_substitute(regex,
-			(PCRE2_SPTR)asm_text->c_str(), asm_text->length(), 0,
-			options | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH,
-			match_data, NULL,
-			(PCRE2_SPTR)replace_copy.c_str(), replace_copy.length(),
-			buf, &output_size);
-
-	if (rc == PCRE2_ERROR_NOMEMORY) {
-		LogInfo("  NOTICE: regex replace requires a %u byte buffer\n", (unsigned)output_size);
-		LogInfo("  NOTICE: We underestimated by %u bytes and have to start over\n", (unsigned)(output_size - est_size));
-		LogInfo("  NOTICE: What kind of crazy are you doing to get down this code path?\n");
-		LogInfo("  NOTICE: You didn't inject a matrix inverse or two in assembly did you?\n");
-		LogInfo("  NOTICE: Once more, with passion!\n");
-
-		delete [] buf;
-		buf = new PCRE2_UCHAR[output_size];
-
-		rc = pcre2_substitute(regex,
-				(PCRE2_SPTR)asm_text->c_str(), asm_text->length(), 0,
-				options, // No PCRE2_SUBSTITUTE_OVERFLOW_LENGTH this time
-				match_data, NULL,
-				(PCRE2_SPTR)replace_copy.c_str(), replace_copy.length(),
-				buf, &output_size);
-	}
-
-	if (rc == 0)
-		goto out_free;
-	if (rc < 0) {
-		log_pcre2_error_nonl(rc, "  WARNING: regex replace error");
-		goto out_free;
-	}
-
-	*asm_text = (char*)buf;
-	patch = true;
-
-out_free:
-	pcre2_match_data_free(match_data);
-	delete [] buf;
-
-	return patch;
-}
-
-void ShaderRegexGroup::apply_regex_patterns(std::string *asm_text, bool *match, bool *patch)
-{
-	ShaderRegexPatterns::iterator i;
-	ShaderRegexPattern *pattern;
-	unsigned dcl_temps = 0;
-
-	// Match defaults to true so that if there are no patterns we can still
-	// apply the command list. Patch defaults to false because we don't
-	// want to waste time re-assembling the shader if we didn't change it.
-	*match = true;
-	*patch = false;
-
-	if (!temp_regs.empty())
-		dcl_temps = get_dcl_temps(asm_text);
-
-	for (i = patterns.begin(); i != patterns.end(); i++) {
-		pattern = &i->second;
-
-		if (pattern->do_replace)
-			*match = *patch = pattern->patch(asm_text, &temp_regs, dcl_temps);
-		else
-			*match = pattern->matches(asm_text);
-
-		if (!*match) {
-			*patch = false;
-			return;
-		}
-	}
-
-	// Only update dcl_temps if we are patching:
-	if (*patch && !temp_regs.empty())
-		*patch = update_dcl_temps(asm_text, dcl_temps + temp_regs.size());
-
-	// But we can update declarations even if we aren't doing a regex
-	// replace in some cases, so long as the patterns all matched (e.g.
-	// globally disable the driver stereo cb):
-	if (!declarations.empty())
-		*patch = insert_declarations(asm_text, &declarations) || *patch;
+	return &get_tls()->shader_regex;
 }
 
 void ShaderRegexGroup::link_command_lists_and_filter_index(UINT64 shader_hash)
@@ -376,6 +36,10 @@ void ShaderRegexGroup::link_command_lists_and_filter_index(UINT64 shader_hash)
 	if (command_list.commands.empty() && post_command_list.commands.empty() && filter_index == FLT_MAX)
 		return;
 
+	// Creating a new ShaderOverride invalidates any that SetShader has
+	// cached as not existing for this hash:
+	if (!G->mShaderOverrideMap.count(shader_hash))
+		G->shader_override_generation++;
 	shader_override = &G->mShaderOverrideMap[shader_hash];
 
 	// Initialise the ShaderOverride's command lists if they aren't already:
@@ -466,14 +130,36 @@ bool unlink_shader_regex_command_lists_and_filter_index(UINT64 shader_hash)
 	return ret;
 }
 
-#define SHADER_REGEX_CACHE_VERSION 1
+// Version 2 replaced the global hash of every ShaderRegex section with the
+// digests of the individual groups that applied to the shader, so that editing
+// one group doesn't throw away the cached results for every other shader.
+#define SHADER_REGEX_CACHE_VERSION 2
 struct ShaderRegexCacheHeader {
 	uint32_t version;
-	uint32_t shader_regex_hash;
+	uint32_t settings_hash;
 	uint32_t patched;
+	uint32_t num_groups;
 	uint32_t num_matches;
+	char shader_model[16];
+	// Followed by num_groups digests of the groups that applied to the
+	// shader model at the time the cache entry was made, in order, then
+	// num_matches indices into that list of the groups that matched.
 };
 
+// Finds the groups that apply to a given shader model. These are the only ones
+// that could have any effect on a shader with that model, so they are all we
+// need to compare to know if a cache entry is still valid:
+static void get_applicable_shader_regex_groups(const char *shader_model, vector<uint32_t> *group_ids)
+{
+	uint32_t i;
+
+	group_ids->clear();
+	for (i = 0; i < shader_regex_group_index.size(); i++) {
+		if (shader_regex_group_index[i]->shader_models.count(shader_model))
+			group_ids->push_back(i);
+	}
+}
+
 ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode, std::wstring *tagline)
 {
 	ShaderRegexCache ret = ShaderRegexCache::NO_CACHE;
@@ -482,7 +168,9 @@ ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type
 	ShaderRegexCacheHeader *header;
 	ShaderRegexGroup *group;
 	wchar_t path[MAX_PATH];
-	uint32_t *match_ids;
+	char shader_model[sizeof(header->shader_model) + 1];
+	vector<uint32_t> applicable_ids;
+	uint32_t *digests, *match_ids;
 	DWORD size, size2;
 	byte *buf = NULL;
 	size_t suffix;
@@ -504,14 +192,34 @@ ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type
 		goto out;
 
 	header = (ShaderRegexCacheHeader*)buf;
-	match_ids = (uint32_t*)(buf + sizeof(ShaderRegexCacheHeader));
+	digests = (uint32_t*)(buf + sizeof(ShaderRegexCacheHeader));
 
 	if (header->version != SHADER_REGEX_CACHE_VERSION
-	 || header->shader_regex_hash != shader_regex_hash)
+	 || header->settings_hash != shader_regex_settings_hash)
 		goto out;
 
-	if (size != sizeof(ShaderRegexCacheHeader) + header->num_matches * sizeof(uint32_t))
+	if (size != sizeof(ShaderRegexCacheHeader) + ((size_t)header->num_groups + header->num_matches) * sizeof(uint32_t))
+		goto out;
+	match_ids = digests + header->num_groups;
+
+	// The cache entry is still valid if exactly the same groups (by
+	// content, which includes their names) apply to this shader model now
+	// as when it was made. Groups that were edited, added or removed for
+	// other shader models don't affect it:
+	memcpy(shader_model, header->shader_model, sizeof(header->shader_model));
+	shader_model[sizeof(header->shader_model)] = '\0';
+	get_applicable_shader_regex_groups(shader_model, &applicable_ids);
+	if (applicable_ids.size() != header->num_groups) {
+		LogInfo("ShaderRegexCache: %S %016I64x is stale: groups were added or removed\n", shader_type, hash);
 		goto out;
+	}
+	for (i = 0; i < header->num_groups; i++) {
+		group = shader_regex_group_index[applicable_ids[i]];
+		if (group->digest != digests[i]) {
+			LogInfo("ShaderRegexCache: %S %016I64x is stale: [%S] changed\n", shader_type, hash, group->ini_section.c_str());
+			goto out;
+		}
+	}
 
 	// num_matches may be 0, which means the ShaderRegex didn't match the
 	// shader, but we cache it anyway to skip processing the shader again.
@@ -524,13 +232,9 @@ ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type
 	}
 
 	for (i = 0; i < header->num_matches; i++) {
-		// The ShaderRegex groups are sorted and since the cached hash
-		// already matched the map should be identical to when the
-		// cache was made, so we can use that to find the matching
-		// groups without having to do an expensive lookup by name:
-		if (match_ids[i] >= shader_regex_group_index.size())
+		if (match_ids[i] >= applicable_ids.size())
 			goto out;
-		group = shader_regex_group_index[match_ids[i]];
+		group = shader_regex_group_index[applicable_ids[match_ids[i]]];
 
 		LogInfo("ShaderRegexCache: %S %016I64x matches [%S]\n", shader_type, hash, group->ini_section.c_str());
 
@@ -563,20 +267,22 @@ out:
 	return ret;
 }
 
-static void save_shader_regex_cache_meta(UINT64 hash, const wchar_t *shader_type, vector<uint32_t> *match_ids,
+static void save_shader_regex_cache_meta(UINT64 hash, const wchar_t *shader_type, std::string *shader_model,
+		vector<uint32_t> *applicable_ids, vector<uint32_t> *match_ids,
 		bool patched, std::string *asm_text, std::wstring *tagline)
 {
 	ShaderRegexCacheHeader header;
 	wchar_t path[MAX_PATH];
 	FILE *f = NULL;
 	size_t suffix;
+	uint32_t digest;
 
 	if (!G->SHADER_CACHE_PATH[0] || (!G->CACHE_SHADERS && !G->EXPORT_FIXED))
 		return;
 
 	suffix = swprintf_s(path, MAX_PATH, L"%ls\\%016llx-%ls_regex.", G->SHADER_CACHE_PATH, hash, shader_type);
 
-	if (G->CACHE_SHADERS) {
+	if (G->CACHE_SHADERS && shader_model->size() <= sizeof(header.shader_model)) {
 		// TODO: When we have a condition field in ShaderRegex: The evaluations
 		// of *all* valid conditions (not just those matched) must qualify the
 		// cache, either by encoding them in the filename or extending the
@@ -595,11 +301,18 @@ static void save_shader_regex_cache_meta(UINT64 hash, const wchar_t *shader_type
 		if (!f)
 			return;
 
+		memset(&header, 0, sizeof(ShaderRegexCacheHeader));
 		header.version = SHADER_REGEX_CACHE_VERSION;
-		header.shader_regex_hash = shader_regex_hash;
+		header.settings_hash = shader_regex_settings_hash;
 		header.patched = patched;
+		header.num_groups = (uint32_t)applicable_ids->size();
 		header.num_matches = (uint32_t)match_ids->size();
+		memcpy(header.shader_model, shader_model->data(), shader_model->size());
 		fwrite(&header, 1, sizeof(ShaderRegexCacheHeader), f);
+		for (uint32_t id : *applicable_ids) {
+			digest = shader_regex_group_index[id]->digest;
+			fwrite(&digest, sizeof(uint32_t), 1, f);
+		}
 		fwrite(match_ids->data(), sizeof(uint32_t), match_ids->size(), f);
 
 		fclose(f);
@@ -643,38 +356,124 @@ void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector
 	fclose(f);
 }
 
+void build_shader_regex_prefilter()
+{
+	ShaderRegexGroups::iterator i;
+	ShaderRegexGroup *group;
+	unsigned prefiltered = 0;
+
+	shader_regex_prefilter.clear();
+
+	for (i = shader_regex_groups.begin(); i != shader_regex_groups.end(); i++) {
+		group = &i->second;
+		group->add_required_literals(&shader_regex_prefilter);
+		if (!group->required_literals.empty())
+			prefiltered++;
+	}
+
+	shader_regex_prefilter.build();
+
+	LogInfo("ShaderRegex prefilter: %u/%u groups, %Iu literals, %Iu states\n",
+			prefiltered, (unsigned)shader_regex_groups.size(),
+			shader_regex_prefilter.size(), shader_regex_prefilter.states());
+}
+
+std::wstring shader_regex_profiling_report()
+{
+	ShaderRegexGroups::iterator i;
+	ShaderRegexPatterns::iterator j;
+	std::vector<std::pair<ShaderRegexPattern*, std::wstring>> patterns;
+	LONG64 total_ticks = 0;
+	LONG total_runs = 0, total_hits = 0;
+	unsigned jit = 0;
+	LARGE_INTEGER freq;
+	wchar_t buf[256];
+	std::wstring ret;
+	size_t k;
+
+	if (shader_regex_groups.empty())
+		return ret;
+
+	QueryPerformanceFrequency(&freq);
+
+	for (i = shader_regex_groups.begin(); i != shader_regex_groups.end(); i++) {
+		for (j = i->second.patterns.begin(); j != i->second.patterns.end(); j++) {
+			patterns.emplace_back(&j->second, i->second.ini_section + L"." + j->first);
+			total_ticks += j->second.ticks;
+			total_runs += j->second.runs;
+			total_hits += j->second.hits;
+			jit += j->second.jit;
+		}
+	}
+
+	// These are cumulative since the patterns were loaded rather than
+	// per profiling interval, since most shaders are patched while the
+	// game is loading, long before anyone opens the profiling overlay:
+	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
+			L"\nShaderRegex patterns (since loaded):\n"
+			L"   %Iu patterns (%u JIT), %li runs, %li matches, %.3fms\n",
+			patterns.size(), jit, total_runs, total_hits,
+			total_ticks * 1000.0 / freq.QuadPart);
+	ret += buf;
+
+	std::sort(patterns.begin(), patterns.end(), [](const std::pair<ShaderRegexPattern*, std::wstring> &lhs, const std::pair<ShaderRegexPattern*, std::wstring> &rhs) {
+		return lhs.first->ticks > rhs.first->ticks;
+	});
+
+	for (k = 0; k < patterns.size() && k < 5; k++) {
+		if (!patterns[k].first->runs)
+			break;
+		_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
+				L"   %8.3fms %6li runs %5li matches [%ls]\n",
+				patterns[k].first->ticks * 1000.0 / freq.QuadPart,
+				patterns[k].first->runs, patterns[k].first->hits,
+				patterns[k].second.c_str());
+		ret += buf;
+	}
+
+	return ret;
+}
+
 bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type, std::string *shader_model, UINT64 hash, std::wstring *tagline)
 {
 	ShaderRegexGroups::iterator i;
 	ShaderRegexGroup *group;
 	bool patched = false;
 	bool match, patch;
-	vector<uint32_t> match_ids;
+	vector<uint32_t> applicable_ids, match_ids;
+	vector<char> literals_found;
+	bool scanned = false;
 	uint32_t j;
 
 	if (*shader_model == std::string("bin")) {
 		// This will update the data structure, because we may as well
 		// - it will save effort if we have to redo this again later.
-		if (!get_shader_model(asm_text, shader_model))
+		if (!get_shader_model_from_asm(asm_text, shader_model))
 			return false;
 	}
 
 	for (i = shader_regex_groups.begin(), j = 0; i != shader_regex_groups.end(); i++, j++) {
 		group = &i->second;
 
-		// FIXME: Don't even disassemble if the shader model isn't in
-		// any of the regex groups and we aren't applying any other
-		// forms of deferred patches
+		// Shaders whose model isn't in any group are normally skipped
+		// before we get here (see shader_regex_targeted_models), but
+		// each group still only applies to its own models:
 		if (!group->shader_models.count(*shader_model))
 			continue;
 
-		group->apply_regex_patterns(asm_text, &match, &patch);
+		// Every group that applies to this shader model goes into the
+		// cache, whether it matches or not, since editing any of them
+		// could change the result:
+		applicable_ids.push_back(j);
+
+		group->apply_regex_patterns_prefiltered(asm_text, &shader_regex_prefilter,
+				&literals_found, &scanned, &match, &patch);
 		if (!match)
 			continue;
 
 		LogInfo("ShaderRegex: %s %016I64x matches [%S]\n", shader_model->c_str(), hash, group->ini_section.c_str());
 		patched = patched || patch;
-		match_ids.push_back(j);
+		match_ids.push_back((uint32_t)applicable_ids.size() - 1);
 
 		if (patch && tagline)
 			tagline->append(std::wstring(L"[") + group->ini_section + std::wstring(L"]"));
@@ -686,7 +485,7 @@ bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type
 	// way we can skip checking for a match next time when we know there
 	// won't be any. This only saves the metadata - the caller will use
 	// save_shader_regex_cache_bin to save the assembled binary.
-	save_shader_regex_cache_meta(hash, shader_type, &match_ids, patched, asm_text, tagline);
+	save_shader_regex_cache_meta(hash, shader_type, shader_model, &applicable_ids, &match_ids, patched, asm_text, tagline);
 
 	return patched;
 }
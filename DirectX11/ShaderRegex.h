@@ -1,14 +1,12 @@
 #pragma once
 
 #include "CommandList.h"
+#include "ShaderRegexEngine.h"
 
 #include <map>
-#include <set>
 #include <string>
 #include <vector>
 
-#include <pcre2.h>
-
 enum class ShaderRegexCache {
 	NO_CACHE,
 	NO_MATCH,
@@ -20,58 +18,27 @@ bool apply_shader_regex_groups(std::string *asm_text, const wchar_t *shader_type
 ShaderRegexCache load_shader_regex_cache(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode, std::wstring *tagline);
 void save_shader_regex_cache_bin(UINT64 hash, const wchar_t *shader_type, vector<byte> *bytecode);
 bool unlink_shader_regex_command_lists_and_filter_index(UINT64 shader_hash);
+void build_shader_regex_prefilter();
+std::wstring shader_regex_profiling_report();
 
-typedef std::set<std::string> ShaderRegexTemps;
-typedef std::set<std::string> ShaderRegexModels;
-
-class ShaderRegexPattern {
+class ShaderRegexGroup : public ShaderRegexPatternGroup {
 public:
-	pcre2_code *regex;
-	std::string replace;
-
-	bool do_replace;
-
-	// These will be used later when we implement our own advanced
-	// substitution to allow matches to be used between multiple patterns
-	// in the one regex group, and to apply some (very) simple arithmetic
-	// to convert byte offsets to constant buffer indexes and vice versa
-	std::set<std::string> named_capture_groups;
-
-	ShaderRegexPattern();
-	~ShaderRegexPattern();
-
-	bool compile(std::string *pattern);
-	bool named_group_overlaps(ShaderRegexTemps &other_set);
-	bool matches(std::string *asm_text);
-	bool patch(std::string *asm_text, ShaderRegexTemps *temp_regs, unsigned dcl_temps);
-};
-
-// These are sorted to make sure we get consistent results between runs
-// in case the user does something that winds up depending on the order:
-typedef std::map<std::wstring, ShaderRegexPattern> ShaderRegexPatterns;
-typedef std::vector<std::string> ShaderRegexDeclarations;
-
-class ShaderRegexGroup {
-public:
-	std::wstring ini_section;
-
-	ShaderRegexPatterns patterns;
-
-	ShaderRegexDeclarations declarations;
-	ShaderRegexModels shader_models;
-	ShaderRegexTemps temp_regs;
 	float filter_index;
 
+	// Hash of all ini sections making up this group. Cached ShaderRegex
+	// results record the digests of every group that applied to them:
+	uint32_t digest;
+
 	CommandList command_list;
 	CommandList post_command_list;
 	std::shared_ptr<RunLinkedCommandList> link;
 	std::shared_ptr<RunLinkedCommandList> post_link;
 
-	void apply_regex_patterns(std::string *asm_text, bool *match, bool *patch);
 	void link_command_lists_and_filter_index(UINT64 shader_hash);
 
 	ShaderRegexGroup() :
-		filter_index(FLT_MAX)
+		filter_index(FLT_MAX),
+		digest(0)
 	{}
 };
 
@@ -81,6 +48,17 @@ typedef std::map<std::wstring, ShaderRegexGroup> ShaderRegexGroups;
 extern ShaderRegexGroups shader_regex_groups;
 extern std::vector<ShaderRegexGroup*> shader_regex_group_index;
 
-// This hash is of all ShaderRegex sections and is used to determine if a
-// cached shader is still valid and to avoid discarding regex patched shaders:
+// Every shader model named by any ShaderRegex group, so that shaders that no
+// group could apply to can be skipped before they are disassembled:
+extern ShaderRegexModels shader_regex_targeted_models;
+extern volatile LONG shader_regex_model_skips;
+
+// This hash is of all ShaderRegex sections. Cache validity is now tracked per
+// group (below), but this is still logged to identify the configuration:
 extern uint32_t shader_regex_hash;
+
+// Hash of the global settings that affect every ShaderRegex group, such as
+// how shaders are disassembled. Changing any of these invalidates the entire
+// ShaderRegex cache, whereas changing a single group only invalidates cached
+// shaders that group applies to:
+extern uint32_t shader_regex_settings_hash;
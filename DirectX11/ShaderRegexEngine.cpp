@@ -0,0 +1,508 @@
+#include "ShaderRegexEngine.h"
+#include "log.h"
+
+#include <algorithm>
+#include <iterator>
+
+static void log_pcre2_error_nonl(int err, char *fmt, ...)
+{
+	PCRE2_UCHAR buf[120]; // doco says "120 code units is ample"
+	va_list ap;
+
+	pcre2_get_error_message(err, buf, sizeof(buf));
+
+	va_start(ap, fmt);
+	vLogInfo(fmt, ap);
+	va_end(ap);
+
+	LogInfo(": %s\n", buf);
+}
+
+bool get_shader_model_from_asm(std::string *asm_text, std::string *shader_model)
+{
+	size_t shader_model_pos;
+
+	for (
+		shader_model_pos = asm_text->find("\n");
+		shader_model_pos != std::string::npos && (*asm_text)[shader_model_pos + 1] == '/';
+		shader_model_pos = asm_text->find("\n", shader_model_pos + 1)
+	) {}
+
+	if (shader_model_pos == std::string::npos)
+		return false;
+
+	*shader_model = asm_text->substr(shader_model_pos + 1, asm_text->find("\n", shader_model_pos + 1) - shader_model_pos - 1);
+	return true;
+}
+
+static bool find_dcl_end(std::string *asm_text, size_t *dcl_end_pos)
+{
+	// FIXME: Might be better to scan forwards
+
+	*dcl_end_pos = asm_text->rfind("\ndcl_");
+	*dcl_end_pos = asm_text->find("\n", *dcl_end_pos + 1);
+
+	if (*dcl_end_pos == std::string::npos) {
+		LogInfo("WARNING: Unable to locate end of shader declarations!\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool insert_declarations(std::string *asm_text, ShaderRegexDeclarations *declarations)
+{
+	ShaderRegexDeclarations::iterator i;
+	std::string insert_str;
+	size_t dcl_end;
+	bool patch = false;
+
+	if (!find_dcl_end(asm_text, &dcl_end))
+		return false;
+
+	for (i = declarations->begin(); i != declarations->end(); i++) {
+		insert_str = std::string("\n") + *i;
+
+		if (asm_text->find(insert_str + std::string("\n")) != std::string::npos)
+			continue;
+
+		asm_text->insert(dcl_end, insert_str);
+		dcl_end += insert_str.size();
+
+		patch = true;
+	}
+
+	return patch;
+}
+
+static bool find_dcl_temps(std::string *asm_text, size_t *dcl_temps_pos)
+{
+	// Could use regex for this as well, but given we only need to find a
+	// constant string it will be more efficient to just do this:
+	*dcl_temps_pos = asm_text->find("\ndcl_temps ", 0);
+
+	if (*dcl_temps_pos == std::string::npos)
+		return false;
+
+	return true;
+}
+
+static unsigned get_dcl_temps(std::string *asm_text)
+{
+	size_t dcl_temps;
+	unsigned tmp_regs = 0;
+
+	if (!find_dcl_temps(asm_text, &dcl_temps))
+		return 0;
+
+	tmp_regs = stoul(asm_text->substr(dcl_temps + 10, 4));
+	LogInfo("Found dcl_temps %d\n", tmp_regs);
+
+	return tmp_regs;
+}
+
+static bool update_dcl_temps(std::string *asm_text, size_t new_val)
+{
+	size_t dcl_temps, dcl_temps_end, dcl_end;
+	std::string insert_str;
+
+	if (find_dcl_temps(asm_text, &dcl_temps)) {
+		dcl_temps += 11;
+		dcl_temps_end = asm_text->find("\n", dcl_temps);
+		LogInfo("Updating dcl_temps %Iu\n", new_val);
+		asm_text->replace(dcl_temps, dcl_temps_end - dcl_temps, std::to_string(new_val));
+		return true;
+	}
+
+	if (!find_dcl_end(asm_text, &dcl_end))
+		return false;
+
+	insert_str = std::string("\ndcl_temps ") + std::to_string(new_val);
+	LogInfo("Inserting dcl_temps %Iu\n", new_val);
+	asm_text->insert(dcl_end, insert_str);
+	dcl_end += insert_str.size();
+
+	return true;
+}
+
+// Per-thread pcre2 state, so that we don't have to allocate new match data
+// for every pattern we try on every shader. The JIT stack is per-thread for
+// the same reason - pcre2 only allows a JIT stack to be used by one thread at
+// a time. The default 32K stack pcre2 uses if we don't assign one is fine for
+// most patterns, but may be insufficient for a complicated pattern matched
+// against a long shader, so allow it to grow up to this limit:
+#define SHADER_REGEX_JIT_STACK_START (32 * 1024)
+#define SHADER_REGEX_JIT_STACK_MAX (1024 * 1024)
+
+struct ShaderRegexThreadState {
+	pcre2_match_data *match_data;
+	pcre2_match_context *match_context;
+	pcre2_jit_stack *jit_stack;
+
+	ShaderRegexThreadState() :
+		match_data(NULL),
+		match_context(NULL),
+		jit_stack(NULL)
+	{}
+};
+
+static ShaderRegexThreadState* get_shader_regex_thread_state(uint32_t ovector_pairs)
+{
+	ShaderRegexThreadState **slot = shader_regex_thread_state_slot();
+	ShaderRegexThreadState *state = *slot;
+
+	if (!state) {
+		state = new ShaderRegexThreadState();
+		state->match_context = pcre2_match_context_create(NULL);
+		state->jit_stack = pcre2_jit_stack_create(SHADER_REGEX_JIT_STACK_START, SHADER_REGEX_JIT_STACK_MAX, NULL);
+		if (state->match_context && state->jit_stack)
+			pcre2_jit_stack_assign(state->match_context, NULL, state->jit_stack);
+		*slot = state;
+	}
+
+	// Grow the match data if this pattern has more capture groups than
+	// any we have matched on this thread before:
+	if (state->match_data && pcre2_get_ovector_count(state->match_data) < ovector_pairs) {
+		pcre2_match_data_free(state->match_data);
+		state->match_data = NULL;
+	}
+	if (!state->match_data)
+		state->match_data = pcre2_match_data_create(ovector_pairs, NULL);
+
+	return state;
+}
+
+ShaderRegexPattern::ShaderRegexPattern() :
+	regex(NULL),
+	do_replace(false),
+	jit(false),
+	capture_count(0),
+	ticks(0),
+	runs(0),
+	hits(0)
+{
+}
+
+ShaderRegexPattern::~ShaderRegexPattern()
+{
+	pcre2_code_free(regex);
+}
+
+bool ShaderRegexPattern::compile(std::string *pattern)
+{
+	uint32_t name_table_entry_size;
+	uint32_t name_table_count;
+	uint32_t i;
+	PCRE2_SPTR name_table;
+	PCRE2_SIZE err_off;
+	int err, rc;
+
+	// CASELESS is for compatibility with d3dcompiler_46 & 47 without
+	// having to always remember to account for the dcl_constantbuffer
+	// differences:
+	regex = pcre2_compile((PCRE2_SPTR)pattern->c_str(),
+			pattern->length(), // or PCRE2_ZERO_TERMINATED
+			PCRE2_CASELESS | PCRE2_MULTILINE,
+			&err, &err_off, NULL);
+	if (!regex) {
+		log_pcre2_error_nonl(err, "  WARNING: PCRE2 regex compilation failed at offset %u", (unsigned)err_off);
+		return false;
+	}
+
+	// The JIT only compiles the modes we ask for - passing 0 here compiles
+	// nothing at all and leaves the pattern running on the interpreter.
+	// If it fails (e.g. the JIT is not supported on this platform) we can
+	// still use the interpreter, it's just slower:
+	rc = pcre2_jit_compile(regex, PCRE2_JIT_COMPLETE);
+	jit = (rc == 0);
+	if (!jit)
+		log_pcre2_error_nonl(rc, "  NOTICE: PCRE2 JIT compilation failed, falling back to interpreter");
+
+	pcre2_pattern_info(regex, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+
+	extract_required_literals(*pattern, &required_literals);
+
+	pcre2_pattern_info(regex, PCRE2_INFO_NAMECOUNT, &name_table_count);
+	pcre2_pattern_info(regex, PCRE2_INFO_NAMEENTRYSIZE, &name_table_entry_size);
+	pcre2_pattern_info(regex, PCRE2_INFO_NAMETABLE, &name_table);
+
+	static_assert(PCRE2_CODE_UNIT_WIDTH == 8, "Need to fix name table parsing for non-8bit pcre2");
+	for (i = 0; i < name_table_count; i++)
+		named_capture_groups.insert(std::string((char*)(name_table + name_table_entry_size*i + 2)));
+
+	return true;
+}
+
+bool ShaderRegexPattern::named_group_overlaps(ShaderRegexTemps &other_set)
+{
+	ShaderRegexTemps intersection;
+
+	// C++ why you be so verbose?
+	std::set_intersection(
+				named_capture_groups.begin(),
+				named_capture_groups.end(),
+				other_set.begin(),
+				other_set.end(),
+				std::inserter(intersection, intersection.begin()));
+
+	return intersection.size() != 0;
+}
+
+// Runs the pattern over the text with this thread's match data, returning the
+// pcre2 result code. The match data and context are passed back so that a
+// replace can make use of them.
+int ShaderRegexPattern::match(std::string *asm_text, pcre2_match_data **match_data, pcre2_match_context **match_context)
+{
+	ShaderRegexThreadState *state;
+	LARGE_INTEGER start, end;
+	int rc;
+
+	state = get_shader_regex_thread_state(capture_count + 1);
+	if (!state->match_data) {
+		LogInfo("  WARNING: Unable to allocate regex match data\n");
+		return PCRE2_ERROR_NOMEMORY;
+	}
+	*match_data = state->match_data;
+	*match_context = state->match_context;
+
+	QueryPerformanceCounter(&start);
+
+	// pcre2_jit_match skips the sanity checks pcre2_match does on the
+	// arguments before handing off to the JIT, which we don't need since
+	// the subject is always our own disassembly
+	if (jit)
+		rc = pcre2_jit_match(regex, (PCRE2_SPTR)asm_text->c_str(), asm_text->length(), 0, 0, state->match_data, state->match_context);
+	else
+		rc = pcre2_match(regex, (PCRE2_SPTR)asm_text->c_str(), asm_text->length(), 0, 0, state->match_data, state->match_context);
+
+	QueryPerformanceCounter(&end);
+
+	InterlockedAdd64(&ticks, end.QuadPart - start.QuadPart);
+	InterlockedIncrement(&runs);
+	if (rc >= 0)
+		InterlockedIncrement(&hits);
+
+	return rc;
+}
+
+bool ShaderRegexPattern::matches(std::string *asm_text)
+{
+	pcre2_match_data *match_data;
+	pcre2_match_context *match_context;
+	int rc;
+
+	rc = match(asm_text, &match_data, &match_context);
+	if (rc == PCRE2_ERROR_NOMATCH)
+		return false;
+	if (rc < 0) {
+		log_pcre2_error_nonl(rc, "  WARNING: regex match error");
+		return false;
+	}
+
+	return true;
+}
+
+static void replacement_search_and_replace(std::string &str, std::string *search, std::string *replace)
+{
+	size_t pos;
+
+	for (pos = str.find(*search); pos != std::string::npos; pos = str.find(*search, pos + 1)) {
+		if (pos > 0 && (str[pos-1] == '$' || str[pos-1] == '\\'))
+			continue;
+
+		str.replace(pos, search->length(), *replace);
+	}
+}
+
+static void substitute_temp_regs(std::string &replacement, ShaderRegexTemps *temp_regs, unsigned dcl_temps)
+{
+	ShaderRegexTemps::iterator i;
+	unsigned tmp_reg = dcl_temps;
+	std::string search_str, repl_str;
+
+	for (i = temp_regs->begin(); i != temp_regs->end(); i++, tmp_reg++) {
+		repl_str = std::string("r") + std::to_string(tmp_reg);
+
+		search_str = std::string("$") + *i;
+		replacement_search_and_replace(replacement, &search_str, &repl_str);
+
+		search_str = std::string("${") + *i + std::string("}");
+		replacement_search_and_replace(replacement, &search_str, &repl_str);
+	}
+}
+
+bool ShaderRegexPattern::patch(std::string *asm_text, ShaderRegexTemps *temp_regs, unsigned dcl_temps)
+{
+	pcre2_match_data *match_data;
+	pcre2_match_context *match_context;
+	PCRE2_SIZE est_size, output_size, match_start;
+	std::string replace_copy, output;
+	uint32_t options;
+	int rc;
+
+	static_assert(PCRE2_CODE_UNIT_WIDTH == 8, "Need to fix output buffer allocation for non-8bit pcre2");
+
+	// Find the match first, so that in the common case where the pattern
+	// doesn't match we don't waste time preparing the replace string or
+	// allocating a buffer for the output:
+	rc = match(asm_text, &match_data, &match_context);
+	if (rc == PCRE2_ERROR_NOMATCH)
+		return false;
+	if (rc < 0) {
+		log_pcre2_error_nonl(rc, "  WARNING: regex match error");
+		return false;
+	}
+	match_start = pcre2_get_ovector_pointer(match_data)[0];
+
+	// We operate on a copy of the replace string so that future shaders
+	// don't get our temporary register numbers:
+	replace_copy = replace;
+	substitute_temp_regs(replace_copy, temp_regs, dcl_temps);
+
+	// TODO: Allow named capture groups from other patterns in the same
+	// regex group to be substituted in, and provide some simple arithmetic
+	// operators to e.g. allow a constant buffer byte offset to be divided
+	// by 16 to get the constant buffer index and vice versa
+
+	// At a minimum we want \n to be translated in the replace string,
+	// which needs extended substitution processing to be enabled.
+	//
+	// This version of pcre2_substitute has no way to reuse the match we
+	// just found and will search for it again, so we start it at the
+	// position we already know the match is at and anchor it there. That
+	// way it only has to try the pattern once, instead of scanning the
+	// whole shader a second time:
+	options = PCRE2_SUBSTITUTE_EXTENDED | PCRE2_ANCHORED;
+
+	output_size = est_size = asm_text->length() + replace_copy.length() + 1024;
+	output.resize(output_size);
+	rc = pcre2_substitute(regex,
+			(PCRE2_SPTR)asm_text->c_str(), asm_text->length(), match_start,
+			options | PCRE2_SUBSTITUTE_OVERFLOW_LENGTH,
+			match_data, match_context,
+			(PCRE2_SPTR)replace_copy.c_str(), replace_copy.length(),
+			(PCRE2_UCHAR*)&output[0], &output_size);
+
+	if (rc == PCRE2_ERROR_NOMEMORY) {
+		LogInfo("  NOTICE: regex replace requires a %u byte buffer\n", (unsigned)output_size);
+		LogInfo("  NOTICE: We underestimated by %u bytes and have to start over\n", (unsigned)(output_size - est_size));
+		LogInfo("  NOTICE: What kind of crazy are you doing to get down this code path?\n");
+		LogInfo("  NOTICE: You didn't inject a matrix inverse or two in assembly did you?\n");
+		LogInfo("  NOTICE: Once more, with passion!\n");
+
+		output.resize(output_size);
+
+		rc = pcre2_substitute(regex,
+				(PCRE2_SPTR)asm_text->c_str(), asm_text->length(), match_start,
+				options, // No PCRE2_SUBSTITUTE_OVERFLOW_LENGTH this time
+				match_data, match_context,
+				(PCRE2_SPTR)replace_copy.c_str(), replace_copy.length(),
+				(PCRE2_UCHAR*)&output[0], &output_size);
+	}
+
+	if (rc == 0)
+		return false;
+	if (rc < 0) {
+		log_pcre2_error_nonl(rc, "  WARNING: regex replace error");
+		return false;
+	}
+
+	// output_size is now the length of the result, not including the
+	// terminator pcre2 wrote after it:
+	output.resize(output_size);
+	asm_text->swap(output);
+
+	return true;
+}
+
+void ShaderRegexPatternGroup::apply_regex_patterns(std::string *asm_text, bool *match, bool *patch)
+{
+	ShaderRegexPatterns::iterator i;
+	ShaderRegexPattern *pattern;
+	unsigned dcl_temps = 0;
+
+	// Match defaults to true so that if there are no patterns we can still
+	// apply the command list. Patch defaults to false because we don't
+	// want to waste time re-assembling the shader if we didn't change it.
+	*match = true;
+	*patch = false;
+
+	if (!temp_regs.empty())
+		dcl_temps = get_dcl_temps(asm_text);
+
+	for (i = patterns.begin(); i != patterns.end(); i++) {
+		pattern = &i->second;
+
+		if (pattern->do_replace)
+			*match = *patch = pattern->patch(asm_text, &temp_regs, dcl_temps);
+		else
+			*match = pattern->matches(asm_text);
+
+		if (!*match) {
+			*patch = false;
+			return;
+		}
+	}
+
+	// Only update dcl_temps if we are patching:
+	if (*patch && !temp_regs.empty())
+		*patch = update_dcl_temps(asm_text, dcl_temps + temp_regs.size());
+
+	// But we can update declarations even if we aren't doing a regex
+	// replace in some cases, so long as the patterns all matched (e.g.
+	// globally disable the driver stereo cb):
+	if (!declarations.empty())
+		*patch = insert_declarations(asm_text, &declarations) || *patch;
+}
+
+void ShaderRegexPatternGroup::add_required_literals(LiteralAutomaton *prefilter)
+{
+	ShaderRegexPatterns::iterator i;
+	ShaderRegexPattern *pattern;
+	uint32_t id;
+
+	required_literals.clear();
+
+	// The patterns in a group are applied in order and a replace changes
+	// the text the later patterns see, so we can only depend on the
+	// literals up to and including the first one that does a replace:
+	for (i = patterns.begin(); i != patterns.end(); i++) {
+		pattern = &i->second;
+
+		for (auto &literal : pattern->required_literals) {
+			id = prefilter->add(literal);
+			if (std::find(required_literals.begin(), required_literals.end(), id) == required_literals.end())
+				required_literals.push_back(id);
+		}
+
+		if (pattern->do_replace)
+			break;
+	}
+}
+
+void ShaderRegexPatternGroup::apply_regex_patterns_prefiltered(std::string *asm_text,
+		const LiteralAutomaton *prefilter, std::vector<char> *literals_found,
+		bool *scanned, bool *match, bool *patch)
+{
+	// Rather than run every group's regex over the whole shader, find
+	// which literals are present in a single pass and skip any group that
+	// is missing one:
+	if (!required_literals.empty()) {
+		if (!*scanned) {
+			prefilter->scan(asm_text->data(), asm_text->size(), literals_found);
+			*scanned = true;
+		}
+		for (uint32_t id : required_literals) {
+			if (!(*literals_found)[id]) {
+				*match = *patch = false;
+				return;
+			}
+		}
+	}
+
+	apply_regex_patterns(asm_text, match, patch);
+
+	// Later groups must see the literals in the patched text:
+	if (*patch)
+		*scanned = false;
+}
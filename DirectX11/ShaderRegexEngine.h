@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ShaderRegexPrefilter.h"
+
+#include <windows.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <pcre2.h>
+
+// The text processing half of ShaderRegex - compiling the patterns, matching
+// and patching the disassembly, and fixing up dcl_temps and declarations.
+// Everything to do with the d3dx.ini, the cache, command lists and
+// ShaderOverrides lives in ShaderRegex.cpp.
+//
+// This file does not depend on anything else in 3DMigoto other than the
+// logging macros, so that cmd_Decompiler can build it in and run a d3dx.ini's
+// ShaderRegex sections over a shader dump through exactly the same code that
+// the DLL uses in game.
+
+typedef std::set<std::string> ShaderRegexTemps;
+typedef std::set<std::string> ShaderRegexModels;
+
+// Per-thread pcre2 match data, match context and JIT stack. Whatever links in
+// this file must implement shader_regex_thread_state_slot() to return a
+// pointer to a per-thread variable that starts out as NULL, which this will
+// fill in the first time a pattern is matched on that thread. The DLL keeps it
+// in its TLS structure, cmd_Decompiler in a thread_local.
+struct ShaderRegexThreadState;
+ShaderRegexThreadState** shader_regex_thread_state_slot();
+
+class ShaderRegexPattern {
+	int match(std::string *asm_text, pcre2_match_data **match_data, pcre2_match_context **match_context);
+
+public:
+	pcre2_code *regex;
+	std::string replace;
+
+	bool do_replace;
+	bool jit;
+	uint32_t capture_count;
+
+	// Cumulative timing for the profiling overlay. Shaders may be patched
+	// from background threads, so these are only updated with interlocked
+	// operations:
+	volatile LONG64 ticks;
+	volatile LONG runs;
+	volatile LONG hits;
+
+	// These will be used later when we implement our own advanced
+	// substitution to allow matches to be used between multiple patterns
+	// in the one regex group, and to apply some (very) simple arithmetic
+	// to convert byte offsets to constant buffer indexes and vice versa
+	std::set<std::string> named_capture_groups;
+
+	// Literal strings that must be present in any text this pattern can
+	// match, used to skip the regex without running it:
+	std::vector<std::string> required_literals;
+
+	ShaderRegexPattern();
+	~ShaderRegexPattern();
+
+	bool compile(std::string *pattern);
+	bool named_group_overlaps(ShaderRegexTemps &other_set);
+	bool matches(std::string *asm_text);
+	bool patch(std::string *asm_text, ShaderRegexTemps *temp_regs, unsigned dcl_temps);
+};
+
+// These are sorted to make sure we get consistent results between runs
+// in case the user does something that winds up depending on the order:
+typedef std::map<std::wstring, ShaderRegexPattern> ShaderRegexPatterns;
+typedef std::vector<std::string> ShaderRegexDeclarations;
+
+// The parts of a ShaderRegex group that decide whether it matches a shader and
+// what it does to the assembly. The DLL's ShaderRegexGroup extends this with
+// the command lists and filter_index to link into matched shaders.
+class ShaderRegexPatternGroup {
+public:
+	std::wstring ini_section;
+
+	ShaderRegexPatterns patterns;
+
+	ShaderRegexDeclarations declarations;
+	ShaderRegexModels shader_models;
+	ShaderRegexTemps temp_regs;
+
+	// IDs in the prefilter automaton of literals that must all be present
+	// in a shader for this group's patterns to be able to match it:
+	std::vector<uint32_t> required_literals;
+
+	void add_required_literals(LiteralAutomaton *prefilter);
+	void apply_regex_patterns(std::string *asm_text, bool *match, bool *patch);
+
+	// Applies the patterns if the literals they need are all present.
+	// literals_found holds the result of scanning the text with the
+	// prefilter, and *scanned whether that is still current - it is only
+	// scanned when first needed, and cleared again after a patch so that
+	// the next group will rescan the patched text. Pass the same two
+	// variables to every group applied to a given shader.
+	void apply_regex_patterns_prefiltered(std::string *asm_text,
+			const LiteralAutomaton *prefilter, std::vector<char> *literals_found,
+			bool *scanned, bool *match, bool *patch);
+};
+
+// Finds the shader model line in the disassembly (e.g. "vs_5_0"), skipping
+// over any comments before it:
+bool get_shader_model_from_asm(std::string *asm_text, std::string *shader_model);
@@ -0,0 +1,345 @@
+#include "ShaderRegexPrefilter.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+
+// Shorter literals than this are not worth the bother - things like "r0." or
+// "mul" will be in nearly every shader, and just bloat the automaton:
+#define MIN_LITERAL_LENGTH 3
+
+// Marks missing transitions in the trie until build() fills them in
+#define NO_STATE UINT32_MAX
+
+static void finish_literal(std::string *run, std::vector<std::string> *literals)
+{
+	if (run->size() >= MIN_LITERAL_LENGTH) {
+		if (std::find(literals->begin(), literals->end(), *run) == literals->end())
+			literals->push_back(*run);
+	}
+	run->clear();
+}
+
+// Returns the length of a counted repetition like {2} or {1,3} starting at
+// pos, or 0 if it isn't one. pcre2 treats a { that doesn't start a valid
+// repetition as a literal character, so we have to as well.
+static size_t counted_repetition_length(const std::string &pattern, size_t pos)
+{
+	size_t i = pos + 1;
+	size_t digits;
+
+	for (digits = 0; i < pattern.size() && isdigit((unsigned char)pattern[i]); i++)
+		digits++;
+	if (!digits)
+		return 0;
+	if (i < pattern.size() && pattern[i] == ',') {
+		for (i++; i < pattern.size() && isdigit((unsigned char)pattern[i]); i++) {}
+	}
+	if (i < pattern.size() && pattern[i] == '}')
+		return i + 1 - pos;
+	return 0;
+}
+
+// Some escapes take an argument, such as \x41, \g{1} or \p{L}, which must not
+// be mistaken for literal characters. Given the position of the escape letter
+// returns the position of the last character of the escape sequence.
+static size_t skip_escape_argument(const std::string &pattern, size_t pos)
+{
+	char c = pattern[pos];
+	size_t i = pos + 1;
+	size_t digits;
+
+	if (i >= pattern.size())
+		return pos;
+
+	if (c == 'c') // Control character
+		return i;
+
+	if (strchr("gkopxNP", c) && strchr("{<'", pattern[i])) {
+		char close = pattern[i] == '{' ? '}' : pattern[i] == '<' ? '>' : '\'';
+		for (; i < pattern.size() && pattern[i] != close; i++) {}
+		return i < pattern.size() ? i : pattern.size() - 1;
+	}
+
+	if (c == 'x') {
+		for (digits = 0; digits < 2 && i < pattern.size() && isxdigit((unsigned char)pattern[i]); digits++)
+			i++;
+		return i - 1;
+	}
+
+	// Back references and octal escapes like \1 or \012, or \g1 / \g-1:
+	if (isdigit((unsigned char)c) || c == 'g') {
+		if (c == 'g' && pattern[i] == '-')
+			i++;
+		for (; i < pattern.size() && isdigit((unsigned char)pattern[i]); i++) {}
+		return i - 1;
+	}
+
+	return pos;
+}
+
+// Skips over a parenthesised group starting at pos, leaving pos on the closing
+// parenthesis. We don't try to find literals inside groups, since they could
+// be optional, alternatives, lookarounds, etc. Returns false if the group does
+// something that invalidates the literals found outside of it.
+static bool skip_group(const std::string &pattern, size_t *pos)
+{
+	size_t i = *pos;
+	int depth = 0;
+	bool in_class = false;
+
+	for (; i < pattern.size(); i++) {
+		char c = pattern[i];
+
+		if (c == '\\') {
+			// \Q...\E quoting could hide parentheses from us
+			if (i + 1 < pattern.size() && pattern[i + 1] == 'Q')
+				return false;
+			i++;
+			continue;
+		}
+		if (in_class) {
+			if (c == ']')
+				in_class = false;
+			continue;
+		}
+		if (c == '[') {
+			in_class = true;
+			// A ] straight after the [ or [^ is literal
+			if (i + 1 < pattern.size() && pattern[i + 1] == '^')
+				i++;
+			if (i + 1 < pattern.size() && pattern[i + 1] == ']')
+				i++;
+			continue;
+		}
+		if (c == '(') {
+			// An option setting like (?x) that doesn't end the group
+			// with a : applies to the rest of the enclosing group,
+			// which may be the whole pattern. Extended mode would
+			// make the whitespace in our literals meaningless, so
+			// give up if we see it. Other options (including turning
+			// caseless off) only make the pattern more specific.
+			if (i + 1 < pattern.size() && pattern[i + 1] == '?') {
+				size_t j;
+				for (j = i + 2; j < pattern.size(); j++) {
+					char o = pattern[j];
+					if (o == 'x')
+						return false;
+					if (!isalpha((unsigned char)o) && o != '-' && o != '^')
+						break;
+				}
+			}
+			depth++;
+			continue;
+		}
+		if (c == ')') {
+			if (--depth == 0) {
+				*pos = i;
+				return true;
+			}
+		}
+	}
+
+	// Unbalanced - pcre2 would have rejected this
+	return false;
+}
+
+void extract_required_literals(const std::string &pattern, std::vector<std::string> *literals)
+{
+	std::vector<std::string> found;
+	std::string run;
+	size_t i, len;
+	char c;
+
+	literals->clear();
+
+	for (i = 0; i < pattern.size(); i++) {
+		c = pattern[i];
+
+		switch (c) {
+		case '|':
+			// Top level alternation - nothing is required
+			return;
+		case '(':
+			finish_literal(&run, &found);
+			if (!skip_group(pattern, &i))
+				return;
+			continue;
+		case '[':
+			// Character classes are a single character that could
+			// be one of several, so just end the current literal
+			// and skip to the closing ] (which is literal if it is
+			// the first character of the class)
+			finish_literal(&run, &found);
+			i++;
+			if (i < pattern.size() && pattern[i] == '^')
+				i++;
+			if (i < pattern.size() && pattern[i] == ']')
+				i++;
+			for (; i < pattern.size() && pattern[i] != ']'; i++) {
+				if (pattern[i] == '\\')
+					i++;
+			}
+			continue;
+		case '.': case '^': case '$':
+			finish_literal(&run, &found);
+			continue;
+		case '?': case '*': case '+':
+			// The previous character may be repeated or absent. It
+			// will still be there at least once for +, but keep it
+			// simple and drop it from the literal either way:
+			if (!run.empty())
+				run.pop_back();
+			finish_literal(&run, &found);
+			continue;
+		case '{':
+			len = counted_repetition_length(pattern, i);
+			if (len) {
+				if (!run.empty())
+					run.pop_back();
+				finish_literal(&run, &found);
+				i += len - 1;
+				continue;
+			}
+			break;
+		case '\\':
+			if (++i >= pattern.size())
+				return;
+			c = pattern[i];
+			// \Q...\E would be a literal, but is rare enough in
+			// ShaderRegex that we just give up rather than handle
+			// the quoting rules:
+			if (c == 'Q')
+				return;
+			// Escaped alphanumerics are things like \d, \s, \b,
+			// back references or code points, none of which we
+			// treat as a literal. Anything else is the literal
+			// character itself, such as \. or \[
+			if (isalnum((unsigned char)c)) {
+				finish_literal(&run, &found);
+				i = skip_escape_argument(pattern, i);
+				continue;
+			}
+			break;
+		}
+
+		run.push_back((char)tolower((unsigned char)c));
+	}
+	finish_literal(&run, &found);
+
+	literals->swap(found);
+}
+
+LiteralAutomaton::LiteralAutomaton()
+{
+	clear();
+}
+
+uint32_t LiteralAutomaton::new_state()
+{
+	transitions.resize(transitions.size() + 256, NO_STATE);
+	outputs.emplace_back();
+	return (uint32_t)(outputs.size() - 1);
+}
+
+void LiteralAutomaton::clear()
+{
+	transitions.clear();
+	outputs.clear();
+	literals.clear();
+	built = false;
+
+	new_state(); // Root
+}
+
+uint32_t LiteralAutomaton::add(const std::string &literal)
+{
+	uint32_t state = 0, id;
+	unsigned char c;
+	size_t i;
+
+	for (id = 0; id < literals.size(); id++) {
+		if (literals[id] == literal)
+			return id;
+	}
+	literals.push_back(literal);
+
+	for (i = 0; i < literal.size(); i++) {
+		c = (unsigned char)tolower((unsigned char)literal[i]);
+		if (transitions[state * 256 + c] == NO_STATE) {
+			uint32_t next = new_state();
+			transitions[state * 256 + c] = next;
+		}
+		state = transitions[state * 256 + c];
+	}
+	outputs[state].push_back(id);
+
+	return id;
+}
+
+void LiteralAutomaton::build()
+{
+	std::vector<uint32_t> fail(outputs.size(), 0);
+	std::deque<uint32_t> queue;
+	uint32_t state, next;
+	unsigned c;
+
+	// Standard Aho-Corasick construction, but rather than keeping the
+	// failure links around to follow while scanning we fold them into
+	// the transition table so that scanning is one lookup per character.
+	// Only ever a few thousand states, so the table is small enough.
+	for (c = 0; c < 256; c++) {
+		next = transitions[c];
+		if (next == NO_STATE) {
+			transitions[c] = 0;
+		} else {
+			fail[next] = 0;
+			queue.push_back(next);
+		}
+	}
+
+	while (!queue.empty()) {
+		state = queue.front();
+		queue.pop_front();
+
+		outputs[state].insert(outputs[state].end(),
+				outputs[fail[state]].begin(), outputs[fail[state]].end());
+
+		for (c = 0; c < 256; c++) {
+			next = transitions[state * 256 + c];
+			if (next == NO_STATE) {
+				transitions[state * 256 + c] = transitions[fail[state] * 256 + c];
+			} else {
+				fail[next] = transitions[fail[state] * 256 + c];
+				queue.push_back(next);
+			}
+		}
+	}
+
+	// Fold upper case onto lower case in the table so that scanning
+	// doesn't have to convert each character:
+	for (state = 0; state < outputs.size(); state++) {
+		for (c = 'A'; c <= 'Z'; c++)
+			transitions[state * 256 + c] = transitions[state * 256 + tolower(c)];
+	}
+
+	built = true;
+}
+
+void LiteralAutomaton::scan(const char *text, size_t len, std::vector<char> *found) const
+{
+	const uint32_t *table = transitions.data();
+	uint32_t state = 0;
+	size_t i;
+
+	found->assign(literals.size(), 0);
+	if (!built || literals.empty())
+		return;
+
+	for (i = 0; i < len; i++) {
+		state = table[state * 256 + (unsigned char)text[i]];
+		for (uint32_t id : outputs[state])
+			(*found)[id] = 1;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Prefilter for ShaderRegex. Most regex patterns fail to match most shaders,
+// but finding that out with pcre2 means a full pass over the disassembly for
+// every pattern. Instead, we pull the literal strings that any match of each
+// pattern must contain (such as "dp4" or "cb12[") out of the pattern when it
+// is parsed, and build a single Aho-Corasick automaton over all of them. Each
+// shader is then scanned once, and pcre2 only has to run for the regex groups
+// whose literals all showed up.
+//
+// This file does not depend on anything else in 3DMigoto, so that it can also
+// be built into cmd_Decompiler for benchmarking.
+
+// Conservatively finds literal substrings that any text matched by the pcre2
+// pattern must contain. It's fine for this to miss some (worst case we find
+// none and the pattern always has to be run), but it must never return a
+// literal that a match could omit. Returned literals are in lower case, since
+// ShaderRegex patterns are always compiled with PCRE2_CASELESS.
+void extract_required_literals(const std::string &pattern, std::vector<std::string> *literals);
+
+// Aho-Corasick automaton matching a set of literals case insensitively
+class LiteralAutomaton
+{
+	std::vector<uint32_t> transitions; // 256 entries per state
+	std::vector<std::vector<uint32_t>> outputs;
+	std::vector<std::string> literals;
+	bool built;
+
+	uint32_t new_state();
+
+public:
+	LiteralAutomaton();
+
+	void clear();
+
+	// Returns an ID for the literal, which will be the same as any
+	// previously added identical literal. Must be called before build().
+	uint32_t add(const std::string &literal);
+
+	void build();
+
+	size_t size() const { return literals.size(); }
+	size_t states() const { return outputs.size(); }
+
+	// Sets (*found)[id] to a non-zero value for every literal that occurs
+	// in the text, and zero for those that don't.
+	void scan(const char *text, size_t len, std::vector<char> *found) const;
+};
@@ -0,0 +1,13 @@
+#!/bin/sh
+# Builds and runs the parts of the DLL that don't depend on Windows with the
+# host compiler, e.g. from Linux, WSL or cygwin:
+#   $ CXX=clang++ ./run_tests.sh
+
+CXX="${CXX:-g++}"
+OUT="${TMPDIR:-/tmp}/3dmigoto_tests"
+cd "$(dirname "$0")" || exit 1
+mkdir -p "$OUT" || exit 1
+
+$CXX -std=c++11 -Wall -O2 -o "$OUT/test_directory_snapshot" \
+	test_directory_snapshot.cpp ../DirectorySnapshot.cpp || exit 1
+"$OUT/test_directory_snapshot"
@@ -0,0 +1,145 @@
+// Tests for the directory comparison behind reload_fixes_watch=poll. Has no
+// Windows dependencies, so it builds with any C++11 compiler - see
+// run_tests.sh.
+
+#include "../DirectorySnapshot.h"
+
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static bool contains(const std::vector<std::wstring> &names, const wchar_t *name)
+{
+	for (const std::wstring &n : names) {
+		if (n == name)
+			return true;
+	}
+	return false;
+}
+
+static void test_identical()
+{
+	DirectorySnapshot a, b;
+
+	a.add(L"0123456789abcdef-ps_replace.txt", 100, 10);
+	a.add(L"fedcba9876543210-vs_replace.txt", 200, 20);
+	b.add(L"0123456789abcdef-ps_replace.txt", 100, 10);
+	b.add(L"fedcba9876543210-vs_replace.txt", 200, 20);
+
+	CHECK(b.diff(a).empty());
+	CHECK(DirectorySnapshot().diff(DirectorySnapshot()).empty());
+}
+
+static void test_order_does_not_matter()
+{
+	DirectorySnapshot a, b;
+
+	a.add(L"b.txt", 1, 1);
+	a.add(L"a.txt", 2, 2);
+	a.add(L"c.txt", 3, 3);
+	b.add(L"c.txt", 3, 3);
+	b.add(L"a.txt", 2, 2);
+	b.add(L"b.txt", 1, 1);
+
+	CHECK(b.diff(a).empty());
+}
+
+static void test_added_removed()
+{
+	DirectorySnapshot a, b;
+	DirectorySnapshotDiff d;
+
+	a.add(L"a.txt", 1, 1);
+	a.add(L"b.txt", 1, 1);
+	b.add(L"b.txt", 1, 1);
+	b.add(L"c.txt", 1, 1);
+
+	d = b.diff(a);
+	CHECK(d.added.size() == 1 && contains(d.added, L"c.txt"));
+	CHECK(d.removed.size() == 1 && contains(d.removed, L"a.txt"));
+	CHECK(d.modified.empty());
+
+	// Everything was added to an empty directory, and vice versa:
+	d = b.diff(DirectorySnapshot());
+	CHECK(d.added.size() == 2 && d.removed.empty());
+	d = DirectorySnapshot().diff(b);
+	CHECK(d.removed.size() == 2 && d.added.empty());
+}
+
+static void test_modified()
+{
+	DirectorySnapshot a, b;
+	DirectorySnapshotDiff d;
+
+	a.add(L"time.txt", 1, 5);
+	a.add(L"size.txt", 1, 5);
+	a.add(L"same.txt", 1, 5);
+	b.add(L"time.txt", 2, 5);
+	b.add(L"size.txt", 1, 6);
+	b.add(L"same.txt", 1, 5);
+
+	d = b.diff(a);
+	CHECK(d.modified.size() == 2);
+	CHECK(contains(d.modified, L"time.txt"));
+	CHECK(contains(d.modified, L"size.txt"));
+	CHECK(d.added.empty() && d.removed.empty());
+}
+
+static void test_case_insensitive()
+{
+	DirectorySnapshot a, b;
+	DirectorySnapshotDiff d;
+
+	a.add(L"0123456789ABCDEF-ps_replace.txt", 1, 1);
+	b.add(L"0123456789abcdef-ps_replace.txt", 1, 1);
+	CHECK(b.diff(a).empty());
+
+	// Names that only differ in case from their neighbours in the sort
+	// order must still line up:
+	a.add(L"B.txt", 1, 1);
+	a.add(L"a.txt", 1, 1);
+	b.add(L"b.txt", 1, 1);
+	b.add(L"A.txt", 2, 1);
+	d = b.diff(a);
+	CHECK(d.added.empty() && d.removed.empty());
+	CHECK(d.modified.size() == 1 && contains(d.modified, L"A.txt"));
+}
+
+static void test_prefix_names()
+{
+	DirectorySnapshot a, b;
+	DirectorySnapshotDiff d;
+
+	a.add(L"abc", 1, 1);
+	b.add(L"abc", 1, 1);
+	b.add(L"abcd", 1, 1);
+
+	d = b.diff(a);
+	CHECK(d.added.size() == 1 && contains(d.added, L"abcd"));
+	CHECK(d.removed.empty() && d.modified.empty());
+}
+
+int main()
+{
+	test_identical();
+	test_order_does_not_matter();
+	test_added_removed();
+	test_modified();
+	test_case_insensitive();
+	test_prefix_names();
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("All directory snapshot tests passed\n");
+	return 0;
+}
@@ -18,6 +18,7 @@
 #include "CommandList.h"
 #include "profiling.h"
 #include "lock.h"
+#include "BytecodeStore.h"
 
 extern HINSTANCE migoto_handle;
 
@@ -49,6 +50,26 @@ static EnumName_t<const wchar_t *, MarkingMode> MarkingModeNames[] = {
 	{NULL, MarkingMode::INVALID} // End of list marker
 };
 
+// Automatically reload ShaderFixes when a file in it is modified:
+//	0/off  = Only reload when the reload_fixes key is pressed (default)
+//	1/on   = Use change notifications from Windows to watch the directory
+//	poll   = Periodically list the directory to look for changes instead,
+//	         for filesystems where change notifications don't work
+enum class ReloadFixesWatch {
+	INVALID = -1,
+	OFF,
+	NOTIFY,
+	POLL,
+};
+static EnumName_t<const wchar_t *, ReloadFixesWatch> ReloadFixesWatchNames[] = {
+	{L"0", ReloadFixesWatch::OFF},
+	{L"off", ReloadFixesWatch::OFF},
+	{L"1", ReloadFixesWatch::NOTIFY},
+	{L"on", ReloadFixesWatch::NOTIFY},
+	{L"poll", ReloadFixesWatch::POLL},
+	{NULL, ReloadFixesWatch::INVALID} // End of list marker
+};
+
 enum class MarkingAction {
 	INVALID    = 0,
 	CLIPBOARD  = 0x0000001,
@@ -81,11 +102,13 @@ enum class ShaderHashType {
 	FNV,
 	EMBEDDED,
 	BYTECODE,
+	FAST,
 };
 static EnumName_t<const wchar_t *, ShaderHashType> ShaderHashNames[] = {
 	{L"3dmigoto", ShaderHashType::FNV},
 	{L"embedded", ShaderHashType::EMBEDDED},
 	{L"bytecode", ShaderHashType::BYTECODE},
+	{L"fast", ShaderHashType::FAST},
 	{NULL, ShaderHashType::INVALID} // End of list marker
 };
 
@@ -101,7 +124,8 @@ static EnumName_t<const wchar_t *, ShaderHashType> ShaderHashNames[] = {
 //	shaderType is "vs" or "ps" or maybe later "gs" (type wstring for file name use)
 //	shaderModel is only filled in when a shader is replaced.  (type string for old D3 API use)
 //	linkage is passed as a parameter, seems to be rarely if ever used.
-//	byteCode is the original shader byte code passed in by game, or recompiled by override.
+//	byteCode is the original shader byte code passed in by game, or recompiled by override,
+//		stored as per the shader_bytecode option - use recall() to get at it.
 //	timeStamp allows reloading/recompiling only modified shaders
 //	replacement is either ID3D11VertexShader or ID3D11PixelShader
 //  found is used to revert shaders that are deleted from ShaderFixes
@@ -111,8 +135,12 @@ struct OriginalShaderInfo
 	UINT64 hash;
 	std::wstring shaderType;
 	std::string shaderModel;
+	// Read from the bytecode's version token when the shader was created,
+	// or empty if that wasn't possible. Unlike shaderModel this is never
+	// "bin", so it can be used to skip ShaderRegex without disassembling:
+	std::string bytecodeShaderModel;
 	ID3D11ClassLinkage* linkage;
-	ID3DBlob* byteCode;
+	StoredBytecode byteCode;
 	FILETIME timeStamp;
 	ID3D11DeviceChild* replacement;
 	bool found;
@@ -125,14 +153,69 @@ struct OriginalShaderInfo
 // the handle have been removed in the event that it has been reused:
 void CleanupShaderMaps(ID3D11DeviceChild *handle);
 
-// Key is the overridden shader that was given back to the game at CreateVertexShader (vs or ps)
-typedef std::unordered_map<ID3D11DeviceChild *, OriginalShaderInfo> ShaderReloadMap;
-
-// TODO: We can probably merge this into ShaderReloadMap
-typedef std::unordered_map<ID3D11DeviceChild *, ID3D11DeviceChild *> ShaderReplacementMap;
+// Everything we track about a shader handle given back to the game. This used
+// to be spread over three separate maps (hash, live reload info and original
+// shader), which meant XXSetShader - one of the hottest paths we hook - had to
+// do up to three lookups every call. Now it is one.
+//	hash is the hash of the shader as passed in by the game.
+//	reload is only allocated if we kept the original bytecode for live
+//		reload, CopyToFixes and ShaderRegex (hunting, or a ShaderRegex
+//		that may need to patch it later), and is NULL otherwise.
+//	original is the unreplaced shader for marking_mode=original,
+//		show_original and shader reversion, or NULL if we didn't keep one.
+//	override caches the [ShaderOverride] for this hash (or NULL) and is only
+//		valid while override_generation matches shader_override_generation.
+//		Both are only written with mCriticalSection held, pointer first.
+//	visited_generation avoids re-inserting into the hunting visited sets
+//		(and taking the lock to do so) every time the shader is bound.
+struct ShaderInfo
+{
+	UINT64 hash;
+	std::unique_ptr<OriginalShaderInfo> reload;
+	ID3D11DeviceChild *original;
+	struct ShaderOverride *override;
+	volatile unsigned override_generation;
+	unsigned visited_generation;
+
+	ShaderInfo() :
+		hash(0),
+		reload(),
+		original(NULL),
+		override(NULL),
+		override_generation(0),
+		visited_generation(0)
+	{}
+};
 
-// Key is shader, value is hash key.
-typedef std::unordered_map<ID3D11DeviceChild *, UINT64> ShaderMap;
+// Key is the shader that was given back to the game at CreateXXXShader
+typedef std::unordered_map<ID3D11DeviceChild *, ShaderInfo> ShaderInfoMap;
+
+// The outcome of looking for a shader in ShaderFixes (and exporting,
+// decompiling, compiling or assembling it along the way), keyed by the hash of
+// the original bytecode. Some engines create identical shaders over and over
+// (e.g. once per material instance), and this lets every creation after the
+// first skip straight to creating the shader. An empty bytecode means we
+// looked and there was no replacement. Cleared on config reload and whenever
+// ShaderFixes may have changed.
+//
+// Depending on shader_hash the hash may not cover the whole shader, so an
+// entry only counts as identical if the length and the 128 bit checksum from
+// the DXBC header (which does cover everything) match as well. Unlike
+// replacements there is a negative result for every distinct shader the game
+// creates, so those are only added while the cache is below
+// MAX_SHADER_FIXES_CACHE_ENTRIES.
+#define MAX_SHADER_FIXES_CACHE_ENTRIES 4096
+struct ShaderFixesResult
+{
+	std::wstring shaderType;
+	SIZE_T originalLength;
+	uint32_t originalChecksum[4];
+	std::vector<char> bytecode;
+	std::string shaderModel;
+	FILETIME timeStamp;
+	std::wstring headerLine;
+};
+typedef std::unordered_map<UINT64, ShaderFixesResult> ShaderFixesCache;
 
 enum class FrameAnalysisOptions {
 	INVALID         = 0,
@@ -435,6 +518,7 @@ struct Globals
 	bool implicit_post_checktextureoverride_used;
 
 	MarkingMode marking_mode;
+	ReloadFixesWatch reload_fixes_watch;
 	MarkingAction marking_actions;
 	int gForceStereo;
 	bool gCreateStereoProfile;
@@ -460,6 +544,7 @@ struct Globals
 	std::unordered_set<void*> frame_analysis_seen_rts;
 
 	ShaderHashType shader_hash_type;
+	ShaderBytecodeStorage shader_bytecode_storage;
 	int texture_hash_version;
 	int EXPORT_HLSL;		// 0=off, 1=HLSL only, 2=HLSL+OriginalASM, 3= HLSL+OriginalASM+recompiledASM
 	bool EXPORT_SHADERS, EXPORT_FIXED, EXPORT_BINARY, CACHE_SHADERS, SCISSOR_DISABLE;
@@ -526,9 +611,12 @@ struct Globals
 	std::set<uint32_t> mSelectedPixelShader_VertexBuffer;	// std::set so that index buffers used with a shader will be sorted in log when marked
 	ID3D11PixelShader* mPinkingShader;						// Special pixels shader to mark a selection with hot pink.
 
-	ShaderMap mShaders;										// All shaders ever registered with CreateXXXShader
-	ShaderReloadMap mReloadedShaders;						// Shaders that were reloaded live from ShaderFixes
-	ShaderReplacementMap mOriginalShaders;					// When MarkingMode=Original, switch to original. Also used for show_original and shader reversion
+	ShaderInfoMap mShaderInfo;								// All shaders ever registered with CreateXXXShader
+	unsigned visited_shaders_generation;					// Bumped whenever the mVisited*Shaders sets are cleared
+	unsigned shader_override_generation;					// Bumped whenever entries are added to / removed from mShaderOverrideMap
+	ShaderFixesCache mShaderFixesCache;						// Deduplicates ShaderFixes processing of identical shaders
+	unsigned shader_fixes_cache_lookups;
+	unsigned shader_fixes_cache_hits;
 
 	std::set<UINT64> mVisitedComputeShaders;
 	UINT64 mSelectedComputeShader;
@@ -642,6 +730,7 @@ struct Globals
 		cur_analyse_options(FrameAnalysisOptions::INVALID),
 
 		shader_hash_type(ShaderHashType::FNV),
+		shader_bytecode_storage(ShaderBytecodeStorage::MEMORY),
 		texture_hash_version(0),
 		EXPORT_SHADERS(false),
 		EXPORT_HLSL(0),
@@ -656,6 +745,10 @@ struct Globals
 
 		constants_run(false),
 		frame_no(0),
+		visited_shaders_generation(1),
+		shader_override_generation(1),
+		shader_fixes_cache_lookups(0),
+		shader_fixes_cache_hits(0),
 		hWnd(NULL),
 		hide_cursor(false),
 		cursor_upscaling_bypass(true),
@@ -674,6 +767,7 @@ struct Globals
 		implicit_post_checktextureoverride_used(false),
 
 		marking_mode(MarkingMode::INVALID),
+		reload_fixes_watch(ReloadFixesWatch::OFF),
 		marking_actions(MarkingAction::INVALID),
 		gForceStereo(0),
 		gCreateStereoProfile(false),
@@ -714,6 +808,8 @@ struct Globals
 	}
 };
 
+struct ShaderRegexThreadState;
+
 // Everything in this struct has a unique copy per thread. It would be vastly
 // simpler to just use the "thread_local" keyword, but MSDN warns that it can
 // interfere with delay loading DLLs (without any detail as to what it means by
@@ -745,8 +841,13 @@ struct TLS
 
 	LockStack locks_held;
 
+	// pcre2 match data and JIT stack for ShaderRegex, allocated the first
+	// time this thread matches a pattern and reused after that:
+	ShaderRegexThreadState *shader_regex;
+
 	TLS() :
-		hooking_quirk_protection(false)
+		hooking_quirk_protection(false),
+		shader_regex(NULL)
 	{}
 };
 
@@ -766,24 +867,42 @@ static struct TLS* get_tls()
 
 extern Globals *G;
 
-static inline ShaderMap::iterator lookup_shader_hash(ID3D11DeviceChild *shader)
+static inline ShaderInfoMap::iterator lookup_shader_info(ID3D11DeviceChild *shader)
 {
-	return Profiling::lookup_map(G->mShaders, shader, &Profiling::shader_hash_lookup_overhead);
+	return Profiling::lookup_map(G->mShaderInfo, shader, &Profiling::shader_info_lookup_overhead);
 }
 
-static inline ShaderReloadMap::iterator lookup_reloaded_shader(ID3D11DeviceChild *shader)
+static inline ShaderOverrideMap::iterator lookup_shaderoverride(UINT64 hash)
 {
-	return Profiling::lookup_map(G->mReloadedShaders, shader, &Profiling::shader_reload_lookup_overhead);
+	return Profiling::lookup_map(G->mShaderOverrideMap, hash, &Profiling::shaderoverride_lookup_overhead);
 }
 
-static inline ShaderReplacementMap::iterator lookup_original_shader(ID3D11DeviceChild *shader)
+// Returns the ShaderOverride for a shader we already have the info for,
+// only going back to the ShaderOverride map if it has changed since we last
+// looked (config reload, or ShaderRegex creating a new ShaderOverride):
+//
+// ShaderInfo is shared by every context, so the cached pointer is only
+// updated under the lock. The generation is volatile and is written after
+// the pointer, so a reader that sees it match without the lock also sees
+// the pointer that goes with it:
+static inline ShaderOverride* lookup_shader_info_override(ShaderInfo *info)
 {
-	return Profiling::lookup_map(G->mOriginalShaders, shader, &Profiling::shader_original_lookup_overhead);
-}
+	ShaderOverrideMap::iterator i;
+	ShaderOverride *override;
 
-static inline ShaderOverrideMap::iterator lookup_shaderoverride(UINT64 hash)
-{
-	return Profiling::lookup_map(G->mShaderOverrideMap, hash, &Profiling::shaderoverride_lookup_overhead);
+	if (info->override_generation == G->shader_override_generation)
+		return info->override;
+
+	EnterCriticalSectionPretty(&G->mCriticalSection);
+	if (info->override_generation != G->shader_override_generation) {
+		i = lookup_shaderoverride(info->hash);
+		info->override = (i == G->mShaderOverrideMap.end()) ? NULL : &i->second;
+		info->override_generation = G->shader_override_generation;
+	}
+	override = info->override;
+	LeaveCriticalSection(&G->mCriticalSection);
+
+	return override;
 }
 
 static inline ResourceMap::iterator lookup_resource_handle_info(ID3D11Resource *resource)
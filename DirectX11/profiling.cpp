@@ -1,5 +1,6 @@
 #include "profiling.h"
 #include "globals.h"
+#include "ShaderRegex.h"
 
 #include <algorithm>
 
@@ -26,9 +27,7 @@ namespace Profiling {
 	INT64 interval;
 	bool freeze;
 
-	Overhead shader_hash_lookup_overhead;
-	Overhead shader_reload_lookup_overhead;
-	Overhead shader_original_lookup_overhead;
+	Overhead shader_info_lookup_overhead;
 	Overhead shaderoverride_lookup_overhead;
 	Overhead texture_handle_info_lookup_overhead;
 	Overhead textureoverride_lookup_overhead;
@@ -48,6 +47,12 @@ namespace Profiling {
 	unsigned skipped_draw_calls;
 	unsigned max_executions_per_frame_exceeded;
 	unsigned iniparams_updates;
+
+	unsigned background_jobs_queued;
+	size_t background_bytes_queued;
+	unsigned background_jobs_peak;
+	unsigned background_jobs_coalesced;
+	unsigned background_writer_stalls;
 }
 
 static LARGE_INTEGER profiling_start_time;
@@ -132,9 +137,7 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 	LARGE_INTEGER shaderregex_overhead;
 	LARGE_INTEGER cursor_overhead;
 	LARGE_INTEGER nvapi_overhead;
-	LARGE_INTEGER shader_hash_lookup_overhead;
-	LARGE_INTEGER shader_reload_lookup_overhead;
-	LARGE_INTEGER shader_original_lookup_overhead;
+	LARGE_INTEGER shader_info_lookup_overhead;
 	LARGE_INTEGER shaderoverride_lookup_overhead;
 	LARGE_INTEGER texture_handle_info_lookup_overhead;
 	LARGE_INTEGER textureoverride_lookup_overhead;
@@ -164,9 +167,7 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 	cursor_overhead.QuadPart = Profiling::cursor_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
 	nvapi_overhead.QuadPart = Profiling::nvapi_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
 
-	shader_hash_lookup_overhead.QuadPart = Profiling::shader_hash_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
-	shader_reload_lookup_overhead.QuadPart = Profiling::shader_reload_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
-	shader_original_lookup_overhead.QuadPart = Profiling::shader_original_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
+	shader_info_lookup_overhead.QuadPart = Profiling::shader_info_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
 	shaderoverride_lookup_overhead.QuadPart = Profiling::shaderoverride_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
 	texture_handle_info_lookup_overhead.QuadPart = Profiling::texture_handle_info_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
 	textureoverride_lookup_overhead.QuadPart = Profiling::textureoverride_lookup_overhead.cpu.QuadPart * 1000000 / freq.QuadPart;
@@ -220,28 +221,16 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
 			    L"\n"
 			    L"Map Lookups (CPU):\n"
-			    L"          Shader hash: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
-			    L"Live reloaded shaders: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
-			    L"     Original shaders: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
+			    L"   Shader hash / info: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    L"       ShaderOverride: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    L"  Texture hash / info: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    L"      TextureOverride: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    L"       Resource pools: %7.2fus/frame ~%ffps (%u/%u hits/frame)\n"
 			    ,
-			    (float)shader_hash_lookup_overhead.QuadPart / frames,
-			    60.0 * shader_hash_lookup_overhead.QuadPart / collection_duration.QuadPart,
-			    Profiling::shader_hash_lookup_overhead.hits / frames,
-			    Profiling::shader_hash_lookup_overhead.count / frames,
-
-			    (float)shader_reload_lookup_overhead.QuadPart / frames,
-			    60.0 * shader_reload_lookup_overhead.QuadPart / collection_duration.QuadPart,
-			    Profiling::shader_reload_lookup_overhead.hits / frames,
-			    Profiling::shader_reload_lookup_overhead.count / frames,
-
-			    (float)shader_original_lookup_overhead.QuadPart / frames,
-			    60.0 * shader_original_lookup_overhead.QuadPart / collection_duration.QuadPart,
-			    Profiling::shader_original_lookup_overhead.hits / frames,
-			    Profiling::shader_original_lookup_overhead.count / frames,
+			    (float)shader_info_lookup_overhead.QuadPart / frames,
+			    60.0 * shader_info_lookup_overhead.QuadPart / collection_duration.QuadPart,
+			    Profiling::shader_info_lookup_overhead.hits / frames,
+			    Profiling::shader_info_lookup_overhead.count / frames,
 
 			    (float)shaderoverride_lookup_overhead.QuadPart / frames,
 			    60.0 * shaderoverride_lookup_overhead.QuadPart / collection_duration.QuadPart,
@@ -300,6 +289,23 @@ static void update_txt_summary(LARGE_INTEGER collection_duration, LARGE_INTEGER
 	);
 	Profiling::text += buf;
 
+	_snwprintf_s(buf, ARRAYSIZE(buf), _TRUNCATE,
+			    L"\n"
+			    L"Background shader export / cache writes:\n"
+			    L"   Backlog: %4u (%Iu bytes), peak %u\n"
+			    L"   Coalesced: %4u  Stalled on full queue: %4u\n"
+			    ,
+			    Profiling::background_jobs_queued,
+			    Profiling::background_bytes_queued,
+			    Profiling::background_jobs_peak,
+			    Profiling::background_jobs_coalesced,
+			    Profiling::background_writer_stalls
+	);
+	Profiling::text += buf;
+
+	Profiling::text += shader_bytecode_memory_report();
+	Profiling::text += shader_regex_profiling_report();
+
 	if (G->implicit_post_checktextureoverride_used && !Profiling::cto_warning.empty())
 		Profiling::text += L"\nImplicit post checktextureoverrides were not optimised out\n";
 }
@@ -455,9 +461,7 @@ void Profiling::clear()
 	nvapi_overhead.clear();
 	freeze = false;
 
-	shader_hash_lookup_overhead.clear();
-	shader_reload_lookup_overhead.clear();
-	shader_original_lookup_overhead.clear();
+	shader_info_lookup_overhead.clear();
 	shaderoverride_lookup_overhead.clear();
 	texture_handle_info_lookup_overhead.clear();
 	textureoverride_lookup_overhead.clear();
@@ -478,6 +482,10 @@ void Profiling::clear()
 	max_executions_per_frame_exceeded = 0;
 	iniparams_updates = 0;
 
+	background_jobs_peak = background_jobs_queued;
+	background_jobs_coalesced = 0;
+	background_writer_stalls = 0;
+
 	start_frame_no = G->frame_no;
 	QueryPerformanceCounter(&profiling_start_time);
 }
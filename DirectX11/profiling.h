@@ -77,9 +77,7 @@ namespace Profiling {
 	extern INT64 interval;
 	extern bool freeze;
 
-	extern Overhead shader_hash_lookup_overhead;
-	extern Overhead shader_reload_lookup_overhead;
-	extern Overhead shader_original_lookup_overhead;
+	extern Overhead shader_info_lookup_overhead;
 	extern Overhead shaderoverride_lookup_overhead;
 	extern Overhead texture_handle_info_lookup_overhead;
 	extern Overhead textureoverride_lookup_overhead;
@@ -100,6 +98,14 @@ namespace Profiling {
 	extern unsigned max_executions_per_frame_exceeded;
 	extern unsigned iniparams_updates;
 
+	// Background writer backlog. The queued counts are live and are not
+	// reset when profiling is cleared:
+	extern unsigned background_jobs_queued;
+	extern size_t background_bytes_queued;
+	extern unsigned background_jobs_peak;
+	extern unsigned background_jobs_coalesced;
+	extern unsigned background_writer_stalls;
+
 	// NvAPI profiling:
 
 #define NVAPI_PROFILE(CODE) \
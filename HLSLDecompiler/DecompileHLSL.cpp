@@ -101,8 +101,110 @@ struct BufferEntry
 	bool isRowMajor;
 	string Name;
 };
+
+// Recycles the nodes of the maps the decompiler rebuilds for every shader.
+// A freed node goes on a free list for its size rather than back to the
+// heap, so a Decompiler that is reused across shaders stops allocating
+// nodes once it has seen one with as many cbuffer entries. The memory is
+// only released when the pool itself is destroyed.
+class NodePool
+{
+	static const size_t granularity = 16;
+	static const size_t maxPooledSize = 256;
+	static const size_t blockSize = 16 * 1024;
+
+	struct FreeNode { FreeNode *next; };
+
+	FreeNode *mFreeLists[maxPooledSize / granularity];
+	vector<char*> mBlocks;
+	char *mNext, *mEnd;
+
+public:
+	NodePool()
+		: mNext(NULL),
+		mEnd(NULL)
+	{
+		memset(mFreeLists, 0, sizeof(mFreeLists));
+	}
+
+	~NodePool()
+	{
+		for (char *block : mBlocks)
+			::operator delete(block);
+	}
+
+	NodePool(NodePool const&) = delete;
+	NodePool& operator= (NodePool const&) = delete;
+
+	void* allocate(size_t size)
+	{
+		if (size > maxPooledSize)
+			return ::operator new(size);
+
+		size_t bucket = (size - 1) / granularity;
+		if (mFreeLists[bucket])
+		{
+			FreeNode *node = mFreeLists[bucket];
+			mFreeLists[bucket] = node->next;
+			return node;
+		}
+
+		size = (bucket + 1) * granularity;
+		if ((size_t)(mEnd - mNext) < size)
+		{
+			mBlocks.push_back((char*)::operator new(blockSize));
+			mNext = mBlocks.back();
+			mEnd = mNext + blockSize;
+		}
+		void *p = mNext;
+		mNext += size;
+		return p;
+	}
+
+	void deallocate(void *p, size_t size)
+	{
+		if (size > maxPooledSize)
+		{
+			::operator delete(p);
+			return;
+		}
+
+		size_t bucket = (size - 1) / granularity;
+		FreeNode *node = (FreeNode*)p;
+		node->next = mFreeLists[bucket];
+		mFreeLists[bucket] = node;
+	}
+};
+
+template <class T>
+class PoolAllocator
+{
+public:
+	typedef T value_type;
+
+	NodePool *pool;
+
+	explicit PoolAllocator(NodePool *pool) : pool(pool) {}
+	template <class U> PoolAllocator(const PoolAllocator<U> &other) : pool(other.pool) {}
+
+	T* allocate(size_t n)
+	{
+		return (T*)pool->allocate(n * sizeof(T));
+	}
+
+	void deallocate(T *p, size_t n)
+	{
+		pool->deallocate(p, n * sizeof(T));
+	}
+};
+
+template <class T, class U>
+bool operator== (const PoolAllocator<T> &a, const PoolAllocator<U> &b) { return a.pool == b.pool; }
+template <class T, class U>
+bool operator!= (const PoolAllocator<T> &a, const PoolAllocator<U> &b) { return a.pool != b.pool; }
+
 // Key is register << 16 + offset
-typedef map<int, BufferEntry> CBufferData;
+typedef map<int, BufferEntry, less<int>, PoolAllocator<pair<const int, BufferEntry> > > CBufferData;
 typedef map<string, string> StringStringMap;
 
 //dx9
@@ -132,6 +234,9 @@ class Decompiler
 {
 public:
 
+	// Must come before any containers that allocate from it
+	NodePool mNodePool;
+
 	// Key is register << 16 + offset
 	CBufferData mCBufferData;
 
@@ -187,11 +292,63 @@ public:
 	int nestCount;
 
 	Decompiler()
-		: mLastStatement(0),
+		: mCBufferData(CBufferData::allocator_type(&mNodePool)),
+		mLastStatement(0),
 		uuidVar(0),
 		nestCount(0)
 	{}
 
+	// Put everything back the way a new Decompiler would have it, so the
+	// same instance can be used for the next shader. Containers are only
+	// cleared, so the output buffer and vectors keep their capacity.
+	void Reset(DecompilerSettings *settings)
+	{
+		mCBufferData.clear();
+		mCBufferNames.clear();
+		mSamplerNames.clear();
+		mSamplerNamesArraySize.clear();
+		mSamplerComparisonNames.clear();
+		mSamplerComparisonNamesArraySize.clear();
+		mTextureNames.clear();
+		mTextureNamesArraySize.clear();
+		mTextureType.clear();
+		mUAVNames.clear();
+		mUAVNamesArraySize.clear();
+		mUAVType.clear();
+		mStructuredBufferTypes.clear();
+		mStructuredBufferUsedNames.clear();
+		mUniformNames.clear();
+		mBoolUniformNames.clear();
+		mConstantValues.clear();
+		mInputNames.clear();
+		mOutputRegisterValues.clear();
+		mOutputRegisterType.clear();
+		mShaderType = "unknown";
+		mSV_Position.clear();
+		mUsesProjection = false;
+		mLastStatement = 0;
+		mMulOperand.clear();
+		mMulOperand2.clear();
+		mMulTarget.clear();
+		mCorrectedIndexRegisters.clear();
+		mRemappedOutputRegisters.clear();
+		mRemappedInputRegisters.clear();
+		mBooleanRegisters.clear();
+		G = settings;
+		mOutput.clear();
+		mOutput.reserve(16 * 1024);
+		mCodeStartPos = 0;
+		mErrorOccurred = false;
+		mPatched = false;
+		uuidVar = 0;
+		nestCount = 0;
+
+		// Don't let a statement from the last shader leak into this one:
+		statement[0] = 0;
+		op1[0] = 0; op2[0] = 0; op3[0] = 0; op4[0] = 0; op5[0] = 0; op6[0] = 0; op7[0] = 0; op8[0] = 0;
+		op9[0] = 0; op10[0] = 0; op11[0] = 0; op12[0] = 0; op13[0] = 0; op14[0] = 0; op15[0] = 0;
+	}
+
 	void logDecompileError(const string &err)
 	{
 		mErrorOccurred = true;
@@ -6770,17 +6927,28 @@ public:
 	}
 };
 
+DecompilerContext::DecompilerContext()
+	: decompiler(new Decompiler())
+{
+}
+
+DecompilerContext::~DecompilerContext()
+{
+	delete decompiler;
+}
+
 const string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred)
 {
-	Decompiler d;
-
-	d.mCodeStartPos = 0;
-	d.mCorrectedIndexRegisters.clear();
-	d.mOutput.reserve(16 * 1024);
-	d.mErrorOccurred = false;
-	d.mShaderType = "unknown";
-	d.mPatched = false;
-	d.G = params.G;
+	DecompilerContext context;
+
+	return DecompileBinaryHLSL(context, params, patched, shaderModel, errorOccurred);
+}
+
+const string DecompileBinaryHLSL(DecompilerContext &context, ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred)
+{
+	Decompiler &d = *context.decompiler;
+
+	d.Reset(params.G);
 
 	// Decompile binary.
 
@@ -57,4 +57,23 @@ struct ParseParameters
 	DecompilerSettings *G;
 };
 
+class Decompiler;
+
+// Batch tools that decompile a lot of shaders can keep one of these around
+// and pass it to every call, so the decompiler's tables and output buffer
+// are cleared and reused rather than built from scratch for each shader.
+// Only one shader at a time - use a separate context for each thread.
+class DecompilerContext
+{
+public:
+	DecompilerContext();
+	~DecompilerContext();
+
+	DecompilerContext(DecompilerContext const&) = delete;
+	DecompilerContext& operator= (DecompilerContext const&) = delete;
+
+	Decompiler *decompiler;
+};
+
 const std::string DecompileBinaryHLSL(ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred);
+const std::string DecompileBinaryHLSL(DecompilerContext &context, ParseParameters &params, bool &patched, std::string &shaderModel, bool &errorOccurred);
@@ -0,0 +1,1043 @@
+// Benchmarks for cmd_Decompiler, to measure changes to the hashes, checksums,
+// ShaderRegex engine, dis/assemblers and decompiler against a corpus of real
+// shaders. These are only compiled into the command line tool, not the DLL.
+
+#include "stdafx.h"
+
+#include <algorithm>
+#include <map>
+#include <malloc.h>
+#include <new>
+
+#include <D3Dcompiler.h>
+#include "DecompileHLSL.h"
+#include "DecompilerServer.h"
+#include "log.h"
+#define MIGOTO_DX 11
+#include "util.h"
+#include "shader.h"
+#include "DirectX11/ShaderRegexPrefilter.h"
+
+#include <pcre2.h>
+
+#include "cmd_Decompiler.h"
+#include "Benchmark.h"
+
+using namespace std;
+
+// Accumulated over every file so we can print a summary at the end. The
+// timings are in QueryPerformanceCounter ticks.
+struct BenchmarkStat {
+	const char *name;
+	LONGLONG ticks;
+	size_t bytes;
+	size_t runs;
+};
+
+static BenchmarkStat hash_benchmarks[] = {
+	{"3dmigoto (FNV-1)"},
+	{"crc32c"},
+	{"fast (xxh64)"},
+};
+
+template <typename F>
+static UINT64 benchmark(BenchmarkStat *stat, const void *buf, size_t len, F fn)
+{
+	LARGE_INTEGER start, end;
+	UINT64 ret = 0;
+	int i;
+
+	QueryPerformanceCounter(&start);
+	for (i = 0; i < args.benchmark_iterations; i++)
+		ret = fn(buf, len);
+	QueryPerformanceCounter(&end);
+
+	stat->ticks += end.QuadPart - start.QuadPart;
+	stat->bytes += len * args.benchmark_iterations;
+	stat->runs += args.benchmark_iterations;
+	return ret;
+}
+
+static void BenchmarkHash(const void *pShaderBytecode, size_t BytecodeLength)
+{
+	UINT64 fnv, crc, fast;
+
+	fnv = benchmark(&hash_benchmarks[0], pShaderBytecode, BytecodeLength,
+			[](const void *buf, size_t len) { return fnv_64_buf(buf, len); });
+	crc = benchmark(&hash_benchmarks[1], pShaderBytecode, BytecodeLength,
+			[](const void *buf, size_t len) { return (UINT64)crc32c_hw(0, buf, len); });
+	fast = benchmark(&hash_benchmarks[2], pShaderBytecode, BytecodeLength,
+			[](const void *buf, size_t len) { return fast_shader_hash(buf, len); });
+
+	LogInfo("    %Iu bytes: 3dmigoto=%016llx crc32c=%08llx fast=%016llx\n",
+			BytecodeLength, fnv, crc, fast);
+}
+
+// Patterns are compiled the same way as ShaderRegex in the DLL, so that the
+// numbers are representative of what happens there when a shader is loaded.
+struct RegexBenchmarkPattern {
+	std::string pattern;
+	pcre2_code *regex;
+	bool jit;
+	std::vector<uint32_t> literals;
+};
+
+static std::vector<RegexBenchmarkPattern> benchmark_regexes;
+static LiteralAutomaton benchmark_regex_prefilter;
+static pcre2_match_data *benchmark_match_data;
+
+static BenchmarkStat regex_benchmarks[] = {
+	{"pcre2 only"},
+	{"prefilter scan"},
+	{"prefilter + pcre2"},
+};
+
+static int LoadRegexBenchmark(string const *filename)
+{
+	std::vector<std::string> literals;
+	std::string line;
+	PCRE2_SIZE err_off;
+	size_t prefiltered = 0;
+	FILE *fp;
+	char buf[4096];
+	int err;
+
+	fopen_s(&fp, filename->c_str(), "r");
+	if (!fp) {
+		LogInfo("Unable to open regex benchmark patterns %s\n", filename->c_str());
+		return EXIT_FAILURE;
+	}
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		line = buf;
+		while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+			line.pop_back();
+		// Comments use the same syntax as the d3dx.ini:
+		if (line.empty() || line[0] == ';')
+			continue;
+
+		RegexBenchmarkPattern regex;
+		regex.pattern = line;
+		regex.regex = pcre2_compile((PCRE2_SPTR)line.c_str(), line.length(),
+				PCRE2_CASELESS | PCRE2_MULTILINE, &err, &err_off, NULL);
+		if (!regex.regex) {
+			LogInfo("Failed to compile regex at offset %u: %s\n", (unsigned)err_off, line.c_str());
+			fclose(fp);
+			return EXIT_FAILURE;
+		}
+		regex.jit = !pcre2_jit_compile(regex.regex, PCRE2_JIT_COMPLETE);
+
+		extract_required_literals(line, &literals);
+		for (auto &literal : literals)
+			regex.literals.push_back(benchmark_regex_prefilter.add(literal));
+		if (!regex.literals.empty())
+			prefiltered++;
+
+		benchmark_regexes.push_back(regex);
+	}
+	fclose(fp);
+
+	benchmark_regex_prefilter.build();
+	benchmark_match_data = pcre2_match_data_create(64, NULL);
+
+	LogInfo("Loaded %Iu regex patterns, %Iu with literals (%Iu literals, %Iu automaton states)\n",
+			benchmark_regexes.size(), prefiltered,
+			benchmark_regex_prefilter.size(), benchmark_regex_prefilter.states());
+	return EXIT_SUCCESS;
+}
+
+static bool benchmark_regex_match(RegexBenchmarkPattern *regex, const char *text, size_t len)
+{
+	if (regex->jit)
+		return pcre2_jit_match(regex->regex, (PCRE2_SPTR)text, len, 0, 0, benchmark_match_data, NULL) >= 0;
+	return pcre2_match(regex->regex, (PCRE2_SPTR)text, len, 0, 0, benchmark_match_data, NULL) >= 0;
+}
+
+static bool benchmark_regex_literals_found(RegexBenchmarkPattern *regex, std::vector<char> *found)
+{
+	for (uint32_t id : regex->literals) {
+		if (!(*found)[id])
+			return false;
+	}
+	return true;
+}
+
+static int BenchmarkRegex(const void *pShaderBytecode, size_t BytecodeLength)
+{
+	std::vector<char> found, plain_matches, filtered_matches;
+	string asmText;
+	UINT64 plain, scanned, filtered;
+	size_t i;
+
+	if (FAILED(DisassembleFlugan(pShaderBytecode, BytecodeLength, &asmText, 0, false)))
+		return EXIT_FAILURE;
+
+	plain = benchmark(&regex_benchmarks[0], asmText.data(), asmText.size(),
+		[](const void *buf, size_t len) {
+			UINT64 matches = 0;
+			for (auto &regex : benchmark_regexes)
+				matches += benchmark_regex_match(&regex, (const char*)buf, len);
+			return matches;
+		});
+	scanned = benchmark(&regex_benchmarks[1], asmText.data(), asmText.size(),
+		[&found](const void *buf, size_t len) {
+			benchmark_regex_prefilter.scan((const char*)buf, len, &found);
+			return (UINT64)std::count(found.begin(), found.end(), 1);
+		});
+	filtered = benchmark(&regex_benchmarks[2], asmText.data(), asmText.size(),
+		[&found](const void *buf, size_t len) {
+			UINT64 matches = 0;
+			benchmark_regex_prefilter.scan((const char*)buf, len, &found);
+			for (auto &regex : benchmark_regexes) {
+				if (benchmark_regex_literals_found(&regex, &found))
+					matches += benchmark_regex_match(&regex, (const char*)buf, len);
+			}
+			return matches;
+		});
+
+	LogInfo("    %Iu bytes of assembly: %llu/%Iu patterns matched, %llu literals present\n",
+			asmText.size(), plain, benchmark_regexes.size(), scanned);
+
+	// The prefilter must never change the result, so double check it
+	// against each pattern individually as we go:
+	benchmark_regex_prefilter.scan(asmText.data(), asmText.size(), &found);
+	for (i = 0; i < benchmark_regexes.size(); i++) {
+		RegexBenchmarkPattern *regex = &benchmark_regexes[i];
+		if (benchmark_regex_match(regex, asmText.data(), asmText.size())
+				&& !benchmark_regex_literals_found(regex, &found)) {
+			LogInfo("    Prefilter wrongly excluded pattern %Iu: %s\n", i, regex->pattern.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+	if (plain != filtered) {
+		LogInfo("    Prefilter changed the number of matches: %llu != %llu\n", plain, filtered);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static BenchmarkStat assembler_benchmarks[] = {
+	{"disassemble"},
+	{"assemble"},
+	{"disassemble-native"},
+	{"assemble-patched"},
+	{"assemble-incremental"},
+};
+
+// Time for each shader to make one round trip, to find any outliers:
+struct RoundTripTiming {
+	string filename;
+	size_t bytes;
+	LONGLONG ticks;
+};
+static std::vector<RoundTripTiming> round_trip_timings;
+
+static bool check_dxbc_checksum(const void *bytecode, size_t size)
+{
+	struct dxbc_header *header = (struct dxbc_header*)bytecode;
+	DWORD hash[4];
+
+	if (size < sizeof(struct dxbc_header))
+		return false;
+
+	ComputeHash((byte const*)bytecode + 20, (DWORD)(size - 20), hash);
+	return !memcmp(header->hash, hash, sizeof(header->hash));
+}
+
+static BenchmarkStat checksum_benchmarks[] = {
+	{"one at a time"},
+	{"batched (SSE2 x4)"},
+};
+
+// Every shader fxc produced has its checksum stored in the header, so each
+// shader in the corpus doubles as a known answer test for both versions of
+// the checksum. The shaders are kept to hash as one batch at the end:
+static vector<vector<char>> checksum_batch;
+
+static int BenchmarkChecksum(vector<char> *pShaderBytecode)
+{
+	if (pShaderBytecode->size() < sizeof(struct dxbc_header)
+			|| strncmp(pShaderBytecode->data(), "DXBC", 4)) {
+		LogInfo("    Not a DXBC shader, skipping\n");
+		return EXIT_SUCCESS;
+	}
+
+	if (!check_dxbc_checksum(pShaderBytecode->data(), pShaderBytecode->size())) {
+		LogInfo("    Checksum does not match the one stored in the shader\n");
+		return EXIT_FAILURE;
+	}
+
+	benchmark(&checksum_benchmarks[0], pShaderBytecode->data() + 20, pShaderBytecode->size() - 20,
+		[](const void *buf, size_t len) {
+			DWORD hash[4];
+			ComputeHash((byte const*)buf, (DWORD)len, hash);
+			return (UINT64)hash[0];
+		});
+
+	checksum_batch.push_back(*pShaderBytecode);
+	return EXIT_SUCCESS;
+}
+
+static int BenchmarkChecksumBatch()
+{
+	vector<byte const*> inputs;
+	vector<DWORD> sizes;
+	vector<DWORD> hashes(checksum_batch.size() * 4);
+	size_t total = 0, i;
+	int rc = EXIT_SUCCESS;
+
+	if (checksum_batch.empty())
+		return EXIT_SUCCESS;
+
+	for (auto &shader : checksum_batch) {
+		inputs.push_back((byte const*)shader.data() + 20);
+		sizes.push_back((DWORD)(shader.size() - 20));
+		total += shader.size() - 20;
+	}
+
+	LogInfo("Benchmarking DXBC checksum of %Iu shaders in one batch...\n", checksum_batch.size());
+	benchmark(&checksum_benchmarks[1], NULL, total,
+		[&inputs, &sizes, &hashes](const void *buf, size_t len) {
+			ComputeHashes(inputs.data(), sizes.data(), inputs.size(), (DWORD(*)[4])hashes.data());
+			return (UINT64)0;
+		});
+
+	for (i = 0; i < checksum_batch.size(); i++) {
+		if (memcmp(checksum_batch[i].data() + 4, &hashes[i * 4], 16)) {
+			LogInfo("    Batched checksum of shader %Iu does not match the one stored in it\n", i);
+			rc = EXIT_FAILURE;
+		}
+	}
+
+	return rc;
+}
+
+// Makes the sort of small change to a shader that a ShaderRegex patch would -
+// bumping dcl_temps and adding an instruction near the end - to benchmark the
+// incremental assembler against assembling the whole patched shader:
+static bool SimulateShaderRegexPatch(string *asmText)
+{
+	size_t pos, end;
+
+	pos = asmText->rfind("\nret");
+	if (pos == string::npos)
+		return false;
+	asmText->insert(pos + 1, "nop\n");
+
+	pos = asmText->find("\ndcl_temps ");
+	if (pos != string::npos) {
+		pos += 11;
+		end = asmText->find('\n', pos);
+		asmText->replace(pos, end - pos, to_string(atoi(asmText->c_str() + pos) + 1));
+	}
+
+	return true;
+}
+
+static int BenchmarkIncrementalAssembler(string *asmText, vector<char> *pShaderBytecode)
+{
+	vector<byte> origBytecode(pShaderBytecode->begin(), pShaderBytecode->end());
+	vector<byte> full, incremental;
+	vector<char> asmVec(asmText->begin(), asmText->end());
+	vector<char> patchedVec;
+	string patchedText(*asmText);
+	int reencoded = -1;
+	UINT64 size;
+
+	if (!SimulateShaderRegexPatch(&patchedText)) {
+		LogInfo("    No ret instruction to patch before\n");
+		return EXIT_SUCCESS;
+	}
+	patchedVec.assign(patchedText.begin(), patchedText.end());
+
+	size = benchmark(&assembler_benchmarks[3], patchedVec.data(), patchedVec.size(),
+		[&patchedVec, &full](const void *buf, size_t len) {
+			if (FAILED(AssembleFluganWithSignatureParsing(&patchedVec, &full)))
+				return (UINT64)0;
+			return (UINT64)full.size();
+		});
+	if (!size) {
+		LogInfo("    Error assembling patched shader\n");
+		return EXIT_FAILURE;
+	}
+
+	size = benchmark(&assembler_benchmarks[4], patchedVec.data(), patchedVec.size(),
+		[&patchedVec, &asmVec, &origBytecode, &incremental, &reencoded](const void *buf, size_t len) {
+			if (FAILED(AssembleFluganIncrementalWithSignatureParsing(&patchedVec, &asmVec,
+					&origBytecode, &incremental, NULL, &reencoded)))
+				return (UINT64)0;
+			return (UINT64)incremental.size();
+		});
+	if (!size) {
+		LogInfo("    Error incrementally assembling patched shader\n");
+		return EXIT_FAILURE;
+	}
+
+	if (reencoded < 0)
+		LogInfo("    Incremental assembler fell back to assembling the whole shader\n");
+	else
+		LogInfo("    Incremental assembler encoded %i patched instructions\n", reencoded);
+
+	// The unpatched disassembly has already been checked to assemble back
+	// to the original shader, so copying instructions from the original
+	// must give the same result as assembling them again:
+	if (full != incremental) {
+		LogInfo("    Incremental assembly does not match assembling the whole patched shader\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int BenchmarkAssembler(string const *filename, vector<char> *pShaderBytecode)
+{
+	LONGLONG start_ticks = assembler_benchmarks[0].ticks + assembler_benchmarks[1].ticks;
+	vector<char> asmVec;
+	vector<byte> bytecode;
+	string asmText;
+	UINT64 size;
+
+	// The assembler only handles DX10+ shaders, and the benchmark corpus
+	// includes some DX9 ones from HLSLCrossCompiler:
+	if (pShaderBytecode->size() < sizeof(struct dxbc_header)
+			|| strncmp(pShaderBytecode->data(), "DXBC", 4)) {
+		LogInfo("    Not a DXBC shader, skipping\n");
+		return EXIT_SUCCESS;
+	}
+
+	// The original shaders were all made by fxc, so this checks that
+	// our implementation of the checksum agrees with Microsoft's:
+	if (!check_dxbc_checksum(pShaderBytecode->data(), pShaderBytecode->size())) {
+		LogInfo("    Checksum of original shader does not match its contents\n");
+		return EXIT_FAILURE;
+	}
+
+	size = benchmark(&assembler_benchmarks[0], pShaderBytecode->data(), pShaderBytecode->size(),
+		[&asmText](const void *buf, size_t len) {
+			if (FAILED(DisassembleFlugan(buf, len, &asmText, 0, false)))
+				return (UINT64)0;
+			return (UINT64)asmText.size();
+		});
+	if (!size) {
+		LogInfo("    Error disassembling shader\n");
+		return EXIT_FAILURE;
+	}
+	asmVec.assign(asmText.begin(), asmText.end());
+
+	size = benchmark(&assembler_benchmarks[1], asmVec.data(), asmVec.size(),
+		[&asmVec, &bytecode](const void *buf, size_t len) {
+			if (FAILED(AssembleFluganWithSignatureParsing(&asmVec, &bytecode)))
+				return (UINT64)0;
+			return (UINT64)bytecode.size();
+		});
+	if (!size) {
+		LogInfo("    Error assembling disassembly\n");
+		return EXIT_FAILURE;
+	}
+
+	round_trip_timings.push_back({*filename, pShaderBytecode->size(),
+			(assembler_benchmarks[0].ticks + assembler_benchmarks[1].ticks - start_ticks)
+			/ args.benchmark_iterations});
+
+	LogInfo("    %Iu bytes of bytecode -> %Iu bytes of assembly -> %llu bytes of bytecode\n",
+			pShaderBytecode->size(), asmText.size(), size);
+
+	if (!check_dxbc_checksum(bytecode.data(), bytecode.size())) {
+		LogInfo("    Checksum of reassembled shader does not match its contents\n");
+		return EXIT_FAILURE;
+	}
+
+	// Any change to the assembler must not change what it produces, so
+	// check the result matches the original shader as we go:
+	if (validate_assembly(&asmText, pShaderBytecode))
+		return EXIT_FAILURE;
+
+	if (BenchmarkIncrementalAssembler(&asmText, pShaderBytecode))
+		return EXIT_FAILURE;
+
+	// Compare with the native disassembler, which doesn't go through
+	// d3dcompiler. It doesn't support everything, so try it once first
+	// to avoid counting the shaders it bails on:
+	if (FAILED(DisassembleNative(pShaderBytecode->data(), pShaderBytecode->size(), &asmText))) {
+		LogInfo("    Shader not supported by the native disassembler\n");
+		return EXIT_SUCCESS;
+	}
+	size = benchmark(&assembler_benchmarks[2], pShaderBytecode->data(), pShaderBytecode->size(),
+		[&asmText](const void *buf, size_t len) {
+			if (FAILED(DisassembleNative(buf, len, &asmText)))
+				return (UINT64)0;
+			return (UINT64)asmText.size();
+		});
+	LogInfo("    %llu bytes of assembly from the native disassembler\n", size);
+
+	return EXIT_SUCCESS;
+}
+
+// operator new is replaced for the whole program, but only the decompiler
+// and corpus benchmarks turn on tracking, and only for the duration of the
+// run. Everything else, including the normal decompiler and the server,
+// takes the untracked path, which behaves the same as the CRT's version.
+static bool heap_tracking;
+
+// Counts calls to operator new while the decompiler is being benchmarked,
+// which covers all the STL containers the decompiler builds.
+static bool count_heap_allocations;
+static volatile LONG64 heap_allocations;
+
+// The corpus benchmark also tracks how far the heap grows while decompiling
+// each shader. It is single threaded, so these don't need to be atomic. Frees
+// of blocks allocated before tracking started can only make the peak lower,
+// never higher, and there are very few of those.
+static bool track_heap_bytes;
+static LONG64 heap_bytes;
+static LONG64 heap_bytes_peak;
+
+static void* untracked_new(size_t size)
+{
+	std::new_handler handler;
+	void *p;
+
+	while (!(p = malloc(size ? size : 1))) {
+		handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+
+	return p;
+}
+
+void* operator new(size_t size)
+{
+	void *p;
+
+	if (!heap_tracking)
+		return untracked_new(size);
+
+	if (count_heap_allocations)
+		InterlockedIncrement64(&heap_allocations);
+
+	p = untracked_new(size);
+
+	if (track_heap_bytes) {
+		heap_bytes += _msize(p);
+		heap_bytes_peak = max(heap_bytes_peak, heap_bytes);
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	if (heap_tracking && track_heap_bytes && p)
+		heap_bytes -= _msize(p);
+	free(p);
+}
+
+static BenchmarkStat decompiler_benchmarks[] = {
+	{"new decompiler"},
+	{"reused context"},
+};
+static LONG64 decompiler_allocations[ARRAYSIZE(decompiler_benchmarks)];
+
+static int BenchmarkDecompiler(const void *pShaderBytecode, size_t BytecodeLength)
+{
+	string disassembly, fresh, reused, model;
+	DecompilerContext context;
+	LONG64 allocations;
+	HRESULT hret;
+
+	hret = DisassembleMS(pShaderBytecode, BytecodeLength, &disassembly);
+	if (FAILED(hret))
+		return EXIT_FAILURE;
+
+	// Throughput is measured over the disassembly, since that is what the
+	// decompiler walks over:
+	count_heap_allocations = true;
+
+	allocations = heap_allocations;
+	benchmark(&decompiler_benchmarks[0], disassembly.data(), disassembly.size(),
+		[&](const void *buf, size_t len) {
+			return (UINT64)DecompileDisassembly(pShaderBytecode, &disassembly, NULL, &fresh, &model);
+		});
+	decompiler_allocations[0] += heap_allocations - allocations;
+
+	allocations = heap_allocations;
+	benchmark(&decompiler_benchmarks[1], disassembly.data(), disassembly.size(),
+		[&](const void *buf, size_t len) {
+			return (UINT64)DecompileDisassembly(pShaderBytecode, &disassembly, &context, &reused, &model);
+		});
+	decompiler_allocations[1] += heap_allocations - allocations;
+
+	count_heap_allocations = false;
+
+	// Anything left behind from the previous shader would show up here:
+	if (fresh != reused) {
+		LogInfo("    *** Reusing the decompiler context changed the output\n");
+		return EXIT_FAILURE;
+	}
+
+	LogInfo("    %Iu bytes of HLSL\n", reused.size());
+	return EXIT_SUCCESS;
+}
+
+static void PrintDecompilerAllocations()
+{
+	size_t i;
+
+	LogInfo("\nHeap allocations per decompiled shader:\n");
+	for (i = 0; i < ARRAYSIZE(decompiler_benchmarks); i++) {
+		LogInfo("  %-20s %10.1f\n", decompiler_benchmarks[i].name,
+				decompiler_benchmarks[i].runs ? (double)decompiler_allocations[i] / decompiler_benchmarks[i].runs : 0.0);
+	}
+}
+
+// One line of the corpus benchmark's results file. These are tab separated
+// with a header comment, so they are easy to load into a spreadsheet, and
+// are compared by shader filename against the baseline. A baseline may have
+// - in place of the time, peak heap and allocations, since those depend on
+// the machine, which is stored here as a negative number:
+struct CorpusResult {
+	string filename;
+	string status;
+	string disassembler;
+	string model;
+	double time_us;
+	LONG64 peak_bytes;
+	LONG64 allocations;
+	UINT64 hlsl_hash;
+};
+static vector<CorpusResult> corpus_results;
+
+// The first line has the version and time it was decompiled, which would
+// make the hash different on every run:
+static UINT64 HashHLSLIgnoringHeader(string const *hlsl)
+{
+	size_t start = 0;
+
+	if (!hlsl->compare(0, 20, "// ---- Created with")) {
+		start = hlsl->find('\n');
+		start = (start == string::npos) ? hlsl->size() : start + 1;
+	}
+
+	return fnv_64_buf(hlsl->data() + start, hlsl->size() - start);
+}
+
+// d3dcompiler_47.dll is delay loaded, so calling into it without checking
+// first would throw an exception on a machine that doesn't have it. Loading
+// it here uses the same search path, and keeps it loaded for the real calls:
+static bool d3dcompiler_available()
+{
+	static int available = -1;
+
+	if (available == -1)
+		available = !!LoadLibraryA("d3dcompiler_47.dll");
+	return !!available;
+}
+
+// Decompiles the same disassembly that the rest of cmd_Decompiler and the
+// DLL would, unless d3dcompiler can't be loaded (or --corpus-native is
+// used), in which case it falls back to the native disassembler. That way
+// this still runs anywhere cmd_Decompiler starts (including under Wine),
+// but the results from the two disassemblers can't be compared with each
+// other, so each line records which was used. It never validates the HLSL.
+// The time is the fastest of the iterations, which is much less noisy than
+// the average for comparing against a baseline taken on another day.
+static int BenchmarkCorpus(string const *filename, vector<char> *srcData)
+{
+	CorpusResult result = {*filename, "ok", "-", "", 0.0, 0, 0, 0};
+	unique_lock<mutex> dx9_lock(dx9_decoder_lock, defer_lock);
+	LARGE_INTEGER freq, start, end;
+	LONG64 allocations, best = 0;
+	string disassembly, hlsl, model;
+	bool dx9;
+	int i;
+
+	dx9 = srcData->size() < 4 || memcmp(srcData->data(), "DXBC", 4);
+	if (dx9)
+		dx9_lock.lock();
+
+	// The native disassembler only understands DXBC, and doesn't support
+	// shader model 5.1. Shaders that can't be disassembled are still listed,
+	// so that one that starts or stops decompiling shows up in the
+	// comparison:
+	if (!args.corpus_native && d3dcompiler_available()) {
+		result.disassembler = "ms";
+		if (FAILED(DisassembleMS(srcData->data(), srcData->size(), &disassembly)))
+			result.status = "disassembly_failed";
+	} else if (dx9) {
+		result.status = "skipped";
+	} else {
+		result.disassembler = "native";
+		if (FAILED(DisassembleNative(srcData->data(), srcData->size(), &disassembly)))
+			result.status = "disassembly_failed";
+	}
+	if (result.status != "ok") {
+		corpus_results.push_back(result);
+		return EXIT_SUCCESS;
+	}
+
+	heap_bytes = heap_bytes_peak = 0;
+	allocations = heap_allocations;
+	track_heap_bytes = count_heap_allocations = true;
+	if (FAILED(DecompileDisassembly(srcData->data(), &disassembly, NULL, &hlsl, &model)))
+		result.status = "decompile_failed";
+	track_heap_bytes = count_heap_allocations = false;
+	result.peak_bytes = heap_bytes_peak;
+	result.allocations = heap_allocations - allocations;
+	result.hlsl_hash = HashHLSLIgnoringHeader(&hlsl);
+	result.model = model;
+
+	QueryPerformanceFrequency(&freq);
+	for (i = 0; i < args.benchmark_iterations; i++) {
+		QueryPerformanceCounter(&start);
+		DecompileDisassembly(srcData->data(), &disassembly, NULL, &hlsl, &model);
+		QueryPerformanceCounter(&end);
+		if (!i || end.QuadPart - start.QuadPart < best)
+			best = end.QuadPart - start.QuadPart;
+	}
+	result.time_us = best * 1000000.0 / freq.QuadPart;
+
+	LogInfo("    %.1f us, %lli bytes peak, %lli allocations, HLSL hash %016llx (%s disassembler)\n",
+			result.time_us, result.peak_bytes, result.allocations, result.hlsl_hash,
+			result.disassembler.c_str());
+
+	corpus_results.push_back(result);
+	return EXIT_SUCCESS;
+}
+
+static int WriteCorpusResults(string const *path)
+{
+	FILE *f;
+
+	if (fopen_s(&f, path->c_str(), "w") || !f) {
+		LogInfo("Unable to write %s\n", path->c_str());
+		return EXIT_FAILURE;
+	}
+
+	fprintf(f, "# shader\tstatus\tdisassembler\tmodel\ttime_us\tpeak_bytes\tallocations\thlsl_hash\n");
+	for (CorpusResult const &result : corpus_results) {
+		fprintf(f, "%s\t%s\t%s\t%s\t%.1f\t%lli\t%lli\t%016llx\n",
+				result.filename.c_str(), result.status.c_str(), result.disassembler.c_str(),
+				result.model.empty() ? "-" : result.model.c_str(),
+				result.time_us, result.peak_bytes, result.allocations, result.hlsl_hash);
+	}
+
+	fclose(f);
+	return EXIT_SUCCESS;
+}
+
+static int LoadCorpusBaseline(string const *path, map<string, CorpusResult> *baseline)
+{
+	CorpusResult result;
+	char filename[MAX_PATH], status[32], disassembler[32], model[32];
+	char time_us[32], peak_bytes[32], allocations[32];
+	char line[MAX_PATH + 256];
+	FILE *f;
+
+	if (fopen_s(&f, path->c_str(), "r") || !f) {
+		LogInfo("Unable to open baseline %s\n", path->c_str());
+		return EXIT_FAILURE;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf_s(line, "%[^\t]\t%31s\t%31s\t%31s\t%31s\t%31s\t%31s\t%llx",
+				filename, (unsigned)sizeof(filename), status, (unsigned)sizeof(status),
+				disassembler, (unsigned)sizeof(disassembler), model, (unsigned)sizeof(model),
+				time_us, (unsigned)sizeof(time_us), peak_bytes, (unsigned)sizeof(peak_bytes),
+				allocations, (unsigned)sizeof(allocations), &result.hlsl_hash) != 8) {
+			LogInfo("Bad line in baseline %s: %s", path->c_str(), line);
+			fclose(f);
+			return EXIT_FAILURE;
+		}
+		result.filename = filename;
+		result.status = status;
+		result.disassembler = disassembler;
+		result.model = model;
+		result.time_us = strcmp(time_us, "-") ? atof(time_us) : -1.0;
+		result.peak_bytes = strcmp(peak_bytes, "-") ? strtoll(peak_bytes, NULL, 10) : -1;
+		result.allocations = strcmp(allocations, "-") ? strtoll(allocations, NULL, 10) : -1;
+		(*baseline)[result.filename] = result;
+	}
+
+	fclose(f);
+	return EXIT_SUCCESS;
+}
+
+// Fails if any shader got slower or used more memory than its baseline by
+// more than the thresholds, or decompiled differently. Changing the output
+// may well be intentional, but it means the baseline is stale either way.
+static int CompareCorpusBaseline(string const *path)
+{
+	map<string, CorpusResult> baseline;
+	double time = 0.0, base_time = 0.0;
+	size_t compared = 0, slower = 0, bigger = 0, changed = 0, other_disassembler = 0;
+
+	if (LoadCorpusBaseline(path, &baseline))
+		return EXIT_FAILURE;
+
+	LogInfo("\nComparing against baseline %s (thresholds: time +%.0f%%, peak heap +%.0f%%):\n",
+			path->c_str(), args.corpus_time_threshold, args.corpus_alloc_threshold);
+
+	for (CorpusResult const &result : corpus_results) {
+		auto i = baseline.find(result.filename);
+		if (i == baseline.end()) {
+			LogInfo("  new shader          %s\n", result.filename.c_str());
+			continue;
+		}
+		CorpusResult const &base = i->second;
+
+		// The two disassemblers format things differently, which carries
+		// through to the HLSL, so there's nothing to compare. A shader that
+		// neither could disassemble is still compared, by its status:
+		if (result.disassembler != base.disassembler) {
+			other_disassembler++;
+			continue;
+		}
+		compared++;
+
+		if (result.status != base.status || result.hlsl_hash != base.hlsl_hash) {
+			LogInfo("  output changed      %s (%s -> %s)\n", result.filename.c_str(),
+					base.status.c_str(), result.status.c_str());
+			changed++;
+		}
+		if (result.status != "ok" || base.status != "ok")
+			continue;
+
+		if (base.time_us >= 0) {
+			time += result.time_us;
+			base_time += base.time_us;
+		}
+		if (base.time_us >= 0 && result.time_us > base.time_us * (1.0 + args.corpus_time_threshold / 100.0)) {
+			LogInfo("  slower  %+7.1f%%    %s (%.1f -> %.1f us)\n",
+					(result.time_us / base.time_us - 1.0) * 100.0,
+					result.filename.c_str(), base.time_us, result.time_us);
+			slower++;
+		}
+		if (base.peak_bytes >= 0 && result.peak_bytes > base.peak_bytes * (1.0 + args.corpus_alloc_threshold / 100.0)) {
+			LogInfo("  peak heap %+7.1f%%  %s (%lli -> %lli bytes)\n",
+					base.peak_bytes ? ((double)result.peak_bytes / base.peak_bytes - 1.0) * 100.0 : 100.0,
+					result.filename.c_str(), base.peak_bytes, result.peak_bytes);
+			bigger++;
+		}
+	}
+	for (auto const &i : baseline) {
+		if (none_of(corpus_results.begin(), corpus_results.end(),
+				[&](CorpusResult const &result) { return result.filename == i.first; }))
+			LogInfo("  missing shader      %s\n", i.first.c_str());
+	}
+
+	LogInfo("\nCompared %Iu shaders: %Iu slower, %Iu using more memory, %Iu with changed output\n",
+			compared, slower, bigger, changed);
+	if (other_disassembler)
+		LogInfo("Not compared %Iu shaders that the baseline disassembled differently\n", other_disassembler);
+	if (base_time) {
+		LogInfo("Total decompile time %.3f ms vs %.3f ms in the baseline (%+.1f%%)\n",
+				time / 1000.0, base_time / 1000.0, (time / base_time - 1.0) * 100.0);
+	}
+
+	return (slower || bigger || changed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void PrintRoundTripOutliers(size_t count)
+{
+	LARGE_INTEGER freq;
+	double secs;
+	size_t i;
+
+	QueryPerformanceFrequency(&freq);
+
+	std::sort(round_trip_timings.begin(), round_trip_timings.end(),
+		[](const RoundTripTiming &a, const RoundTripTiming &b) {
+			return a.ticks > b.ticks;
+		});
+
+	LogInfo("\nSlowest shaders to round trip:\n");
+	for (i = 0; i < count && i < round_trip_timings.size(); i++) {
+		secs = (double)round_trip_timings[i].ticks / freq.QuadPart;
+		LogInfo("  %10.3f ms %8Iu bytes %10.1f MB/s  %s\n", secs * 1000.0,
+				round_trip_timings[i].bytes,
+				secs ? round_trip_timings[i].bytes / secs / (1024 * 1024) : 0.0,
+				round_trip_timings[i].filename.c_str());
+	}
+}
+
+static void PrintBenchmarkSummary(const char *title, BenchmarkStat *stats, size_t num_stats)
+{
+	LARGE_INTEGER freq;
+	double secs;
+	size_t i;
+
+	QueryPerformanceFrequency(&freq);
+
+	LogInfo("\n%s:\n", title);
+	for (i = 0; i < num_stats; i++) {
+		secs = (double)stats[i].ticks / freq.QuadPart;
+		LogInfo("  %-20s %10.3f ms %10.1f MB/s %10.1f /s\n", stats[i].name, secs * 1000.0,
+				secs ? stats[i].bytes / secs / (1024 * 1024) : 0.0,
+				secs ? stats[i].runs / secs : 0.0);
+	}
+}
+
+bool benchmarking()
+{
+	return args.benchmark_hash
+		|| args.benchmark_checksum
+		|| !args.benchmark_regex.empty()
+		|| args.benchmark_assembler
+		|| args.benchmark_decompiler
+		|| args.benchmark_server
+		|| !args.benchmark_corpus.empty();
+}
+
+int StartBenchmarks()
+{
+	heap_tracking = args.benchmark_decompiler || !args.benchmark_corpus.empty();
+
+	if (!args.benchmark_regex.empty())
+		return LoadRegexBenchmark(&args.benchmark_regex);
+
+	return EXIT_SUCCESS;
+}
+
+int BenchmarkFile(string const *filename, vector<char> *srcData)
+{
+	if (args.benchmark_hash) {
+		LogInfo("Benchmarking hashes of %s...\n", filename->c_str());
+		BenchmarkHash(srcData->data(), srcData->size());
+	}
+
+	if (args.benchmark_checksum) {
+		LogInfo("Benchmarking DXBC checksum of %s...\n", filename->c_str());
+		if (BenchmarkChecksum(srcData))
+			return EXIT_FAILURE;
+	}
+
+	if (!args.benchmark_regex.empty()) {
+		LogInfo("Benchmarking regex patterns over %s...\n", filename->c_str());
+		if (BenchmarkRegex(srcData->data(), srcData->size()))
+			return EXIT_FAILURE;
+	}
+
+	if (args.benchmark_assembler) {
+		LogInfo("Benchmarking assembler on %s...\n", filename->c_str());
+		if (BenchmarkAssembler(filename, srcData))
+			return EXIT_FAILURE;
+	}
+
+	if (args.benchmark_decompiler) {
+		LogInfo("Benchmarking decompiler on %s...\n", filename->c_str());
+		if (BenchmarkDecompiler(srcData->data(), srcData->size()))
+			return EXIT_FAILURE;
+	}
+
+	if (!args.benchmark_corpus.empty()) {
+		LogInfo("Benchmarking decompiler corpus on %s...\n", filename->c_str());
+		if (BenchmarkCorpus(filename, srcData))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int FinishBenchmarks()
+{
+	int rc = EXIT_SUCCESS;
+
+	if (args.benchmark_hash)
+		PrintBenchmarkSummary("Shader hash throughput", hash_benchmarks, ARRAYSIZE(hash_benchmarks));
+	if (args.benchmark_checksum) {
+		if (BenchmarkChecksumBatch())
+			rc = EXIT_FAILURE;
+		PrintBenchmarkSummary("DXBC checksum throughput", checksum_benchmarks, ARRAYSIZE(checksum_benchmarks));
+	}
+	if (!args.benchmark_regex.empty())
+		PrintBenchmarkSummary("ShaderRegex matching throughput", regex_benchmarks, ARRAYSIZE(regex_benchmarks));
+	if (args.benchmark_assembler) {
+		PrintBenchmarkSummary("Assembler round trip throughput", assembler_benchmarks, ARRAYSIZE(assembler_benchmarks));
+		PrintRoundTripOutliers(10);
+	}
+	if (args.benchmark_decompiler) {
+		PrintBenchmarkSummary("Decompiler throughput", decompiler_benchmarks, ARRAYSIZE(decompiler_benchmarks));
+		PrintDecompilerAllocations();
+	}
+	if (!args.benchmark_corpus.empty()) {
+		if (WriteCorpusResults(&args.benchmark_corpus))
+			rc = EXIT_FAILURE;
+		else if (!args.corpus_baseline.empty() && CompareCorpusBaseline(&args.corpus_baseline))
+			rc = EXIT_FAILURE;
+	}
+
+	return rc;
+}
+
+// Compares the throughput of one server handling every input file against
+// starting a new server for each one, which costs about the same as running
+// cmd_Decompiler once per file. The input files are read up front so that
+// only the decompiler is being timed.
+int BenchmarkServer()
+{
+	vector<vector<char>> inputs(args.files.size());
+	vector<string> results(args.files.size());
+	DecompilerServerClient server;
+	LARGE_INTEGER freq, start, end;
+	double persistent_ms, per_process_ms;
+	char exe[MAX_PATH];
+	string output;
+	uint32_t status;
+	size_t i, bytes = 0, mismatches = 0;
+
+	if (!GetModuleFileNameA(NULL, exe, MAX_PATH))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < args.files.size(); i++) {
+		if (ReadInput(&inputs[i], &args.files[i]))
+			return EXIT_FAILURE;
+		bytes += inputs[i].size();
+	}
+
+	QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&start);
+	if (!server.Start(exe)) {
+		LogInfo("Unable to start %s --server\n", exe);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < inputs.size(); i++) {
+		if (!server.Request(DECOMPILER_SERVER_DECOMPILE, 0, inputs[i].data(), inputs[i].size(), &status, &results[i])) {
+			LogInfo("Lost connection to server on %s\n", args.files[i].c_str());
+			return EXIT_FAILURE;
+		}
+	}
+	server.Stop();
+	QueryPerformanceCounter(&end);
+	persistent_ms = (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+
+	QueryPerformanceCounter(&start);
+	for (i = 0; i < inputs.size(); i++) {
+		if (!server.Start(exe) || !server.Request(DECOMPILER_SERVER_DECOMPILE, 0,
+				inputs[i].data(), inputs[i].size(), &status, &output)) {
+			LogInfo("Server failed on %s\n", args.files[i].c_str());
+			return EXIT_FAILURE;
+		}
+		server.Stop();
+
+		// The decompiler must not depend on what came before it:
+		if (output != results[i]) {
+			LogInfo("*** %s decompiled differently in the long running server\n", args.files[i].c_str());
+			mismatches++;
+		}
+	}
+	QueryPerformanceCounter(&end);
+	per_process_ms = (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+
+	LogInfo("\nDecompiling %Iu shaders (%Iu bytes):\n", inputs.size(), bytes);
+	LogInfo("  %-20s %10.3f ms %10.1f /s\n", "one server", persistent_ms,
+			persistent_ms ? inputs.size() * 1000.0 / persistent_ms : 0.0);
+	LogInfo("  %-20s %10.3f ms %10.1f /s\n", "process per shader", per_process_ms,
+			per_process_ms ? inputs.size() * 1000.0 / per_process_ms : 0.0);
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
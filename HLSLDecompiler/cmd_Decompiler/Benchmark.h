@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+// The --benchmark-* options. Each one runs alongside the normal processing
+// of every input file and keeps its totals until the end of the run, where
+// FinishBenchmarks() prints the summaries. --benchmark-server is the
+// exception, since it decompiles all the files itself.
+
+bool benchmarking();
+int StartBenchmarks();
+int BenchmarkFile(std::string const *filename, std::vector<char> *srcData);
+int FinishBenchmarks();
+int BenchmarkServer();
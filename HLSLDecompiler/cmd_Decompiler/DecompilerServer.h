@@ -0,0 +1,201 @@
+#pragma once
+
+#include <windows.h>
+#include <stdint.h>
+#include <string>
+
+// Protocol for cmd_Decompiler --server, plus a small client for it. Asset
+// pipelines that used to run cmd_Decompiler once per shader can start one
+// server and send it every shader instead, which saves the process startup
+// and keeps the decompiler's tables warm between requests.
+//
+// Each request is a DecompilerServerRequest followed by size bytes of
+// input, and each gets back a DecompilerServerResponse followed by size
+// bytes of output - the result on success, or an error message on failure.
+// All fields are little endian. The server exits when stdin is closed, or
+// on a request it can't make sense of, including one whose input is larger
+// than DECOMPILER_SERVER_MAX_SIZE.
+//
+// This file only depends on Windows, so it can be copied into other tools.
+
+#define DECOMPILER_SERVER_MAGIC 0x43443344 // "D3DC"
+
+// Far bigger than any real shader or its assembly, but small enough that a
+// corrupt size can't make the server try to allocate gigabytes for it:
+#define DECOMPILER_SERVER_MAX_SIZE (64 * 1024 * 1024)
+
+enum DecompilerServerOperation {
+	DECOMPILER_SERVER_DECOMPILE = 1,          // DXBC shader -> HLSL
+	DECOMPILER_SERVER_DISASSEMBLE_MS = 2,     // DXBC shader -> assembly
+	DECOMPILER_SERVER_DISASSEMBLE_FLUGAN = 3, // DXBC shader -> assembly
+	DECOMPILER_SERVER_DISASSEMBLE_NATIVE = 4, // DXBC shader -> assembly
+	DECOMPILER_SERVER_ASSEMBLE = 5,           // Assembly -> DXBC shader
+};
+
+enum DecompilerServerFlags {
+	DECOMPILER_SERVER_VALIDATE = 0x1,         // As --validate
+	DECOMPILER_SERVER_DISASSEMBLE_46 = 0x2,   // As --disassemble-46
+};
+
+struct DecompilerServerRequest {
+	uint32_t magic;
+	uint32_t operation;
+	uint32_t flags;
+	uint32_t size;
+};
+
+enum DecompilerServerStatus {
+	DECOMPILER_SERVER_OK = 0,
+	DECOMPILER_SERVER_FAILED = 1,
+	DECOMPILER_SERVER_BAD_REQUEST = 2,
+};
+
+struct DecompilerServerResponse {
+	uint32_t magic;
+	uint32_t status;
+	uint32_t size;
+};
+
+class DecompilerServerClient
+{
+	HANDLE process;
+	HANDLE to_server;
+	HANDLE from_server;
+
+	static bool write_all(HANDLE handle, const void *buf, size_t size)
+	{
+		const char *pos = (const char*)buf;
+		DWORD written;
+
+		while (size) {
+			if (!WriteFile(handle, pos, (DWORD)size, &written, NULL))
+				return false;
+			pos += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	static bool read_all(HANDLE handle, void *buf, size_t size)
+	{
+		char *pos = (char*)buf;
+		DWORD read;
+
+		while (size) {
+			if (!ReadFile(handle, pos, (DWORD)size, &read, NULL) || !read)
+				return false;
+			pos += read;
+			size -= read;
+		}
+		return true;
+	}
+
+public:
+	DecompilerServerClient() :
+		process(NULL),
+		to_server(NULL),
+		from_server(NULL)
+	{}
+
+	~DecompilerServerClient()
+	{
+		Stop();
+	}
+
+	DecompilerServerClient(DecompilerServerClient const&) = delete;
+	DecompilerServerClient& operator= (DecompilerServerClient const&) = delete;
+
+	// Starts cmd_Decompiler.exe from the given path. The server's log goes
+	// to the same place as ours.
+	bool Start(const char *cmd_decompiler)
+	{
+		SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+		STARTUPINFOA si = { sizeof(STARTUPINFOA) };
+		PROCESS_INFORMATION pi;
+		HANDLE server_stdin = NULL, server_stdout = NULL;
+		std::string cmdline;
+		BOOL ok;
+
+		Stop();
+
+		if (!CreatePipe(&server_stdin, &to_server, &sa, 0))
+			return false;
+		if (!CreatePipe(&from_server, &server_stdout, &sa, 0)) {
+			CloseHandle(server_stdin);
+			Stop();
+			return false;
+		}
+		// Our ends must not be inherited, or the server would never see
+		// stdin closed:
+		SetHandleInformation(to_server, HANDLE_FLAG_INHERIT, 0);
+		SetHandleInformation(from_server, HANDLE_FLAG_INHERIT, 0);
+
+		si.dwFlags = STARTF_USESTDHANDLES;
+		si.hStdInput = server_stdin;
+		si.hStdOutput = server_stdout;
+		si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+		cmdline = std::string("\"") + cmd_decompiler + "\" --server";
+		ok = CreateProcessA(NULL, &cmdline[0], NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+		CloseHandle(server_stdin);
+		CloseHandle(server_stdout);
+		if (!ok) {
+			Stop();
+			return false;
+		}
+
+		CloseHandle(pi.hThread);
+		process = pi.hProcess;
+		return true;
+	}
+
+	// Returns false if the server could not be reached, in which case it
+	// needs to be started again. Otherwise *status says whether the
+	// operation itself succeeded, and *output holds the result or error.
+	bool Request(DecompilerServerOperation operation, uint32_t flags,
+			const void *input, size_t size, uint32_t *status, std::string *output)
+	{
+		DecompilerServerRequest request = { DECOMPILER_SERVER_MAGIC, (uint32_t)operation, flags, (uint32_t)size };
+		DecompilerServerResponse response;
+
+		if (!process)
+			return false;
+
+		if (size > DECOMPILER_SERVER_MAX_SIZE) {
+			*status = DECOMPILER_SERVER_BAD_REQUEST;
+			*output = "Input too large";
+			return true;
+		}
+
+		if (!write_all(to_server, &request, sizeof(request)) || !write_all(to_server, input, size))
+			return false;
+
+		if (!read_all(from_server, &response, sizeof(response)) || response.magic != DECOMPILER_SERVER_MAGIC)
+			return false;
+
+		output->resize(response.size);
+		if (response.size && !read_all(from_server, &(*output)[0], response.size))
+			return false;
+
+		*status = response.status;
+		return true;
+	}
+
+	// Closes the server's stdin and waits for it to exit
+	void Stop()
+	{
+		if (to_server)
+			CloseHandle(to_server);
+		to_server = NULL;
+
+		if (process) {
+			WaitForSingleObject(process, INFINITE);
+			CloseHandle(process);
+		}
+		process = NULL;
+
+		if (from_server)
+			CloseHandle(from_server);
+		from_server = NULL;
+	}
+};
@@ -4,9 +4,17 @@
 #include "stdafx.h"
 
 #include <iostream>     // console output
+#include <fstream>
+#include <algorithm>
+#include <mutex>
+#include <io.h>
+#include <fcntl.h>
 
 #include <D3Dcompiler.h>
 #include "DecompileHLSL.h"
+#include "DecompilerServer.h"
+#include "cmd_Decompiler.h"
+#include "Benchmark.h"
 #include "version.h"
 #include "log.h"
 #define MIGOTO_DX 11 // Selects the DX11 disassembler in util.h - the DX9 dis/assembler is not very
@@ -14,6 +22,10 @@
                      // The DX9 decompiler is more interesting, which is unrelated to this flag.
 #include "util.h"
 #include "shader.h"
+#include "DirectX11/ShaderRegexPrefilter.h"
+#include "DirectX11/ShaderRegexEngine.h"
+
+#include <pcre2.h>
 
 using namespace std;
 
@@ -40,6 +52,12 @@ static void PrintHelp(int argc, char *argv[])
 	LogInfo("  --disassemble-ms\n");
 	LogInfo("\t\t\tDisassemble binary shaders with Microsoft's disassembler\n");
 
+	LogInfo("  --disassemble-native\n");
+	LogInfo("\t\t\tDisassemble binary shaders with 3DMigoto's native disassembler, which does\n");
+	LogInfo("\t\t\tnot need d3dcompiler and produces the same output as --disassemble-flugan.\n");
+	LogInfo("\t\t\tThis is what 3DMigoto itself uses, falling back to Flugan's disassembler\n");
+	LogInfo("\t\t\tfor the shaders it can't handle (shader model 5.1, shader messages)\n");
+
 	// Only applicable to the vs2017 branch / d3dcompiler_47 version:
 	LogInfo("  -6, --disassemble-46\n");
 	LogInfo("\t\t\tApply backwards compatibility formatting patch to disassembler output\n");
@@ -57,6 +75,78 @@ static void PrintHelp(int argc, char *argv[])
 	// LogInfo("  -f, --force\n");
 	// LogInfo("\t\t\tOverwrite existing files\n");
 
+	LogInfo("  --benchmark-hash\n");
+	LogInfo("\t\t\tCompare the throughput of the shader hash algorithms over the input files\n");
+
+	LogInfo("  --benchmark-checksum\n");
+	LogInfo("\t\t\tCheck the DXBC checksum of each input file against the one the compiler\n");
+	LogInfo("\t\t\tstored in it, and compare the throughput of hashing the files one at a time\n");
+	LogInfo("\t\t\tagainst hashing them all in one batch\n");
+
+	LogInfo("  --benchmark-regex FILE\n");
+	LogInfo("\t\t\tCompare matching the ShaderRegex style patterns in FILE (one per line) against the\n");
+	LogInfo("\t\t\tdisassembly of the input files with and without the literal prefilter\n");
+
+	LogInfo("  --benchmark-assembler\n");
+	LogInfo("\t\t\tTime round tripping the input files through Flugan's disassembler and\n");
+	LogInfo("\t\t\tassembler, and check that the result and its checksum are identical to the\n");
+	LogInfo("\t\t\toriginal shader. Also compares assembling a lightly patched copy of each\n");
+	LogInfo("\t\t\tshader in full against the incremental assembler used for ShaderRegex.\n");
+	LogInfo("\t\t\tLists the slowest shaders at the end\n");
+
+	LogInfo("  --benchmark-decompiler\n");
+	LogInfo("\t\t\tCompare the time and heap allocations of decompiling each input file with a\n");
+	LogInfo("\t\t\tnew decompiler every time against reusing one DecompilerContext, and check\n");
+	LogInfo("\t\t\tthat both produce the same HLSL\n");
+
+	LogInfo("  --shader-regex INI\n");
+	LogInfo("\t\t\tApply the [ShaderRegex*] sections from a d3dx.ini to the input files, which may\n");
+	LogInfo("\t\t\tinclude directories of dumped *.bin shaders. Writes any patched assembly to\n");
+	LogInfo("\t\t\t*_regex.asm and reports the matches and time taken by each group and pattern\n");
+
+	LogInfo("  --shader-regex-budget US\n");
+	LogInfo("\t\t\tFail if any ShaderRegex pattern averages more than US microseconds per run\n");
+
+	LogInfo("  -j N, --jobs N\n");
+	LogInfo("\t\t\tNumber of threads to use with --shader-regex (default: one per CPU). When\n");
+	LogInfo("\t\t\tprocessing files, spreads them over N threads and prints a per file result\n");
+	LogInfo("\t\t\tin input order and a summary of each stage at the end (default: 1). The\n");
+	LogInfo("\t\t\tbenchmarks always run on one thread\n");
+
+	LogInfo("  --server\n");
+	LogInfo("\t\t\tRead requests from stdin and write the results to stdout until stdin is\n");
+	LogInfo("\t\t\tclosed, keeping the decompiler warm between them. See DecompilerServer.h\n");
+	LogInfo("\t\t\tfor the protocol and a client\n");
+
+	LogInfo("  --benchmark-server\n");
+	LogInfo("\t\t\tCompare decompiling the input files through one --server process against\n");
+	LogInfo("\t\t\tstarting a new process for each file, and check both give the same HLSL\n");
+
+	LogInfo("  --benchmark-corpus RESULTS\n");
+	LogInfo("\t\t\tDecompile each input file, and write the fastest time, peak heap growth,\n");
+	LogInfo("\t\t\tallocations and a hash of the HLSL of each to RESULTS as tab separated\n");
+	LogInfo("\t\t\tvalues. Disassembles with d3dcompiler if it can be loaded, otherwise with\n");
+	LogInfo("\t\t\tthe native disassembler (which skips DX9 shaders)\n");
+
+	LogInfo("  --corpus-native\n");
+	LogInfo("\t\t\tWith --benchmark-corpus, always use the native disassembler, so that the\n");
+	LogInfo("\t\t\tresults don't depend on which d3dcompiler is installed\n");
+
+	LogInfo("  --baseline FILE\n");
+	LogInfo("\t\t\tWith --benchmark-corpus, fail if any shader is slower or uses more memory\n");
+	LogInfo("\t\t\tthan in FILE (an earlier RESULTS) by more than the thresholds, or if its\n");
+	LogInfo("\t\t\tHLSL has changed. Times and sizes of - in FILE are not compared, and nor\n");
+	LogInfo("\t\t\tis anything from a different disassembler\n");
+
+	LogInfo("  --time-threshold PERCENT\n");
+	LogInfo("\t\t\tHow much slower than the baseline a shader may be (default 20)\n");
+
+	LogInfo("  --alloc-threshold PERCENT\n");
+	LogInfo("\t\t\tHow much more peak heap than the baseline a shader may use (default 5)\n");
+
+	LogInfo("  --benchmark-iterations N\n");
+	LogInfo("\t\t\tNumber of times to repeat each benchmarked operation per file (default 100)\n");
+
 	// Call this validate not verify, because it's impossible to machine
 	// verify the decompiler:
 	LogInfo("  -V, --validate\n");
@@ -81,22 +171,7 @@ static void PrintVersion()
 	exit(EXIT_SUCCESS);
 }
 
-static struct {
-	std::vector<std::string> files;
-	bool decompile;
-	bool compile;
-	bool disassemble_ms;
-	bool disassemble_flugan;
-	int disassemble_hexdump;
-	bool disassemble_46;
-	bool patch_cb_offsets;
-	std::string reflection_reference;
-	bool assemble;
-	bool force;
-	bool validate;
-	bool lenient;
-	bool stop;
-} args;
+CmdDecompilerArgs args;
 
 void parse_args(int argc, char *argv[])
 {
@@ -160,6 +235,10 @@ void parse_args(int argc, char *argv[])
 				args.disassemble_ms = true;
 				continue;
 			}
+			if (!strcmp(arg, "--disassemble-native")) {
+				args.disassemble_native = true;
+				continue;
+			}
 			if (!strcmp(arg, "-a") || !strcmp(arg, "--assemble")) {
 				args.assemble = true;
 				continue;
@@ -168,6 +247,98 @@ void parse_args(int argc, char *argv[])
 			// 	args.force = true;
 			// 	continue;
 			// }
+			if (!strcmp(arg, "--benchmark-hash")) {
+				args.benchmark_hash = true;
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-checksum")) {
+				args.benchmark_checksum = true;
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-regex")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.benchmark_regex = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-assembler")) {
+				args.benchmark_assembler = true;
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-decompiler")) {
+				args.benchmark_decompiler = true;
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-server")) {
+				args.benchmark_server = true;
+				continue;
+			}
+			if (!strcmp(arg, "--server")) {
+				args.server = true;
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-corpus")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.benchmark_corpus = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--corpus-native")) {
+				args.corpus_native = true;
+				continue;
+			}
+			if (!strcmp(arg, "--baseline")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.corpus_baseline = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--time-threshold")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.corpus_time_threshold = atof(argv[i]);
+				if (args.corpus_time_threshold < 0)
+					PrintHelp(argc, argv);
+				continue;
+			}
+			if (!strcmp(arg, "--alloc-threshold")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.corpus_alloc_threshold = atof(argv[i]);
+				if (args.corpus_alloc_threshold < 0)
+					PrintHelp(argc, argv);
+				continue;
+			}
+			if (!strcmp(arg, "--benchmark-iterations")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.benchmark_iterations = atoi(argv[i]);
+				if (args.benchmark_iterations < 1)
+					PrintHelp(argc, argv);
+				continue;
+			}
+			if (!strcmp(arg, "--shader-regex")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.shader_regex = argv[i];
+				continue;
+			}
+			if (!strcmp(arg, "--shader-regex-budget")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.shader_regex_budget = atof(argv[i]);
+				if (args.shader_regex_budget <= 0)
+					PrintHelp(argc, argv);
+				continue;
+			}
+			if (!strcmp(arg, "-j") || !strcmp(arg, "--jobs")) {
+				if (++i >= argc)
+					PrintHelp(argc, argv);
+				args.jobs = atoi(argv[i]);
+				if (args.jobs < 1)
+					PrintHelp(argc, argv);
+				continue;
+			}
 			if (!strcmp(arg, "-V") || !strcmp(arg, "--validate")) {
 				args.validate = true;
 				continue;
@@ -193,9 +364,19 @@ void parse_args(int argc, char *argv[])
 	if (args.decompile + args.compile
 			+ args.disassemble_ms
 			+ args.disassemble_flugan
+			+ args.disassemble_native
 			+ args.disassemble_hexdump
 			+ args.disassemble_46
-			+ args.assemble < 1) {
+			+ args.assemble
+			+ args.benchmark_hash
+			+ args.benchmark_checksum
+			+ !args.benchmark_regex.empty()
+			+ args.benchmark_assembler
+			+ args.benchmark_decompiler
+			+ args.benchmark_server
+			+ !args.benchmark_corpus.empty()
+			+ args.server
+			+ !args.shader_regex.empty() < 1) {
 		LogInfo("No action specified\n");
 		PrintHelp(argc, argv); // Does not return
 	}
@@ -206,7 +387,7 @@ void parse_args(int argc, char *argv[])
 // to bug in MS's disassembler that always prints floats with %f, which does
 // not have sufficient precision to reproduce a 32bit floating point value
 // exactly. Might still be useful for comparison:
-static HRESULT DisassembleMS(const void *pShaderBytecode, size_t BytecodeLength, string *asmText)
+HRESULT DisassembleMS(const void *pShaderBytecode, size_t BytecodeLength, string *asmText)
 {
 	ID3DBlob *disassembly = nullptr;
 	UINT flags = D3D_DISASM_ENABLE_DEFAULT_VALUE_PRINTS;
@@ -227,16 +408,49 @@ static HRESULT DisassembleMS(const void *pShaderBytecode, size_t BytecodeLength,
 	return S_OK;
 }
 
-static HRESULT DisassembleFlugan(const void *pShaderBytecode, size_t BytecodeLength, string *asmText,
+HRESULT DisassembleFlugan(const void *pShaderBytecode, size_t BytecodeLength, string *asmText,
 		int hexdump, bool d3dcompiler_46_compat)
 {
 	// FIXME: This is a bit of a waste - we convert from a vector<char> to
 	// a void* + size_t to a vector<byte>
+	vector<byte> byteCode((byte*)pShaderBytecode, (byte*)pShaderBytecode + BytecodeLength);
+	vector<byte> disassembly;
+	string comments = "//   using 3Dmigoto command line v" + string(VER_FILE_VERSION_STR) + " on " + LogTime() + "//\n";
+	HRESULT hr;
 
-	*asmText = BinaryToAsmText(pShaderBytecode, BytecodeLength, args.patch_cb_offsets, true, hexdump, d3dcompiler_46_compat);
-	if (*asmText == "")
-		return E_FAIL;
+	// This calls disassembler() directly rather than going through
+	// BinaryToAsmText(), which would try the native disassembler first,
+	// so that the two can still be compared against each other:
+	hr = disassembler(&byteCode, &disassembly, comments.c_str(), hexdump,
+			d3dcompiler_46_compat, true, args.patch_cb_offsets);
+	if (FAILED(hr)) {
+		LogInfo("  disassembly failed. Error: %x\n", hr);
+		return hr;
+	}
+
+	*asmText = string(disassembly.begin(), disassembly.end());
+	return S_OK;
+}
 
+// Disassembles without d3dcompiler by decoding the bytecode ourselves. This
+// produces the same text as DisassembleFlugan, and is what BinaryToAsmText()
+// tries first, but fails with E_FAIL on anything it can't reproduce exactly
+// (shader model 5.1, shader messages) instead of falling back:
+HRESULT DisassembleNative(const void *pShaderBytecode, size_t BytecodeLength, string *asmText)
+{
+	vector<byte> byteCode((byte*)pShaderBytecode, (byte*)pShaderBytecode + BytecodeLength);
+	vector<byte> disassembly;
+	string comments = "//   using 3Dmigoto command line v" + string(VER_FILE_VERSION_STR) + " on " + LogTime() + "//\n";
+	HRESULT hr;
+
+	hr = disassemblerNative(&byteCode, &disassembly, comments.c_str(),
+			args.disassemble_46, true, args.patch_cb_offsets);
+	if (FAILED(hr)) {
+		LogInfo("  native disassembly failed. Error: %x\n", hr);
+		return hr;
+	}
+
+	*asmText = string(disassembly.begin(), disassembly.end());
 	return S_OK;
 }
 
@@ -261,7 +475,7 @@ static int validate_section(char section[4], unsigned char *old_section, unsigne
 	return rc;
 }
 
-static int validate_assembly(string *assembly, vector<char> *old_shader)
+int validate_assembly(string *assembly, vector<char> *old_shader)
 {
 	vector<char> assembly_vec(assembly->begin(), assembly->end());
 	vector<byte> new_shader;
@@ -395,25 +609,23 @@ static int validate_assembly(string *assembly, vector<char> *old_shader)
 }
 
 
-static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, string *hlslText, string *shaderModel)
+// The DX9 decoder keeps some of its state in globals, so only one thread
+// can be decompiling a DX9 shader at a time:
+mutex dx9_decoder_lock;
+
+// context may be NULL to use a new decompiler for just this shader
+HRESULT DecompileDisassembly(const void *pShaderBytecode, string const *disassembly,
+		DecompilerContext *context, string *hlslText, string *shaderModel)
 {
 	// Set all to zero, so we only init the ones we are using here:
 	ParseParameters p = {0};
 	DecompilerSettings d;
 	bool patched = false;
 	bool errorOccurred = false;
-	string disassembly;
-	HRESULT hret;
-
-	hret = DisassembleMS(pShaderBytecode, BytecodeLength, &disassembly);
-	if (FAILED(hret))
-		return E_FAIL;
-
-	LogInfo("    creating HLSL representation\n");
 
 	p.bytecode = pShaderBytecode;
-	p.decompiled = disassembly.c_str(); // XXX: Why do we call this "decompiled" when it's actually disassembled?
-	p.decompiledSize = disassembly.size();
+	p.decompiled = disassembly->c_str(); // XXX: Why do we call this "decompiled" when it's actually disassembled?
+	p.decompiledSize = disassembly->size();
 	p.G = &d;
 
 	// Disable IniParams and StereoParams registers. This avoids inserting
@@ -427,8 +639,36 @@ static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, str
 	d.IniParamsReg = -1;
 	d.StereoParamsReg = -1;
 
-	*hlslText = DecompileBinaryHLSL(p, patched, *shaderModel, errorOccurred);
-	if (!hlslText->size() || errorOccurred) {
+	if (context)
+		*hlslText = DecompileBinaryHLSL(*context, p, patched, *shaderModel, errorOccurred);
+	else
+		*hlslText = DecompileBinaryHLSL(p, patched, *shaderModel, errorOccurred);
+	if (!hlslText->size() || errorOccurred)
+		return E_FAIL;
+
+	return S_OK;
+}
+
+// The context is reused for every file a thread decompiles, so the
+// decompiler doesn't have to rebuild its tables from scratch each time:
+static HRESULT Decompile(const void *pShaderBytecode, size_t BytecodeLength, string *hlslText, string *shaderModel,
+		DecompilerContext *context)
+{
+	unique_lock<mutex> dx9_lock(dx9_decoder_lock, defer_lock);
+	string disassembly;
+	HRESULT hret;
+
+	if (BytecodeLength < 4 || memcmp(pShaderBytecode, "DXBC", 4))
+		dx9_lock.lock();
+
+	hret = DisassembleMS(pShaderBytecode, BytecodeLength, &disassembly);
+	if (FAILED(hret))
+		return E_FAIL;
+
+	LogInfo("    creating HLSL representation\n");
+
+	hret = DecompileDisassembly(pShaderBytecode, &disassembly, context, hlslText, shaderModel);
+	if (FAILED(hret)) {
 		LogInfo("    error while decompiling\n");
 		return E_FAIL;
 	}
@@ -470,35 +710,6 @@ static int validate_hlsl(string *hlsl, string *shaderModel)
 	return EXIT_SUCCESS;
 }
 
-template<typename T>
-static int ReadInput(vector<T> *srcData, string const *filename)
-{
-	DWORD srcDataSize;
-	DWORD readSize;
-	BOOL bret;
-	HANDLE fp;
-
-	// TODO: Handle reading from stdin for use in a pipeline
-
-	fp = CreateFileA(filename->c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (fp == INVALID_HANDLE_VALUE) {
-		LogInfo("    Shader not found: %s\n", filename->c_str());
-		return EXIT_FAILURE;
-	}
-
-	srcDataSize = GetFileSize(fp, 0);
-	srcData->resize(srcDataSize);
-
-	bret = ReadFile(fp, srcData->data(), srcDataSize, &readSize, 0);
-	CloseHandle(fp);
-	if (!bret || srcDataSize != readSize) {
-		LogInfo("    Error reading input file\n");
-		return EXIT_FAILURE;
-	}
-
-	return EXIT_SUCCESS;
-}
-
 static int WriteOutput(string const *in_filename, char const *extension, string const *output)
 {
 	string out_filename;
@@ -526,84 +737,660 @@ static int WriteOutput(string const *in_filename, char const *extension, string
 	return EXIT_SUCCESS;
 }
 
-static int process(string const *filename)
+// The ShaderRegex engine keeps its pcre2 match data per thread. The DLL uses
+// the Win32 TLS API for this since thread_local can interfere with delay
+// loading DLLs, but that's not a concern for an executable:
+static thread_local ShaderRegexThreadState *shader_regex_thread_state;
+
+ShaderRegexThreadState** shader_regex_thread_state_slot()
+{
+	return &shader_regex_thread_state;
+}
+
+struct StringInsensitiveLess {
+	bool operator() (const string &x, const string &y) const
+	{
+		return _stricmp(x.c_str(), y.c_str()) < 0;
+	}
+};
+
+// The lines of one d3dx.ini section, with leading and trailing whitespace,
+// blank lines and comments stripped the same way as the DLL's ini parser.
+// These are what the DLL calls the raw lines, and are concatenated to form
+// the patterns, replace strings and declarations:
+typedef vector<string> ShaderRegexIniLines;
+// Sorted the same way as the DLL sorts the sections in the d3dx.ini, so that
+// the main section of each group is always seen before its subsections:
+typedef map<string, ShaderRegexIniLines, StringInsensitiveLess> ShaderRegexIniSections;
+
+// Accumulated over every shader each group applies to. Updated from several
+// threads at once, so only with interlocked operations:
+struct ShaderRegexGroupStats {
+	volatile LONG64 ticks;
+	volatile LONG shaders;
+	volatile LONG matches;
+	volatile LONG patches;
+};
+
+// Sorted by name in the same way as the DLL, since that is the order the
+// groups are applied in:
+typedef map<wstring, ShaderRegexPatternGroup> ShaderRegexBatchGroups;
+static ShaderRegexBatchGroups batch_regex_groups;
+static vector<ShaderRegexGroupStats> batch_regex_stats;
+static ShaderRegexModels batch_regex_models;
+static LiteralAutomaton batch_regex_prefilter;
+
+static bool get_shader_regex_ini_setting(ShaderRegexIniLines *lines, const char *key, string *value)
+{
+	size_t delim, last, first;
+
+	// First match wins, the same as GetPrivateProfileString:
+	for (string &line : *lines) {
+		delim = line.find('=');
+		if (delim == line.npos || !delim)
+			continue;
+
+		last = line.find_last_not_of(" \t", delim - 1);
+		if (last == line.npos || _stricmp(line.substr(0, last + 1).c_str(), key))
+			continue;
+
+		first = line.find_first_not_of(" \t", delim + 1);
+		*value = first == line.npos ? "" : line.substr(first);
+		return true;
+	}
+
+	return false;
+}
+
+static ShaderRegexModels split_shader_regex_setting(string *setting)
+{
+	ShaderRegexModels ret;
+	size_t pos = 0, end;
+
+	while ((pos = setting->find_first_not_of(' ', pos)) != setting->npos) {
+		end = setting->find(' ', pos);
+		ret.insert(setting->substr(pos, end - pos));
+		pos = end;
+	}
+
+	return ret;
+}
+
+static string join_shader_regex_lines(ShaderRegexIniLines *lines)
+{
+	string ret;
+
+	for (string &line : *lines)
+		ret.append(line);
+
+	return ret;
+}
+
+// The equivalent of the DLL's ParseShaderRegexSections for a single d3dx.ini
+// without the include / namespace handling. Command list and filter_index
+// settings are accepted, but ignored since there is nothing to run them on.
+static bool parse_shader_regex_section(const string *section_id, ShaderRegexIniLines *lines)
+{
+	ShaderRegexBatchGroups::iterator group_i;
+	ShaderRegexPatternGroup *group;
+	ShaderRegexPattern *pattern;
+	vector<wstring> names;
+	wstring wsection_id(section_id->begin(), section_id->end());
+	string setting;
+	size_t pos = 0, end;
+
+	do {
+		end = wsection_id.find(L'.', pos);
+		names.push_back(wsection_id.substr(pos, end - pos));
+		pos = end + 1;
+	} while (end != wsection_id.npos);
+
+	if (names.size() == 1) {
+		group = &batch_regex_groups[names[0]];
+		group->ini_section = names[0];
+		if (!get_shader_regex_ini_setting(lines, "shader_model", &setting)) {
+			LogInfo("WARNING: [%s] missing shader_model\n", section_id->c_str());
+			return false;
+		}
+		group->shader_models = split_shader_regex_setting(&setting);
+		if (get_shader_regex_ini_setting(lines, "temps", &setting))
+			group->temp_regs = split_shader_regex_setting(&setting);
+		return true;
+	}
+
+	group_i = batch_regex_groups.find(names[0]);
+	if (group_i == batch_regex_groups.end()) {
+		LogInfo("WARNING: Missing [%S] section\n", names[0].c_str());
+		return true;
+	}
+	group = &group_i->second;
+
+	if (names.size() == 2 && !_wcsicmp(names[1].c_str(), L"Pattern")) {
+		setting = join_shader_regex_lines(lines);
+		LogDebug("[%s] final pcre2 regex pattern:\n%s\n", section_id->c_str(), setting.c_str());
+		pattern = &group->patterns[names[1]];
+		if (!pattern->compile(&setting)) {
+			LogInfo("WARNING: [%s] failed to compile\n", section_id->c_str());
+			return false;
+		}
+		if (pattern->named_group_overlaps(group->temp_regs)) {
+			LogInfo("WARNING: [%s] named capture group overlaps with temp regs!\n", section_id->c_str());
+			return false;
+		}
+		return true;
+	}
+
+	if (names.size() == 2 && !_wcsicmp(names[1].c_str(), L"InsertDeclarations")) {
+		group->declarations.insert(group->declarations.end(), lines->begin(), lines->end());
+		return true;
+	}
+
+	if (names.size() == 3 && !_wcsnicmp(names[1].c_str(), L"Pattern", 7)
+			&& !_wcsicmp(names[2].c_str(), L"Replace")) {
+		if (!group->patterns.count(names[1])) {
+			LogInfo("WARNING: Missing corresponding pattern section for [%s]\n", section_id->c_str());
+			return false;
+		}
+		pattern = &group->patterns[names[1]];
+		pattern->replace = join_shader_regex_lines(lines);
+		LogDebug("[%s] final pcre2 replace string:\n%s\n", section_id->c_str(), pattern->replace.c_str());
+		pattern->do_replace = true;
+		return true;
+	}
+
+	LogInfo("WARNING: Unrecognised section [%s]\n", section_id->c_str());
+	return false;
+}
+
+static int LoadShaderRegexIni(string const *filename)
+{
+	ShaderRegexIniSections sections;
+	ShaderRegexIniSections::iterator i;
+	ShaderRegexIniLines *lines = NULL;
+	ShaderRegexBatchGroups::iterator j;
+	wstring group_id;
+	string line, section;
+	size_t first, last, patterns = 0;
+	int rc = EXIT_SUCCESS;
+
+	ifstream f(*filename);
+	if (!f) {
+		LogInfo("Unable to open %s\n", filename->c_str());
+		return EXIT_FAILURE;
+	}
+
+	while (getline(f, line)) {
+		first = line.find_first_not_of(" \t\r");
+		last = line.find_last_not_of(" \t\r");
+		if (first == line.npos)
+			continue;
+		line = line.substr(first, last - first + 1);
+
+		if (line[0] == ';')
+			continue;
+
+		if (line[0] == '[') {
+			// Up to the first ], the same as GetPrivateProfileString:
+			last = line.find(']');
+			if (last == line.npos)
+				last = line.length();
+			first = line.find_first_not_of(" \t", 1);
+			last = line.find_last_not_of(" \t", last - 1);
+			section = first > last ? "" : line.substr(first, last - first + 1);
+
+			lines = NULL;
+			if (!_strnicmp(section.c_str(), "ShaderRegex", 11)) {
+				if (sections.count(section))
+					LogInfo("WARNING: Duplicate section found in %s: [%s]\n", filename->c_str(), section.c_str());
+				else
+					lines = &sections[section];
+			}
+			continue;
+		}
+
+		if (lines)
+			lines->push_back(line);
+	}
+
+	for (i = sections.begin(); i != sections.end(); i++) {
+		if (parse_shader_regex_section(&i->first, &i->second))
+			continue;
+
+		// Same as the DLL, we discard the whole group if any part of it
+		// fails, so that we don't apply an incomplete regex. Unlike the
+		// DLL we treat this as an error, since the whole point of this
+		// is to find problems before going in game:
+		group_id = wstring(i->first.begin(), i->first.end());
+		group_id = group_id.substr(0, group_id.find(L'.'));
+		LogInfo("WARNING: disabling entire shader regex group [%S]\n", group_id.c_str());
+		batch_regex_groups.erase(group_id);
+		rc = EXIT_FAILURE;
+	}
+
+	for (j = batch_regex_groups.begin(); j != batch_regex_groups.end(); j++) {
+		j->second.add_required_literals(&batch_regex_prefilter);
+		batch_regex_models.insert(j->second.shader_models.begin(), j->second.shader_models.end());
+		patterns += j->second.patterns.size();
+	}
+	batch_regex_prefilter.build();
+	batch_regex_stats.resize(batch_regex_groups.size());
+
+	LogInfo("Loaded %Iu ShaderRegex groups with %Iu patterns from %s (%Iu prefilter literals)\n",
+			batch_regex_groups.size(), patterns, filename->c_str(), batch_regex_prefilter.size());
+
+	return rc;
+}
+
+// Directories are expanded to the *.bin files in them, which is how shaders
+// are named when dumped with export_binary or found in the ShaderCache:
+static void ExpandShaderRegexInputs(vector<string> *files)
+{
+	WIN32_FIND_DATAA find_data;
+	vector<string> ret, dir_files;
+	HANDLE hFind;
+	DWORD attrs;
+
+	for (string &file : *files) {
+		attrs = GetFileAttributesA(file.c_str());
+		if (attrs == INVALID_FILE_ATTRIBUTES || !(attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+			ret.push_back(file);
+			continue;
+		}
+
+		dir_files.clear();
+		hFind = FindFirstFileA((file + "\\*.bin").c_str(), &find_data);
+		if (hFind != INVALID_HANDLE_VALUE) {
+			do {
+				dir_files.push_back(file + "\\" + find_data.cFileName);
+			} while (FindNextFileA(hFind, &find_data));
+			FindClose(hFind);
+		}
+		sort(dir_files.begin(), dir_files.end());
+		ret.insert(ret.end(), dir_files.begin(), dir_files.end());
+	}
+
+	files->swap(ret);
+}
+
+static int ApplyShaderRegex(string const *filename, volatile LONG *skipped, volatile LONG *patched)
+{
+	ShaderRegexBatchGroups::iterator i;
+	ShaderRegexPatternGroup *group;
+	ShaderRegexGroupStats *stats;
+	LARGE_INTEGER start, end;
+	vector<char> srcData, literals_found;
+	string asm_text, shader_model, tagline("//");
+	bool scanned = false, any_patch = false;
+	bool match, patch;
+	size_t j;
+
+	if (ReadInput(&srcData, filename))
+		return EXIT_FAILURE;
+
+	// Skip shaders no group applies to without disassembling them, the
+	// same as the DLL does:
+	shader_model = GetShaderModelFromVersionToken(srcData.data(), srcData.size());
+	if (!shader_model.empty() && !batch_regex_models.count(shader_model)) {
+		InterlockedIncrement(skipped);
+		return EXIT_SUCCESS;
+	}
+
+	// Disassembled with the same options the DLL uses for ShaderRegex:
+	asm_text = BinaryToAsmText(srcData.data(), srcData.size(), args.patch_cb_offsets);
+	if (asm_text.empty() || !get_shader_model_from_asm(&asm_text, &shader_model)) {
+		LogInfo("%s: disassembly failed\n", filename->c_str());
+		return EXIT_FAILURE;
+	}
+
+	for (i = batch_regex_groups.begin(), j = 0; i != batch_regex_groups.end(); i++, j++) {
+		group = &i->second;
+		stats = &batch_regex_stats[j];
+
+		if (!group->shader_models.count(shader_model))
+			continue;
+
+		QueryPerformanceCounter(&start);
+		group->apply_regex_patterns_prefiltered(&asm_text, &batch_regex_prefilter,
+				&literals_found, &scanned, &match, &patch);
+		QueryPerformanceCounter(&end);
+
+		InterlockedAdd64(&stats->ticks, end.QuadPart - start.QuadPart);
+		InterlockedIncrement(&stats->shaders);
+		if (!match)
+			continue;
+
+		LogInfo("%s: %s matches [%S]\n", filename->c_str(), shader_model.c_str(), group->ini_section.c_str());
+		InterlockedIncrement(&stats->matches);
+		if (patch) {
+			InterlockedIncrement(&stats->patches);
+			tagline += "[" + string(group->ini_section.begin(), group->ini_section.end()) + "]";
+			any_patch = true;
+		}
+	}
+
+	if (any_patch) {
+		InterlockedIncrement(patched);
+		// Same format as the DLL's export_fixed ShaderRegex output:
+		asm_text = tagline + "\n" + asm_text;
+		if (WriteOutput(filename, "_regex.asm", &asm_text))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+struct ShaderRegexBatch {
+	vector<string> *files;
+	volatile LONG next;
+	volatile LONG failed;
+	volatile LONG skipped;
+	volatile LONG patched;
+};
+
+static DWORD WINAPI ShaderRegexBatchThread(LPVOID param)
+{
+	ShaderRegexBatch *batch = (ShaderRegexBatch*)param;
+	int rc;
+	LONG i;
+
+	while ((i = InterlockedIncrement(&batch->next) - 1) < (LONG)batch->files->size()) {
+		if (args.stop && batch->failed)
+			break;
+
+		try {
+			rc = ApplyShaderRegex(&(*batch->files)[i], &batch->skipped, &batch->patched);
+		} catch (const exception & e) {
+			LogInfo("\n*** UNHANDLED EXCEPTION processing %s: %s\n", (*batch->files)[i].c_str(), e.what());
+			rc = EXIT_FAILURE;
+		}
+		if (rc)
+			InterlockedIncrement(&batch->failed);
+	}
+
+	return 0;
+}
+
+static bool PrintShaderRegexReport(ShaderRegexBatch *batch, DWORD num_threads, LONGLONG wall_ticks)
+{
+	vector<pair<ShaderRegexPattern*, wstring>> patterns;
+	ShaderRegexBatchGroups::iterator i;
+	ShaderRegexPatterns::iterator k;
+	ShaderRegexGroupStats *stats;
+	ShaderRegexPattern *pattern;
+	LARGE_INTEGER freq;
+	bool over_budget = false;
+	double us;
+	size_t j;
+
+	QueryPerformanceFrequency(&freq);
+
+	LogInfo("\nShaderRegex over %Iu shaders using %u threads in %.3f ms (%li skipped by shader model, %li patched, %li failed):\n",
+			batch->files->size(), num_threads, wall_ticks * 1000.0 / freq.QuadPart,
+			batch->skipped, batch->patched, batch->failed);
+	LogInfo("  %10s %8s %8s %8s  %s\n", "ms", "shaders", "matches", "patches", "group");
+	for (i = batch_regex_groups.begin(), j = 0; i != batch_regex_groups.end(); i++, j++) {
+		stats = &batch_regex_stats[j];
+		LogInfo("  %10.3f %8li %8li %8li  [%S]\n", stats->ticks * 1000.0 / freq.QuadPart,
+				stats->shaders, stats->matches, stats->patches, i->first.c_str());
+
+		for (k = i->second.patterns.begin(); k != i->second.patterns.end(); k++)
+			patterns.emplace_back(&k->second, i->first + L"." + k->first);
+	}
+
+	// The time per run is the cost of a pattern to every shader it is
+	// applied to in game, which is what a mod author needs to keep an eye
+	// on - a pattern that backtracks badly may be fine on a small test
+	// but add seconds to a game's loading times. Runs skipped by the
+	// prefilter cost next to nothing and are not counted.
+	sort(patterns.begin(), patterns.end(), [](const pair<ShaderRegexPattern*, wstring> &lhs, const pair<ShaderRegexPattern*, wstring> &rhs) {
+		return lhs.first->ticks > rhs.first->ticks;
+	});
+
+	LogInfo("\nShaderRegex pattern budget (slowest first):\n");
+	LogInfo("  %10s %10s %8s %8s  %s\n", "ms", "us/run", "runs", "matches", "pattern");
+	for (auto &p : patterns) {
+		pattern = p.first;
+		us = pattern->runs ? pattern->ticks * 1000000.0 / freq.QuadPart / pattern->runs : 0.0;
+		LogInfo("  %10.3f %10.1f %8li %8li  [%S]%s%s\n", pattern->ticks * 1000.0 / freq.QuadPart,
+				us, pattern->runs, pattern->hits, p.second.c_str(),
+				pattern->jit ? "" : " (no JIT)",
+				args.shader_regex_budget && us > args.shader_regex_budget ? " *** OVER BUDGET ***" : "");
+		if (args.shader_regex_budget && us > args.shader_regex_budget)
+			over_budget = true;
+	}
+
+	if (over_budget)
+		LogInfo("\n*** At least one pattern exceeded the budget of %.1f us per run ***\n", args.shader_regex_budget);
+
+	return over_budget;
+}
+
+// Applies the ShaderRegex groups to every input file spread over the given
+// number of threads, the same way the DLL reloads ShaderFixes.
+static int ShaderRegexBatchMain()
+{
+	ShaderRegexBatch batch = {&args.files, 0, 0, 0, 0};
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	LARGE_INTEGER start, end;
+	SYSTEM_INFO sysinfo;
+	DWORD num_threads = 0, max_threads;
+	int rc;
+
+	rc = LoadShaderRegexIni(&args.shader_regex);
+	if (rc && args.stop)
+		return rc;
+
+	ExpandShaderRegexInputs(&args.files);
+
+	if (args.jobs) {
+		max_threads = (DWORD)args.jobs;
+	} else {
+		GetSystemInfo(&sysinfo);
+		max_threads = sysinfo.dwNumberOfProcessors;
+	}
+	max_threads = min(max_threads, (DWORD)MAXIMUM_WAIT_OBJECTS);
+	max_threads = max(min(max_threads, (DWORD)args.files.size()), (DWORD)1);
+
+	QueryPerformanceCounter(&start);
+
+	// We do our share on this thread, so only need to start the others:
+	while (num_threads + 1 < max_threads) {
+		threads[num_threads] = CreateThread(NULL, 0, ShaderRegexBatchThread, &batch, 0, NULL);
+		if (!threads[num_threads])
+			break;
+		num_threads++;
+	}
+
+	ShaderRegexBatchThread(&batch);
+
+	if (num_threads) {
+		WaitForMultipleObjects(num_threads, threads, TRUE, INFINITE);
+		while (num_threads)
+			CloseHandle(threads[--num_threads]);
+	}
+
+	QueryPerformanceCounter(&end);
+
+	if (PrintShaderRegexReport(&batch, max_threads, end.QuadPart - start.QuadPart))
+		rc = EXIT_FAILURE;
+	if (batch.failed)
+		rc = EXIT_FAILURE;
+
+	if (rc)
+		LogInfo("\n*** At least one error occurred during run ***\n");
+
+	return rc;
+}
+
+// Stages of process() that are timed for the batch summary. Each file only
+// goes through the stages its options ask for.
+enum ProcessStage {
+	STAGE_READ,
+	STAGE_DISASSEMBLE,
+	STAGE_ASSEMBLE,
+	STAGE_DECOMPILE,
+	STAGE_VALIDATE,
+	STAGE_WRITE,
+	NUM_PROCESS_STAGES
+};
+
+static const char *process_stage_names[NUM_PROCESS_STAGES] = {
+	"read",
+	"disassemble",
+	"assemble",
+	"decompile",
+	"validate",
+	"write",
+};
+
+// Each thread keeps its own, and they are only added up once every thread
+// has finished. The timings are in QueryPerformanceCounter ticks.
+struct ProcessStats {
+	LONGLONG ticks[NUM_PROCESS_STAGES];
+	size_t runs[NUM_PROCESS_STAGES];
+	size_t failures[NUM_PROCESS_STAGES];
+};
+
+template <typename F>
+static int timed_stage(ProcessStats *stats, ProcessStage stage, F fn)
+{
+	LARGE_INTEGER start, end;
+	int rc;
+
+	QueryPerformanceCounter(&start);
+	rc = fn();
+	QueryPerformanceCounter(&end);
+
+	stats->ticks[stage] += end.QuadPart - start.QuadPart;
+	stats->runs[stage]++;
+	if (rc)
+		stats->failures[stage]++;
+	return rc;
+}
+
+static int process(string const *filename, DecompilerContext *context, ProcessStats *stats)
 {
-	HRESULT hret;
 	string output;
 	vector<char> srcData;
 	string model;
 
-	if (ReadInput(&srcData, filename))
+	if (timed_stage(stats, STAGE_READ, [&] {
+			return ReadInput(&srcData, filename);
+		}))
+		return EXIT_FAILURE;
+
+	if (BenchmarkFile(filename, &srcData))
 		return EXIT_FAILURE;
 
 	if (args.disassemble_ms) {
 		LogInfo("Disassembling (MS) %s...\n", filename->c_str());
-		hret = DisassembleMS(srcData.data(), srcData.size(), &output);
-		if (FAILED(hret))
+		if (timed_stage(stats, STAGE_DISASSEMBLE, [&] {
+				return FAILED(DisassembleMS(srcData.data(), srcData.size(), &output)) ? EXIT_FAILURE : EXIT_SUCCESS;
+			}))
 			return EXIT_FAILURE;
 
 		if (args.validate) {
-			if (validate_assembly(&output, &srcData))
+			if (timed_stage(stats, STAGE_VALIDATE, [&] {
+					return validate_assembly(&output, &srcData);
+				}))
 				return EXIT_FAILURE;
 		}
 
-		if (WriteOutput(filename, ".msasm", &output))
+		if (timed_stage(stats, STAGE_WRITE, [&] {
+				return WriteOutput(filename, ".msasm", &output);
+			}))
+			return EXIT_FAILURE;
+	}
+
+	if (args.disassemble_native) {
+		LogInfo("Disassembling (native) %s...\n", filename->c_str());
+		if (timed_stage(stats, STAGE_DISASSEMBLE, [&] {
+				return FAILED(DisassembleNative(srcData.data(), srcData.size(), &output)) ? EXIT_FAILURE : EXIT_SUCCESS;
+			}))
+			return EXIT_FAILURE;
+
+		if (args.validate) {
+			if (timed_stage(stats, STAGE_VALIDATE, [&] {
+					return validate_assembly(&output, &srcData);
+				}))
+				return EXIT_FAILURE;
+		}
+
+		if (timed_stage(stats, STAGE_WRITE, [&] {
+				return WriteOutput(filename, ".nasm", &output);
+			}))
 			return EXIT_FAILURE;
 	}
 
 	if (args.disassemble_flugan || args.disassemble_hexdump || args.disassemble_46) {
 		LogInfo("Disassembling (Flugan) %s...\n", filename->c_str());
-		hret = DisassembleFlugan(srcData.data(), srcData.size(), &output, args.disassemble_hexdump, args.disassemble_46);
-		if (FAILED(hret))
+		if (timed_stage(stats, STAGE_DISASSEMBLE, [&] {
+				return FAILED(DisassembleFlugan(srcData.data(), srcData.size(), &output,
+						args.disassemble_hexdump, args.disassemble_46)) ? EXIT_FAILURE : EXIT_SUCCESS;
+			}))
 			return EXIT_FAILURE;
 
 		if (args.validate) {
-			if (validate_assembly(&output, &srcData))
+			if (timed_stage(stats, STAGE_VALIDATE, [&] {
+					return validate_assembly(&output, &srcData);
+				}))
 				return EXIT_FAILURE;
 			// TODO: Validate signature parsing instead of binary identical files
 		}
 
-		if (WriteOutput(filename, ".asm", &output))
+		if (timed_stage(stats, STAGE_WRITE, [&] {
+				return WriteOutput(filename, ".asm", &output);
+			}))
 			return EXIT_FAILURE;
 
 	}
 
 	if (args.assemble) {
 		LogInfo("Assembling %s...\n", filename->c_str());
-		vector<byte> new_bytecode;
-		if (args.reflection_reference.empty()) {
-			hret = AssembleFluganWithSignatureParsing(&srcData, &new_bytecode);
-			if (FAILED(hret))
-				return EXIT_FAILURE;
-		} else {
-			vector<byte> refData;
-			if (ReadInput(&refData, &args.reflection_reference))
-				return EXIT_FAILURE;
-			new_bytecode = AssembleFluganWithOptionalSignatureParsing(&srcData, false, &refData);
-		}
+		if (timed_stage(stats, STAGE_ASSEMBLE, [&] {
+				vector<byte> new_bytecode;
+				if (args.reflection_reference.empty()) {
+					if (FAILED(AssembleFluganWithSignatureParsing(&srcData, &new_bytecode)))
+						return EXIT_FAILURE;
+				} else {
+					vector<byte> refData;
+					if (ReadInput(&refData, &args.reflection_reference))
+						return EXIT_FAILURE;
+					new_bytecode = AssembleFluganWithOptionalSignatureParsing(&srcData, false, &refData);
+				}
+				output = string(new_bytecode.begin(), new_bytecode.end());
+				return EXIT_SUCCESS;
+			}))
+			return EXIT_FAILURE;
 
 		// TODO:
 		// if (args.validate)
 		// disassemble again and perform fuzzy compare
 
-		output = string(new_bytecode.begin(), new_bytecode.end());
-		if (WriteOutput(filename, ".shdr", &output))
+		if (timed_stage(stats, STAGE_WRITE, [&] {
+				return WriteOutput(filename, ".shdr", &output);
+			}))
 			return EXIT_FAILURE;
 
 	}
 
 	if (args.decompile) {
 		LogInfo("Decompiling %s...\n", filename->c_str());
-		hret = Decompile(srcData.data(), srcData.size(), &output, &model);
-		if (FAILED(hret))
+		if (timed_stage(stats, STAGE_DECOMPILE, [&] {
+				return FAILED(Decompile(srcData.data(), srcData.size(), &output, &model, context)) ? EXIT_FAILURE : EXIT_SUCCESS;
+			}))
 			return EXIT_FAILURE;
 
 		if (args.validate) {
-			if (validate_hlsl(&output, &model))
+			if (timed_stage(stats, STAGE_VALIDATE, [&] {
+					return validate_hlsl(&output, &model);
+				}))
 				return EXIT_FAILURE;
 		}
 
-		if (WriteOutput(filename, ".hlsl", &output))
+		if (timed_stage(stats, STAGE_WRITE, [&] {
+				return WriteOutput(filename, ".hlsl", &output);
+			}))
 			return EXIT_FAILURE;
 
 	}
@@ -611,19 +1398,321 @@ static int process(string const *filename)
 	return EXIT_SUCCESS;
 }
 
+static int process_catching_exceptions(string const *filename, DecompilerContext *context, ProcessStats *stats)
+{
+	try {
+		return process(filename, context, stats);
+	} catch (const exception & e) {
+		LogInfo("\n*** UNHANDLED EXCEPTION processing %s: %s\n", filename->c_str(), e.what());
+		return EXIT_FAILURE;
+	}
+}
+
+// Result of one file in a parallel batch. done is only set once the rest
+// has been filled in, so the main thread can print the results in order
+// as soon as each one is available.
+struct ProcessBatchResult {
+	int rc;
+	LONGLONG ticks;
+	volatile LONG done;
+};
+
+struct ProcessBatch {
+	vector<ProcessBatchResult> results;
+	volatile LONG next;
+	volatile LONG failed;
+};
+
+// Everything a worker thread touches while it runs is its own, apart from
+// taking the next file off the batch and filling in that file's result:
+struct ProcessWorker {
+	ProcessBatch *batch;
+	ProcessStats stats;
+};
+
+static DWORD WINAPI ProcessBatchThread(LPVOID param)
+{
+	ProcessWorker *worker = (ProcessWorker*)param;
+	ProcessBatch *batch = worker->batch;
+	ProcessBatchResult *result;
+	DecompilerContext context;
+	LARGE_INTEGER start, end;
+	LONG i;
+
+	// Idle threads take whichever file is next, so a few slow shaders
+	// don't hold up the files queued behind them on another thread:
+	while ((i = InterlockedIncrement(&batch->next) - 1) < (LONG)args.files.size()) {
+		if (args.stop && batch->failed)
+			break;
+
+		result = &batch->results[i];
+		QueryPerformanceCounter(&start);
+		result->rc = process_catching_exceptions(&args.files[i], &context, &worker->stats);
+		QueryPerformanceCounter(&end);
+		result->ticks = end.QuadPart - start.QuadPart;
+		if (result->rc)
+			InterlockedIncrement(&batch->failed);
+		InterlockedExchange(&result->done, 1);
+	}
+
+	return 0;
+}
+
+static void PrintProcessStats(ProcessStats *stats)
+{
+	LARGE_INTEGER freq;
+	int i;
+
+	QueryPerformanceFrequency(&freq);
+
+	LogInfo("\nPer stage totals over all threads:\n");
+	LogInfo("  %-12s %10s %8s %8s\n", "stage", "ms", "files", "failed");
+	for (i = 0; i < NUM_PROCESS_STAGES; i++) {
+		if (!stats->runs[i])
+			continue;
+		LogInfo("  %-12s %10.3f %8Iu %8Iu\n", process_stage_names[i],
+				stats->ticks[i] * 1000.0 / freq.QuadPart,
+				stats->runs[i], stats->failures[i]);
+	}
+}
+
+// Processes the input files over several threads. The log from each file
+// would be interleaved with the others, so logging is turned off while the
+// threads run and one line per file is printed in input order instead. Any
+// files that failed are then processed again on this thread with logging,
+// so their errors come out complete and in a consistent order.
+static int ProcessBatchMain()
+{
+	ProcessBatch batch;
+	ProcessWorker workers[MAXIMUM_WAIT_OBJECTS];
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	ProcessStats total_stats = {};
+	ProcessStats retry_stats = {};
+	DecompilerContext context;
+	LARGE_INTEGER freq, start, end;
+	FILE *log = LogFile;
+	DWORD num_threads = 0, max_threads, wait = WAIT_TIMEOUT;
+	size_t processed = 0, i;
+	int j, rc = EXIT_SUCCESS;
+
+	batch.results.resize(args.files.size());
+	batch.next = 0;
+	batch.failed = 0;
+
+	max_threads = min((DWORD)args.jobs, (DWORD)MAXIMUM_WAIT_OBJECTS);
+	max_threads = max(min(max_threads, (DWORD)args.files.size()), (DWORD)1);
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+
+	LogFile = NULL;
+	while (num_threads < max_threads) {
+		workers[num_threads].batch = &batch;
+		workers[num_threads].stats = ProcessStats();
+		threads[num_threads] = CreateThread(NULL, 0, ProcessBatchThread, &workers[num_threads], 0, NULL);
+		if (!threads[num_threads])
+			break;
+		num_threads++;
+	}
+	if (!num_threads) {
+		LogFile = log;
+		LogInfo("Unable to start any worker threads\n");
+		return EXIT_FAILURE;
+	}
+
+	// Print each result as soon as it and everything before it is done.
+	// Once the threads have all finished, anything still not done was
+	// skipped after a failure with --stop:
+	for (i = 0; i < batch.results.size(); i++) {
+		while (!batch.results[i].done && wait == WAIT_TIMEOUT)
+			wait = WaitForMultipleObjects(num_threads, threads, TRUE, 100);
+		if (!batch.results[i].done)
+			continue;
+
+		fprintf(log, "%s %10.3f ms  %s\n", batch.results[i].rc ? "FAILED" : "    ok",
+				batch.results[i].ticks * 1000.0 / freq.QuadPart,
+				args.files[i].c_str());
+		processed++;
+	}
+	if (wait == WAIT_TIMEOUT)
+		WaitForMultipleObjects(num_threads, threads, TRUE, INFINITE);
+
+	QueryPerformanceCounter(&end);
+	LogFile = log;
+
+	for (i = 0; i < num_threads; i++) {
+		CloseHandle(threads[i]);
+		for (j = 0; j < NUM_PROCESS_STAGES; j++) {
+			total_stats.ticks[j] += workers[i].stats.ticks[j];
+			total_stats.runs[j] += workers[i].stats.runs[j];
+			total_stats.failures[j] += workers[i].stats.failures[j];
+		}
+	}
+
+	if (batch.failed) {
+		rc = EXIT_FAILURE;
+		LogInfo("\nProcessing the %li files that failed again for their errors:\n", batch.failed);
+		for (i = 0; i < batch.results.size(); i++) {
+			if (batch.results[i].done && batch.results[i].rc)
+				process_catching_exceptions(&args.files[i], &context, &retry_stats);
+		}
+	}
+
+	LogInfo("\nProcessed %Iu of %Iu files using %u threads in %.3f ms (%li failed)\n",
+			processed, args.files.size(), num_threads,
+			(end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart, batch.failed);
+	PrintProcessStats(&total_stats);
+
+	if (rc)
+		LogInfo("\n*** At least one error occurred during run ***\n");
+
+	return rc;
+}
+
+static uint32_t ServerHandleRequest(DecompilerServerRequest *request, vector<char> *input,
+		DecompilerContext *context, string *output)
+{
+	vector<byte> bytecode;
+	string model;
+
+	switch (request->operation) {
+	case DECOMPILER_SERVER_DECOMPILE:
+		if (FAILED(Decompile(input->data(), input->size(), output, &model, context))) {
+			*output = "Decompilation failed";
+			return DECOMPILER_SERVER_FAILED;
+		}
+		if (request->flags & DECOMPILER_SERVER_VALIDATE && validate_hlsl(output, &model)) {
+			*output = "Decompiled HLSL failed validation";
+			return DECOMPILER_SERVER_FAILED;
+		}
+		return DECOMPILER_SERVER_OK;
+
+	case DECOMPILER_SERVER_DISASSEMBLE_MS:
+	case DECOMPILER_SERVER_DISASSEMBLE_FLUGAN:
+	case DECOMPILER_SERVER_DISASSEMBLE_NATIVE:
+		if (request->operation == DECOMPILER_SERVER_DISASSEMBLE_MS) {
+			if (FAILED(DisassembleMS(input->data(), input->size(), output)))
+				output->clear();
+		} else if (request->operation == DECOMPILER_SERVER_DISASSEMBLE_NATIVE) {
+			if (FAILED(DisassembleNative(input->data(), input->size(), output)))
+				output->clear();
+		} else {
+			if (FAILED(DisassembleFlugan(input->data(), input->size(), output, 0,
+					!!(request->flags & DECOMPILER_SERVER_DISASSEMBLE_46))))
+				output->clear();
+		}
+		if (output->empty()) {
+			*output = "Disassembly failed";
+			return DECOMPILER_SERVER_FAILED;
+		}
+		if (request->flags & DECOMPILER_SERVER_VALIDATE && validate_assembly(output, input)) {
+			*output = "Disassembly failed validation";
+			return DECOMPILER_SERVER_FAILED;
+		}
+		return DECOMPILER_SERVER_OK;
+
+	case DECOMPILER_SERVER_ASSEMBLE:
+		if (FAILED(AssembleFluganWithSignatureParsing(input, &bytecode))) {
+			*output = "Assembly failed";
+			return DECOMPILER_SERVER_FAILED;
+		}
+		*output = string(bytecode.begin(), bytecode.end());
+		return DECOMPILER_SERVER_OK;
+	}
+
+	*output = "Unknown operation";
+	return DECOMPILER_SERVER_BAD_REQUEST;
+}
+
+// Serves requests from stdin until it is closed. Responses get their own
+// copy of stdout, and stdout itself is pointed at stderr, so that anything
+// that prints to stdout (like the assembler's warnings) ends up in the log
+// rather than in the middle of a response.
+static int ServerMain()
+{
+	DecompilerServerRequest request;
+	DecompilerServerResponse response;
+	DecompilerContext context;
+	vector<char> input;
+	string output;
+	FILE *responses;
+	int fd;
+
+	fflush(stdout);
+	fd = _dup(_fileno(stdout));
+	if (fd == -1 || _dup2(_fileno(stderr), _fileno(stdout)))
+		return EXIT_FAILURE;
+	responses = _fdopen(fd, "wb");
+	if (!responses)
+		return EXIT_FAILURE;
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(fd, _O_BINARY);
+
+	while (fread(&request, sizeof(request), 1, stdin) == 1) {
+		if (request.magic != DECOMPILER_SERVER_MAGIC) {
+			LogInfo("Bad request, exiting\n");
+			return EXIT_FAILURE;
+		}
+		if (request.size > DECOMPILER_SERVER_MAX_SIZE) {
+			LogInfo("Request of %u bytes is too large, exiting\n", request.size);
+			return EXIT_FAILURE;
+		}
+
+		input.resize(request.size);
+		if (request.size && fread(input.data(), 1, request.size, stdin) != request.size) {
+			LogInfo("Truncated request, exiting\n");
+			return EXIT_FAILURE;
+		}
+
+		try {
+			response.status = ServerHandleRequest(&request, &input, &context, &output);
+		} catch (const exception & e) {
+			response.status = DECOMPILER_SERVER_FAILED;
+			output = string("Unhandled exception: ") + e.what();
+		}
+
+		response.magic = DECOMPILER_SERVER_MAGIC;
+		response.size = (uint32_t)output.size();
+		if (fwrite(&response, sizeof(response), 1, responses) != 1
+				|| fwrite(output.data(), 1, output.size(), responses) != output.size()
+				|| fflush(responses))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
 
 //-----------------------------------------------------------------------------
 // Console App Entry-Point.
 //-----------------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
+	DecompilerContext context;
+	ProcessStats stats = {};
 	int rc = EXIT_SUCCESS;
 
 	parse_args(argc, argv);
 
+	if (!args.shader_regex.empty())
+		return ShaderRegexBatchMain();
+
+	if (args.server)
+		return ServerMain();
+
+	if (args.benchmark_server)
+		return BenchmarkServer();
+
+	if (StartBenchmarks())
+		return EXIT_FAILURE;
+
+	// The benchmarks keep their totals in globals, and would only be
+	// measuring each other if they ran at the same time:
+	if (args.jobs > 1 && !benchmarking())
+		return ProcessBatchMain();
+
 	for (string const &filename : args.files) {
 		try {
-			rc = process(&filename) || rc;
+			rc = process(&filename, &context, &stats) || rc;
 		} catch (const exception & e) {
 			LogInfo("\n*** UNHANDLED EXCEPTION: %s\n", e.what());
 			rc = EXIT_FAILURE;
@@ -633,6 +1722,9 @@ int main(int argc, char *argv[])
 			return rc;
 	}
 
+	if (FinishBenchmarks())
+		rc = EXIT_FAILURE;
+
 	if (rc)
 		LogInfo("\n*** At least one error occurred during run ***\n");
 
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <windows.h>
+#include <vector>
+#include <string>
+#include <mutex>
+
+#include "DecompileHLSL.h"
+#include "log.h"
+
+// Shared between the command line front end in cmd_Decompiler.cpp and the
+// benchmarks in Benchmark.cpp, which drive the same dis/assemblers and
+// decompiler that the normal options do.
+
+struct CmdDecompilerArgs {
+	std::vector<std::string> files;
+	bool decompile;
+	bool compile;
+	bool disassemble_ms;
+	bool disassemble_flugan;
+	bool disassemble_native;
+	int disassemble_hexdump;
+	bool disassemble_46;
+	bool patch_cb_offsets;
+	std::string reflection_reference;
+	bool assemble;
+	bool force;
+	bool validate;
+	bool lenient;
+	bool stop;
+	bool benchmark_hash;
+	bool benchmark_checksum;
+	std::string benchmark_regex;
+	bool benchmark_assembler;
+	bool benchmark_decompiler;
+	bool benchmark_server;
+	std::string benchmark_corpus;
+	std::string corpus_baseline;
+	bool corpus_native;
+	double corpus_time_threshold = 20.0;
+	double corpus_alloc_threshold = 5.0;
+	int benchmark_iterations = 100;
+	bool server;
+	std::string shader_regex;
+	double shader_regex_budget;
+	int jobs;
+};
+
+extern CmdDecompilerArgs args;
+
+extern std::mutex dx9_decoder_lock;
+
+HRESULT DisassembleMS(const void *pShaderBytecode, size_t BytecodeLength, std::string *asmText);
+HRESULT DisassembleFlugan(const void *pShaderBytecode, size_t BytecodeLength, std::string *asmText,
+		int hexdump, bool d3dcompiler_46_compat);
+HRESULT DisassembleNative(const void *pShaderBytecode, size_t BytecodeLength, std::string *asmText);
+int validate_assembly(std::string *assembly, std::vector<char> *old_shader);
+HRESULT DecompileDisassembly(const void *pShaderBytecode, std::string const *disassembly,
+		DecompilerContext *context, std::string *hlslText, std::string *shaderModel);
+
+template<typename T>
+int ReadInput(std::vector<T> *srcData, std::string const *filename)
+{
+	DWORD srcDataSize;
+	DWORD readSize;
+	BOOL bret;
+	HANDLE fp;
+
+	// TODO: Handle reading from stdin for use in a pipeline
+
+	fp = CreateFileA(filename->c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fp == INVALID_HANDLE_VALUE) {
+		LogInfo("    Shader not found: %s\n", filename->c_str());
+		return EXIT_FAILURE;
+	}
+
+	srcDataSize = GetFileSize(fp, 0);
+	srcData->resize(srcDataSize);
+
+	bret = ReadFile(fp, srcData->data(), srcDataSize, &readSize, 0);
+	CloseHandle(fp);
+	if (!bret || srcDataSize != readSize) {
+		LogInfo("    Error reading input file\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
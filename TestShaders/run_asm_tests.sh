@@ -167,4 +167,46 @@ run_bin_asm_test BinaryDecompiler/vs5/rcp.o
 run_bin_asm_test BinaryDecompiler/vs5/sincos.o
 run_bin_asm_test BinaryDecompiler/vs5/tempArray.o
 
+# The native disassembler (no d3dcompiler) should round trip the same shaders:
+run_bin_native_asm_test BinaryDecompiler/apps/shaders/ExtrudeGS.o
+run_bin_native_asm_test BinaryDecompiler/apps/shaders/tessellationDS.o
+run_bin_native_asm_test BinaryDecompiler/apps/shaders/tessellationHS.o
+run_bin_native_asm_test BinaryDecompiler/cs5/BasicCompute11StructuredBufferDouble.o
+run_bin_native_asm_test BinaryDecompiler/cs5/ThreadGroupSharedMem.o
+run_bin_native_asm_test BinaryDecompiler/gs5/stream.o
+run_bin_native_asm_test BinaryDecompiler/hs5/two_fork_phases.o
+run_bin_native_asm_test BinaryDecompiler/ps4/HDAO.o
+run_bin_native_asm_test BinaryDecompiler/ps5/atomic_mem.o
+run_bin_native_asm_test BinaryDecompiler/ps5/conservative_depth_ge.o
+run_bin_native_asm_test BinaryDecompiler/ps5/coverage.o
+run_bin_native_asm_test BinaryDecompiler/ps5/gather.o
+run_bin_native_asm_test BinaryDecompiler/ps5/precision.o
+run_bin_native_asm_test BinaryDecompiler/vs4/switch.o
+run_bin_native_asm_test BinaryDecompiler/vs5/tempArray.o
+
+# ... and its output should be identical to Flugan's disassembler, including
+# the RDEF block. The assembler doesn't support class linkage, so the shaders
+# using interfaces are only compared here:
+run_bin_native_diff_test BinaryDecompiler/apps/shaders/ExtrudeGS.o
+run_bin_native_diff_test BinaryDecompiler/apps/shaders/tessellationDS.o
+run_bin_native_diff_test BinaryDecompiler/apps/shaders/tessellationHS.o
+run_bin_native_diff_test BinaryDecompiler/cs5/BasicCompute11StructuredBufferDouble.o
+run_bin_native_diff_test BinaryDecompiler/cs5/ThreadGroupSharedMem.o
+run_bin_native_diff_test BinaryDecompiler/gs5/stream.o
+run_bin_native_diff_test BinaryDecompiler/hs5/two_fork_phases.o
+run_bin_native_diff_test BinaryDecompiler/ps4/HDAO.o
+run_bin_native_diff_test BinaryDecompiler/ps5/atomic_mem.o
+run_bin_native_diff_test BinaryDecompiler/ps5/conservative_depth_ge.o
+run_bin_native_diff_test BinaryDecompiler/ps5/coverage.o
+run_bin_native_diff_test BinaryDecompiler/ps5/gather.o
+run_bin_native_diff_test BinaryDecompiler/ps5/interfaces.o
+run_bin_native_diff_test BinaryDecompiler/ps5/interfaces_multifunc.o
+run_bin_native_diff_test BinaryDecompiler/ps5/interface_arrays.o
+run_bin_native_diff_test BinaryDecompiler/ps5/precision.o
+run_bin_native_diff_test BinaryDecompiler/vs4/struct_const.o
+run_bin_native_diff_test BinaryDecompiler/vs4/switch.o
+run_bin_native_diff_test BinaryDecompiler/vs5/tempArray.o
+
+run_checksum_test
+
 [ $TESTS_FAILED = 0 ]
@@ -0,0 +1,241 @@
+#!/bin/bash
+# Performance benchmarks over the binary shaders in the test corpus. These are
+# not pass/fail tests in the usual sense - they only fail if cmd_Decompiler
+# itself fails - the point is to have a consistent set of inputs to compare
+# numbers between builds.
+
+# Only needs cmd_Decompiler - the round trip uses Flugan's [dis]assembler:
+NO_FXC=1
+. ./test_framework.sh
+
+ITERATIONS=100
+TIME_THRESHOLD=20
+ALLOC_THRESHOLD=5
+run_all=1
+
+for arg in "$@"; do
+	case "$arg" in
+		"--hash")
+			run_hash=1
+			run_all=0
+			;;
+		"--checksum")
+			run_checksum=1
+			run_all=0
+			;;
+		"--regex")
+			run_regex=1
+			run_all=0
+			;;
+		"--shader-regex")
+			run_shader_regex=1
+			run_all=0
+			;;
+		"--assembler")
+			run_assembler=1
+			run_all=0
+			;;
+		"--decompiler")
+			run_decompiler=1
+			run_all=0
+			;;
+		"--batch")
+			run_batch=1
+			run_all=0
+			;;
+		"--server")
+			run_server=1
+			run_all=0
+			;;
+		"--corpus")
+			run_corpus=1
+			run_all=0
+			;;
+		"--update-baseline")
+			update_baseline=1
+			;;
+		"--update-reference")
+			update_reference=1
+			;;
+		--time-threshold=*)
+			TIME_THRESHOLD="${arg#--time-threshold=}"
+			;;
+		--alloc-threshold=*)
+			ALLOC_THRESHOLD="${arg#--alloc-threshold=}"
+			;;
+		--iterations=*)
+			ITERATIONS="${arg#--iterations=}"
+			;;
+		*)
+			echo Invalid argument: "$arg"
+			exit 1
+			;;
+	esac
+done
+
+BENCHMARK_OUTPUT_DIR=output/benchmark
+mkdir -p "$BENCHMARK_OUTPUT_DIR"
+
+# Both the HLSLCrossCompiler test binaries and the game shaders that we have
+# the original binaries for. Use relative paths since cmd_Decompiler is a
+# native Windows application and won't understand cygwin paths:
+BENCHMARK_SHADERS=()
+while IFS= read -r -d '' shader; do
+	BENCHMARK_SHADERS+=("$shader")
+done < <(find BinaryDecompiler GameExamples \( -name '*.o' -o -name '*.bin' \) -print0 | sort -z)
+
+run_benchmark()
+{
+	local name="$1"
+	shift
+	local log="$BENCHMARK_OUTPUT_DIR/$name.log"
+
+	echo -n "....: $name (${#BENCHMARK_SHADERS[@]} shaders)..."
+	"$CMD_DECOMPILER" "$@" --benchmark-iterations "$ITERATIONS" "${BENCHMARK_SHADERS[@]}" </dev/null > "$log" 2>&1
+	local fail=$?
+	pass_fail $fail
+	# Print the summary that follows the per-shader output:
+	sed -n '/^$/,$p' "$log"
+}
+
+# Decompiles the shaders on one thread and then on several, and compares
+# the HLSL. Works on copies, since the output is written next to each input.
+# Some of the corpus doesn't decompile cleanly, so only the HLSL decides
+# whether this passes:
+run_batch_benchmark()
+{
+	local dir="$BENCHMARK_OUTPUT_DIR/batch"
+	local shader
+	local jobs
+
+	echo -n "....: batch (${#BENCHMARK_SHADERS[@]} shaders, -j 1 vs -j 4)..."
+	rm -fr "$dir"
+	for jobs in 1 4; do
+		for shader in "${BENCHMARK_SHADERS[@]}"; do
+			mkdir -p "$dir/j$jobs/$(dirname "$shader")"
+			cp "$shader" "$dir/j$jobs/$shader"
+		done
+		(cd "$dir/j$jobs" && "$CMD_DECOMPILER" -D -j $jobs "${BENCHMARK_SHADERS[@]}" </dev/null > ../j$jobs.log 2>&1)
+	done
+	diff -r "$dir/j1" "$dir/j4" > "$dir/diff.log" 2>&1
+	pass_fail $?
+	# Print the summary that follows the per-shader output:
+	sed -n '/^Processed/,$p' "$dir/j4.log"
+}
+
+# Decompiles every shader and compares the time, peak heap and HLSL of each
+# against the baseline from an earlier run. This skips validating the HLSL,
+# and falls back to the native disassembler without d3dcompiler, so it
+# doesn't need d3dcompiler or fxc - on Linux point CMD_DECOMPILER at a script
+# that runs cmd_Decompiler.exe under Wine. The times depend on the machine,
+# so keep a baseline per machine: run with --update-baseline once on a known
+# good build, then without it to check for regressions.
+#
+# Before that, if there is a decompiler_reference.tsv the status and HLSL of
+# each shader are checked against it. It always uses the native disassembler
+# so it gives the same answer on any machine with the same build. None is
+# committed yet - it has to come from the real MSVC build of cmd_Decompiler.
+# Run with --update-reference to create it, or after a change that is meant
+# to alter the HLSL.
+CORPUS_BASELINE="${CORPUS_BASELINE:-decompiler_baseline.tsv}"
+CORPUS_REFERENCE=decompiler_reference.tsv
+run_corpus_benchmark()
+{
+	local results="$BENCHMARK_OUTPUT_DIR/corpus.tsv"
+	local log="$BENCHMARK_OUTPUT_DIR/corpus.log"
+	local reference_results="$BENCHMARK_OUTPUT_DIR/corpus_reference.tsv"
+	local reference_log="$BENCHMARK_OUTPUT_DIR/corpus_reference.log"
+	local baseline=()
+	local reference=()
+
+	if [ "$update_reference" = 1 ]; then
+		echo -n "....: corpus reference (${#BENCHMARK_SHADERS[@]} shaders)..."
+		"$CMD_DECOMPILER" --benchmark-corpus "$reference_results" --corpus-native --benchmark-iterations 1 "${BENCHMARK_SHADERS[@]}" </dev/null > "$reference_log" 2>&1
+		pass_fail $?
+		(
+			echo "# Reference results for run_benchmarks.sh --corpus, using the native disassembler"
+			echo "# (--corpus-native) so they can be checked on any machine. Times and heap sizes"
+			echo "# depend on the machine, so they are left out. Regenerate with --update-reference"
+			awk -F '\t' 'BEGIN {OFS = "\t"} !/^#/ {$5 = $6 = $7 = "-"} {print}' "$reference_results"
+		) > "$CORPUS_REFERENCE.tmp" && mv "$CORPUS_REFERENCE.tmp" "$CORPUS_REFERENCE" && echo "Updated $CORPUS_REFERENCE"
+	elif [ -f "$CORPUS_REFERENCE" ]; then
+		reference=(--baseline "$CORPUS_REFERENCE")
+		echo -n "....: corpus reference (${#BENCHMARK_SHADERS[@]} shaders)..."
+		"$CMD_DECOMPILER" --benchmark-corpus "$reference_results" --corpus-native "${reference[@]}" --benchmark-iterations 1 "${BENCHMARK_SHADERS[@]}" </dev/null > "$reference_log" 2>&1
+		pass_fail $?
+		sed -n '/^Comparing against baseline/,$p' "$reference_log"
+	else
+		echo "No $CORPUS_REFERENCE to check the HLSL against, skipping the reference check"
+	fi
+
+	if [ "$update_baseline" != 1 -a -f "$CORPUS_BASELINE" ]; then
+		baseline=(--baseline "$CORPUS_BASELINE" --time-threshold "$TIME_THRESHOLD" --alloc-threshold "$ALLOC_THRESHOLD")
+	fi
+
+	echo -n "....: corpus (${#BENCHMARK_SHADERS[@]} shaders)..."
+	"$CMD_DECOMPILER" --benchmark-corpus "$results" "${baseline[@]}" --benchmark-iterations "$ITERATIONS" "${BENCHMARK_SHADERS[@]}" </dev/null > "$log" 2>&1
+	pass_fail $?
+
+	if [ ${#baseline[@]} = 0 ]; then
+		if [ "$update_baseline" = 1 ]; then
+			cp "$results" "$CORPUS_BASELINE" && echo "Updated $CORPUS_BASELINE"
+		else
+			echo "No $CORPUS_BASELINE to compare against, run with --update-baseline to create it"
+		fi
+	else
+		sed -n '/^Comparing against baseline/,$p' "$log"
+	fi
+}
+
+if [ "$run_all" = 1 -o "$run_hash" = 1 ]; then
+	run_benchmark hash --benchmark-hash
+fi
+
+if [ "$run_all" = 1 -o "$run_checksum" = 1 ]; then
+	# The DXBC checksum hashing each shader on its own vs all in one batch:
+	run_benchmark checksum --benchmark-checksum
+fi
+
+if [ "$run_all" = 1 -o "$run_regex" = 1 ]; then
+	# Fails if the literal prefilter ever skips a pattern that would match:
+	run_benchmark regex --benchmark-regex benchmark_regex_patterns.txt
+fi
+
+if [ "$run_all" = 1 -o "$run_shader_regex" = 1 ]; then
+	# Applies a d3dx.ini's ShaderRegex sections through the same code as
+	# the DLL, and reports the time taken by each group and pattern:
+	run_benchmark shader_regex --shader-regex shader_regex_benchmark.ini
+fi
+
+if [ "$run_all" = 1 -o "$run_assembler" = 1 ]; then
+	# Round trips each shader through the disassembler and assembler, and
+	# fails if the result or its checksum differs from the original. Also
+	# times a small ShaderRegex style patch to each shader assembled in full
+	# vs incrementally, and fails if the two results differ.
+	# Lenient, since the assembler doesn't recreate every section and the
+	# older corpus shaders have SHDR where it emits SHEX:
+	run_benchmark assembler --benchmark-assembler --lenient
+fi
+
+if [ "$run_all" = 1 -o "$run_decompiler" = 1 ]; then
+	# Decompiles each shader with a new decompiler every time vs reusing one
+	# context, reports the heap allocations of each, and fails if reusing
+	# the context changes the HLSL:
+	run_benchmark decompiler --benchmark-decompiler
+fi
+
+if [ "$run_all" = 1 -o "$run_batch" = 1 ]; then
+	run_batch_benchmark
+fi
+
+if [ "$run_all" = 1 -o "$run_server" = 1 ]; then
+	# Sends every shader to one cmd_Decompiler --server vs starting a server
+	# per shader, and fails if the two ever give different HLSL:
+	run_benchmark server --benchmark-server
+fi
+
+if [ "$run_all" = 1 -o "$run_corpus" = 1 ]; then
+	run_corpus_benchmark
+fi
+
+[ $TESTS_FAILED = 0 ]
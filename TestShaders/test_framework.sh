@@ -17,7 +17,14 @@ if [ -z "$CMD_DECOMPILER" ]; then
 	CMD_DECOMPILER=cmd_Decompiler.exe
 fi
 
-if [ ! -x "$FXC" -o ! -x "$CMD_DECOMPILER" ]; then
+# Scripts that only exercise cmd_Decompiler can set NO_FXC=1 before sourcing
+# this, so they can be run without the Windows SDK (e.g. from WSL):
+if [ "$NO_FXC" = 1 ]; then
+	if [ ! -x "$CMD_DECOMPILER" ]; then
+		echo Please set CMD_DECOMPILER environment variable
+		exit 1
+	fi
+elif [ ! -x "$FXC" -o ! -x "$CMD_DECOMPILER" ]; then
 	echo Please set FXC and CMD_DECOMPILER environment variables
 	exit 1
 fi
@@ -194,6 +201,88 @@ run_bin_asm_test()
 	cd "$test_dir"
 }
 
+run_native_assembler_test()
+{
+	local compiled="$1"
+	local dst="$(echo "$compiled" | sed -r 's/\.[^.]+$//')"
+	local disassembled="${dst}.nasm"
+	local asemble_log="${dst}_nasm.log"
+
+	rm "$disassembled" "$asemble_log" 2>/dev/null
+	"$CMD_DECOMPILER" --disassemble-native -V $LENIENT "$compiled" </dev/null > "$asemble_log" 2>&1 # produces "$disassembled"
+	pass_fail $?
+}
+
+run_bin_native_asm_test()
+{
+	local src="$1"
+	dn=$(dirname "$src")
+
+	echo -n "....: ${src} (native)..."
+
+	mkdir -p "$ASM_OUTPUT_DIR/$dn"
+	cp "$src" "$ASM_OUTPUT_DIR/$src"
+
+	local test_dir="$PWD"
+	cd "$ASM_OUTPUT_DIR"
+		run_native_assembler_test "$1"
+	cd "$test_dir"
+}
+
+# Checks the native disassembler produces the same text as Flugan's wrapper
+# around Microsoft's disassembler. The "using 3Dmigoto" comment has the time
+# in it, and Microsoft's disassembler credits itself for stripped shaders, so
+# those lines are normalised first:
+run_native_diff_test()
+{
+	local compiled="$1"
+	local dst="$(echo "$compiled" | sed -r 's/\.[^.]+$//')"
+	local diff_log="${dst}_ndiff.log"
+	local fail=0
+
+	rm "${dst}.asm" "${dst}.nasm" "$diff_log" 2>/dev/null
+	"$CMD_DECOMPILER" -d --disassemble-native "$compiled" </dev/null > "$diff_log" 2>&1 || fail=1
+	if [ $fail = 0 ]; then
+		sed '/^\/\/   using 3Dmigoto/d' "${dst}.asm" > "${dst}.asm.cmp"
+		sed -e '/^\/\/   using 3Dmigoto/d' \
+		    -e "s/^\/\/ Generated by 3Dmigoto's native disassembler$/\/\/ Generated by Microsoft (R) D3D Shader Disassembler/" \
+		    "${dst}.nasm" > "${dst}.nasm.cmp"
+		diff -u "${dst}.asm.cmp" "${dst}.nasm.cmp" >> "$diff_log" || fail=1
+	fi
+	pass_fail $fail
+}
+
+run_bin_native_diff_test()
+{
+	local src="$1"
+	dn=$(dirname "$src")
+
+	echo -n "....: ${src} (native vs ms)..."
+
+	mkdir -p "$ASM_OUTPUT_DIR/$dn"
+	cp "$src" "$ASM_OUTPUT_DIR/$src"
+
+	local test_dir="$PWD"
+	cd "$ASM_OUTPUT_DIR"
+		run_native_diff_test "$1"
+	cd "$test_dir"
+}
+
+# Every binary shader in the corpus was made by fxc and has its checksum stored
+# in the header, so they double as known answer tests for both the regular and
+# batched versions of the DXBC checksum:
+run_checksum_test()
+{
+	local log="$ASM_OUTPUT_DIR/checksum.log"
+	local fail=0
+
+	echo -n "....: DXBC checksum known answers..."
+
+	find BinaryDecompiler GameExamples \( -name '*.o' -o -name '*.bin' \) -print0 | sort -z |
+		xargs -0 "$CMD_DECOMPILER" --benchmark-checksum --benchmark-iterations 1 </dev/null > "$log" 2>&1 || fail=1
+	pass_fail $fail
+}
+
 run_hlsl_asm_test()
 {
 	local src="$1"
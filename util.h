@@ -127,6 +127,106 @@ static UINT64 fnv_64_buf(const void *buf, size_t len)
 	return hval;
 }
 
+// Opt-in replacement for fnv_64_buf when hashing shaders (shader_hash = fast).
+// The FNV-1 loop above has a serial multiply dependency on every single byte,
+// whereas this is XXH64, which runs four independent lanes over 32 bytes at a
+// time, so it is an order of magnitude faster on the large shaders some games
+// ship. Unlike a pair of 32 bit CRCs every input bit ends up mixed into all 64
+// bits of the result, so a change anywhere in the shader gets the full 64 bit
+// collision resistance.
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline UINT64 xxh64_rotl(UINT64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline UINT64 xxh64_read64(const uint8_t *p)
+{
+	UINT64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t xxh64_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline UINT64 xxh64_round(UINT64 acc, UINT64 input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = xxh64_rotl(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline UINT64 xxh64_merge_round(UINT64 acc, UINT64 val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static UINT64 fast_shader_hash(const void *buf, size_t len)
+{
+	const uint8_t *bp = (const uint8_t*)buf;
+	const uint8_t *be = bp + len;
+	UINT64 h;
+
+	if (len >= 32) {
+		const uint8_t *limit = be - 32;
+		UINT64 v1 = XXH_PRIME64_1 + XXH_PRIME64_2;
+		UINT64 v2 = XXH_PRIME64_2;
+		UINT64 v3 = 0;
+		UINT64 v4 = 0 - XXH_PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, xxh64_read64(bp)); bp += 8;
+			v2 = xxh64_round(v2, xxh64_read64(bp)); bp += 8;
+			v3 = xxh64_round(v3, xxh64_read64(bp)); bp += 8;
+			v4 = xxh64_round(v4, xxh64_read64(bp)); bp += 8;
+		} while (bp <= limit);
+
+		h = xxh64_rotl(v1, 1) + xxh64_rotl(v2, 7) + xxh64_rotl(v3, 12) + xxh64_rotl(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	} else {
+		h = XXH_PRIME64_5;
+	}
+
+	h += (UINT64)len;
+
+	for (; bp + 8 <= be; bp += 8) {
+		h ^= xxh64_round(0, xxh64_read64(bp));
+		h = xxh64_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (bp + 4 <= be) {
+		h ^= (UINT64)xxh64_read32(bp) * XXH_PRIME64_1;
+		h = xxh64_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		bp += 4;
+	}
+	for (; bp < be; bp++) {
+		h ^= (*bp) * XXH_PRIME64_5;
+		h = xxh64_rotl(h, 11) * XXH_PRIME64_1;
+	}
+
+	// Final avalanche
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
 
 // -----------------------------------------------------------------------------------------------
 
@@ -755,7 +855,13 @@ static const char* type_name_dx9(IUnknown *object)
 
 // New version using Flugan's wrapper around D3DDisassemble to replace the
 // problematic %f floating point values with %.9e, which is enough that a 32bit
-// floating point value will be reproduced exactly:
+// floating point value will be reproduced exactly.
+//
+// In DX11 we try our native disassembler first, which produces the same text
+// without the round trip through d3dcompiler and matching its output back up
+// with the bytecode. It refuses anything it can't reproduce exactly (shader
+// model 5.1, shader messages, hexdumps), in which case we fall back to
+// Flugan's wrapper:
 static string BinaryToAsmText(const void *pShaderBytecode, size_t BytecodeLength,
 		bool patch_cb_offsets,
 		bool disassemble_undecipherable_data = true,
@@ -772,8 +878,15 @@ static string BinaryToAsmText(const void *pShaderBytecode, size_t BytecodeLength
 #if MIGOTO_DX == 9
 	r = disassemblerDX9(&byteCode, &disassembly, comments.c_str());
 #elif MIGOTO_DX == 11
-	r = disassembler(&byteCode, &disassembly, comments.c_str(), hexdump,
-			d3dcompiler_46_compat, disassemble_undecipherable_data, patch_cb_offsets);
+	r = E_FAIL;
+	if (!hexdump) {
+		r = disassemblerNative(&byteCode, &disassembly, comments.c_str(),
+				d3dcompiler_46_compat, disassemble_undecipherable_data, patch_cb_offsets);
+	}
+	if (FAILED(r)) {
+		r = disassembler(&byteCode, &disassembly, comments.c_str(), hexdump,
+				d3dcompiler_46_compat, disassemble_undecipherable_data, patch_cb_offsets);
+	}
 #endif // MIGOTO_DX
 	if (FAILED(r)) {
 		LogInfo("  disassembly failed. Error: %x\n", r);
@@ -856,6 +969,55 @@ static string GetShaderModel(const void *pShaderBytecode, size_t bytecodeLength)
 	return shaderModel;
 }
 
+// Get the shader model straight out of the version token at the start of the
+// SHDR / SHEX section, without disassembling the shader. This is cheap enough
+// to do on every shader as it is created. Returns an empty string if the
+// bytecode isn't in the form we expect, or for feature level 9 shaders, since
+// the disassembler names those differently (ps_4_0_level_9_1, etc) - callers
+// should fall back to GetShaderModel() in that case.
+static string GetShaderModelFromVersionToken(const void *pShaderBytecode, size_t bytecodeLength)
+{
+	static const char *program_types[] = {"ps", "vs", "gs", "hs", "ds", "cs"};
+	const uint32_t *dwords = (const uint32_t*)pShaderBytecode;
+	const uint32_t *section;
+	uint32_t num_sections, offset, i;
+	uint32_t version = 0, type;
+	bool found = false;
+	char model[8];
+
+	// DXBC header: "DXBC", 16 byte hash, 1, total size, section count,
+	// then the offset of each section:
+	if (bytecodeLength < 32 || memcmp(pShaderBytecode, "DXBC", 4))
+		return "";
+	num_sections = dwords[7];
+	if (num_sections > (bytecodeLength - 32) / 4)
+		return "";
+
+	for (i = 0; i < num_sections; i++) {
+		offset = dwords[8 + i];
+		if (offset & 3 || offset > bytecodeLength - 12)
+			return "";
+		section = (const uint32_t*)((const char*)pShaderBytecode + offset);
+
+		if (!memcmp(section, "Aon9", 4))
+			return "";
+		if (!memcmp(section, "SHDR", 4) || !memcmp(section, "SHEX", 4)) {
+			version = section[2];
+			found = true;
+		}
+	}
+	if (!found)
+		return "";
+
+	type = version >> 16;
+	if (type >= ARRAYSIZE(program_types))
+		return "";
+
+	_snprintf_s(model, sizeof(model), _TRUNCATE, "%s_%u_%u",
+			program_types[type], (version >> 4) & 0xf, version & 0xf);
+	return model;
+}
+
 // Create a text file containing text for the string specified.  Can be Asm or HLSL.
 // If the file already exists and the caller did not specify overwrite (used
 // for reassembled text), return that as an error to avoid overwriting previous